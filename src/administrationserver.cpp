@@ -9,7 +9,7 @@
 #include "administrationserver.h"
 #include "administrationserverconnection.h"
 
-AdministrationServer::AdministrationServer(Configuration *_configuration, HashTable *_catalogHashtable) {
+AdministrationServer::AdministrationServer(Configuration *_configuration, HashTable *_catalogHashtable, CatalogHashtableTimeout *_catalogHashtableTimeout, MulticastServerCatalog *_multicastServerCatalog, CacheManager *_cacheManager) {
 	//in_addr_t bindAddr = inet_addr("127.0.0.1");
 
 	administrationServerDebug = false;
@@ -30,6 +30,9 @@ AdministrationServer::AdministrationServer(Configuration *_configuration, HashTa
 	else
 		configuration = _configuration;
 	catalogHashtable = _catalogHashtable;
+	catalogHashtableTimeout = _catalogHashtableTimeout;
+	multicastServerCatalog = _multicastServerCatalog;
+	cacheManager = _cacheManager;
 	administrationServerPort = configuration->administrationServerPort;
 
 	return; 
@@ -61,7 +64,7 @@ void AdministrationServer::listen(void) {
 		clientSocket = server->acceptSocket(saddr);
 		// If clientSocket is non negative, then the socket is open
 		if (clientSocket >= 0) {
-			administrationServerConnection = new AdministrationServerConnection(server, configuration, saddr, catalogHashtable);
+			administrationServerConnection = new AdministrationServerConnection(server, configuration, saddr, catalogHashtable, catalogHashtableTimeout, multicastServerCatalog, cacheManager);
 			administrationServerThread = new Thread(administrationServerConnection);
 			administrationServerThread->createThread((void *)clientSocket);
 			delete administrationServerThread;
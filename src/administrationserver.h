@@ -15,6 +15,9 @@
 #include "../toolkit/objectaction.h"
 #include "../src/configuration.h"
 #include "../toolkit/hashtable.h"
+#include "../toolkit/cachemanager.h"
+#include "../src/cataloghashtabletimeout.h"
+#include "../toolkit/multicastservercatalog.h"
 
 /**
   *@author spe
@@ -28,10 +31,13 @@ private:
 	int administrationServerMaxQueue;
 	Configuration *configuration;
 	HashTable *catalogHashtable;
+	CatalogHashtableTimeout *catalogHashtableTimeout;
+	MulticastServerCatalog *multicastServerCatalog;
+	CacheManager *cacheManager;
 
 public: 
 	Server *server;
-	AdministrationServer(Configuration *, HashTable *);
+	AdministrationServer(Configuration *, HashTable *, CatalogHashtableTimeout *, MulticastServerCatalog *, CacheManager *);
 	~AdministrationServer();
 
 	void listen(void);
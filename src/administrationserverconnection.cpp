@@ -14,6 +14,7 @@
 #include "../toolkit/list.h"
 #include "../toolkit/mystring.h"
 #include "../src/catalogdata.h"
+#include "../src/multicastpacketcatalog.h"
 
 const char *cmdAuth = "AUTH";
 const char *cmdReload = "RELOAD";
@@ -23,12 +24,92 @@ const char *cmdVersion = "VERSION";
 const char *cmdQuit = "QUIT";
 const char *cmdSet = "SET";
 const char *cmdGetCatalog = "GETCATALOG";
+const char *cmdPurgeCatalog = "PURGECATALOG";
 
-AdministrationServerConnection::AdministrationServerConnection(Server *_server, Configuration *_configuration, struct sockaddr_in *_sourceAddress, HashTable *_catalogHashtable) {
+struct CatalogDump {
+	char *buffer;
+	size_t bufferSize;
+	size_t bufferLength;
+};
+
+struct CatalogPurge {
+	HashTableElt **hashtableElts;
+	int numberOfElts;
+	int size;
+};
+
+// Prefix index walkers, called with the catalog hashtable locked. The lockless
+// dump of the whole catalog also appends with dumpCatalogEntry
+static int dumpCatalogEntry(char *key, void *value, void *arguments) {
+	struct CatalogDump *catalogDump = (struct CatalogDump *)arguments;
+	struct CatalogData *catalogData;
+	char *newBuffer;
+	char line[2048];
+	size_t lineLength;
+
+	catalogData = (struct CatalogData *)((HashTableElt *)value)->getData();
+	lineLength = snprintf(line, sizeof(line), "%s|%s|%d\n", key, inet_ntoa(*((struct in_addr *)&catalogData->host)), catalogData->counter);
+	if (lineLength >= sizeof(line))
+		return 0;
+	if (catalogDump->bufferLength + lineLength + 1 > catalogDump->bufferSize) {
+		newBuffer = (char *)realloc(catalogDump->buffer, (catalogDump->bufferLength + lineLength + 1) << 1);
+		if (! newBuffer) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate catalogBuffer: %s", strerror(errno));
+			return -1;
+		}
+		catalogDump->buffer = newBuffer;
+		catalogDump->bufferSize = (catalogDump->bufferLength + lineLength + 1) << 1;
+	}
+	memcpy(catalogDump->buffer + catalogDump->bufferLength, line, lineLength + 1);
+	catalogDump->bufferLength += lineLength;
+
+	return 0;
+}
+
+static int collectCatalogEntry(char *key, void *value, void *arguments) {
+	struct CatalogPurge *catalogPurge = (struct CatalogPurge *)arguments;
+	HashTableElt **newHashtableElts;
+
+	if (catalogPurge->numberOfElts == catalogPurge->size) {
+		newHashtableElts = (HashTableElt **)realloc(catalogPurge->hashtableElts, (catalogPurge->size + 64) * 2 * sizeof(HashTableElt *));
+		if (! newHashtableElts) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate hashtableElts: %s", strerror(errno));
+			return -1;
+		}
+		catalogPurge->hashtableElts = newHashtableElts;
+		catalogPurge->size = (catalogPurge->size + 64) * 2;
+	}
+	catalogPurge->hashtableElts[catalogPurge->numberOfElts++] = (HashTableElt *)value;
+
+	return 0;
+}
+
+// First argument of the command without the end of line, NULL if there is none
+static char *getCatalogPrefix(List<Memory<char> *> *tokensCommand) {
+	char *prefix;
+	int i = 0;
+
+	if ((! tokensCommand->getListSize()) || (! tokensCommand->getFirstElement()->bloc))
+		return NULL;
+	prefix = tokensCommand->getFirstElement()->bloc;
+	while (prefix[i]) {
+		if ((prefix[i] == '\n') || (prefix[i] == '\r') || (prefix[i] == ' ')) {
+			prefix[i] = '\0';
+			break;
+		}
+		i++;
+	}
+	if (! prefix[0])
+		return NULL;
+
+	return prefix;
+}
+
+AdministrationServerConnection::AdministrationServerConnection(Server *_server, Configuration *_configuration, struct sockaddr_in *_sourceAddress, HashTable *_catalogHashtable, CatalogHashtableTimeout *_catalogHashtableTimeout, MulticastServerCatalog *_multicastServerCatalog, CacheManager *_cacheManager) {
 	administrationServerConnectionDebug = false;
 	administrationServerConnectionInitialized = false;
 	server = _server;
-	commandsList = new const char *[9];
+	commandsList = new const char *[10];
 	commandsList[0] = cmdAuth;
 	commandsList[1] = cmdReload;
 	commandsList[2] = cmdStats;
@@ -37,8 +118,9 @@ AdministrationServerConnection::AdministrationServerConnection(Server *_server,
 	commandsList[5] = cmdQuit;
 	commandsList[6] = cmdSet;
 	commandsList[7] = cmdGetCatalog;
-	commandsList[8] = NULL;
-	serverAnswer = new String(1024);
+	commandsList[8] = cmdPurgeCatalog;
+	commandsList[9] = NULL;
+	serverAnswer = new String(ADMINISTRATIONSERVERCONNECTION_ANSWERSIZE);
 	if (! serverAnswer) {
 		systemLog->sysLog(ERROR, "cannot allocate memory for serverAnswer. Error is %s", strerror(errno));
 		return;
@@ -52,6 +134,10 @@ AdministrationServerConnection::AdministrationServerConnection(Server *_server,
 	sourceAddress = _sourceAddress;
 	sessionAuthenticated = false;
 	catalogHashtable = _catalogHashtable;
+	catalogHashtableTimeout = _catalogHashtableTimeout;
+	multicastServerCatalog = _multicastServerCatalog;
+	purgedCatalogObjects = 0;
+	cacheManager = _cacheManager;
 	administrationServerConnectionInitialized = true;
 
 	return;
@@ -93,6 +179,64 @@ void AdministrationServerConnection::serverMessage(unsigned short errorCode) {
 		case 205:
 			serverAnswer->snPrintf("%d GETCATALOG successfull\n", errorCode);
 			break;
+		case 207:
+			serverAnswer->snPrintf("%d PURGECATALOG %d objects removed\n", errorCode, purgedCatalogObjects);
+			break;
+		case 206:
+			{
+				char negativeCacheStats[ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE];
+				char descriptorCacheStats[ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE];
+				char seekIndexCacheStats[ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE];
+				char catalogSlabStats[ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE];
+				char catalogIndexStats[ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE];
+				char catalogHashStats[ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE];
+				unsigned int usedBuckets;
+				unsigned int longestChain;
+				RadixTree *prefixIndex;
+				SlabAllocator *slabAllocator;
+				NegativeCache *negativeCache = NULL;
+				DescriptorCache *descriptorCache = NULL;
+				SeekIndexCache *seekIndexCache = NULL;
+
+				if (cacheManager) {
+					negativeCache = cacheManager->getNegativeCache();
+					descriptorCache = cacheManager->getDescriptorCache();
+					seekIndexCache = cacheManager->getSeekIndexCache();
+				}
+				if (negativeCache)
+					snprintf(negativeCacheStats, sizeof(negativeCacheStats), "negativecache_entries=%d negativecache_hits=%llu negativecache_inserts=%llu", negativeCache->getNumberOfElements(), (unsigned long long)negativeCache->getHits(), (unsigned long long)negativeCache->getInserts());
+				else
+					snprintf(negativeCacheStats, sizeof(negativeCacheStats), "negativecache=disabled");
+				if (descriptorCache)
+					snprintf(descriptorCacheStats, sizeof(descriptorCacheStats), "descriptorcache_hits=%llu descriptorcache_misses=%llu descriptorcache_open=%d descriptorcache_used=%d descriptorcache_max=%d", (unsigned long long)descriptorCache->getHits(), (unsigned long long)descriptorCache->getMisses(), descriptorCache->getOpenDescriptors(), descriptorCache->getUsedDescriptors(), descriptorCache->getMaxDescriptors());
+				else
+					snprintf(descriptorCacheStats, sizeof(descriptorCacheStats), "descriptorcache=disabled");
+				if (seekIndexCache)
+					snprintf(seekIndexCacheStats, sizeof(seekIndexCacheStats), "seekindexcache_hits=%llu seekindexcache_misses=%llu seekindexcache_sidecars=%llu seekindexcache_entries=%d seekindexcache_bytes=%lu seekindexcache_max=%lu", (unsigned long long)seekIndexCache->getHits(), (unsigned long long)seekIndexCache->getMisses(), (unsigned long long)seekIndexCache->getSidecarLoads(), seekIndexCache->getNumberOfEntries(), (unsigned long)seekIndexCache->getMemoryUsage(), (unsigned long)seekIndexCache->getMaxMemoryUsage());
+				else
+					snprintf(seekIndexCacheStats, sizeof(seekIndexCacheStats), "seekindexcache=disabled");
+				if (catalogHashtable) {
+					slabAllocator = catalogHashtable->getSlabAllocator();
+					snprintf(catalogSlabStats, sizeof(catalogSlabStats), "catalog_slabs=%u catalog_slab_inuse=%lu catalog_slab_reserved=%lu catalog_allocations=%llu catalog_releases=%llu", slabAllocator->getNumberOfSlabs(), (unsigned long)slabAllocator->getBytesInUse(), (unsigned long)slabAllocator->getBytesReserved(), (unsigned long long)slabAllocator->getNumberOfAllocations(), (unsigned long long)slabAllocator->getNumberOfReleases());
+					prefixIndex = catalogHashtable->getPrefixIndex();
+					if (prefixIndex)
+						snprintf(catalogIndexStats, sizeof(catalogIndexStats), "catalog_index_keys=%u catalog_index_nodes=%u catalog_index_bytes=%lu", prefixIndex->getNumberOfKeys(), prefixIndex->getNumberOfNodes(), (unsigned long)prefixIndex->getMemoryUsage());
+					else
+						snprintf(catalogIndexStats, sizeof(catalogIndexStats), "catalog_index=disabled");
+					// Chain lengths show how well the configured hash spreads the paths
+					catalogHashtable->lock();
+					catalogHashtable->getChainStatistics(&usedBuckets, &longestChain);
+					snprintf(catalogHashStats, sizeof(catalogHashStats), "catalog_hash=%u catalog_buckets=%u catalog_buckets_used=%u catalog_longest_chain=%u catalog_collisions=%u", catalogHashtable->getHashAlgorithm()->getAlgorithmType(), catalogHashtable->getSize() + 1, usedBuckets, longestChain, catalogHashtable->getNumberOfCollisions());
+					catalogHashtable->unlock();
+				}
+				else {
+					snprintf(catalogSlabStats, sizeof(catalogSlabStats), "catalog=disabled");
+					catalogIndexStats[0] = '\0';
+					catalogHashStats[0] = '\0';
+				}
+				serverAnswer->snPrintf("%d STATS %s %s %s %s %s %s\n", errorCode, negativeCacheStats, descriptorCacheStats, seekIndexCacheStats, catalogSlabStats, catalogIndexStats, catalogHashStats);
+			}
+			break;
 		case 300:
 			serverAnswer->stringNCopy("300 AUTH syntax is <user> <pass>\n", serverAnswer->getBlocSize());
 			break;
@@ -114,12 +258,18 @@ void AdministrationServerConnection::serverMessage(unsigned short errorCode) {
 		case 306:
 			serverAnswer->snPrintf("%d AUTH failed, sorry :(\n", errorCode);
 			break;
+		case 307:
+			serverAnswer->stringNCopy("307 PURGECATALOG syntax is <prefix>\n", serverAnswer->getBlocSize());
+			break;
 		case 400:
 			serverAnswer->snPrintf("%d you must be authenticated, please use AUTH <user> <pass>\n", errorCode);
 			break;
 		case 401:
 			serverAnswer->snPrintf("%d catalog hashtable is empty\n", errorCode);
 			break;
+		case 402:
+			serverAnswer->snPrintf("%d catalog prefix index is disabled\n", errorCode);
+			break;
 		case 501:
 			serverAnswer->stringNCopy("501 Arguments cannot be parsed correctly\n", serverAnswer->getBlocSize());
 			break;
@@ -165,6 +315,11 @@ bool AdministrationServerConnection::executeCommand(socketMsg *smsg) {
 	int i;
 	size_t catalogBufferSize;
 	char *catalogBuffer;
+	char *prefix;
+	struct CatalogDump catalogDump;
+	struct CatalogPurge catalogPurge;
+	char **purgedKeys;
+	int numberOfPurgedKeys;
 	int returnCode;
 
 	specialDelimiter[0] = ';';
@@ -217,7 +372,7 @@ bool AdministrationServerConnection::executeCommand(socketMsg *smsg) {
 	case 2:
 		/* DAEMONSTATS - get the stats */
 		if (checkAuthentication() == true)
-			serverMessage(201);
+			serverMessage(206);
 		break;
 	case 3:
 		/* DAEMONPING - check if daemon is ok */
@@ -322,39 +477,57 @@ bool AdministrationServerConnection::executeCommand(socketMsg *smsg) {
 		delete tokensArgument;
 		break;
 	case 7:
-		catalogHashtable->lock();
-		hashtablePtr = catalogHashtable->getHashtable();
-		hashtableSize = catalogHashtable->getSize();
-		i = 0;
-		if (! catalogHashtable->getNumberOfElements()) {
-			serverMessage(401);
+		/* GETCATALOG [<prefix>] - dump the catalog, only the paths under <prefix> in order with the prefix index */
+		prefix = getCatalogPrefix(tokensCommand);
+		if (prefix) {
+			if (! catalogHashtable->getPrefixIndex()) {
+				serverMessage(402);
+				break;
+			}
+			catalogDump.buffer = NULL;
+			catalogDump.bufferSize = 0;
+			catalogDump.bufferLength = 0;
+			catalogHashtable->lock();
+			returnCode = catalogHashtable->getPrefixIndex()->walk(prefix, dumpCatalogEntry, &catalogDump);
 			catalogHashtable->unlock();
-			break;
+			if (returnCode <= 0) {
+				if (catalogDump.buffer)
+					free(catalogDump.buffer);
+				serverMessage(returnCode ? 502 : 401);
+				break;
+			}
+			catalogBuffer = catalogDump.buffer;
+			catalogBufferSize = catalogDump.bufferLength;
 		}
-		catalogBufferSize = 0;
-		catalogBuffer = (char *)malloc(1);
-		catalogBuffer[0] = '\0';
-		while (i < hashtableSize) {
-			if (hashtablePtr[i]) {
-				hashtableElt = (HashTableElt *)hashtablePtr[i];
-				while (hashtableElt) {
-					catalogData = (struct CatalogData *)hashtableElt->getData();
-					serverAnswer->snPrintf("%s|%s|%d\n", hashtableElt->getKey(), inet_ntoa(*((struct in_addr *)&catalogData->host)), catalogData->counter);
-					catalogBufferSize += strlen(serverAnswer->bloc);
-					catalogBuffer = (char *)realloc(catalogBuffer, catalogBufferSize+1);
-					if (! catalogBuffer) {
-						systemLog->sysLog(CRITICAL, "cannot reallocate catalogBuffer: %s", strerror(errno));
-						serverMessage(502);
-						catalogHashtable->unlock();
-						break;
-					}
-					strcat(catalogBuffer, serverAnswer->bloc);
-					hashtableElt = hashtableElt->getNext();
-				}
+		else {
+			// Dump without blocking catalog updates, size must be read before the array
+			catalogHashtable->enterRead();
+			hashtableSize = catalogHashtable->getSize();
+			__sync_synchronize();
+			hashtablePtr = catalogHashtable->getHashtable();
+			if (! catalogHashtable->getNumberOfElements()) {
+				serverMessage(401);
+				catalogHashtable->exitRead();
+				break;
 			}
-			i++;
+			catalogDump.buffer = NULL;
+			catalogDump.bufferSize = 0;
+			catalogDump.bufferLength = 0;
+			returnCode = 0;
+			for (i = 0; (returnCode == 0) && (i <= hashtableSize); i++) {
+				for (hashtableElt = (HashTableElt *)hashtablePtr[i]; (returnCode == 0) && hashtableElt; hashtableElt = hashtableElt->getNext())
+					returnCode = dumpCatalogEntry(hashtableElt->getKey(), hashtableElt, &catalogDump);
+			}
+			catalogHashtable->exitRead();
+			if (returnCode < 0) {
+				if (catalogDump.buffer)
+					free(catalogDump.buffer);
+				serverMessage(502);
+				break;
+			}
+			catalogBuffer = catalogDump.buffer;
+			catalogBufferSize = catalogDump.bufferLength;
 		}
-		catalogHashtable->unlock();
 		serverMessage(205);
 		usleep(500);
 		serverAnswer->snPrintf("%d\n", catalogBufferSize);
@@ -377,6 +550,62 @@ bool AdministrationServerConnection::executeCommand(socketMsg *smsg) {
 		if (catalogBuffer)
 			free(catalogBuffer);
 
+		break;
+	case 8:
+		/* PURGECATALOG <prefix> - remove every catalog path under <prefix>, and the local cache files */
+		if (checkAuthentication() == false)
+			break;
+		prefix = getCatalogPrefix(tokensCommand);
+		if (! prefix) {
+			serverMessage(307);
+			break;
+		}
+		if (! catalogHashtable->getPrefixIndex()) {
+			serverMessage(402);
+			break;
+		}
+		catalogPurge.hashtableElts = NULL;
+		catalogPurge.numberOfElts = 0;
+		catalogPurge.size = 0;
+		purgedKeys = NULL;
+		numberOfPurgedKeys = 0;
+		catalogHashtable->lock();
+		// The tree can't change during the walk, elements are removed afterwards
+		returnCode = catalogHashtable->getPrefixIndex()->walk(prefix, collectCatalogEntry, &catalogPurge);
+		if (returnCode > 0)
+			purgedKeys = (char **)malloc(catalogPurge.numberOfElts * sizeof(char *));
+		for (i = 0; (returnCode > 0) && (i < catalogPurge.numberOfElts); i++) {
+			hashtableElt = catalogPurge.hashtableElts[i];
+			catalogData = (struct CatalogData *)hashtableElt->getData();
+			if (purgedKeys && (catalogData->host == configuration->proxyIp.s_addr))
+				purgedKeys[numberOfPurgedKeys++] = strdup(hashtableElt->getKey());
+			if (catalogHashtableTimeout)
+				catalogHashtableTimeout->remove(hashtableElt);
+			catalogHashtable->remove(hashtableElt->getHash(), hashtableElt);
+			catalogHashtable->freeData(catalogData);
+		}
+		catalogHashtable->unlock();
+		if (catalogPurge.hashtableElts)
+			free(catalogPurge.hashtableElts);
+		// Peers redirect to this host for the objects it owns, they must forget them too
+		for (i = 0; i < numberOfPurgedKeys; i++) {
+			if (purgedKeys[i]) {
+				if (multicastServerCatalog)
+					sendCatalogDel(purgedKeys[i]);
+				if (cacheManager && cacheManager->remove(purgedKeys[i]))
+					systemLog->sysLog(ERROR, "cannot remove object name %s from cache: %s", purgedKeys[i], strerror(errno));
+				free(purgedKeys[i]);
+			}
+		}
+		if (purgedKeys)
+			free(purgedKeys);
+		if (returnCode < 0) {
+			serverMessage(502);
+			break;
+		}
+		purgedCatalogObjects = returnCode;
+		systemLog->sysLog(NOTICE, "%d objects under %s purged from catalog", returnCode, prefix);
+		serverMessage(207);
 		break;
 	default:
 		serverMessage(500);
@@ -390,6 +619,23 @@ bool AdministrationServerConnection::executeCommand(socketMsg *smsg) {
 	return wantToQuit;
 }
 
+void AdministrationServerConnection::sendCatalogDel(char *key) {
+	size_t bufferLength;
+	char *buffer;
+
+	bufferLength = 2+strlen(key);
+	buffer = new char[bufferLength+1];
+	if (! buffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate buffer object with %d bytes: %s", bufferLength+1, strerror(errno));
+		return;
+	}
+	snprintf(buffer, bufferLength+1, "%d\n%s", CATALOGDEL, key);
+	multicastServerCatalog->sendPacket(buffer, bufferLength);
+	delete [] buffer;
+
+	return;
+}
+
 int AdministrationServerConnection::presentServer(void) {
 	socketMsg smsg;
 	char banner[2048];
@@ -16,10 +16,17 @@
 #include "../toolkit/mystring.h"
 #include "../src/configuration.h"
 #include "../toolkit/hashtable.h"
+#include "../toolkit/cachemanager.h"
+#include "../src/cataloghashtabletimeout.h"
+#include "../toolkit/multicastservercatalog.h"
 
 #include <sys/types.h>
 #include <netinet/in.h>
 
+// STATS answers six groups of counters on one line, it must fit with its prefix and newline
+#define ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE 256
+#define ADMINISTRATIONSERVERCONNECTION_ANSWERSIZE (6 * ADMINISTRATIONSERVERCONNECTION_STATSGROUPSIZE + 64)
+
 /**
   *@author spe
   */
@@ -40,15 +47,20 @@ private:
 	struct sockaddr_in *sourceAddress;
 	bool sessionAuthenticated;
 	HashTable *catalogHashtable;
+	CatalogHashtableTimeout *catalogHashtableTimeout;
+	MulticastServerCatalog *multicastServerCatalog;
+	CacheManager *cacheManager;
+	int purgedCatalogObjects;
 
 public: 
-	AdministrationServerConnection(Server *, Configuration *, struct sockaddr_in *, HashTable *);
+	AdministrationServerConnection(Server *, Configuration *, struct sockaddr_in *, HashTable *, CatalogHashtableTimeout *, MulticastServerCatalog *, CacheManager *);
 	~AdministrationServerConnection();
 
 	void newSession(void *);
 	bool checkAuthentication(void);
 	bool executeCommand(socketMsg *smsg);
 	int presentServer(void);
+	void sendCatalogDel(char *);
 	void serverMessage(unsigned short);
 	virtual void start(void *arguments) { newSession(arguments); delete this; return; };
 };
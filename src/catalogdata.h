@@ -1,9 +1,14 @@
 #ifndef CATALOGDATA_H
 #define CATALOGDATA_H
 
+#include <sys/types.h>
+#include <time.h>
+
 struct CatalogData {
 	uint32_t host;
 	uint16_t counter;
+	// Pushed by each download, checked when the catalog timer expires
+	time_t expireTime;
 };
 
 #endif
@@ -11,21 +11,21 @@
 //
 #include "cataloghashtabletimeout.h"
 #include "../src/multicastpacketcatalog.h"
+#include "../src/catalogdata.h"
 
 #include <sys/types.h>
-#include <sys/event.h>
-#include <sys/time.h>
 #include <errno.h>
 #include <unistd.h>
 
 CatalogHashtableTimeout::CatalogHashtableTimeout(HashTable *_catalogHashtable, int _timeout, CacheManager *_cacheManager, MulticastServerCatalog *_multicastServerCatalog) {
+	timerWheel = NULL;
 	if (! _catalogHashtable) {
 		systemLog->sysLog(CRITICAL, "keyHashtable is NULL, something is terribly wrong");
 		return;
 	}
-	kQueue = kqueue();
-	if (kQueue < 0) {
-		systemLog->sysLog(CRITICAL, "cannot initialize kQueue for KeyHashtableTimeout object: %s", strerror(errno));
+	timerWheel = new TimerWheel(CATALOGHASHTABLETIMEOUT_RESOLUTION);
+	if (! timerWheel) {
+		systemLog->sysLog(CRITICAL, "cannot create a TimerWheel object for CatalogHashtableTimeout object: %s", strerror(errno));
 		return;
 	}
 	timeout = _timeout;
@@ -38,129 +38,165 @@ CatalogHashtableTimeout::CatalogHashtableTimeout(HashTable *_catalogHashtable, i
 
 
 CatalogHashtableTimeout::~CatalogHashtableTimeout() {
-	if (kQueue)
-		close(kQueue);
+	if (timerWheel)
+		delete timerWheel;
 
 	return;
 }
 
 int CatalogHashtableTimeout::add(uint32_t hashPosition, HashTableElt *hashtableElt) {
-	struct kevent kChange;
-	int returnCode;
+	return add(hashPosition, hashtableElt, timeout);
+}
 
-	EV_SET(&kChange, (uintptr_t)hashtableElt, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, timeout, (void *)hashPosition);
-	returnCode = kevent(kQueue, &kChange, 1, NULL, 0, NULL);
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "cannot add a timeout event: %s", strerror(errno));
+int CatalogHashtableTimeout::add(uint32_t hashPosition, HashTableElt *hashtableElt, int objectTimeout) {
+	struct TimerWheelEntry *timerWheelEntry;
+	struct CatalogData *catalogData;
+
+	catalogData = (struct CatalogData *)hashtableElt->getData();
+	if (catalogData)
+		catalogData->expireTime = time(NULL) + objectTimeout / 1000;
+	timerWheel->lock();
+	timerWheelEntry = timerWheel->add(hashtableElt, hashPosition, objectTimeout);
+	if (! timerWheelEntry) {
+		timerWheel->unlock();
+		systemLog->sysLog(ERROR, "cannot add a timeout event");
 		return -1;
 	}
+	hashtableElt->setTimerEntry(timerWheelEntry);
+	timerWheel->unlock();
 
 	return 0;
 }
 
-int CatalogHashtableTimeout::add(uint32_t hashPosition, HashTableElt *hashtableElt, int objectTimeout) {
-	struct kevent kChange;
-	int returnCode;
+int CatalogHashtableTimeout::remove(HashTableElt *hashtableElt) {
+	struct TimerWheelEntry *timerWheelEntry;
 
-	EV_SET(&kChange, (uintptr_t)hashtableElt, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, objectTimeout, (void *)hashPosition);
-	returnCode = kevent(kQueue, &kChange, 1, NULL, 0, NULL);
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "cannot add a timeout event: %s", strerror(errno));
+	timerWheel->lock();
+	timerWheelEntry = hashtableElt->getTimerEntry();
+	if (! timerWheelEntry) {
+		timerWheel->unlock();
 		return -1;
 	}
+	timerWheel->cancel(timerWheelEntry);
+	hashtableElt->setTimerEntry(NULL);
+	timerWheel->unlock();
 
 	return 0;
 }
 
-/*int CatalogHashtableTimeout::renew() {
-
-}*/
+// Called without lock on each download, the timer rearms itself when it finds a later expire time
+void CatalogHashtableTimeout::refresh(HashTableElt *hashtableElt) {
+	struct CatalogData *catalogData;
 
-int CatalogHashtableTimeout::remove(HashTableElt *hashtableElt) {
-	struct kevent kChange;
-	int returnCode;
+	catalogData = (struct CatalogData *)hashtableElt->getData();
+	if (catalogData)
+		catalogData->expireTime = time(NULL) + timeout / 1000;
 
-	EV_SET(&kChange, (uintptr_t)hashtableElt, EVFILT_TIMER, EV_DELETE | EV_CLEAR, 0, 0, 0);
-	returnCode = kevent(kQueue, &kChange, 1, NULL, 0, NULL);
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "cannot delete a timeout event: %s", strerror(errno));
-		return -1;
-	}
-
-	return 0;
+	return;
 }
 
-void CatalogHashtableTimeout::run(void *arguments) {
-	int numberOfEvents;
-	struct kevent kEvents;
+void CatalogHashtableTimeout::expire(struct TimerWheelEntry *timerWheelEntry) {
 	int returnCode;
 	HashTableElt *hashtableElt;
+	struct TimerWheelEntry *timerWheelEntryNew;
+	struct CatalogData *catalogData;
+	bool isCurrent;
+	time_t now;
+	void *data;
 	char *key;
 	size_t bufferLength;
 	char *buffer;
 
-	if (kQueue < 0)
+	catalogHashtable->lock();
+
+	// The element may be already removed (CATALOGDEL, purge), don't touch it then
+	hashtableElt = catalogHashtable->search(timerWheelEntry->cookie, (HashTableElt *)timerWheelEntry->object);
+	if (! hashtableElt) {
+		catalogHashtable->unlock();
 		return;
-	for (;;) {
-		numberOfEvents = kevent(kQueue, NULL, 0, &kEvents, 1, NULL);
-		if (numberOfEvents < 0) {
-			systemLog->sysLog(ERROR, "error while receiving an event from kqueue: %s", strerror(errno));
-			continue;
-			// Remplacer ca par l'extraction de l'evenement en erreur et continuer ensuite...
+	}
+	timerWheel->lock();
+	isCurrent = (hashtableElt->getTimerEntry() == timerWheelEntry);
+	if (isCurrent) {
+		hashtableElt->setTimerEntry(NULL);
+		// Downloaded since the timer was armed, wait for the remaining time
+		catalogData = (struct CatalogData *)hashtableElt->getData();
+		now = time(NULL);
+		if (catalogData && (catalogData->expireTime > now)) {
+			timerWheelEntryNew = timerWheel->add(hashtableElt, timerWheelEntry->cookie, (catalogData->expireTime - now) * 1000);
+			hashtableElt->setTimerEntry(timerWheelEntryNew);
+			if (timerWheelEntryNew)
+				isCurrent = false;
 		}
-		switch (kEvents.filter) {
-			case EVFILT_TIMER:
-				catalogHashtable->lock();
-
-				hashtableElt = (HashTableElt *)kEvents.ident;
+	}
+	timerWheel->unlock();
+	if (isCurrent == false) {
+		catalogHashtable->unlock();
+		return;
+	}
 #ifdef DEBUGOUTPUT
-				fprintf(stderr, "[DEBUG] Removing object name %s from cache, timeout occured !\n", hashtableElt->getKey());
+	fprintf(stderr, "[DEBUG] Removing object name %s from cache, timeout occured !\n", hashtableElt->getKey());
 #endif				
-				if (hashtableElt->getData())
-					free(hashtableElt->getData());
-
-				key = strdup(hashtableElt->getKey());
-				if (! key) {
-					systemLog->sysLog(ERROR, "cannot get key for erasing cache file: %s", strerror(errno));
-					systemLog->sysLog(ERROR, "file will not be delete from disk/memory, something is terribly wrong !");
-				}
-
-				// Sending CATALOGDEL command to the cluster for removing key
-				bufferLength = 2+strlen(key);
-				buffer = new char[bufferLength+1];
-				if (! buffer) {
-					systemLog->sysLog(CRITICAL, "cannot allocate buffer object with %d bytes: %s", bufferLength+1, strerror(errno));
-					free(key);
-					catalogHashtable->unlock();
-					continue;
-				}
-				snprintf(buffer, bufferLength+1, "%d\n%s", CATALOGDEL, key);
+	key = strdup(hashtableElt->getKey());
+	if (! key) {
+		systemLog->sysLog(ERROR, "cannot get key for erasing cache file: %s", strerror(errno));
+		systemLog->sysLog(ERROR, "file will not be delete from disk/memory, something is terribly wrong !");
+		catalogHashtable->unlock();
+		return;
+	}
+
+	// Sending CATALOGDEL command to the cluster for removing key
+	bufferLength = 2+strlen(key);
+	buffer = new char[bufferLength+1];
+	if (! buffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate buffer object with %d bytes: %s", bufferLength+1, strerror(errno));
+		free(key);
+		catalogHashtable->unlock();
+		return;
+	}
+	snprintf(buffer, bufferLength+1, "%d\n%s", CATALOGDEL, key);
 #ifdef DEBUGCATALOG
-				systemLog->sysLog(DEBUG, "sending multicast packet on network: #%s#", buffer);
+	systemLog->sysLog(DEBUG, "sending multicast packet on network: #%s#", buffer);
 #endif
-				multicastServerCatalog->sendPacket(buffer, bufferLength);
-				delete buffer;
-
-				systemLog->sysLog(NOTICE, "removing object name %s from catalog hashtable", key);
-				returnCode = catalogHashtable->remove((uint64_t)kEvents.udata, hashtableElt);
-				if (returnCode < 0) {
-					systemLog->sysLog(ERROR, "cannot remove a key from the hashtable :(");
-					free(key);
-					catalogHashtable->unlock();
-					continue;
-				}
-				catalogHashtable->unlock();
-				if (key) {
-					returnCode = cacheManager->remove(key);
-					if (returnCode)
-						systemLog->sysLog(ERROR, "cannot remove object name %s from cache: %s", key, strerror(errno));
-					free(key);
-				}
-
-				break;
-			default:
-				systemLog->sysLog(ERROR, "filter %d is unknown !", kEvents.filter);
-				break;
+	multicastServerCatalog->sendPacket(buffer, bufferLength);
+	delete buffer;
+
+	systemLog->sysLog(NOTICE, "removing object name %s from catalog hashtable", key);
+	returnCode = catalogHashtable->remove(timerWheelEntry->cookie, hashtableElt, &data);
+	if (returnCode < 0) {
+		systemLog->sysLog(ERROR, "cannot remove a key from the hashtable :(");
+		free(key);
+		catalogHashtable->unlock();
+		return;
+	}
+	if (data)
+		catalogHashtable->freeData(data);
+	catalogHashtable->unlock();
+	returnCode = cacheManager->remove(key);
+	if (returnCode)
+		systemLog->sysLog(ERROR, "cannot remove object name %s from cache: %s", key, strerror(errno));
+	free(key);
+
+	return;
+}
+
+void CatalogHashtableTimeout::run(void *arguments) {
+	struct TimerWheelEntry *timerWheelEntry;
+	struct TimerWheelEntry *timerWheelEntryNext;
+
+	if (! timerWheel)
+		return;
+	for (;;) {
+		timerWheel->waitNextTick();
+		// Every expired timeout in one lock acquisition
+		timerWheel->lock();
+		timerWheelEntry = timerWheel->expire();
+		timerWheel->unlock();
+		while (timerWheelEntry) {
+			timerWheelEntryNext = timerWheelEntry->next;
+			expire(timerWheelEntry);
+			timerWheel->release(timerWheelEntry);
+			timerWheelEntry = timerWheelEntryNext;
 		}
 	}
 }
@@ -16,6 +16,9 @@
 #include "../toolkit/hashtable.h"
 #include "../toolkit/cachemanager.h"
 #include "../toolkit/multicastservercatalog.h"
+#include "../toolkit/timerwheel.h"
+
+#define CATALOGHASHTABLETIMEOUT_RESOLUTION 1000
 
 /**
 	@author  <spe@>
@@ -23,18 +26,22 @@
 class CatalogHashtableTimeout : public ObjectAction {
 private:
 	HashTable *catalogHashtable;
-	int kQueue;
+	TimerWheel *timerWheel;
 	int timeout;
 	CacheManager *cacheManager;
 	MulticastServerCatalog *multicastServerCatalog;
 
+	void expire(struct TimerWheelEntry *);
+
 public:
 	CatalogHashtableTimeout(HashTable *, int, CacheManager *, MulticastServerCatalog *);
 	~CatalogHashtableTimeout();
 
+	// Must be called with the catalog hashtable locked
 	int add(uint32_t, HashTableElt *);
 	int add(uint32_t, HashTableElt *, int);
 	int remove(HashTableElt *);
+	void refresh(HashTableElt *);
 	void run(void *);
 	virtual void start(void *arguments) { run(arguments); delete this; return; }
 };
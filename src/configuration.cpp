@@ -44,8 +44,15 @@ Configuration::Configuration(String *_configurationFileName) {
 	administrationServerEnable = false;
 	proxyName = NULL;
 	shareCatalog = false;
+	catalogPrefixIndex = false;
+	hashAlgorithm = ALGO_PAULHSIEH;
 	workerNumber = 2;
 	cacheTimeout = 43200000;
+	negativeCacheTimeout = 30;
+	negativeCacheSize = 65536;
+	descriptorCacheSize = 4096;
+	seekIndexCacheSize = 64;
+	blockingWorkers = 4;
 	burst = 0;
 	aesKey = NULL;
 	noByteRange[0] = '\0';
@@ -92,8 +99,15 @@ Configuration::Configuration() {
 	administrationServerEnable = false;
 	proxyName = NULL;
 	shareCatalog = false;
+	catalogPrefixIndex = false;
+	hashAlgorithm = ALGO_PAULHSIEH;
 	workerNumber = 2;
 	cacheTimeout = 86400000;
+	negativeCacheTimeout = 30;
+	negativeCacheSize = 65536;
+	descriptorCacheSize = 4096;
+	seekIndexCacheSize = 64;
+	blockingWorkers = 4;
 	burst = 0;
 	aesKey = NULL;
 	aesVHost[0] = '\0';
@@ -278,6 +292,21 @@ int Configuration::parseConfigurationFile(void) {
 			else
 				shareCatalog = false;
 		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "catalogprefixindex")) {
+			tokenCommand->removeFirst();
+			if (! strcasecmp(tokenCommand->getFirstElement()->getBloc(), "yes"))
+				catalogPrefixIndex = true;
+			else
+				catalogPrefixIndex = false;
+		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "hashalgorithm")) {
+			tokenCommand->removeFirst();
+			hashAlgorithm = HashAlgorithm::getAlgorithmType(tokenCommand->getFirstElement()->getBloc());
+			if (! hashAlgorithm) {
+				systemLog->sysLog(ERROR, "invalid value '%s' for option 'hashalgorithm', using paulhsieh", tokenCommand->getFirstElement()->getBloc());
+				hashAlgorithm = ALGO_PAULHSIEH;
+			}
+		}
 		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "workerthreads")) {
 			tokenCommand->removeFirst();
 			workerNumber = atoi(tokenCommand->getFirstElement()->getBloc());
@@ -287,6 +316,26 @@ int Configuration::parseConfigurationFile(void) {
 			cacheTimeout = atoi(tokenCommand->getFirstElement()->getBloc());
 			cacheTimeout *= 1000;
 		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "negativecachetimeout")) {
+			tokenCommand->removeFirst();
+			negativeCacheTimeout = atoi(tokenCommand->getFirstElement()->getBloc());
+		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "negativecachesize")) {
+			tokenCommand->removeFirst();
+			negativeCacheSize = atoi(tokenCommand->getFirstElement()->getBloc());
+		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "descriptorcachesize")) {
+			tokenCommand->removeFirst();
+			descriptorCacheSize = atoi(tokenCommand->getFirstElement()->getBloc());
+		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "seekindexcachesize")) {
+			tokenCommand->removeFirst();
+			seekIndexCacheSize = atoi(tokenCommand->getFirstElement()->getBloc());
+		}
+		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "blockingworkers")) {
+			tokenCommand->removeFirst();
+			blockingWorkers = atoi(tokenCommand->getFirstElement()->getBloc());
+		}
 		if (! strcmp(tokenCommand->getFirstElement()->getBloc(), "burst")) {
 			tokenCommand->removeFirst();
 			burst = atoi(tokenCommand->getFirstElement()->getBloc());
@@ -15,6 +15,7 @@
 
 #include "../toolkit/mystring.h"
 #include "../toolkit/file.h"
+#include "../toolkit/hashalgorithm.h"
 
 /**
   *@author spe
@@ -55,8 +56,16 @@ public:
 	char *proxyName;
 	struct in_addr proxyIp;
 	bool shareCatalog;
+	bool catalogPrefixIndex;
+	unsigned int hashAlgorithm;
 	unsigned char workerNumber;
 	unsigned int cacheTimeout;
+	unsigned int negativeCacheTimeout;
+	int negativeCacheSize;
+	int descriptorCacheSize;
+	// In megabytes
+	int seekIndexCacheSize;
+	int blockingWorkers;
 	char burst;
 	char *aesKey;
 	int aesKeySize;
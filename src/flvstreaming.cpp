@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "flvstreaming.h"
+
+#include "../toolkit/log.h"
+
+FlvStreaming::FlvStreaming(HttpSession *_httpSession, SeekIndexCache *_seekIndexCache, int _indexType) {
+	httpSession = _httpSession;
+	seekIndexCache = _seekIndexCache;
+	indexType = _indexType;
+
+	return;
+}
+
+FlvStreaming::~FlvStreaming() {
+	return;
+}
+
+// Answer is the header of the index (FLV header tags, WebM Info and Tracks, Ogg
+// header pages) then the file from the keyframe tag, cluster or page
+int FlvStreaming::seekKeyFrameIndex(struct FlvKeyFrameIndex *flvKeyFrameIndex, off_t fileSize) {
+	int keyFrame;
+	uint64_t position;
+
+	keyFrame = FlvParser::searchKeyFrameByTime(flvKeyFrameIndex, (uint32_t)(httpSession->seekSeconds * 1000));
+	if (keyFrame < 0)
+		return -1;
+	position = flvKeyFrameIndex->positions[keyFrame];
+	if ((off_t)position >= fileSize)
+		return -1;
+	httpSession->preBuffer = (char *)malloc(flvKeyFrameIndex->headerSize);
+	if (! httpSession->preBuffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %u bytes for preBuffer: %s", flvKeyFrameIndex->headerSize, strerror(errno));
+		return -1;
+	}
+	memcpy(httpSession->preBuffer, flvKeyFrameIndex->header, flvKeyFrameIndex->headerSize);
+	httpSession->preBufferSize = flvKeyFrameIndex->headerSize;
+
+	httpSession->httpExchange->setInputOffset(position);
+
+	httpSession->mp4Position = position;
+	httpSession->fileSize = flvKeyFrameIndex->headerSize + (fileSize - position);
+	// The answer starts with a real header, not the one of byte seeks
+	httpSession->seekPosition = 0;
+
+	return 0;
+}
+
+int FlvStreaming::seek(void) {
+	struct SeekIndexCacheData *seekIndexCacheData = NULL;
+	struct FlvKeyFrameIndex *flvKeyFrameIndex;
+	off_t fileSize;
+	int returnCode = -1;
+
+	if (httpSession->videoNameFilePath == NULL)
+		return -1;
+	fileSize = httpSession->sourceFileStat.st_size;
+	if (fileSize <= 0)
+		return -1;
+
+	if (seekIndexCache)
+		seekIndexCacheData = seekIndexCache->acquire(httpSession->videoName, httpSession->videoNameFilePath, &httpSession->sourceFileStat, indexType);
+	if (seekIndexCacheData) {
+		returnCode = seekKeyFrameIndex(seekIndexCacheData->flvKeyFrameIndex, fileSize);
+		seekIndexCache->release(seekIndexCacheData);
+	}
+	else {
+		flvKeyFrameIndex = SeekIndexCache::buildKeyFrameIndex(indexType, httpSession->httpExchange->inputDescriptor, fileSize);
+		if (flvKeyFrameIndex) {
+			returnCode = seekKeyFrameIndex(flvKeyFrameIndex, fileSize);
+			FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+		}
+	}
+
+	if (returnCode < 0) {
+		systemLog->sysLog(ERROR, "cannot seek file '%s' at %f seconds", httpSession->videoNameFilePath, httpSession->seekSeconds);
+		return -1;
+	}
+
+#ifdef DEBUGOUTPUT
+	systemLog->sysLog(DEBUG, "httpSession->fileSize = %d", httpSession->fileSize);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef FLVSTREAMING_H
+#define FLVSTREAMING_H
+
+#include "../toolkit/httpsession.h"
+#include "../toolkit/flvparser.h"
+#include "../toolkit/seekindexcache.h"
+
+/**
+  *@author spe
+  */
+
+// Also seeks webm and ogg files, their keyframe indices have the FLV layout
+
+class FlvStreaming {
+private:
+	HttpSession *httpSession;
+	SeekIndexCache *seekIndexCache;
+	int indexType;
+
+	int seekKeyFrameIndex(struct FlvKeyFrameIndex *, off_t);
+
+public:
+	FlvStreaming(HttpSession *, SeekIndexCache *, int);
+	~FlvStreaming();
+
+	int seek(void);
+};
+
+#endif
@@ -11,6 +11,8 @@
 //
 #include "../src/multicastdata.h"
 #include "../src/mp4streaming.h"
+#include "../src/flvstreaming.h"
+#include "../src/mp4packaging.h"
 
 #include "httpclientconnection.h"
 
@@ -21,67 +23,198 @@
 
 #define VXFER_LOG_SIZE 512
 
-HttpClientConnection::HttpClientConnection(Configuration *_configuration) {
+HttpClientConnection::HttpClientConnection(Configuration *_configuration, CacheManager *_cacheManager) {
 	configuration = _configuration;
+	cacheManager = _cacheManager;
+	blockingWorkPool = NULL;
+	if (configuration->blockingWorkers > 0) {
+		blockingWorkPool = new BlockingWorkPool(configuration->blockingWorkers);
+		if (! blockingWorkPool) {
+			systemLog->sysLog(CRITICAL, "cannot create a BlockingWorkPool object: %s", strerror(errno));
+			return;
+		}
+		if (blockingWorkPool->startWorkers() < 0) {
+			systemLog->sysLog(CRITICAL, "blocking work pool cannot be started, answers are prepared by the kqueue workers");
+			delete blockingWorkPool;
+			blockingWorkPool = NULL;
+		}
+	}
 
 	return;
 }
 
 
 HttpClientConnection::~HttpClientConnection() {
+	if (blockingWorkPool)
+		delete blockingWorkPool;
+
+	return;
+}
+
+HttpAnswerWork::HttpAnswerWork(HttpClientConnection *_httpClientConnection, HttpServer *_httpServer, HttpSession *_httpSession) {
+	httpClientConnection = _httpClientConnection;
+	httpServer = _httpServer;
+	httpSession = _httpSession;
+
+	return;
+}
+
+void HttpAnswerWork::process(void) {
+	int returnCode;
+
+	// The kqueue worker which parked the session releases this mutex when its event is done
+	httpSession->mutex->lockMutex();
+	returnCode = httpClientConnection->prepareAnswer(httpServer, httpSession);
+	if (returnCode == 1) {
+		// Session is owned by the proxy thread now
+		httpSession->mutex->unlockMutex();
+		httpServer->deleteAConnection();
+		return;
+	}
+	httpSession->asyncReturnCode = returnCode;
+	httpSession->asyncState = ASYNC_DONE;
+	httpSession->mutex->unlockMutex();
+
+	httpServer->resumeWriteEvent(httpSession);
+
 	return;
 }
 
+// Fragmented mp4 answer of a flv, NULL if it cannot be remuxed and is sent as flv
+Mp4Streaming *HttpClientConnection::remuxFlv(HttpSession *httpSession) {
+	Mp4Streaming *mp4Streaming;
+
+	mp4Streaming = new Mp4Streaming(httpSession, cacheManager ? cacheManager->getSeekIndexCache() : NULL);
+	if (! mp4Streaming) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a mp4Streaming object, cannot remux file: %s", strerror(errno));
+		return NULL;
+	}
+	if (mp4Streaming->remux() < 0) {
+		delete mp4Streaming;
+		return NULL;
+	}
+
+	return mp4Streaming;
+}
+
+// Blocking part of the answer: open/stat the object, fill the cache, parse the mp4 index
+int HttpClientConnection::prepareAnswer(HttpServer *httpServer, HttpSession *httpSession) {
+	int returnCode;
+	Mp4Streaming *mp4Streaming = NULL;
+	FlvStreaming *flvStreaming = NULL;
+	Mp4Packaging *mp4Packaging = NULL;
+	int packagingCode;
+	int indexType;
+
+	returnCode = httpServer->getContent()->initialize(httpSession);
+	if (returnCode < 0) {
+		httpSession->httpCode = 404;
+		httpSession->noDataToSend = true;
+	}
+	if (returnCode == 1)
+		return 1;
+
+	// If all is normal continue to construct header
+	if (httpSession->httpCode == 200) {
+		indexType = SeekIndexCache::getIndexType(httpSession->videoName);
+		if (httpSession->seekPosition) {
+			if (httpSession->mimeType == 3) {
+				if (httpSession->seekPosition < httpSession->fileSize)
+					httpSession->fileSize -= httpSession->seekPosition;
+				else
+					httpSession->seekPosition = 0;
+			}
+		}
+		if (httpSession->packaging) {
+			packagingCode = -1;
+			if (indexType == SEEKINDEXCACHE_MP4) {
+				mp4Packaging = new Mp4Packaging(httpSession, cacheManager ? cacheManager->getSeekIndexCache() : NULL);
+				if (! mp4Packaging)
+					systemLog->sysLog(CRITICAL, "cannot allocate a mp4Packaging object, cannot package file: %s", strerror(errno));
+				else {
+					packagingCode = mp4Packaging->package();
+					delete mp4Packaging;
+				}
+			}
+			if (packagingCode < 0) {
+				httpSession->httpCode = 404;
+				httpSession->noDataToSend = true;
+			}
+		}
+		else
+		if (httpSession->fragmentedSeek && (indexType == SEEKINDEXCACHE_FLV) && ((mp4Streaming = remuxFlv(httpSession)) != NULL)) {
+			// A remuxed answer is built while it is sent
+			httpSession->mp4Streaming = mp4Streaming;
+		}
+		else
+		if (httpSession->seekSeconds && ((indexType == SEEKINDEXCACHE_FLV) || (indexType == SEEKINDEXCACHE_WEBM) || (indexType == SEEKINDEXCACHE_OGG))) {
+			flvStreaming = new FlvStreaming(httpSession, cacheManager ? cacheManager->getSeekIndexCache() : NULL, indexType);
+			if (! flvStreaming)
+				systemLog->sysLog(CRITICAL, "cannot allocate a flvStreaming object, cannot seek file: %s", strerror(errno));
+			else {
+				flvStreaming->seek();
+				delete flvStreaming;
+			}
+		}
+		else
+		if (httpSession->seekSeconds || (httpSession->endSeconds && (indexType == SEEKINDEXCACHE_MP4))) {
+			mp4Streaming = new Mp4Streaming(httpSession, cacheManager ? cacheManager->getSeekIndexCache() : NULL);
+			if (! mp4Streaming)
+				systemLog->sysLog(CRITICAL, "cannot allocate a mp4Streaming object, cannot seek file: %s", strerror(errno));
+			else {
+				mp4Streaming->seek();
+				// A fragmented answer is built while it is sent
+				if (mp4Streaming->isFragmented())
+					httpSession->mp4Streaming = mp4Streaming;
+				else
+					delete mp4Streaming;
+			}
+		}
+		if (httpSession->byteRange.start != -1) {
+			httpSession->httpCode = 206;
+			if (httpSession->byteRange.end == -1)
+			  httpSession->byteRange.end = httpSession->sourceFileStat.st_size > 0 ? httpSession->sourceFileStat.st_size - 1 : 0;
+			httpSession->fileSize = httpSession->byteRange.end - httpSession->byteRange.start + 1;
+		}
+		if (httpSession->shapping) {
+			int shappingTimeout = httpServer->getSendBuffer();
+			httpSession->shappingTimeout = (int)((((float)(shappingTimeout * 8)) / httpSession->shapping));
+		}
+	}
+
+	return returnCode;
+}
+
 int HttpClientConnection::handleConnection(HttpServer *httpServer, HttpSession *httpSession) {
 	int returnCode = 0;
 	ssize_t bytesRead;
 	ssize_t bytesToSent;
-	Mp4Streaming *mp4Streaming = NULL;
+	HttpAnswerWork *httpAnswerWork;
 
 	// Write event received...
 	// Test if we have sent HTTP Header already, if not, send it
 	if (httpSession->HTTPHeaderInitialized == false) {
-		returnCode = httpServer->getContent()->initialize(httpSession);
-		if (returnCode < 0) {
-			httpSession->httpCode = 404;
-			httpSession->noDataToSend = true;
+		if ((blockingWorkPool) && (httpSession->asyncState == ASYNC_NONE)) {
+			// Park the session, the pool wakes it up with a new write event
+			httpAnswerWork = new HttpAnswerWork(this, httpServer, httpSession);
+			if (httpAnswerWork) {
+				httpSession->asyncState = ASYNC_PENDING;
+				if (! blockingWorkPool->submit(httpAnswerWork))
+					return 4;
+				// Pool is saturated, prepare the answer here
+				httpSession->asyncState = ASYNC_NONE;
+				delete httpAnswerWork;
+			}
 		}
+		if (httpSession->asyncState == ASYNC_DONE)
+			returnCode = httpSession->asyncReturnCode;
+		else
+			returnCode = prepareAnswer(httpServer, httpSession);
 		if (returnCode == 1) {
 			httpServer->deleteAConnection();
 			return 1;
 		}
 
-		// If all is normal continue to construct header
-		if (httpSession->httpCode == 200) {
-			if (httpSession->seekPosition) {
-				if (httpSession->mimeType == 3) {
-					if (httpSession->seekPosition < httpSession->fileSize)
-						httpSession->fileSize -= httpSession->seekPosition;
-					else
-						httpSession->seekPosition = 0;
-				}
-			}
-			if (httpSession->seekSeconds) {
-				mp4Streaming = new Mp4Streaming(httpSession);
-				if (! mp4Streaming)
-					systemLog->sysLog(CRITICAL, "cannot allocate a mp4Streaming object, cannot seek file: %s", strerror(errno));
-				else {
-					mp4Streaming->seek();
-					delete mp4Streaming;
-				}
-			}
-			if (httpSession->byteRange.start != -1) {
-				httpSession->httpCode = 206;
-				if (httpSession->byteRange.end == -1)
-				  httpSession->byteRange.end = httpSession->sourceFileStat.st_size > 0 ? httpSession->sourceFileStat.st_size - 1 : 0;
-				httpSession->fileSize = httpSession->byteRange.end - httpSession->byteRange.start + 1;
-			}
-			if (httpSession->shapping) {
-				int shappingTimeout = httpServer->getSendBuffer();
-				httpSession->shappingTimeout = (int)((((float)(shappingTimeout * 8)) / httpSession->shapping));
-			}
-		}
-
 		char additionalHeader[1024] = "Cache-Control: max-age=86400";
 		if (configuration->aesVHost[0] && (! strcmp(httpSession->virtualHost, configuration->aesVHost))) {
 			snprintf(additionalHeader, sizeof(additionalHeader), "Cache-Control: max-age=0,no-store,no-transform");
@@ -15,8 +15,12 @@
 #include "../toolkit/httpsession.h"
 #include "../toolkit/httpserver.h"
 #include "../toolkit/httphandler.h"
+#include "../toolkit/blockingworkpool.h"
+#include "../toolkit/cachemanager.h"
 #include "../src/configuration.h"
 
+class Mp4Streaming;
+
 /**
 	@author  <spe@>
 */
@@ -25,15 +29,35 @@ private:
 	char *buffer;
 	int bufferSize;
 	Configuration *configuration;
+	CacheManager *cacheManager;
+	BlockingWorkPool *blockingWorkPool;
+
+	Mp4Streaming *remuxFlv(HttpSession *);
 	
 public:
-	HttpClientConnection(Configuration *);
+	HttpClientConnection(Configuration *, CacheManager *);
 	~HttpClientConnection();
 
+	int prepareAnswer(HttpServer *, HttpSession *);
 	int handleConnection(HttpServer *, HttpSession *);
+	BlockingWorkPool *getBlockingWorkPool(void) { return blockingWorkPool; };
 	void logDataDownloaded(HttpSession *);
 	virtual int handle(HttpServer *httpServer, HttpSession *httpSession) { return handleConnection(httpServer, httpSession); }
 	virtual int closeEvent(HttpServer *, HttpSession *);
 };
 
+/**
+	@author  <spe@>
+*/
+class HttpAnswerWork : public BlockingWork {
+private:
+	HttpClientConnection *httpClientConnection;
+	HttpServer *httpServer;
+	HttpSession *httpSession;
+
+public:
+	HttpAnswerWork(HttpClientConnection *, HttpServer *, HttpSession *);
+	virtual void process(void);
+};
+
 #endif
@@ -12,19 +12,18 @@
 #include "keyhashtabletimeout.h"
 
 #include <sys/types.h>
-#include <sys/event.h>
-#include <sys/time.h>
 #include <errno.h>
 #include <unistd.h>
 
 KeyHashtableTimeout::KeyHashtableTimeout(HashTable *_keyHashtable, int _timeout) {
+	timerWheel = NULL;
 	if (! _keyHashtable) {
 		systemLog->sysLog(CRITICAL, "keyHashtable is NULL, something is terribly wrong");
 		return;
 	}
-	kQueue = kqueue();
-	if (kQueue < 0) {
-		systemLog->sysLog(CRITICAL, "cannot initialize kQueue for KeyHashtableTimeout object: %s", strerror(errno));
+	timerWheel = new TimerWheel(KEYHASHTABLETIMEOUT_RESOLUTION);
+	if (! timerWheel) {
+		systemLog->sysLog(CRITICAL, "cannot create a TimerWheel object for KeyHashtableTimeout object: %s", strerror(errno));
 		return;
 	}
 	timeout = _timeout;
@@ -35,76 +34,112 @@ KeyHashtableTimeout::KeyHashtableTimeout(HashTable *_keyHashtable, int _timeout)
 
 
 KeyHashtableTimeout::~KeyHashtableTimeout() {
-	if (kQueue)
-		close(kQueue);
+	if (timerWheel)
+		delete timerWheel;
 
 	return;
 }
 
 int KeyHashtableTimeout::add(uint32_t hashPosition, HashTableElt *hashtableElt) {
-	struct kevent kChange;
-	int returnCode;
+	struct TimerWheelEntry *timerWheelEntry;
 
-	EV_SET(&kChange, (uintptr_t)hashtableElt, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, timeout, (void *)hashPosition);
-	returnCode = kevent(kQueue, &kChange, 1, NULL, 0, NULL);
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "cannot add a timeout event: %s", strerror(errno));
-		// XXX patch
-		exit(-1);
+	timerWheel->lock();
+	timerWheelEntry = timerWheel->add(hashtableElt, hashPosition, timeout);
+	if (! timerWheelEntry) {
+		timerWheel->unlock();
+		systemLog->sysLog(ERROR, "cannot add a timeout event");
 		return -1;
 	}
+	hashtableElt->setTimerEntry(timerWheelEntry);
+	timerWheel->unlock();
 
 	return 0;
 }
 
 int KeyHashtableTimeout::remove(HashTableElt *hashtableElt) {
-	struct kevent kChange;
-	int returnCode;
+	struct TimerWheelEntry *timerWheelEntry;
 
-	EV_SET(&kChange, (uintptr_t)hashtableElt, EVFILT_TIMER, EV_DELETE | EV_CLEAR, 0, 0, 0);
-	returnCode = kevent(kQueue, &kChange, 1, NULL, 0, NULL);
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "cannot delete a timeout event: %s", strerror(errno));
+	timerWheel->lock();
+	timerWheelEntry = hashtableElt->getTimerEntry();
+	if (! timerWheelEntry) {
+		timerWheel->unlock();
 		return -1;
 	}
+	timerWheel->cancel(timerWheelEntry);
+	hashtableElt->setTimerEntry(NULL);
+	timerWheel->unlock();
 
 	return 0;
 }
 
-void KeyHashtableTimeout::run(void *arguments) {
-	int numberOfEvents;
-	struct kevent kEvents;
+// Keep the key for timeout ms from now instead of the timeout it was added with
+int KeyHashtableTimeout::refresh(HashTableElt *hashtableElt, int refreshTimeout) {
+	struct TimerWheelEntry *timerWheelEntry;
 	int returnCode;
+
+	timerWheel->lock();
+	timerWheelEntry = hashtableElt->getTimerEntry();
+	if (! timerWheelEntry) {
+		timerWheel->unlock();
+		return -1;
+	}
+	returnCode = timerWheel->refresh(timerWheelEntry, refreshTimeout);
+	timerWheel->unlock();
+
+	return returnCode;
+}
+
+void KeyHashtableTimeout::expire(struct TimerWheelEntry *timerWheelEntry) {
 	HashTableElt *hashtableElt;
+	bool isCurrent;
+	int returnCode;
+	void *data;
 
-	if (kQueue < 0)
+	keyHashtable->lock();
+	// The key may have been consumed by a request meanwhile, then the element is already freed
+	hashtableElt = keyHashtable->search(timerWheelEntry->cookie, (HashTableElt *)timerWheelEntry->object);
+	if (! hashtableElt) {
+		keyHashtable->unlock();
 		return;
-	for (;;) {
-		numberOfEvents = kevent(kQueue, NULL, 0, &kEvents, 1, NULL);
-		if (numberOfEvents < 0) {
-			systemLog->sysLog(ERROR, "error while receiving an event from kqueue: %s", strerror(errno));
-			continue;
-			// Remplacer ca par l'extraction de l'evenement en erreur et continuer ensuite...
-		}
-		switch (kEvents.filter) {
-			case EVFILT_TIMER:
-				hashtableElt = (HashTableElt *)kEvents.ident;
+	}
+	// Or freed and its address reused by a new key with its own timeout
+	timerWheel->lock();
+	isCurrent = (hashtableElt->getTimerEntry() == timerWheelEntry);
+	if (isCurrent)
+		hashtableElt->setTimerEntry(NULL);
+	timerWheel->unlock();
+	if (isCurrent == false) {
+		keyHashtable->unlock();
+		return;
+	}
 #ifdef DEBUGOUTPUT
-				fprintf(stderr, "[DEBUG] Removing key %s, timeout occured !\n", hashtableElt->getKey());
+	fprintf(stderr, "[DEBUG] Removing key %s, timeout occured !\n", hashtableElt->getKey());
 #endif
-				if (hashtableElt->getData())
-					free(hashtableElt->getData());
-				keyHashtable->lock();
-				returnCode = keyHashtable->remove((uint64_t)kEvents.udata, hashtableElt);
-				keyHashtable->unlock();
-				if (returnCode < 0) {
-					systemLog->sysLog(ERROR, "cannot remove a key from the hashtable :(");
-					continue;
-				}
-				break;
-			default:
-				systemLog->sysLog(ERROR, "filter %d is unknown !", kEvents.filter);
-				break;
+	returnCode = keyHashtable->remove(timerWheelEntry->cookie, hashtableElt, &data);
+	keyHashtable->unlock();
+	if ((returnCode == 0) && data)
+		free(data);
+
+	return;
+}
+
+void KeyHashtableTimeout::run(void *arguments) {
+	struct TimerWheelEntry *timerWheelEntry;
+	struct TimerWheelEntry *timerWheelEntryNext;
+
+	if (! timerWheel)
+		return;
+	for (;;) {
+		timerWheel->waitNextTick();
+		// Every expired timeout in one lock acquisition
+		timerWheel->lock();
+		timerWheelEntry = timerWheel->expire();
+		timerWheel->unlock();
+		while (timerWheelEntry) {
+			timerWheelEntryNext = timerWheelEntry->next;
+			expire(timerWheelEntry);
+			timerWheel->release(timerWheelEntry);
+			timerWheelEntry = timerWheelEntryNext;
 		}
 	}
 }
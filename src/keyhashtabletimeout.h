@@ -14,6 +14,9 @@
 
 #include "../toolkit/objectaction.h"
 #include "../toolkit/hashtable.h"
+#include "../toolkit/timerwheel.h"
+
+#define KEYHASHTABLETIMEOUT_RESOLUTION 1000
 
 /**
 	@author  <spe@>
@@ -21,15 +24,19 @@
 class KeyHashtableTimeout : public ObjectAction {
 private:
 	HashTable *keyHashtable;
-	int kQueue;
+	TimerWheel *timerWheel;
 	int timeout;
 
+	void expire(struct TimerWheelEntry *);
+
 public:
 	KeyHashtableTimeout(HashTable *, int);
 	~KeyHashtableTimeout();
 
+	// Must be called with the key hashtable locked
 	int add(uint32_t, HashTableElt *);
 	int remove(HashTableElt *);
+	int refresh(HashTableElt *, int);
 	void run(void *);
 	virtual void start(void *arguments) { run(arguments); delete this; return; }
 };
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+#include "mp4packaging.h"
+
+#include "../toolkit/log.h"
+
+Mp4Packaging::Mp4Packaging(HttpSession *_httpSession, SeekIndexCache *_seekIndexCache) {
+	httpSession = _httpSession;
+	seekIndexCache = _seekIndexCache;
+	segmentName[0] = '\0';
+	segmentArguments[0] = '\0';
+
+	return;
+}
+
+Mp4Packaging::~Mp4Packaging() {
+	return;
+}
+
+// Append part of an URL with the characters that would end a quoted URI or attribute
+// percent-encoded, return -1 if it doesn't fit
+static int appendUrl(char *url, size_t urlSize, size_t *urlLength, const char *part, size_t partSize) {
+	static const char hexDigits[] = "0123456789ABCDEF";
+	unsigned char character;
+	size_t i;
+
+	for (i = 0; i < partSize; i++) {
+		character = (unsigned char)part[i];
+		if ((character <= 0x20) || (character >= 0x7f) || (character == '"') || (character == '\'') || (character == '<') || (character == '>')) {
+			if (*urlLength + 4 > urlSize)
+				return -1;
+			url[(*urlLength)++] = '%';
+			url[(*urlLength)++] = hexDigits[character >> 4];
+			url[(*urlLength)++] = hexDigits[character & 0x0f];
+		}
+		else {
+			if (*urlLength + 2 > urlSize)
+				return -1;
+			url[(*urlLength)++] = character;
+		}
+	}
+	url[*urlLength] = '\0';
+
+	return 0;
+}
+
+// XML attribute value, escaped needs 6 bytes per character of value
+static void escapeXml(char *escaped, const char *value) {
+	size_t i;
+	size_t j = 0;
+
+	for (i = 0; value[i]; i++) {
+		switch (value[i]) {
+			case '&':
+				memcpy(&escaped[j], "&amp;", 5);
+				j += 5;
+				break;
+			case '<':
+				memcpy(&escaped[j], "&lt;", 4);
+				j += 4;
+				break;
+			case '>':
+				memcpy(&escaped[j], "&gt;", 4);
+				j += 4;
+				break;
+			case '"':
+				memcpy(&escaped[j], "&quot;", 6);
+				j += 6;
+				break;
+			case '\'':
+				memcpy(&escaped[j], "&apos;", 6);
+				j += 6;
+				break;
+			default:
+				escaped[j++] = value[i];
+		}
+	}
+	escaped[j] = '\0';
+
+	return;
+}
+
+// Segments are requested on the same object with the arguments of the manifest
+// request, only the packaging arguments are replaced. The key is kept by
+// StreamContent while segments are fetched
+int Mp4Packaging::getSegmentUrl(void) {
+	const char *name;
+	const char *arguments;
+	const char *argumentsEnd;
+	const char *argument;
+	const char *argumentEnd;
+	size_t argumentsSize = 0;
+	size_t nameSize = 0;
+
+	name = strrchr(httpSession->videoName, '/');
+	name = name ? name + 1 : httpSession->videoName;
+	if (appendUrl(segmentName, sizeof(segmentName), &nameSize, name, strlen(name)) < 0)
+		return -1;
+
+	segmentArguments[0] = '\0';
+	arguments = strchr(httpSession->httpFullRequest, '?');
+	if (! arguments)
+		return 0;
+	arguments++;
+	argumentsEnd = arguments + strcspn(arguments, " \r\n");
+	for (argument = arguments; argument < argumentsEnd; argument = argumentEnd + 1) {
+		argumentEnd = (const char *)memchr(argument, '&', argumentsEnd - argument);
+		if (! argumentEnd)
+			argumentEnd = argumentsEnd;
+		if ((argumentEnd == argument) || (! strncmp(argument, "hls=", 4)) || (! strncmp(argument, "dash=", 5)) || (! strncmp(argument, "segment=", 8)) || (! strncmp(argument, "seekseconds=", 12)) || (! strncmp(argument, "fmp4=", 5)))
+			continue;
+		if ((appendUrl(segmentArguments, sizeof(segmentArguments), &argumentsSize, argument, argumentEnd - argument) < 0) || (argumentsSize + 2 > sizeof(segmentArguments)))
+			return -1;
+		segmentArguments[argumentsSize++] = '&';
+		segmentArguments[argumentsSize] = '\0';
+	}
+
+	return 0;
+}
+
+// Media playlist with fMP4 segments (EXT-X-MAP needs version 7 for VOD)
+int Mp4Packaging::manifestHls(struct mp4_index_t const *mp4Index) {
+	unsigned int numberOfSegments;
+	unsigned int segmentNumber;
+	size_t manifestSize;
+	int manifestOffset;
+	double targetDuration = 0;
+	double start;
+	double duration;
+
+	numberOfSegments = mp4_index_segments(mp4Index);
+	for (segmentNumber = 0; segmentNumber < numberOfSegments; segmentNumber++) {
+		mp4_index_segment_time(mp4Index, segmentNumber, &start, &duration);
+		if (duration > targetDuration)
+			targetDuration = duration;
+	}
+	manifestSize = 512 + (numberOfSegments + 1) * (64 + strlen(segmentName) + strlen(segmentArguments));
+	httpSession->preBuffer = (char *)malloc(manifestSize);
+	if (! httpSession->preBuffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %d bytes for the manifest: %s", manifestSize, strerror(errno));
+		return -1;
+	}
+	manifestOffset = snprintf(httpSession->preBuffer, manifestSize, "#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:%u\n#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-PLAYLIST-TYPE:VOD\n#EXT-X-INDEPENDENT-SEGMENTS\n#EXT-X-MAP:URI=\"%s?%ssegment=init\"\n", (unsigned int)ceil(targetDuration), segmentName, segmentArguments);
+	for (segmentNumber = 0; segmentNumber < numberOfSegments; segmentNumber++) {
+		mp4_index_segment_time(mp4Index, segmentNumber, &start, &duration);
+		manifestOffset += snprintf(&httpSession->preBuffer[manifestOffset], manifestSize - manifestOffset, "#EXTINF:%.3f,\n%s?%ssegment=%u\n", duration, segmentName, segmentArguments, segmentNumber);
+	}
+	manifestOffset += snprintf(&httpSession->preBuffer[manifestOffset], manifestSize - manifestOffset, "#EXT-X-ENDLIST\n");
+	httpSession->preBufferSize = manifestOffset;
+
+	return 0;
+}
+
+// Static MPD, one muxed representation whose segments are listed with their times in ms
+int Mp4Packaging::manifestDash(struct mp4_index_t const *mp4Index) {
+	char codecs[256];
+	char escapedName[MAXMSGSIZE * 6];
+	char escapedArguments[MP4PACKAGING_MAXARGUMENTSSIZE * 6];
+	unsigned int numberOfSegments;
+	unsigned int segmentNumber;
+	size_t manifestSize;
+	int manifestOffset;
+	double start;
+	double duration;
+	uint64_t startTime;
+	uint64_t endTime;
+
+	if (! mp4_index_codecs(mp4Index, codecs, sizeof(codecs)))
+		codecs[0] = '\0';
+	escapeXml(escapedName, segmentName);
+	escapeXml(escapedArguments, segmentArguments);
+
+	numberOfSegments = mp4_index_segments(mp4Index);
+	mp4_index_segment_time(mp4Index, numberOfSegments - 1, &start, &duration);
+	manifestSize = 1024 + strlen(codecs) + (numberOfSegments + 1) * (96 + strlen(escapedName) + strlen(escapedArguments));
+	httpSession->preBuffer = (char *)malloc(manifestSize);
+	if (! httpSession->preBuffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %d bytes for the manifest: %s", manifestSize, strerror(errno));
+		return -1;
+	}
+	manifestOffset = snprintf(httpSession->preBuffer, manifestSize, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-main:2011\" type=\"static\" mediaPresentationDuration=\"PT%.3fS\" minBufferTime=\"PT2S\">\n<Period start=\"PT0S\">\n<AdaptationSet segmentAlignment=\"true\">\n<Representation id=\"1\" mimeType=\"video/mp4\" codecs=\"%s\" bandwidth=\"%u\">\n<SegmentList timescale=\"1000\">\n<Initialization sourceURL=\"%s?%ssegment=init\"/>\n<SegmentTimeline>\n", start + duration, codecs, mp4_index_bitrate(mp4Index) * 1000, escapedName, escapedArguments);
+	// Rounded ends, the times don't drift from the file
+	for (segmentNumber = 0; segmentNumber < numberOfSegments; segmentNumber++) {
+		mp4_index_segment_time(mp4Index, segmentNumber, &start, &duration);
+		startTime = (uint64_t)(start * 1000 + 0.5);
+		endTime = (uint64_t)((start + duration) * 1000 + 0.5);
+		manifestOffset += snprintf(&httpSession->preBuffer[manifestOffset], manifestSize - manifestOffset, "<S t=\"%llu\" d=\"%llu\"/>\n", (unsigned long long)startTime, (unsigned long long)(endTime - startTime));
+	}
+	manifestOffset += snprintf(&httpSession->preBuffer[manifestOffset], manifestSize - manifestOffset, "</SegmentTimeline>\n");
+	for (segmentNumber = 0; segmentNumber < numberOfSegments; segmentNumber++)
+		manifestOffset += snprintf(&httpSession->preBuffer[manifestOffset], manifestSize - manifestOffset, "<SegmentURL media=\"%s?%ssegment=%u\"/>\n", escapedName, escapedArguments, segmentNumber);
+	manifestOffset += snprintf(&httpSession->preBuffer[manifestOffset], manifestSize - manifestOffset, "</SegmentList>\n</Representation>\n</AdaptationSet>\n</Period>\n</MPD>\n");
+	httpSession->preBufferSize = manifestOffset;
+
+	return 0;
+}
+
+// Init segment alone, or the header of the segment followed by its range of the file
+int Mp4Packaging::segment(struct mp4_index_t const *mp4Index) {
+	char **preBufferPtr;
+	uint64_t dataOffset;
+	uint64_t dataSize;
+
+	preBufferPtr = &httpSession->preBuffer;
+	if (httpSession->segmentNumber < 0) {
+		if (! mp4_index_init_segment(mp4Index, (void **)preBufferPtr, &httpSession->preBufferSize))
+			return -1;
+		httpSession->fileSize = httpSession->preBufferSize;
+		return 0;
+	}
+	if (! mp4_index_segment(mp4Index, httpSession->segmentNumber, (void **)preBufferPtr, &httpSession->preBufferSize, &dataOffset, &dataSize))
+		return -1;
+
+	httpSession->httpExchange->setInputOffset(dataOffset);
+	httpSession->mp4Position = dataOffset;
+	httpSession->fileSize = httpSession->preBufferSize + dataSize;
+
+	return 0;
+}
+
+// Answer a manifest or a segment of the object from its mp4 index
+int Mp4Packaging::package(void) {
+	struct SeekIndexCacheData *seekIndexCacheData = NULL;
+	struct mp4_index_t *mp4Index = NULL;
+	struct mp4_index_t const *index;
+	int returnCode;
+
+	if (httpSession->videoNameFilePath == NULL)
+		return -1;
+	if (seekIndexCache && (httpSession->sourceFileStat.st_size > 0))
+		seekIndexCacheData = seekIndexCache->acquire(httpSession->videoName, httpSession->videoNameFilePath, &httpSession->sourceFileStat, SEEKINDEXCACHE_MP4);
+	if (seekIndexCacheData)
+		index = seekIndexCacheData->mp4Index;
+	else {
+		mp4Index = mp4_index_open(httpSession->videoNameFilePath, httpSession->fileSize);
+		if (! mp4Index) {
+			systemLog->sysLog(ERROR, "cannot index mp4 file '%s' for packaging", httpSession->videoNameFilePath);
+			return -1;
+		}
+		index = mp4Index;
+	}
+
+	if (! mp4_index_segments(index)) {
+		systemLog->sysLog(ERROR, "mp4 file '%s' cannot be segmented", httpSession->videoNameFilePath);
+		returnCode = -1;
+	}
+	else
+	if (httpSession->packaging == PACKAGING_SEGMENT)
+		returnCode = segment(index);
+	else {
+		returnCode = getSegmentUrl();
+		if (returnCode == 0) {
+			if (httpSession->packaging == PACKAGING_HLS)
+				returnCode = manifestHls(index);
+			else
+				returnCode = manifestDash(index);
+		}
+		if (returnCode == 0)
+			httpSession->fileSize = httpSession->preBufferSize;
+	}
+
+	if (seekIndexCacheData)
+		seekIndexCache->release(seekIndexCacheData);
+	if (mp4Index)
+		mp4_index_close(mp4Index);
+	// Ranges apply to the object, not to the generated answer
+	httpSession->byteRange.start = -1;
+	httpSession->byteRange.end = -1;
+
+	return returnCode;
+}
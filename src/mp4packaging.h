@@ -0,0 +1,34 @@
+#ifndef MP4PACKAGING_H
+#define MP4PACKAGING_H
+
+#include "../toolkit/httpsession.h"
+#include "../toolkit/moov.h"
+#include "../toolkit/seekindexcache.h"
+
+// Room for the query string repeated in each segment url of a manifest
+#define MP4PACKAGING_MAXARGUMENTSSIZE 1024
+
+/**
+  *@author spe
+  */
+
+class Mp4Packaging {
+private:
+	HttpSession *httpSession;
+	SeekIndexCache *seekIndexCache;
+	char segmentName[MAXMSGSIZE];
+	char segmentArguments[MP4PACKAGING_MAXARGUMENTSSIZE];
+
+	int getSegmentUrl(void);
+	int manifestHls(struct mp4_index_t const *);
+	int manifestDash(struct mp4_index_t const *);
+	int segment(struct mp4_index_t const *);
+
+public:
+	Mp4Packaging(HttpSession *, SeekIndexCache *);
+	~Mp4Packaging();
+
+	int package(void);
+};
+
+#endif
@@ -3,43 +3,249 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "mp4streaming.h"
 
 #include "../toolkit/log.h"
 
-Mp4Streaming::Mp4Streaming(HttpSession *_httpSession) {
+Mp4Streaming::Mp4Streaming(HttpSession *_httpSession, SeekIndexCache *_seekIndexCache) {
 	httpSession = _httpSession;
+	seekIndexCache = _seekIndexCache;
+	seekIndexCacheData = NULL;
+	mp4Index = NULL;
+	mp4Fragmenter = NULL;
+	remuxIndex = NULL;
+	flvRemuxIndex = NULL;
+	remuxFragment = 0;
+	remuxEndFragment = 0;
+	fragmentBytesLeft = 0;
 
 	return;
 }
 
 Mp4Streaming::~Mp4Streaming() {
+	if (mp4Fragmenter)
+		mp4_fragmenter_close(mp4Fragmenter);
+	if (seekIndexCacheData)
+		seekIndexCache->release(seekIndexCacheData);
+	if (mp4Index)
+		mp4_index_close(mp4Index);
+	if (flvRemuxIndex)
+		FlvRemuxer::destroyRemuxIndex(flvRemuxIndex);
+
+	return;
+}
+
+// The answer is the init segment in preBuffer, then the fragments given by nextFragment()
+// Return -1 if the file cannot be fragmented, the regular seek is done then
+int Mp4Streaming::seekFragmented(void) {
+	struct mp4_index_t const *index;
+	uint32_t initSize;
+	uint64_t dataOffset;
+	uint64_t totalSize;
+	char **preBufferPtr;
+
+	if (seekIndexCache && (httpSession->sourceFileStat.st_size > 0))
+		seekIndexCacheData = seekIndexCache->acquire(httpSession->videoName, httpSession->videoNameFilePath, &httpSession->sourceFileStat, SEEKINDEXCACHE_MP4);
+	if (seekIndexCacheData)
+		index = seekIndexCacheData->mp4Index;
+	else {
+		mp4Index = mp4_index_open(httpSession->videoNameFilePath, httpSession->fileSize);
+		if (! mp4Index)
+			return -1;
+		index = mp4Index;
+	}
+
+	preBufferPtr = &httpSession->preBuffer;
+	mp4Fragmenter = mp4_fragmenter_open(index, httpSession->seekSeconds, httpSession->endSeconds, MP4STREAMING_FRAGMENTSIZE, (void **)preBufferPtr, &initSize, &dataOffset, &totalSize);
+	if (mp4Fragmenter && (totalSize > INT_MAX)) {
+		mp4_fragmenter_close(mp4Fragmenter);
+		mp4Fragmenter = NULL;
+		free(httpSession->preBuffer);
+		httpSession->preBuffer = NULL;
+	}
+	if (! mp4Fragmenter) {
+		if (seekIndexCacheData) {
+			seekIndexCache->release(seekIndexCacheData);
+			seekIndexCacheData = NULL;
+		}
+		if (mp4Index) {
+			mp4_index_close(mp4Index);
+			mp4Index = NULL;
+		}
+		return -1;
+	}
+
+	httpSession->preBufferSize = initSize;
+	httpSession->httpExchange->setInputOffset(dataOffset);
+	httpSession->mp4Position = dataOffset;
+	httpSession->fileSize = totalSize;
+	fragmentBytesLeft = 0;
+
+	return 0;
+}
+
+// Put the header of the next fragment in preBuffer, return 0 after the last fragment
+int Mp4Streaming::nextFragment(void) {
+	void *header;
+	uint32_t headerSize;
+	uint64_t dataSize;
+	int returnCode;
+
+	if (remuxIndex)
+		return nextRemuxFragment();
+	if (! mp4Fragmenter)
+		return 0;
+	returnCode = mp4_fragmenter_next(mp4Fragmenter, &header, &headerSize, &dataSize);
+	if (returnCode < 0) {
+		systemLog->sysLog(ERROR, "cannot build the next fragment of mp4 file '%s'", httpSession->videoNameFilePath);
+		return -1;
+	}
+	if (! returnCode)
+		return 0;
+
+	if (httpSession->preBuffer)
+		free(httpSession->preBuffer);
+	httpSession->preBuffer = (char *)header;
+	httpSession->preBufferSize = headerSize;
+	httpSession->preBufferOffset = 0;
+	httpSession->preBufferSent = false;
+	fragmentBytesLeft = dataSize;
+
+	return 1;
+}
+
+// Answer of a H.264/AAC flv as fragmented mp4: the init segment in preBuffer, then
+// a fragment per GOP from the one of seekSeconds, each mdat is the GOP tags in the file
+// Return -1 if the file cannot be remuxed, it is sent as flv then
+int Mp4Streaming::remux(void) {
+	char remuxKey[2048];
+	char **preBufferPtr;
+	uint32_t initSize;
+	uint32_t fragment;
+	uint64_t totalSize;
+
+	if ((httpSession->videoNameFilePath == NULL) || (httpSession->sourceFileStat.st_size <= 0))
+		return -1;
+	if (seekIndexCache && (SeekIndexCache::getRemuxKey(httpSession->videoName, remuxKey, sizeof(remuxKey)) == 0))
+		seekIndexCacheData = seekIndexCache->acquire(remuxKey, httpSession->videoNameFilePath, &httpSession->sourceFileStat, SEEKINDEXCACHE_FLVREMUX);
+	if (seekIndexCacheData)
+		remuxIndex = seekIndexCacheData->flvRemuxIndex;
+	else {
+		flvRemuxIndex = SeekIndexCache::buildRemuxIndex(httpSession->httpExchange->inputDescriptor, httpSession->sourceFileStat.st_size);
+		remuxIndex = flvRemuxIndex;
+	}
+	if (! remuxIndex)
+		return -1;
+
+	remuxFragment = FlvRemuxer::searchFragmentByTime(remuxIndex, (uint32_t)(httpSession->seekSeconds * 1000));
+	// Fragments starting before the end time
+	remuxEndFragment = remuxIndex->numberOfFragments;
+	if (httpSession->endSeconds) {
+		for (fragment = remuxFragment + 1; fragment < remuxIndex->numberOfFragments; fragment++) {
+			if (remuxIndex->fragments[fragment].timestamp >= (uint32_t)(httpSession->endSeconds * 1000)) {
+				remuxEndFragment = fragment;
+				break;
+			}
+		}
+	}
+	preBufferPtr = &httpSession->preBuffer;
+	if (FlvRemuxer::getInitSegment(remuxIndex, remuxFragment, preBufferPtr, &initSize) < 0) {
+		releaseRemuxIndex();
+		return -1;
+	}
+	totalSize = initSize;
+	for (fragment = remuxFragment; fragment < remuxEndFragment; fragment++)
+		totalSize += FlvRemuxer::getFragmentSize(remuxIndex, fragment);
+	if (totalSize > INT_MAX) {
+		free(httpSession->preBuffer);
+		httpSession->preBuffer = NULL;
+		releaseRemuxIndex();
+		return -1;
+	}
+
+	httpSession->preBufferSize = initSize;
+	httpSession->httpExchange->setInputOffset(remuxIndex->fragments[remuxFragment].position);
+	httpSession->mp4Position = remuxIndex->fragments[remuxFragment].position;
+	httpSession->fileSize = totalSize;
+	// No flv header is sent in front of it and the whole answer is sent
+	httpSession->seekPosition = 0;
+	httpSession->byteRange.start = -1;
+	httpSession->byteRange.end = -1;
+	fragmentBytesLeft = 0;
+
+	return 0;
+}
+
+void Mp4Streaming::releaseRemuxIndex(void) {
+	if (seekIndexCacheData) {
+		seekIndexCache->release(seekIndexCacheData);
+		seekIndexCacheData = NULL;
+	}
+	if (flvRemuxIndex) {
+		FlvRemuxer::destroyRemuxIndex(flvRemuxIndex);
+		flvRemuxIndex = NULL;
+	}
+	remuxIndex = NULL;
+
 	return;
 }
 
+// Fragments are next to each other in the file, the input offset stays where the previous one ended
+int Mp4Streaming::nextRemuxFragment(void) {
+	char *header;
+	uint32_t headerSize;
+	uint64_t dataSize;
+
+	if (remuxFragment >= remuxEndFragment)
+		return 0;
+	if (FlvRemuxer::getFragment(remuxIndex, remuxFragment, &header, &headerSize, &dataSize) < 0) {
+		systemLog->sysLog(ERROR, "cannot build the next fragment of flv file '%s'", httpSession->videoNameFilePath);
+		return -1;
+	}
+	remuxFragment++;
+
+	if (httpSession->preBuffer)
+		free(httpSession->preBuffer);
+	httpSession->preBuffer = header;
+	httpSession->preBufferSize = headerSize;
+	httpSession->preBufferOffset = 0;
+	httpSession->preBufferSent = false;
+	fragmentBytesLeft = dataSize;
+
+	return 1;
+}
+
 int Mp4Streaming::seek(void) {
 	uint64_t mdat_offset;
 	uint64_t mdat_size;
 	int returnCode;
 	char **preBufferPtr;
+	struct SeekIndexCacheData *seekIndexCacheData = NULL;
 
 	if (httpSession->videoNameFilePath == NULL)
 		return -1;
 
+	if (httpSession->fragmentedSeek && (seekFragmented() == 0))
+		return 0;
+
 	preBufferPtr = &httpSession->preBuffer;
-	returnCode = mp4_split(httpSession->videoNameFilePath, httpSession->fileSize, httpSession->seekSeconds, 0, (void **)preBufferPtr, &httpSession->preBufferSize, &mdat_offset, &mdat_size, 1);
+	if (seekIndexCache && (httpSession->sourceFileStat.st_size > 0))
+		seekIndexCacheData = seekIndexCache->acquire(httpSession->videoName, httpSession->videoNameFilePath, &httpSession->sourceFileStat, SEEKINDEXCACHE_MP4);
+	if (seekIndexCacheData) {
+		returnCode = mp4_index_split(seekIndexCacheData->mp4Index, httpSession->seekSeconds, httpSession->endSeconds, (void **)preBufferPtr, &httpSession->preBufferSize, &mdat_offset, &mdat_size, 1);
+		seekIndexCache->release(seekIndexCacheData);
+	}
+	else
+		returnCode = mp4_split(httpSession->videoNameFilePath, httpSession->fileSize, httpSession->seekSeconds, httpSession->endSeconds, (void **)preBufferPtr, &httpSession->preBufferSize, &mdat_offset, &mdat_size, 1);
 
 	if (! returnCode) {
 		systemLog->sysLog(ERROR, "cannot seek mp4 file '%s': %s", httpSession->videoNameFilePath, strerror(errno));
 		return -1;
 	}
 
-	returnCode = lseek(httpSession->httpExchange->inputDescriptor, mdat_offset, SEEK_SET);
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "cannot lseek on descriptor %d: %s", httpSession->fileDescriptor, strerror(errno));
-		return -1;
-	}
+	httpSession->httpExchange->setInputOffset(mdat_offset);
 
 	httpSession->mp4Position = mdat_offset;
 	httpSession->fileSize = mdat_size + httpSession->preBufferSize;;
@@ -3,6 +3,10 @@
 
 #include "../toolkit/httpsession.h"
 #include "../toolkit/moov.h"
+#include "../toolkit/seekindexcache.h"
+
+// Bytes of file data in each fragment of a fragmented seek
+#define MP4STREAMING_FRAGMENTSIZE 1048576
 
 /**
   *@author spe
@@ -11,9 +15,26 @@
 class Mp4Streaming {
 private:
 	HttpSession *httpSession;
+	SeekIndexCache *seekIndexCache;
+	// Kept for the whole answer of a fragmented seek
+	struct SeekIndexCacheData *seekIndexCacheData;
+	struct mp4_index_t *mp4Index;
+	struct mp4_fragmenter_t *mp4Fragmenter;
+	// Remux of a flv, from the cache or owned when there is no cache
+	struct FlvRemuxIndex const *remuxIndex;
+	struct FlvRemuxIndex *flvRemuxIndex;
+	uint32_t remuxFragment;
+	uint32_t remuxEndFragment;
+
+	int seekFragmented(void);
+	void releaseRemuxIndex(void);
+	int nextRemuxFragment(void);
 
 public:
-	Mp4Streaming(HttpSession *);
+	// File bytes of the current fragment still to be read
+	uint64_t fragmentBytesLeft;
+
+	Mp4Streaming(HttpSession *, SeekIndexCache *);
 	~Mp4Streaming();
 
 	void writeChar(unsigned char *, int);
@@ -25,6 +46,9 @@ public:
 	void atomPrint(struct atom_t const *);
 	int atomIs(struct atom_t const *, const char *);
 	int seek(void);
+	int remux(void);
+	bool isFragmented(void) { return (mp4Fragmenter != NULL) || (remuxIndex != NULL); };
+	int nextFragment(void);
 };
 
 #endif
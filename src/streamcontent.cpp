@@ -17,6 +17,8 @@
 #include "multicastdata.h"
 #include "../src/catalogdata.h"
 #include "../src/multicastpacketcatalog.h"
+#include "../toolkit/seekindexcache.h"
+#include "../src/mp4streaming.h"
 
 StreamContent::StreamContent(Configuration *_configuration, HashTable *_keyHashtable, KeyHashtableTimeout *_keyHashtableTimeout, HashTable *_catalogHashtable, CatalogHashtableTimeout *_catalogHashtableTimeout, MulticastServerCatalog *_multicastServerCatalog, CacheManager *_cacheManager) : HttpContent() {
 	char delimiter[2];
@@ -46,22 +48,17 @@ StreamContent::~StreamContent() {
 	return;
 }
 
-// urlLength argument is the length in strlen style (without \0)
-char *StreamContent::urlDecode(char *url, unsigned int urlLength)
+// urlLength argument is the length in strlen style (without \0), decodedUrl is given by the
+// caller. Return the decoded length, -1 if the url cannot be decoded
+int StreamContent::urlDecode(char *url, unsigned int urlLength, char *decodedUrl, size_t decodedUrlSize)
 {
 	char *urlPtr;
-	char *decodedUrl;
 	char c1, c2;
-	int position = 0;
+	size_t position = 0;
 
-	decodedUrl = (char *)malloc(urlLength);
-	if (! decodedUrl) {
-		systemLog->sysLog(CRITICAL, "cannot malloc a string for decodedUrl: %s", strerror(errno));
-		return NULL;
-	}
 	urlPtr = url;
-	while (*urlPtr && (*urlPtr != ' ')) {
-		if ((*urlPtr == '%') && ((urlLength - position) > 2)) {
+	while (*urlPtr && (*urlPtr != ' ') && (position < decodedUrlSize - 1)) {
+		if ((*urlPtr == '%') && ((url + urlLength - urlPtr) > 2)) {
 			c1 = urlPtr[1];
 			c2 = urlPtr[2];
 			c1 = tolower(c1);
@@ -69,7 +66,7 @@ char *StreamContent::urlDecode(char *url, unsigned int urlLength)
 
 			if ((! isxdigit(c1)) || (! isxdigit(c2))) {
 				systemLog->sysLog(ERROR, "impossible to decode url : bad isxdigit");
-				return NULL;
+				return -1;
 			}
 
 			if (c1 <= '9')
@@ -97,7 +94,7 @@ char *StreamContent::urlDecode(char *url, unsigned int urlLength)
 	}
 	decodedUrl[position] = '\0';
 
-	return decodedUrl;
+	return position;
 }
 
 bool StreamContent::isDigitString(char *str) {
@@ -115,10 +112,12 @@ bool StreamContent::isDigitString(char *str) {
 int StreamContent::extractFileName(HttpSession *httpSession) {
 	int i;
 	char *str;
-	char *decodedUrl;
+	// Arguments are decoded and split in place, the key points in it until the end
+	char decodedUrl[MAXHTTPREQUESTSIZE];
+	struct ParserToken httpArguments[STREAMCONTENT_MAXARGUMENTS];
+	int numberOfArguments;
 	int listCounter;
-	List<String *> *httpArgumentsList = NULL;
-	String *httpArgument;
+	char *httpArgument;
 	char *urlArguments = NULL;
 	char *key = NULL;
 	HashTableElt *hashtableElt;
@@ -163,42 +162,62 @@ int StreamContent::extractFileName(HttpSession *httpSession) {
 		urlArguments = str;
 		str++;
 		// Parse http arguments
-		decodedUrl = urlDecode(str, strlen(str));
-		if (! decodedUrl)
+		if (urlDecode(str, strlen(str), decodedUrl, sizeof(decodedUrl)) < 0)
 			systemLog->sysLog(ERROR, "cannot decode url '%s'", httpSession->httpFullRequest);
 		else {
-			httpArgumentsList = parser->tokenizeString(decodedUrl, strlen(decodedUrl));
-			if (decodedUrl)
-				free(decodedUrl);
-			listCounter = 0;
-			while (listCounter < httpArgumentsList->listSize) {
-				httpArgument = httpArgumentsList->getElement(listCounter + 1);
-				if (! strncmp(httpArgument->bloc, "key=", 4)) {
-					key = &httpArgument->bloc[4];
+			numberOfArguments = parser->splitString(decodedUrl, httpArguments, STREAMCONTENT_MAXARGUMENTS);
+			for (listCounter = 0; listCounter < numberOfArguments; listCounter++) {
+				httpArgument = httpArguments[listCounter].bloc;
+				if (! strncmp(httpArgument, "key=", 4)) {
+					key = &httpArgument[4];
+				}
+				else if (! strncmp(httpArgument, "seek=", 5)) {
+					if (this->isDigitString(&httpArgument[5]) == true)
+						httpSession->seekPosition = atoi(&httpArgument[5]);
+				}
+				else if (! strncmp(httpArgument, "seekseconds=", 12)) {
+					httpSession->seekSeconds = strtod(&httpArgument[12], NULL);
 				}
-				else if (! strncmp(httpArgument->bloc, "seek=", 5)) {
-					if (this->isDigitString(&httpArgument->bloc[5]) == true)
-						httpSession->seekPosition = atoi(&httpArgument->bloc[5]);
+				else if (! strncmp(httpArgument, "endseconds=", 11)) {
+					httpSession->endSeconds = strtod(&httpArgument[11], NULL);
 				}
-				else if (! strncmp(httpArgument->bloc, "seekseconds=", 12)) {
-					httpSession->seekSeconds = strtod(&httpArgument->bloc[12], NULL);
+				else if (! strncmp(httpArgument, "fmp4=", 5)) {
+					if (httpArgument[5] == '1')
+						httpSession->fragmentedSeek = true;
+				}
+				else if (! strncmp(httpArgument, "hls=", 4)) {
+					if ((httpArgument[4] == '1') && (httpSession->packaging == PACKAGING_NONE))
+						httpSession->packaging = PACKAGING_HLS;
+				}
+				else if (! strncmp(httpArgument, "dash=", 5)) {
+					if ((httpArgument[5] == '1') && (httpSession->packaging == PACKAGING_NONE))
+						httpSession->packaging = PACKAGING_DASH;
+				}
+				else if (! strncmp(httpArgument, "segment=", 8)) {
+					if (! strcmp(&httpArgument[8], "init")) {
+						httpSession->packaging = PACKAGING_SEGMENT;
+						httpSession->segmentNumber = -1;
+					}
+					else
+					if (this->isDigitString(&httpArgument[8]) == true) {
+						httpSession->packaging = PACKAGING_SEGMENT;
+						httpSession->segmentNumber = atoi(&httpArgument[8]);
+					}
 				}
-				else if (! strncmp(httpArgument->bloc, "dl=", 3)) {
-					if (httpArgument->bloc[3] == '1')
+				else if (! strncmp(httpArgument, "dl=", 3)) {
+					if (httpArgument[3] == '1')
 						httpSession->downloadMimeType = true;
 				}
-				else if (! strncmp(httpArgument->bloc, "sh=", 3)) {
-					if (! strncmp(&httpArgument->bloc[3], "auto", 4))
+				else if (! strncmp(httpArgument, "sh=", 3)) {
+					if (! strncmp(&httpArgument[3], "auto", 4))
 						httpSession->shappingAuto = true;
 					else
-						if (this->isDigitString(&httpArgument->bloc[3]) == true)
-							httpSession->shapping = atoi(&httpArgument->bloc[3]);
+						if (this->isDigitString(&httpArgument[3]) == true)
+							httpSession->shapping = atoi(&httpArgument[3]);
 				}
-				else if (! strncmp(httpArgument->bloc, "kd_", 3)) { // put in requestArgs
-				  httpSession->requestArgs.push_back(httpArgument->bloc);
+				else if (! strncmp(httpArgument, "kd_", 3)) { // put in requestArgs
+				  httpSession->requestArgs.push_back(httpArgument);
 				}
-				
-				listCounter++;
 			}
 		}
 	}
@@ -211,6 +230,8 @@ int StreamContent::extractFileName(HttpSession *httpSession) {
 #endif
 	// Search the key in hashtable
 	if (keyHashtable && key) {
+		// MulticastServer and the timeout thread modify the hashtable concurrently
+		keyHashtable->lock();
 		hashtableElt = keyHashtable->search(key);
 #ifdef DEBUGOUTPUT
 		if (hashtableElt)
@@ -225,11 +246,23 @@ int StreamContent::extractFileName(HttpSession *httpSession) {
 			}
 		}
 		else {
-			// Storing hashtable informations on the HttpSession object for further use
-			httpSession->multicastData = (struct MulticastData *)hashtableElt->getData();
-			keyHashtableTimeout->remove(hashtableElt);
-			keyHashtable->remove(key);
+			// Storing hashtable informations on the HttpSession object for further use,
+			// the data lives in the element so the session keeps a copy
+			httpSession->multicastData = (struct MulticastData *)malloc(sizeof(struct MulticastData));
+			if (httpSession->multicastData)
+				memcpy(httpSession->multicastData, hashtableElt->getData(), sizeof(struct MulticastData));
+			else
+				systemLog->sysLog(CRITICAL, "cannot allocate a MulticastData object: %s", strerror(errno));
+			// The segments of a manifest are requested with its key, it is consumed when
+			// the player stops fetching them instead of on first use
+			if (httpSession->packaging == PACKAGING_NONE) {
+				keyHashtableTimeout->remove(hashtableElt);
+				keyHashtable->remove(key);
+			}
+			else
+				keyHashtableTimeout->refresh(hashtableElt, STREAMCONTENT_PACKAGINGKEYTIMEOUT);
 		}
+		keyHashtable->unlock();
 	}
 	else {
 		if ((configuration->noKeyCheck == false) && (strstr(httpSession->httpFullRequest, ".flv") || strstr(httpSession->httpFullRequest, ".mp4"))) {
@@ -252,7 +285,8 @@ int StreamContent::extractFileName(HttpSession *httpSession) {
 #ifdef DEBUGCATALOG
 		systemLog->sysLog(DEBUG, "trying to search key %s in catalog", httpSession->videoName);
 #endif
-		catalogHashtable->lock();
+		// Lockless lookup, the element and its data stay valid until exitRead()
+		catalogHashtable->enterRead();
 		hashtableElt = catalogHashtable->search(httpSession->videoName);
 		if (hashtableElt) {
 #ifdef DEBUGCATALOG
@@ -287,22 +321,24 @@ int StreamContent::extractFileName(HttpSession *httpSession) {
 					systemLog->sysLog(CRITICAL, "cannot allocate httpSession->redirectUrl object: %s", strerror(errno));
 			}
 		}
-		catalogHashtable->unlock();
+		catalogHashtable->exitRead();
 	}
 
 #ifdef DEBUGOUTPUT
 	systemLog->sysLog(DEBUG, "httpSession->httpCode is %d\n", httpSession->httpCode);
 #endif
 
-	if (httpArgumentsList)
-		delete httpArgumentsList;
-
 	return 0;
 }
 
 ssize_t StreamContent::get(HttpSession *httpSession, char *buffer, int bufferSize) {
 	ssize_t size;
 
+	// Each fragment is its header, then its part of the file
+	if (httpSession->mp4Streaming && (httpSession->preBufferSent == true) && (! httpSession->mp4Streaming->fragmentBytesLeft)) {
+		if (httpSession->mp4Streaming->nextFragment() <= 0)
+			return 0;
+	}
 	if (httpSession->preBuffer && (httpSession->preBufferSent == false)) {
 		size = httpSession->preBufferSize - httpSession->preBufferOffset;
 		if (size > bufferSize)
@@ -318,6 +354,14 @@ ssize_t StreamContent::get(HttpSession *httpSession, char *buffer, int bufferSiz
 			httpSession->fileSize = httpSession->byteRange.end - httpSession->byteRange.start + 1;
 			size = cacheManager->get(httpSession, buffer, httpSession->byteRange.end - httpSession->byteRange.start + 1);
 		}
+		else
+		if (httpSession->mp4Streaming) {
+			if ((uint64_t)bufferSize > httpSession->mp4Streaming->fragmentBytesLeft)
+				bufferSize = httpSession->mp4Streaming->fragmentBytesLeft;
+			size = cacheManager->get(httpSession, buffer, bufferSize);
+			if (size > 0)
+				httpSession->mp4Streaming->fragmentBytesLeft -= size;
+		}
 		else
 			size = cacheManager->get(httpSession, buffer, bufferSize);
 	}
@@ -325,21 +369,27 @@ ssize_t StreamContent::get(HttpSession *httpSession, char *buffer, int bufferSiz
 	return size;
 }
 
-int StreamContent::getBitRate(char *videoName) {
-        char buffer[140];
-        FILE *in;
-        int bitrate = 0;
-        char cmd[2048];
-
-        snprintf(cmd, sizeof(cmd), "ffmpeg -i %s 2>&1 | grep bitrate | sed 's/.*bitrate: //g' | cut -f1 -d ' '", videoName);
-	in = popen(cmd, "r");
-        if (in != NULL) {
-                fgets(buffer, sizeof(buffer), in);
-                bitrate = atoi(buffer);
-                pclose(in);
-        }
-
-        return bitrate;
+// Bitrate in kbit/s kept with the seek index of the object, 0 if it cannot be found
+int StreamContent::getBitRate(HttpSession *httpSession) {
+	SeekIndexCache *seekIndexCache;
+	struct SeekIndexCacheData *seekIndexCacheData;
+	int indexType;
+	int bitrate;
+
+	indexType = SeekIndexCache::getIndexType(httpSession->videoName);
+	// Stat informations are only filled for objects of the disk cache
+	if ((! indexType) || (httpSession->videoNameFilePath == NULL) || (httpSession->sourceFileStat.st_size <= 0))
+		return 0;
+	seekIndexCache = cacheManager->getSeekIndexCache();
+	if (! seekIndexCache)
+		return SeekIndexCache::readBitRate(httpSession->videoNameFilePath, &httpSession->sourceFileStat, indexType);
+	seekIndexCacheData = seekIndexCache->acquire(httpSession->videoName, httpSession->videoNameFilePath, &httpSession->sourceFileStat, indexType);
+	if (! seekIndexCacheData)
+		return 0;
+	bitrate = SeekIndexCache::getBitRate(seekIndexCacheData);
+	seekIndexCache->release(seekIndexCacheData);
+
+	return bitrate;
 }
 
 int StreamContent::initialize(HttpSession *httpSession) {
@@ -360,6 +410,9 @@ int StreamContent::initialize(HttpSession *httpSession) {
 		return 0;
 	}
 	returnCode = cacheManager->initialize(httpSession);
+	// Answered from the negative cache, nothing more to do
+	if (returnCode == -3)
+		return 0;
 
 	// This is a proxyfied request so, dont treat it in kqueue/kevent model
 	// And send catalog multicast if needed
@@ -399,7 +452,7 @@ int StreamContent::initialize(HttpSession *httpSession) {
 			returnCode = catalogHashtableTimeout->add(hashPosition, hashtableElt);
 			if (returnCode < 0) {
 				catalogHashtable->remove(key);
-				free(catalogData);
+				catalogHashtable->freeData(catalogData);
 				catalogHashtable->unlock();
 				return 1;
 			}
@@ -408,11 +461,13 @@ int StreamContent::initialize(HttpSession *httpSession) {
 			buffer = new char[bufferLength+1];
 			if (! buffer) {
 				systemLog->sysLog(CRITICAL, "cannot allocate buffer object with %d bytes: %s", bufferLength+1, strerror(errno));
-				catalogHashtableTimeout->remove(hashtableElt);
 				catalogHashtable->lock();
-				catalogHashtable->remove(key);
+				if (catalogHashtable->search(hashPosition, hashtableElt)) {
+					catalogHashtableTimeout->remove(hashtableElt);
+					catalogHashtable->remove(hashPosition, hashtableElt);
+					catalogHashtable->freeData(catalogData);
+				}
 				catalogHashtable->unlock();
-				free(catalogData);
 				return 1;
 			}
 			snprintf(buffer, bufferLength+1, "%d\n%s\n%s", CATALOGADD, inet_ntoa(*((struct in_addr *)&catalogData->host)), key);
@@ -432,7 +487,7 @@ int StreamContent::initialize(HttpSession *httpSession) {
 
 	if (httpSession->shappingAuto == true) {
 		int bitrate;
-		bitrate = getBitRate(httpSession->videoNameFilePath);
+		bitrate = getBitRate(httpSession);
 		if (bitrate) {
 			systemLog->sysLog(INFO, "File '%s' requested, setting shapping to %d\n", httpSession->videoNameFilePath, bitrate);
 			httpSession->shapping = bitrate + 256;
@@ -449,23 +504,17 @@ int StreamContent::initialize(HttpSession *httpSession) {
 
 	if (configuration->shareCatalog == true) {
 		// count download number
-		catalogHashtable->lock();
+		catalogHashtable->enterRead();
 		hashtableElt = catalogHashtable->search(httpSession->videoName, &hashPosition);
 		if (hashtableElt) {
 			catalogData = (struct CatalogData *)hashtableElt->getData();
 			if (catalogData) {
-				catalogData->counter++;
-			}
-			// Remove and readd timeout
-			catalogHashtableTimeout->remove(hashtableElt);
-			returnCode = catalogHashtableTimeout->add(hashPosition, hashtableElt);
-			if (returnCode < 0) {
-				// XXXFIXME: destroy key from hashtable and remove cache object
-				catalogHashtable->unlock();
-				return -1;
+				__sync_fetch_and_add(&catalogData->counter, 1);
 			}
+			// Push the timeout back, the timer thread rearms itself at expiration
+			catalogHashtableTimeout->refresh(hashtableElt);
 		}
-		catalogHashtable->unlock();
+		catalogHashtable->exitRead();
 	}
 
 	return returnCode;
@@ -21,6 +21,11 @@
 #include "../src/configuration.h"
 #include "../toolkit/multicastservercatalog.h"
 
+// Query string arguments looked at, the last one gets the rest of the query string
+#define STREAMCONTENT_MAXARGUMENTS 32
+// A key used by a manifest or a segment stays valid this long after each of them, in ms
+#define STREAMCONTENT_PACKAGINGKEYTIMEOUT 60000
+
 /**
 	@author  <spe@>
 */
@@ -40,8 +45,8 @@ public:
 	StreamContent(Configuration *, HashTable *, KeyHashtableTimeout *, HashTable *, CatalogHashtableTimeout *, MulticastServerCatalog *, CacheManager *);
 	~StreamContent();
 
-	char *urlDecode(char *url, unsigned int urlLength);
-	int getBitRate(char *);
+	int urlDecode(char *url, unsigned int urlLength, char *decodedUrl, size_t decodedUrlSize);
+	int getBitRate(HttpSession *);
 	bool isDigitString(char *);
 	int extractFileName(HttpSession *);
 	CacheManager *getCacheManager(void) { return cacheManager; };
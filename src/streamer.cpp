@@ -21,6 +21,7 @@
 #include "../toolkit/hashtable.h"
 #include "../src/multicastpacketcatalog.h"
 #include "../toolkit/mystring.h"
+#include "../toolkit/seekindexcache.h"
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -43,6 +44,8 @@ char *stringType[] = { (char *)"", (char *)"PINT", (char *)"EXT", (char *)"VBINT
 
 Streamer::Streamer() {
 	catalogHashtableTimeout = NULL;
+	catalogEpochManager = NULL;
+	catalogPrefixIndex = NULL;
 
 	return;
 }
@@ -87,8 +90,15 @@ void Streamer::usage(char *processName) {
 	fprintf(stderr, "	--adminserver/-A	Enable administration server (default: Disabled)\n");
 	fprintf(stderr, "	--shapping/-S		Shapping in kbits/s (default: none)\n");
 	fprintf(stderr, "	--sharecatalog/-H	Enable distributed cache system via multicast (default: Disabled)\n");
+	fprintf(stderr, "	--catalogprefixindex/-I	Keep catalog paths in a radix tree for ordered and per directory dump/purge (default: Disabled)\n");
+	fprintf(stderr, "	--hashalgorithm/-X	Hash function of the key and catalog hashtables: paulhsieh, wyhash or xxhash32 (default: paulhsieh)\n");
 	fprintf(stderr, "	--workerthreads/-w	Number of worker thread that takes events on the pool (default: 2)\n");
 	fprintf(stderr, "	--cachetimeout/-a	Timeout for objects in disk/memory cache in seconds (default: 86400s)\n");
+	fprintf(stderr, "	--negativecachetimeout/-T Time in seconds to remember objects missing on origin servers, 0 to disable (default: 30s)\n");
+	fprintf(stderr, "	--negativecachesize/-Q	Maximum number of objects remembered as missing on origin servers (default: 65536)\n");
+	fprintf(stderr, "	--descriptorcachesize/-F Maximum number of cached objects kept opened, 0 to disable (default: 4096)\n");
+	fprintf(stderr, "	--seekindexcachesize/-i	Memory in MB kept for parsed mp4 and flv indices used by time seeks, 0 to disable (default: 64)\n");
+	fprintf(stderr, "	--blockingworkers/-j	Number of threads preparing answers (disk, mp4 index) out of the event loop, 0 to disable (default: 4)\n");
 	fprintf(stderr, "	--burst/-B		Number of packets to burst in the beginning of the connection (default: 0)\n");
 	fprintf(stderr, "	--aeskey/-e		AES key (256 Bits) in hexadecimal format for decrypting relative URL\n");
 	fprintf(stderr,	"	--aesvhost/-v		AES Virtual Host name (used to detect if we must decrypt relative url with\n");
@@ -99,63 +109,56 @@ void Streamer::usage(char *processName) {
 	return;
 }
 
+// Lines are "key|host|counter", the buffer is split in place
 int Streamer::parseAndLoadCatalog(char *catalogBuffer) {
 	Parser *parser;
-	Parser *parser2;
 	char delimiter[2];
-	char delimiter2[2];
-	List<String *> *catalogEntriesList;
-	List<String *> *catalogArgumentsList;
+	struct ParserToken catalogArguments[4];
+	int numberOfArguments;
+	char *linePtr;
+	char *lineEnd;
 	struct CatalogData *catalogData;
 	char *key;
 	HashTableElt *hashtableElt;
 	uint32_t hashPosition;
 
-	delimiter[0] = '\n';
-        delimiter[1] = '\0';
-	delimiter2[0] = '|';
-	delimiter2[1] = '\0';
-        parser = new Parser(delimiter);
+	delimiter[0] = '|';
+	delimiter[1] = '\0';
+	parser = new Parser(delimiter);
 	if (! parser) {
 		systemLog->sysLog(CRITICAL, "cannot create a Parser object for loading catalog: %s", strerror(errno));
 		return -1;
 	}
-	parser2 = new Parser(delimiter2);
-	if (! parser2) {
-		systemLog->sysLog(CRITICAL, "cannot create a Parser object for loading catalog: %s", strerror(errno));
-		delete parser;
-		return -1;
-	}
-	catalogEntriesList = parser->tokenizeString(catalogBuffer, strlen(catalogBuffer));
-	if (! catalogEntriesList) {
-		delete parser;
-		delete parser2;
-		return -1;
-	}
-	while (catalogEntriesList->getListSize()) {
-		catalogArgumentsList = parser2->tokenizeString(catalogEntriesList->getFirstElement()->bloc, strlen(catalogEntriesList->getFirstElement()->bloc));
-		catalogData = (struct CatalogData *)malloc(sizeof(struct CatalogData));
-		key = (char *)malloc(strlen(catalogArgumentsList->getFirstElement()->bloc+1));
-		strcpy(key, catalogArgumentsList->getFirstElement()->bloc);
-		catalogArgumentsList->removeFirst();
-		catalogData->host = inet_addr(catalogArgumentsList->getFirstElement()->bloc);
-		catalogArgumentsList->removeFirst();
-		catalogData->counter = atoi(catalogArgumentsList->getFirstElement()->bloc);
-		catalogArgumentsList->removeFirst();
-		if (strstr(key, ".flv") || strstr(key, ".mp4")) {
+	linePtr = catalogBuffer;
+	while (*linePtr) {
+		lineEnd = strchr(linePtr, '\n');
+		if (lineEnd)
+			*lineEnd = '\0';
+		numberOfArguments = parser->splitString(linePtr, catalogArguments, 4);
+		key = (numberOfArguments == 3) ? catalogArguments[0].bloc : NULL;
+		if (key && (strstr(key, ".flv") || strstr(key, ".mp4"))) {
+			catalogData = (struct CatalogData *)malloc(sizeof(struct CatalogData));
+			if (! catalogData) {
+				systemLog->sysLog(CRITICAL, "cannot allocate a CatalogData object: %s", strerror(errno));
+				delete parser;
+				return -1;
+			}
+			catalogData->host = inet_addr(catalogArguments[1].bloc);
+			catalogData->counter = atoi(catalogArguments[2].bloc);
 			catalogHashtable->lock();
 			hashtableElt = catalogHashtable->add(key, catalogData, &hashPosition);
-			if (! hashtableElt)
+			if (! hashtableElt) {
 				systemLog->sysLog(ERROR, "cannot add a redirect on the catalog hashtable");
+				free(catalogData);
+			}
 			catalogHashtable->unlock();
 		}
-		delete catalogArgumentsList;
-		catalogEntriesList->removeFirst();
+		if (! lineEnd)
+			break;
+		linePtr = lineEnd + 1;
 	}
 
-	delete catalogEntriesList;
 	delete parser;
-	delete parser2;
 
 	return 0;
 }
@@ -354,7 +357,8 @@ int Streamer::loadExistingDiskCache(char *directory) {
 			loadExistingDiskCache(absolutePath);
 			delete absolutePath;
 		}
-		if ((directoryEntry->d_type == DT_REG) && (strstr(directoryEntry->d_name, ".flv") || strstr(directoryEntry->d_name, ".mp4"))) {
+		// Seek index sidecars go with their object, they are not objects themselves
+		if ((directoryEntry->d_type == DT_REG) && SeekIndexCache::getIndexType(directoryEntry->d_name) && (! strstr(directoryEntry->d_name, SEEKINDEXCACHE_SIDECARSUFFIX))) {
 			len = strlen(directory)+strlen(directoryEntry->d_name)+2;
 			absolutePath = (char *)malloc(len);
 			if (! absolutePath) {
@@ -416,25 +420,26 @@ int Streamer::loadExistingDiskCache(char *directory) {
 				catalogHashtable->unlock();
 				return 1;
 			}
-			catalogHashtable->unlock();
 			printf("setting timeout for %s to %d seconds\n", fullPath, objectTimeout);
 			returnCode = catalogHashtableTimeout->add(hashPosition, hashtableElt, objectTimeout);
 			if (returnCode < 0) {
-				catalogHashtable->lock();
 				catalogHashtable->remove(key);
+				catalogHashtable->freeData(catalogData);
 				catalogHashtable->unlock();
-				free(catalogData);
 				return -1;
 			}
+			catalogHashtable->unlock();
 			bufferLength = 2+strlen(key)+1+strlen(inet_ntoa(*((struct in_addr *)&catalogData->host)));
 			buffer = new char[bufferLength+1];
 			if (! buffer) {
 				systemLog->sysLog(CRITICAL, "cannot allocate buffer object with %d bytes: %s", bufferLength+1, strerror(errno));
-				catalogHashtableTimeout->remove(hashtableElt);
 				catalogHashtable->lock();
-				catalogHashtable->remove(key);
+				if (catalogHashtable->search(hashPosition, hashtableElt)) {
+					catalogHashtableTimeout->remove(hashtableElt);
+					catalogHashtable->remove(hashPosition, hashtableElt);
+					catalogHashtable->freeData(catalogData);
+				}
 				catalogHashtable->unlock();
-				free(catalogData);
 				return -1;
 			}
 			snprintf(buffer, bufferLength+1, "%d\n%s\n%s", CATALOGADD, inet_ntoa(*((struct in_addr *)&catalogData->host)), key);
@@ -510,6 +515,11 @@ int Streamer::main(int argc, char **argv) {
 		{ "originserverurl",	required_argument,	NULL,	'o' },
 		{ "cachedir",		required_argument,	NULL,	'C' },
 		{ "cachetimeout",	required_argument,	NULL,	'a' },
+		{ "negativecachetimeout", required_argument,	NULL,	'T' },
+		{ "negativecachesize",	required_argument,	NULL,	'Q' },
+		{ "descriptorcachesize", required_argument,	NULL,	'F' },
+		{ "seekindexcachesize",	required_argument,	NULL,	'i' },
+		{ "blockingworkers",	required_argument,	NULL,	'j' },
 		{ "nocache",		no_argument,		NULL,	'n' },
 		{ "sendbuffer",		required_argument,	NULL,	's' },
 		{ "recvbuffer",		required_argument,	NULL,	'b' },
@@ -523,6 +533,8 @@ int Streamer::main(int argc, char **argv) {
 		{ "maxconnections",	required_argument,	NULL,	'm' },
 		{ "adminserver",	no_argument,		NULL,	'A' },
 		{ "sharecatalog",	no_argument,		NULL,	'H' },
+		{ "catalogprefixindex",	no_argument,		NULL,	'I' },
+		{ "hashalgorithm",	required_argument,	NULL,	'X' },
 		{ "proxyname",		required_argument,	NULL,	'x' },
 		{ "burst",		required_argument,	NULL,	'B' },
 		{ "aeskey",		required_argument,	NULL,	'e' },
@@ -532,7 +544,7 @@ int Streamer::main(int argc, char **argv) {
 		{ NULL,			0,			NULL,	0   }
 	};
 
-	while ((ch = getopt_long(argc, argv, "c:p:M:P:dku:g:r:o:O:nhs:b:l:f:R:W:m:Hx:w:a:B:e:v:N:D:U:", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "c:p:M:P:dku:g:r:o:O:nhs:b:l:f:R:W:m:HIX:x:w:a:T:Q:F:i:j:B:e:v:N:D:U:", longopts, NULL)) != -1) {
 		switch (ch) {
 			case 'a':
 				if (configurationFileNameSpecified == true) {
@@ -542,6 +554,41 @@ int Streamer::main(int argc, char **argv) {
 				configuration->cacheTimeout = atoi(optarg);
 				configuration->cacheTimeout *= 1000;
 				
+				break;
+			case 'T':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->negativeCacheTimeout = atoi(optarg);
+				break;
+			case 'Q':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->negativeCacheSize = atoi(optarg);
+				break;
+			case 'F':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->descriptorCacheSize = atoi(optarg);
+				break;
+			case 'i':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->seekIndexCacheSize = atoi(optarg);
+				break;
+			case 'j':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->blockingWorkers = atoi(optarg);
 				break;
 			case 'c':
 				if (optionsSetted == true) {
@@ -792,6 +839,24 @@ int Streamer::main(int argc, char **argv) {
 				}
 				configuration->shareCatalog = true;
 				break;
+			case 'I':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->catalogPrefixIndex = true;
+				break;
+			case 'X':
+				if (configurationFileNameSpecified == true) {
+					errorConfigurationFileAndOptions();
+					exit(EXIT_FAILURE);
+				}
+				configuration->hashAlgorithm = HashAlgorithm::getAlgorithmType(optarg);
+				if (! configuration->hashAlgorithm) {
+					usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'x':
 				if (configurationFileNameSpecified == true) {
 					errorConfigurationFileAndOptions();
@@ -891,13 +956,13 @@ int Streamer::main(int argc, char **argv) {
 	tzset();
 
 	// Create the control key hashtable
-	hashAlgorithm = new HashAlgorithm(ALGO_PAULHSIEH);
+	hashAlgorithm = new HashAlgorithm(configuration->hashAlgorithm);
 	if (! hashAlgorithm) {
 		systemLog->sysLog(CRITICAL, "cannot create an HashTableAlgorithm. Must exit...");
 		return -1;
 	}
-	// Pass the hastable to 0x40000 => sufficient
-	keyHashtable = new HashTable(hashAlgorithm, 0x3FFFF);
+	// Start with 0x40000 buckets, grows up to 0x1000000 with millions of keys
+	keyHashtable = new HashTable(hashAlgorithm, 0x3FFFF, 0xFFFFFF);
 	if (! keyHashtable) {
 		systemLog->sysLog(CRITICAL, "cannot create a HashTable object. Must exit...");
 		delete hashAlgorithm;
@@ -909,20 +974,35 @@ int Streamer::main(int argc, char **argv) {
 	if (configuration->shareCatalog) {
 		systemLog->sysLog(INFO, "creating catalog hashtable needed for storing cache objects");
 		// Create the control key hashtable
-		catalogHashAlgorithm = new HashAlgorithm(ALGO_PAULHSIEH);
+		catalogHashAlgorithm = new HashAlgorithm(configuration->hashAlgorithm);
 		if (! catalogHashAlgorithm) {
 			systemLog->sysLog(CRITICAL, "cannot create an HashTableAlgorithm. Must exit...");
 			return -1;
 		}
 	
 		// Catalog hashtable
-		catalogHashtable = new HashTable(hashAlgorithm, 0x3FFFF);
+		catalogHashtable = new HashTable(hashAlgorithm, 0x3FFFF, 0xFFFFFF);
 		if (! catalogHashtable) {
 			systemLog->sysLog(CRITICAL, "cannot create a HashTable object. Must exit...");
 			delete hashAlgorithm;
 			delete keyHashtable;
 			return -1;
 		}
+		// Requests look the catalog up without lock
+		catalogEpochManager = new EpochManager();
+		if (! catalogEpochManager) {
+			systemLog->sysLog(CRITICAL, "cannot create an EpochManager object. Must exit...");
+			return -1;
+		}
+		catalogHashtable->setEpochManager(catalogEpochManager);
+		if (configuration->catalogPrefixIndex == true) {
+			catalogPrefixIndex = new RadixTree();
+			if (! catalogPrefixIndex) {
+				systemLog->sysLog(CRITICAL, "cannot create a RadixTree object. Must exit...");
+				return -1;
+			}
+			catalogHashtable->setPrefixIndex(catalogPrefixIndex);
+		}
 
 		systemLog->sysLog(INFO, "catalog hashtable is created successfully");
 		systemLog->sysLog(INFO, "creating multicast catalog server and timeout monitoring");
@@ -1027,7 +1107,7 @@ int Streamer::main(int argc, char **argv) {
 	}
 
 	// The infinite run loop treat all events on the socket
-	httpClientConnection = new HttpClientConnection(configuration);
+	httpClientConnection = new HttpClientConnection(configuration, cacheManager);
 	httpServer->createContext("*", httpClientConnection);
 	httpServer->setKqueueEvents();
 
@@ -1049,7 +1129,7 @@ int Streamer::main(int argc, char **argv) {
 	multicastServerThreads->createThread(NULL);
 	
 	if (configuration->administrationServerEnable == true) {
-		administrationServer = new AdministrationServer(configuration, catalogHashtable);
+		administrationServer = new AdministrationServer(configuration, catalogHashtable, catalogHashtableTimeout, multicastServerCatalog, cacheManager);
 		administrationServerThread = new Thread(administrationServer);
 		administrationServerThread->createThread(NULL);
 	}
@@ -37,6 +37,8 @@ private:
 	MulticastServerCatalog *multicastServerCatalog;
 	Thread *cacheFileThread;
 	HashTable *catalogHashtable;
+	EpochManager *catalogEpochManager;
+	RadixTree *catalogPrefixIndex;
 	List<MonitoredHost *> *serverList;
 	Configuration *configuration;
 	CatalogHashtableTimeout *catalogHashtableTimeout;
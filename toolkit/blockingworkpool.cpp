@@ -0,0 +1,120 @@
+//
+// C++ Implementation: blockingworkpool
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <string.h>
+
+#include "blockingworkpool.h"
+
+BlockingWorkPool::BlockingWorkPool(int _numberOfWorkers) {
+	numberOfWorkers = _numberOfWorkers;
+	pendingWorks = 0;
+	processedWorks = 0;
+	rejectedWorks = 0;
+	workerThreads = NULL;
+	workList = new List<BlockingWork *>();
+	if (! workList) {
+		systemLog->sysLog(CRITICAL, "cannot create a List object: %s", strerror(errno));
+		return;
+	}
+	// Works are deleted by the worker after processing
+	workList->setDestroyData(0);
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object: %s", strerror(errno));
+		return;
+	}
+	semaphore = new Semaphore();
+	if (! semaphore) {
+		systemLog->sysLog(CRITICAL, "cannot create a Semaphore object: %s", strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+BlockingWorkPool::~BlockingWorkPool() {
+	if (workList)
+		delete workList;
+	if (mutex)
+		delete mutex;
+	if (semaphore)
+		delete semaphore;
+	if (workerThreads)
+		delete workerThreads;
+
+	return;
+}
+
+int BlockingWorkPool::startWorkers(void) {
+	int i;
+
+	workerThreads = new Thread(this);
+	if (! workerThreads) {
+		systemLog->sysLog(CRITICAL, "cannot create a Thread object: %s", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < numberOfWorkers; i++) {
+		if (workerThreads->createThread(NULL) < 0) {
+			systemLog->sysLog(CRITICAL, "cannot start blocking worker thread number %d", i);
+			return -1;
+		}
+	}
+	systemLog->sysLog(INFO, "%d blocking worker threads started", numberOfWorkers);
+
+	return 0;
+}
+
+// Queue a work, return -1 if the pool is saturated so that the caller runs it itself
+int BlockingWorkPool::submit(BlockingWork *blockingWork) {
+	mutex->lockMutex();
+	if (pendingWorks >= BLOCKINGWORKPOOL_MAXPENDING) {
+		rejectedWorks++;
+		mutex->unlockMutex();
+		return -1;
+	}
+	if (! workList->addElement(blockingWork)) {
+		mutex->unlockMutex();
+		systemLog->sysLog(ERROR, "cannot queue a blocking work");
+		return -1;
+	}
+	pendingWorks++;
+	mutex->unlockMutex();
+	semaphore->semaphorePost();
+
+	return 0;
+}
+
+void BlockingWorkPool::start(void *arguments) {
+	BlockingWork *blockingWork;
+
+	for (;;) {
+		semaphore->semaphoreWait();
+		mutex->lockMutex();
+		blockingWork = workList->getFirstElement();
+		if (blockingWork) {
+			workList->removeFirst();
+			pendingWorks--;
+		}
+		mutex->unlockMutex();
+		if (! blockingWork)
+			continue;
+
+		blockingWork->process();
+		delete blockingWork;
+
+		mutex->lockMutex();
+		processedWorks++;
+		mutex->unlockMutex();
+	}
+
+	return;
+}
@@ -0,0 +1,65 @@
+//
+// C++ Interface: blockingworkpool
+//
+// Description: pool of threads running blocking jobs (disk metadata, mp4
+// index parsing, external commands) away from the kqueue workers
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef BLOCKINGWORKPOOL_H
+#define BLOCKINGWORKPOOL_H
+
+#include <sys/types.h>
+
+#include "../toolkit/objectaction.h"
+#include "../toolkit/thread.h"
+#include "../toolkit/list.h"
+#include "../toolkit/mutex.h"
+#include "../toolkit/semaphore.h"
+
+#define BLOCKINGWORKPOOL_MAXPENDING 4096
+
+/**
+	@author  <spe@>
+*/
+class BlockingWork {
+public:
+	BlockingWork() { };
+	virtual ~BlockingWork() { };
+
+	// Executed on a pool thread, the object is deleted just after
+	virtual void process(void) { };
+};
+
+/**
+	@author  <spe@>
+*/
+class BlockingWorkPool : public ObjectAction {
+private:
+	List<BlockingWork *> *workList;
+	Mutex *mutex;
+	Semaphore *semaphore;
+	Thread *workerThreads;
+	int numberOfWorkers;
+	int pendingWorks;
+	uint64_t processedWorks;
+	uint64_t rejectedWorks;
+
+public:
+	BlockingWorkPool(int);
+	~BlockingWorkPool();
+
+	int startWorkers(void);
+	int submit(BlockingWork *);
+	virtual void start(void *);
+	int getNumberOfWorkers(void) { return numberOfWorkers; };
+	int getPendingWorks(void) { return pendingWorks; };
+	uint64_t getProcessedWorks(void) { return processedWorks; };
+	uint64_t getRejectedWorks(void) { return rejectedWorks; };
+};
+
+#endif
@@ -15,11 +15,28 @@
 
 CacheDisk::CacheDisk(Configuration *_configuration) {
 	configuration = _configuration;
+	descriptorCache = NULL;
+	if (configuration->descriptorCacheSize > 0) {
+		descriptorCache = new DescriptorCache(configuration->descriptorCacheSize);
+		if (! descriptorCache)
+			systemLog->sysLog(ERROR, "cannot create a DescriptorCache object: %s", strerror(errno));
+	}
+	seekIndexCache = NULL;
+	if (configuration->seekIndexCacheSize > 0) {
+		seekIndexCache = new SeekIndexCache((size_t)configuration->seekIndexCacheSize * 1024 * 1024);
+		if (! seekIndexCache)
+			systemLog->sysLog(ERROR, "cannot create a SeekIndexCache object: %s", strerror(errno));
+	}
 
 	return;
 }
 
 CacheDisk::~CacheDisk() {
+	if (descriptorCache)
+		delete descriptorCache;
+	if (seekIndexCache)
+		delete seekIndexCache;
+
 	return;
 }
 
@@ -35,6 +52,20 @@ int CacheDisk::initialize(HttpSession *httpSession) {
 	// XXX boundary checking !
 	strcpy(httpSession->videoNameFilePath, configuration->cacheDirectory);
 	strcat(httpSession->videoNameFilePath, httpSession->videoName);
+
+	// Hot object, descriptor and stat informations are already there
+	if (descriptorCache) {
+		descriptor = descriptorCache->acquire(httpSession->videoName, &httpSession->sourceFileStat);
+		if (descriptor > 0) {
+			httpSession->httpExchange->descriptorCache = descriptorCache;
+			httpSession->fileSize = httpSession->sourceFileStat.st_size;
+			httpSession->httpExchange->setInputOffset(httpSession->seekPosition);
+			httpSession->httpExchange->inputDescriptor = descriptor;
+			httpSession->httpExchange->setMediaType(1);
+
+			return 0;
+		}
+	}
 #ifdef DEBUGOUTPUT
 	fprintf(stderr, "[DEBUG] lstat on %s\n", httpSession->videoNameFilePath);
 #endif
@@ -73,16 +104,11 @@ int CacheDisk::initialize(HttpSession *httpSession) {
 		systemLog->sysLog(ERROR, "[%d] (%d) cannot open file '%s': %s", httpSession->httpExchange->outputDescriptor, descriptor, httpSession->videoNameFilePath, strerror(errno));
 		return -2;
 	}
+	if (descriptorCache && (descriptorCache->add(httpSession->videoName, descriptor, &httpSession->sourceFileStat) == 0))
+		httpSession->httpExchange->descriptorCache = descriptorCache;
 	
-	// XXX Must clean that
-	if (httpSession->seekPosition) {
-		returnCode = lseek(descriptor, httpSession->seekPosition, SEEK_SET);
-		if (returnCode < 0) {
-			systemLog->sysLog(ERROR, "cannot seek at %d for the file %s: %s", httpSession->seekPosition, httpSession->videoNameFilePath);
-		}
-		else
-			httpSession->httpExchange->setInputOffset(httpSession->seekPosition);
-	}
+	// Descriptors can be shared between sessions, reads are done at inputOffset with pread()
+	httpSession->httpExchange->setInputOffset(httpSession->seekPosition);
 
 	httpSession->httpExchange->inputDescriptor = descriptor;
 	httpSession->httpExchange->setMediaType(1);
@@ -102,9 +128,11 @@ ssize_t CacheDisk::get(HttpSession *httpSession, char *buffer, int bufferSize) {
 		return -1;
 	}
 
-	bytesRead = read(httpSession->httpExchange->inputDescriptor, buffer, bufferSize);
-	if (bytesRead < 0)
+	bytesRead = pread(httpSession->httpExchange->inputDescriptor, buffer, bufferSize, httpSession->httpExchange->inputOffset);
+	if (bytesRead < 0) {
 		systemLog->sysLog(ERROR, "cannot read the descriptor of the session: %s", strerror(errno));
+		return bytesRead;
+	}
 
 	httpSession->httpExchange->inputOffset += bytesRead;
 
@@ -141,7 +169,19 @@ int CacheDisk::remove(char *relativePath) {
 	systemLog->sysLog(DEBUG, "trying to delete #%s# file from disk", absolutePath);
 #endif
 	returnCode = unlink(absolutePath);
+	SeekIndexCache::removeSidecar(absolutePath);
 	delete absolutePath;
+	invalidate(relativePath);
 
 	return returnCode;
 }
+
+// Object is removed or replaced on disk, forget its cached descriptor and mp4 index
+void CacheDisk::invalidate(char *relativePath) {
+	if (descriptorCache)
+		descriptorCache->invalidate(relativePath);
+	if (seekIndexCache)
+		seekIndexCache->invalidate(relativePath);
+
+	return;
+}
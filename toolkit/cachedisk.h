@@ -14,6 +14,8 @@
 
 #include "../toolkit/httpsession.h"
 #include "../toolkit/cacheobject.h"
+#include "../toolkit/descriptorcache.h"
+#include "../toolkit/seekindexcache.h"
 #include "../src/configuration.h"
 
 /**
@@ -22,6 +24,8 @@
 class CacheDisk : public CacheObject {
 private:
 	Configuration *configuration;
+	DescriptorCache *descriptorCache;
+	SeekIndexCache *seekIndexCache;
 
 public:
 	CacheDisk(Configuration *);
@@ -31,6 +35,9 @@ public:
 	ssize_t get(HttpSession *, char *, int);
 	ssize_t put(HttpSession *, char *, int);
 	int remove(char *);
+	void invalidate(char *);
+	DescriptorCache *getDescriptorCache(void) { return descriptorCache; };
+	SeekIndexCache *getSeekIndexCache(void) { return seekIndexCache; };
 };
 
 #endif
@@ -19,6 +19,12 @@ CacheManager::CacheManager(Configuration *_configuration) {
 	configuration = _configuration;
 	//cacheMemory = new CacheMemory();
 	cacheDisk = new CacheDisk(configuration);
+	negativeCache = NULL;
+	if (configuration->negativeCacheTimeout) {
+		negativeCache = new NegativeCache(configuration->negativeCacheTimeout, configuration->negativeCacheSize);
+		if (! negativeCache)
+			systemLog->sysLog(ERROR, "cannot create a NegativeCache object: %s", strerror(errno));
+	}
 
 	return;
 }
@@ -26,6 +32,8 @@ CacheManager::CacheManager(Configuration *_configuration) {
 CacheManager::~CacheManager() {
 	//delete cacheMemory;
 	delete cacheDisk;
+	if (negativeCache)
+		delete negativeCache;
 
 	return;
 }
@@ -39,6 +47,18 @@ int CacheManager::initialize(HttpSession *httpSession) {
 	//DiskToMemory *diskToMemory;
 	int returnCode;
 	HttpSession *httpSessionCopy;
+	int negativeHttpCode;
+
+	// Object is known to be missing on origin servers, don't touch the disk nor the origins
+	if ((configuration->noCache == false) && negativeCache) {
+		negativeHttpCode = negativeCache->search(httpSession->videoName);
+		if (negativeHttpCode) {
+			systemLog->sysLog(INFO, "[%d] File '%s' is in negative cache (%d)", httpSession->httpExchange->outputDescriptor, httpSession->videoName, negativeHttpCode);
+			httpSession->httpCode = (negativeHttpCode == 404) ? 404 : 500;
+			httpSession->noDataToSend = true;
+			return -3;
+		}
+	}
 
 	returnCode = cacheDisk->initialize(httpSession);
 	if (httpSession->initialized == false) {
@@ -72,8 +92,21 @@ int CacheManager::initialize(HttpSession *httpSession) {
 				returnCode = -2;
 			}
 		}
+		// Plain GET of the whole object: the origin answer is the cached object, fetch it once
+		if ((returnCode == -1) && (httpSession->httpRequestType == 1) && (httpSession->byteRange.start == -1) && (! strchr(httpSession->httpRequest, '?'))) {
+			httpConnectionCache = new HttpConnection(cacheDisk, negativeCache, configuration);
+			if (! httpConnectionCache) {
+				systemLog->sysLog(ERROR, "cannot create a HttpConnection object: %s", strerror(errno));
+				return -1;
+			}
+			httpConnectionCache->setRelayMode(true);
+			httpConnectionCacheThread = new Thread(httpConnectionCache);
+			httpConnectionCacheThread->createThread(httpSession);
+
+			return 1;
+		}
 		if (returnCode == -1) {
-			httpConnectionCache = new HttpConnection(cacheDisk, configuration);
+			httpConnectionCache = new HttpConnection(cacheDisk, negativeCache, configuration);
 			if (! httpConnectionCache) {
 				systemLog->sysLog(ERROR, "cannot create a HttpConnection object: %s", strerror(errno));
 				return -1;
@@ -84,7 +117,7 @@ int CacheManager::initialize(HttpSession *httpSession) {
 			httpConnectionCacheThread->createThread(httpSessionCopy);
 			httpSession->httpExchange->inputDescriptor = 0;
 		}
-		httpConnectionProxy = new HttpConnection(NULL, configuration);
+		httpConnectionProxy = new HttpConnection(NULL, negativeCache, configuration);
 		if (! httpConnectionProxy) {
 			systemLog->sysLog(ERROR, "cannot create a HttpConnection object: %s", strerror(errno));
 			return -1;
@@ -15,6 +15,7 @@
 #include "../toolkit/httpsession.h"
 #include "../toolkit/cachedisk.h"
 #include "../toolkit/cachememory.h"
+#include "../toolkit/negativecache.h"
 #include "../src/configuration.h"
 
 /**
@@ -24,6 +25,7 @@ class CacheManager {
 private:
 	Configuration *configuration;
 	CacheDisk *cacheDisk;
+	NegativeCache *negativeCache;
 	//CacheMemory *cacheMemory;
 
 public:
@@ -33,6 +35,9 @@ public:
 	int initialize(HttpSession *);
 	ssize_t get(HttpSession *, char *, int);
 	int remove(char *);
+	NegativeCache *getNegativeCache(void) { return negativeCache; };
+	DescriptorCache *getDescriptorCache(void) { return cacheDisk->getDescriptorCache(); };
+	SeekIndexCache *getSeekIndexCache(void) { return cacheDisk->getSeekIndexCache(); };
 };
 
 #endif
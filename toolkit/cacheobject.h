@@ -26,6 +26,7 @@ public:
 	virtual ssize_t get(HttpSession *, char *, int) { return -1; };
 	virtual ssize_t put(HttpSession *, char *, int) { return -1; };
 	virtual int remove(HttpSession *, char *) { return -1; };
+	virtual void invalidate(char *) { return; };
 };
 
 #endif
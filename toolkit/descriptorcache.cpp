@@ -0,0 +1,236 @@
+//
+// C++ Implementation: descriptorcache
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "descriptorcache.h"
+
+DescriptorCache::DescriptorCache(int _maxDescriptors) {
+	maxDescriptors = _maxDescriptors;
+	openDescriptors = 0;
+	idleDescriptors = 0;
+	hits = 0;
+	misses = 0;
+	idleHead = NULL;
+	idleTail = NULL;
+	descriptorIndex = (struct DescriptorCacheData **)calloc(DESCRIPTORCACHE_MAXDESCRIPTOR, sizeof(struct DescriptorCacheData *));
+	if (! descriptorIndex) {
+		systemLog->sysLog(CRITICAL, "cannot allocate descriptorIndex: %s", strerror(errno));
+		return;
+	}
+	hashAlgorithm = new HashAlgorithm(ALGO_PAULHSIEH);
+	if (! hashAlgorithm) {
+		systemLog->sysLog(CRITICAL, "cannot create an HashAlgorithm object: %s", strerror(errno));
+		return;
+	}
+	hashTable = new HashTable(hashAlgorithm, 0xFFFF);
+	if (! hashTable) {
+		systemLog->sysLog(CRITICAL, "cannot create a HashTable object: %s", strerror(errno));
+		return;
+	}
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object: %s", strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+DescriptorCache::~DescriptorCache() {
+	int i;
+
+	for (i = 0; i < DESCRIPTORCACHE_MAXDESCRIPTOR; i++) {
+		if (descriptorIndex[i]) {
+			close(descriptorIndex[i]->descriptor);
+			free(descriptorIndex[i]);
+		}
+	}
+	free(descriptorIndex);
+	if (hashTable)
+		delete hashTable;
+	if (hashAlgorithm)
+		delete hashAlgorithm;
+	if (mutex)
+		delete mutex;
+
+	return;
+}
+
+// All private methods must be called with the mutex locked
+void DescriptorCache::idleUnlink(struct DescriptorCacheData *descriptorCacheData) {
+	if (descriptorCacheData->idlePrevious)
+		descriptorCacheData->idlePrevious->idleNext = descriptorCacheData->idleNext;
+	else
+		idleHead = descriptorCacheData->idleNext;
+	if (descriptorCacheData->idleNext)
+		descriptorCacheData->idleNext->idlePrevious = descriptorCacheData->idlePrevious;
+	else
+		idleTail = descriptorCacheData->idlePrevious;
+	descriptorCacheData->idlePrevious = NULL;
+	descriptorCacheData->idleNext = NULL;
+	idleDescriptors--;
+
+	return;
+}
+
+void DescriptorCache::idlePush(struct DescriptorCacheData *descriptorCacheData) {
+	descriptorCacheData->idlePrevious = NULL;
+	descriptorCacheData->idleNext = idleHead;
+	if (idleHead)
+		idleHead->idlePrevious = descriptorCacheData;
+	else
+		idleTail = descriptorCacheData;
+	idleHead = descriptorCacheData;
+	idleDescriptors++;
+
+	return;
+}
+
+void DescriptorCache::destroyData(struct DescriptorCacheData *descriptorCacheData) {
+	if (descriptorCacheData->hashtableElt)
+		hashTable->remove(descriptorCacheData->hashPosition, descriptorCacheData->hashtableElt);
+	descriptorIndex[descriptorCacheData->descriptor] = NULL;
+	close(descriptorCacheData->descriptor);
+	free(descriptorCacheData);
+	openDescriptors--;
+
+	return;
+}
+
+// Return a shared descriptor for this object and fill the stat structure, -1 if the object is not cached
+int DescriptorCache::acquire(char *key, struct stat *fileStat) {
+	HashTableElt *hashtableElt;
+	struct DescriptorCacheData *descriptorCacheData;
+	int descriptor = -1;
+
+	mutex->lockMutex();
+	hashtableElt = hashTable->search(key);
+	if (hashtableElt) {
+		descriptorCacheData = (struct DescriptorCacheData *)hashtableElt->getData();
+		if (! descriptorCacheData->referenceCounter)
+			idleUnlink(descriptorCacheData);
+		descriptorCacheData->referenceCounter++;
+		memcpy(fileStat, &descriptorCacheData->fileStat, sizeof(struct stat));
+		descriptor = descriptorCacheData->descriptor;
+		hits++;
+	}
+	else
+		misses++;
+	mutex->unlockMutex();
+
+	return descriptor;
+}
+
+// Share a freshly opened descriptor, the caller keeps one reference on it
+// Return -1 if the descriptor cannot be cached, the caller must close it itself
+int DescriptorCache::add(char *key, int descriptor, struct stat *fileStat) {
+	struct DescriptorCacheData *descriptorCacheData;
+	HashTableElt *hashtableElt;
+	uint32_t hashPosition;
+
+	if ((descriptor <= 0) || (descriptor >= DESCRIPTORCACHE_MAXDESCRIPTOR))
+		return -1;
+
+	mutex->lockMutex();
+	// Another session may have opened the same object meanwhile
+	if (hashTable->search(key)) {
+		mutex->unlockMutex();
+		return -1;
+	}
+	if (openDescriptors >= maxDescriptors) {
+		if (! idleTail) {
+			mutex->unlockMutex();
+			return -1;
+		}
+		descriptorCacheData = idleTail;
+		idleUnlink(descriptorCacheData);
+		destroyData(descriptorCacheData);
+	}
+	descriptorCacheData = (struct DescriptorCacheData *)malloc(sizeof(struct DescriptorCacheData));
+	if (! descriptorCacheData) {
+		mutex->unlockMutex();
+		systemLog->sysLog(CRITICAL, "cannot allocate a DescriptorCacheData object: %s", strerror(errno));
+		return -1;
+	}
+	hashtableElt = hashTable->add(key, descriptorCacheData, &hashPosition);
+	if (! hashtableElt) {
+		mutex->unlockMutex();
+		free(descriptorCacheData);
+		return -1;
+	}
+	descriptorCacheData->hashtableElt = hashtableElt;
+	descriptorCacheData->hashPosition = hashPosition;
+	descriptorCacheData->descriptor = descriptor;
+	memcpy(&descriptorCacheData->fileStat, fileStat, sizeof(struct stat));
+	descriptorCacheData->referenceCounter = 1;
+	descriptorCacheData->invalidated = false;
+	descriptorCacheData->idlePrevious = NULL;
+	descriptorCacheData->idleNext = NULL;
+	descriptorIndex[descriptor] = descriptorCacheData;
+	openDescriptors++;
+	mutex->unlockMutex();
+
+	return 0;
+}
+
+// Release one reference, return -1 if the descriptor doesn't belong to the cache
+int DescriptorCache::release(int descriptor) {
+	struct DescriptorCacheData *descriptorCacheData;
+
+	if ((descriptor <= 0) || (descriptor >= DESCRIPTORCACHE_MAXDESCRIPTOR))
+		return -1;
+
+	mutex->lockMutex();
+	descriptorCacheData = descriptorIndex[descriptor];
+	if (! descriptorCacheData) {
+		mutex->unlockMutex();
+		return -1;
+	}
+	descriptorCacheData->referenceCounter--;
+	if (! descriptorCacheData->referenceCounter) {
+		if (descriptorCacheData->invalidated == true)
+			destroyData(descriptorCacheData);
+		else
+			idlePush(descriptorCacheData);
+	}
+	mutex->unlockMutex();
+
+	return 0;
+}
+
+// Object is removed or replaced on disk, the descriptor is closed when the last session releases it
+int DescriptorCache::invalidate(char *key) {
+	HashTableElt *hashtableElt;
+	struct DescriptorCacheData *descriptorCacheData;
+
+	mutex->lockMutex();
+	hashtableElt = hashTable->search(key);
+	if (! hashtableElt) {
+		mutex->unlockMutex();
+		return -1;
+	}
+	descriptorCacheData = (struct DescriptorCacheData *)hashtableElt->getData();
+	if (! descriptorCacheData->referenceCounter) {
+		idleUnlink(descriptorCacheData);
+		destroyData(descriptorCacheData);
+	}
+	else {
+		hashTable->remove(descriptorCacheData->hashPosition, descriptorCacheData->hashtableElt);
+		descriptorCacheData->hashtableElt = NULL;
+		descriptorCacheData->invalidated = true;
+	}
+	mutex->unlockMutex();
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+//
+// C++ Interface: descriptorcache
+//
+// Description: keep descriptors and stat informations of hot cached objects
+// opened, shared between sessions with a reference counter
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef DESCRIPTORCACHE_H
+#define DESCRIPTORCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../toolkit/hashtable.h"
+#include "../toolkit/hashalgorithm.h"
+#include "../toolkit/mutex.h"
+
+#define DESCRIPTORCACHE_MAXDESCRIPTOR 65536
+
+struct DescriptorCacheData {
+	HashTableElt *hashtableElt;
+	uint32_t hashPosition;
+	int descriptor;
+	struct stat fileStat;
+	int referenceCounter;
+	bool invalidated;
+	// LRU list of unused descriptors
+	struct DescriptorCacheData *idlePrevious;
+	struct DescriptorCacheData *idleNext;
+};
+
+/**
+	@author  <spe@>
+*/
+class DescriptorCache {
+private:
+	HashAlgorithm *hashAlgorithm;
+	HashTable *hashTable;
+	Mutex *mutex;
+	struct DescriptorCacheData **descriptorIndex;
+	struct DescriptorCacheData *idleHead;
+	struct DescriptorCacheData *idleTail;
+	int maxDescriptors;
+	int openDescriptors;
+	int idleDescriptors;
+	uint64_t hits;
+	uint64_t misses;
+
+	void idleUnlink(struct DescriptorCacheData *);
+	void idlePush(struct DescriptorCacheData *);
+	void destroyData(struct DescriptorCacheData *);
+
+public:
+	DescriptorCache(int);
+	~DescriptorCache();
+
+	int acquire(char *, struct stat *);
+	int add(char *, int, struct stat *);
+	int release(int);
+	int invalidate(char *);
+	uint64_t getHits(void) { return hits; };
+	uint64_t getMisses(void) { return misses; };
+	int getOpenDescriptors(void) { return openDescriptors; };
+	int getUsedDescriptors(void) { return openDescriptors - idleDescriptors; };
+	int getMaxDescriptors(void) { return maxDescriptors; };
+};
+
+#endif
@@ -0,0 +1,160 @@
+//
+// C++ Implementation: epochmanager
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epochmanager.h"
+
+EpochManager::EpochManager() {
+	int i;
+
+	globalEpoch = 1;
+	numberOfThreads = 0;
+	overflowReaders = 0;
+	retiredList = NULL;
+	numberOfRetired = 0;
+	numberOfReclaimed = 0;
+	for (i = 0; i < EPOCHMANAGER_MAXTHREADS; i++)
+		threadEpochs[i] = 0;
+	if (pthread_key_create(&threadKey, NULL))
+		systemLog->sysLog(CRITICAL, "cannot create a thread key for EpochManager object: %s", strerror(errno));
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object: %s", strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+EpochManager::~EpochManager() {
+	struct EpochRetired *epochRetired;
+
+	while (retiredList) {
+		epochRetired = retiredList;
+		retiredList = retiredList->next;
+		epochRetired->destroyFunction(epochRetired->pointer);
+		free(epochRetired);
+	}
+	pthread_key_delete(threadKey);
+	if (mutex)
+		delete mutex;
+
+	return;
+}
+
+// Slot of the calling thread, allocated on its first read section, -1 if there is no more slot
+int EpochManager::getThreadSlot(void) {
+	intptr_t slot;
+
+	slot = (intptr_t)pthread_getspecific(threadKey);
+	if (slot)
+		return slot - 1;
+	if (numberOfThreads >= EPOCHMANAGER_MAXTHREADS)
+		return -1;
+	slot = __sync_fetch_and_add(&numberOfThreads, 1);
+	if (slot >= EPOCHMANAGER_MAXTHREADS) {
+		systemLog->sysLog(WARNING, "more than %d reader threads, readers without slot delay reclamation", EPOCHMANAGER_MAXTHREADS);
+		return -1;
+	}
+	pthread_setspecific(threadKey, (void *)(slot + 1));
+
+	return slot;
+}
+
+void EpochManager::enter(void) {
+	int slot;
+
+	slot = getThreadSlot();
+	if (slot < 0)
+		__sync_fetch_and_add(&overflowReaders, 1);
+	else
+		threadEpochs[slot] = globalEpoch;
+	// Publish the epoch before reading any shared pointer
+	__sync_synchronize();
+
+	return;
+}
+
+void EpochManager::exit(void) {
+	int slot;
+
+	__sync_synchronize();
+	slot = getThreadSlot();
+	if (slot < 0)
+		__sync_fetch_and_sub(&overflowReaders, 1);
+	else
+		threadEpochs[slot] = 0;
+
+	return;
+}
+
+// The object must be unreachable for new readers, destroyFunction is called when old readers are gone
+int EpochManager::retire(void *pointer, void (*destroyFunction)(void *)) {
+	struct EpochRetired *epochRetired;
+
+	epochRetired = (struct EpochRetired *)malloc(sizeof(struct EpochRetired));
+	if (! epochRetired) {
+		systemLog->sysLog(CRITICAL, "cannot allocate an EpochRetired object, object is leaked: %s", strerror(errno));
+		return -1;
+	}
+	epochRetired->pointer = pointer;
+	epochRetired->destroyFunction = destroyFunction;
+
+	mutex->lockMutex();
+	epochRetired->epoch = globalEpoch;
+	epochRetired->next = retiredList;
+	retiredList = epochRetired;
+	numberOfRetired++;
+	if (numberOfRetired >= EPOCHMANAGER_RECLAIMTHRESHOLD) {
+		// New readers can't reach the retired objects anymore
+		__sync_fetch_and_add(&globalEpoch, 1);
+		reclaim();
+	}
+	mutex->unlockMutex();
+
+	return 0;
+}
+
+// Must be called with the mutex locked
+void EpochManager::reclaim(void) {
+	struct EpochRetired *epochRetired;
+	struct EpochRetired **epochRetiredPrevious;
+	uint64_t minimumEpoch = ~0ULL;
+	uint64_t threadEpoch;
+	int i;
+
+	__sync_synchronize();
+	if (overflowReaders)
+		return;
+	for (i = 0; (i < numberOfThreads) && (i < EPOCHMANAGER_MAXTHREADS); i++) {
+		threadEpoch = threadEpochs[i];
+		if (threadEpoch && (threadEpoch < minimumEpoch))
+			minimumEpoch = threadEpoch;
+	}
+
+	epochRetiredPrevious = &retiredList;
+	while ((epochRetired = *epochRetiredPrevious)) {
+		if (epochRetired->epoch < minimumEpoch) {
+			*epochRetiredPrevious = epochRetired->next;
+			epochRetired->destroyFunction(epochRetired->pointer);
+			free(epochRetired);
+			numberOfRetired--;
+			numberOfReclaimed++;
+		}
+		else
+			epochRetiredPrevious = &epochRetired->next;
+	}
+
+	return;
+}
@@ -0,0 +1,62 @@
+//
+// C++ Interface: epochmanager
+//
+// Description: epoch based reclamation, readers walk shared structures
+// without lock and removed objects are freed once no reader can see them
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "../toolkit/mutex.h"
+
+#define EPOCHMANAGER_MAXTHREADS 256
+#define EPOCHMANAGER_RECLAIMTHRESHOLD 64
+
+struct EpochRetired {
+	void *pointer;
+	void (*destroyFunction)(void *);
+	uint64_t epoch;
+	struct EpochRetired *next;
+};
+
+/**
+	@author  <spe@>
+*/
+class EpochManager {
+private:
+	volatile uint64_t globalEpoch;
+	// Epoch seen by each reader thread when it entered, 0 outside of a read section
+	volatile uint64_t threadEpochs[EPOCHMANAGER_MAXTHREADS];
+	volatile int numberOfThreads;
+	// Readers without a slot block every reclaim while they are inside
+	volatile int overflowReaders;
+	pthread_key_t threadKey;
+	Mutex *mutex;
+	struct EpochRetired *retiredList;
+	int numberOfRetired;
+	uint64_t numberOfReclaimed;
+
+	int getThreadSlot(void);
+	void reclaim(void);
+
+public:
+	EpochManager();
+	~EpochManager();
+
+	void enter(void);
+	void exit(void);
+	int retire(void *, void (*)(void *));
+	int getNumberOfRetired(void) { return numberOfRetired; };
+	uint64_t getNumberOfReclaimed(void) { return numberOfReclaimed; };
+};
+
+#endif
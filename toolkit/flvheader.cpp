@@ -12,38 +12,42 @@
 
 #include <unistd.h>
 #include <errno.h>
-#include <netinet/in.h>
+#include <string.h>
 
 #include "flvheader.h"
 
-FlvHeader::FlvHeader(char *_mmapedFile, int *_filePosition) {
+FlvHeader::FlvHeader(char *_mmapedFile, off_t *_filePosition, off_t _fileSize) {
 	mmapedFile = _mmapedFile;
 	filePosition = _filePosition;
+	fileSize = _fileSize;
 	bzero(signature, sizeof(signature));
-	// XXX check the return of memcpy
+	version = 0;
+	flags = 0;
+	offset = 0;
 }
 
 FlvHeader::~FlvHeader() {
 }
 
+// Return -1 if the file doesn't start with a FLV header
 int FlvHeader::process(void) {
-	char *charPtr;
+	unsigned char *charPtr;
 
-	printf("filePosition is %d\n", *filePosition);
-	charPtr = (char *)&mmapedFile[*filePosition];
+	if (*filePosition + FLVHEADER_SIZE > fileSize)
+		return -1;
+	charPtr = (unsigned char *)&mmapedFile[*filePosition];
+	memcpy(header, charPtr, sizeof(header));
 	signature[0] = charPtr[0];
 	signature[1] = charPtr[1];
 	signature[2] = charPtr[2];
 	signature[3] = 0;
-	(*filePosition) += 3;
-	version = mmapedFile[*filePosition];
-	(*filePosition)++;
-	flags = mmapedFile[*filePosition];
-	(*filePosition)++;
-	offset = *((unsigned int *)&mmapedFile[*filePosition]);
-	(*filePosition) += sizeof(offset);
-	// Big Endian to Little Endian conversion
-	offset = ntohl(offset);
+	version = charPtr[3];
+	flags = charPtr[4];
+	// Big Endian
+	offset = ((unsigned int)charPtr[5] << 24) | ((unsigned int)charPtr[6] << 16) | ((unsigned int)charPtr[7] << 8) | charPtr[8];
+	if (memcmp(signature, "FLV", 3) || (offset < FLVHEADER_SIZE) || ((off_t)offset > fileSize))
+		return -1;
+	(*filePosition) += FLVHEADER_SIZE;
 
 	return 0;
 }
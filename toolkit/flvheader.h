@@ -12,15 +12,21 @@
 #ifndef FLVHEADER_H
 #define FLVHEADER_H
 
+#include <sys/types.h>
+
 #include "log.h"
 
+// Signature, version, flags and offset
+#define FLVHEADER_SIZE 9
+
 /**
 	@author  <spe@>
 */
 class FlvHeader{
 private:
 	char *mmapedFile;
-	int *filePosition;
+	off_t *filePosition;
+	off_t fileSize;
 public:
 	char header[9];
 	unsigned char signature[4];
@@ -28,7 +34,7 @@ public:
 	unsigned char flags;
 	unsigned int offset;
 
-	FlvHeader(char *, int *);
+	FlvHeader(char *, off_t *, off_t);
 	~FlvHeader();
 
 	int process(void);
@@ -12,24 +12,53 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "flvparser.h"
 
-FlvParser::FlvParser(int _fileDescriptor) {
+// Sidecar file of an index: header, FLV header tags, timestamps and positions, 8 bytes aligned
+#define FLVPARSER_INDEXMAGIC 0x66696478
+#define FLVPARSER_INDEXVERSION 2
+#define FLVPARSER_ALIGN(size) (((size) + 7) & ~(uint64_t)7)
+
+struct FlvKeyFrameIndexFile {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numberOfKeyFrames;
+	uint32_t headerSize;
+	uint32_t bitRate;
+	uint32_t reserved;
+	// Version of the object the index was built on
+	int64_t objectSize;
+	int64_t objectModificationTime;
+};
+
+FlvParser::FlvParser(int _fileDescriptor, off_t _fileSize) {
 	fileDescriptor = _fileDescriptor;
+	fileSize = _fileSize;
 	filePosition = 0;
-	mmapedFile = (char *)mmap(NULL, 2117191, PROT_READ, MAP_FILE, fileDescriptor, 0);
-	if (! mmapedFile) {
+	flvHeader = NULL;
+	flvStream = NULL;
+	mmapedFile = NULL;
+	if (fileSize <= 0)
+		return;
+	mmapedFile = (char *)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	if (mmapedFile == MAP_FAILED) {
 		systemLog->sysLog(ERROR, "[%d] cannot mmap file: %s", fileDescriptor, strerror(errno));
+		mmapedFile = NULL;
 		return;
 	}
-	flvHeader = new FlvHeader(mmapedFile, &filePosition);
+	flvHeader = new FlvHeader(mmapedFile, &filePosition, fileSize);
 	if (! flvHeader) {
 		systemLog->sysLog(ERROR, "[%d] cannot initialize a FlvHeader object: %s", fileDescriptor, strerror(errno));
 		return;
 	}
-	flvStream = new FlvStream(mmapedFile, &filePosition);
+	flvStream = new FlvStream(mmapedFile, &filePosition, fileSize);
 	if (! flvStream) {
 		systemLog->sysLog(ERROR, "[%d] cannot initialize a FlvStream object: %s", fileDescriptor, strerror(errno));
 		return;
@@ -44,36 +73,511 @@ FlvParser::~FlvParser() {
 		delete flvHeader;
 	if (flvStream)
 		delete flvStream;
-	munmap(mmapedFile, 2117191);
+	if (mmapedFile)
+		munmap(mmapedFile, fileSize);
 
 	return;
 }
 
-int FlvParser::searchKeyFrameByTime(time_t timestamp) {
-	int returnCode;
+// Copy a part of the file at the end of the header sent before the tags
+int FlvParser::appendHeader(struct FlvKeyFrameIndex *flvKeyFrameIndex, off_t start, off_t end) {
+	return appendHeaderData(flvKeyFrameIndex, &mmapedFile[start], end - start);
+}
 
-	returnCode = flvHeader->process();
-	if (returnCode < 0) {
-		systemLog->sysLog(ERROR, "[%d] cannot process the FlvHeader", fileDescriptor);
+// Also used by the WebM and Ogg parsers, their indices have the same layout
+int FlvParser::appendHeaderData(struct FlvKeyFrameIndex *flvKeyFrameIndex, const char *data, uint32_t size) {
+	char *header;
+
+	header = (char *)realloc(flvKeyFrameIndex->header, flvKeyFrameIndex->headerSize + size);
+	if (! header) {
+		systemLog->sysLog(CRITICAL, "cannot reallocate the index header: %s", strerror(errno));
 		return -1;
 	}
-	flvHeader->print();
-	for (;;) {
-		returnCode = flvStream->process();
-		if (returnCode < 0) {
-			systemLog->sysLog(ERROR, "[%d] cannot process the FlvStream header", fileDescriptor);
+	memcpy(header + flvKeyFrameIndex->headerSize, data, size);
+	flvKeyFrameIndex->header = header;
+	flvKeyFrameIndex->headerSize += size;
+
+	return 0;
+}
+
+int FlvParser::appendKeyFrame(struct FlvKeyFrameIndex *flvKeyFrameIndex, uint32_t *keyFramesSize, uint32_t timestamp, uint64_t position) {
+	uint32_t *timestamps;
+	uint64_t *positions;
+	uint32_t newKeyFramesSize;
+
+	if (flvKeyFrameIndex->numberOfKeyFrames == *keyFramesSize) {
+		newKeyFramesSize = *keyFramesSize ? *keyFramesSize << 1 : 256;
+		timestamps = (uint32_t *)realloc(flvKeyFrameIndex->timestamps, newKeyFramesSize * sizeof(uint32_t));
+		if (! timestamps) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate the keyframe timestamps: %s", strerror(errno));
+			return -1;
+		}
+		flvKeyFrameIndex->timestamps = timestamps;
+		positions = (uint64_t *)realloc(flvKeyFrameIndex->positions, newKeyFramesSize * sizeof(uint64_t));
+		if (! positions) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate the keyframe positions: %s", strerror(errno));
+			return -1;
+		}
+		flvKeyFrameIndex->positions = positions;
+		*keyFramesSize = newKeyFramesSize;
+	}
+	flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames] = timestamp;
+	flvKeyFrameIndex->positions[flvKeyFrameIndex->numberOfKeyFrames] = position;
+	flvKeyFrameIndex->numberOfKeyFrames++;
+
+	return 0;
+}
+
+// AMF0 key or string body: 16 bits length then the bytes, not terminated
+int FlvParser::readAmfString(off_t *position, off_t end, const char **string, uint16_t *length) {
+	u_char *ptrChar;
+
+	if (*position + 2 > end)
+		return -1;
+	ptrChar = (u_char *)&mmapedFile[*position];
+	*length = ((uint16_t)ptrChar[0] << 8) | ptrChar[1];
+	if (*position + 2 + *length > end)
+		return -1;
+	*string = &mmapedFile[*position + 2];
+	*position += 2 + *length;
+
+	return 0;
+}
+
+// Big Endian IEEE 754 double, the marker is already read
+int FlvParser::readAmfNumber(off_t *position, off_t end, double *number) {
+	u_char *ptrChar;
+	uint64_t bits = 0;
+	int i;
+
+	if (*position + 8 > end)
+		return -1;
+	ptrChar = (u_char *)&mmapedFile[*position];
+	for (i = 0; i < 8; i++)
+		bits = (bits << 8) | ptrChar[i];
+	memcpy(number, &bits, sizeof(*number));
+	*position += 8;
+
+	return 0;
+}
+
+// Strict array of numbers, the caller frees the values
+int FlvParser::readAmfNumberArray(off_t *position, off_t end, double **values, uint32_t *count) {
+	u_char *ptrChar;
+	uint32_t i;
+
+	if ((*position + 5 > end) || (mmapedFile[*position] != 10))
+		return -1;
+	ptrChar = (u_char *)&mmapedFile[*position + 1];
+	*count = ((uint32_t)ptrChar[0] << 24) | ((uint32_t)ptrChar[1] << 16) | ((uint32_t)ptrChar[2] << 8) | ptrChar[3];
+	*position += 5;
+	// Marker and number for each value
+	if ((off_t)*count * 9 > end - *position)
+		return -1;
+	*values = (double *)malloc((*count ? *count : 1) * sizeof(double));
+	if (! *values) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %u AMF numbers: %s", *count, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < *count; i++) {
+		if (mmapedFile[*position] != 0) {
+			free(*values);
+			*values = NULL;
+			return -1;
+		}
+		(*position)++;
+		readAmfNumber(position, end, &(*values)[i]);
+	}
+
+	return 0;
+}
+
+int FlvParser::skipAmfValue(off_t *position, off_t end, int depth) {
+	u_char marker;
+	u_char *ptrChar;
+	const char *key;
+	uint16_t keyLength;
+	uint32_t count;
+	uint32_t i;
+
+	if ((depth > FLVPARSER_MAXAMFDEPTH) || (*position + 1 > end))
+		return -1;
+	marker = mmapedFile[*position];
+	(*position)++;
+	switch (marker) {
+		// Number
+		case 0:
+			*position += 8;
+			break;
+		// Boolean
+		case 1:
+			*position += 1;
+			break;
+		// String
+		case 2:
+			if (readAmfString(position, end, &key, &keyLength) < 0)
+				return -1;
+			break;
+		// Object and ECMA array, the array has a count before its properties
+		case 3:
+		case 8:
+			if (marker == 8)
+				*position += 4;
+			for (;;) {
+				if (readAmfString(position, end, &key, &keyLength) < 0)
+					return -1;
+				if ((! keyLength) && (*position < end) && (mmapedFile[*position] == 9)) {
+					(*position)++;
+					break;
+				}
+				if (skipAmfValue(position, end, depth + 1) < 0)
+					return -1;
+			}
+			break;
+		// Null and undefined
+		case 5:
+		case 6:
 			break;
+		// Reference
+		case 7:
+			*position += 2;
+			break;
+		// Strict array
+		case 10:
+			if (*position + 4 > end)
+				return -1;
+			ptrChar = (u_char *)&mmapedFile[*position];
+			count = ((uint32_t)ptrChar[0] << 24) | ((uint32_t)ptrChar[1] << 16) | ((uint32_t)ptrChar[2] << 8) | ptrChar[3];
+			*position += 4;
+			for (i = 0; i < count; i++) {
+				if (skipAmfValue(position, end, depth + 1) < 0)
+					return -1;
+			}
+			break;
+		// Date
+		case 11:
+			*position += 10;
+			break;
+		// Long string
+		case 12:
+			if (*position + 4 > end)
+				return -1;
+			ptrChar = (u_char *)&mmapedFile[*position];
+			*position += 4 + (((uint32_t)ptrChar[0] << 24) | ((uint32_t)ptrChar[1] << 16) | ((uint32_t)ptrChar[2] << 8) | ptrChar[3]);
+			break;
+		default:
+			return -1;
+	}
+	if (*position > end)
+		return -1;
+
+	return 0;
+}
+
+// Properties of the keyframes object, the caller frees the arrays
+int FlvParser::readKeyFramesObject(off_t *position, off_t end, double **times, uint32_t *numberOfTimes, double **filePositions, uint32_t *numberOfFilePositions) {
+	const char *key;
+	uint16_t keyLength;
+
+	for (;;) {
+		if (readAmfString(position, end, &key, &keyLength) < 0)
+			return -1;
+		if (! keyLength)
+			return 0;
+		if ((keyLength == 5) && (! memcmp(key, "times", 5)) && (! *times)) {
+			if (readAmfNumberArray(position, end, times, numberOfTimes) < 0)
+				return -1;
 		}
-		//flvStream->print();
-		if ((flvStream->timestamp >= timestamp) && (flvStream->frameType == FRAME_KEY)) {
-			printf("Frame Key FOUND at %d !!!\n", flvStream->timestamp);
-			printf("return filepos = %d\n", filePosition);
-			return (filePosition - 11);
+		else
+		if ((keyLength == 13) && (! memcmp(key, "filepositions", 13)) && (! *filePositions)) {
+			if (readAmfNumberArray(position, end, filePositions, numberOfFilePositions) < 0)
+				return -1;
 		}
-		filePosition += flvStream->bodyLength;
-		if (filePosition >= 2117191)
+		else
+		if (skipAmfValue(position, end, 0) < 0)
+			return -1;
+	}
+}
+
+// Keyframes of onMetaData must point to video tags of this file, in order
+int FlvParser::appendMetaDataKeyFrames(struct FlvKeyFrameIndex *flvKeyFrameIndex, double *times, double *filePositions, uint32_t numberOfKeyFrames) {
+	uint32_t keyFramesSize = 0;
+	uint32_t timestamp;
+	off_t keyFramePosition;
+	uint32_t i;
+
+	for (i = 0; i < numberOfKeyFrames; i++) {
+		if ((times[i] < 0) || (filePositions[i] < 0) || (filePositions[i] + FLVSTREAM_TAGHEADERSIZE > fileSize))
+			return -1;
+		keyFramePosition = (off_t)filePositions[i];
+		timestamp = (uint32_t)(times[i] * 1000);
+		if ((mmapedFile[keyFramePosition] & 0x1f) != TYPE_VIDEO)
+			return -1;
+		if (i && ((keyFramePosition <= (off_t)flvKeyFrameIndex->positions[i - 1]) || (timestamp < flvKeyFrameIndex->timestamps[i - 1])))
+			return -1;
+		if (appendKeyFrame(flvKeyFrameIndex, &keyFramesSize, timestamp, keyFramePosition) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// Fill the index with the keyframes object of onMetaData, written by most encoders
+// Return -1 if it is missing or doesn't match the file, the tags are scanned then
+int FlvParser::readMetaDataKeyFrames(off_t position, off_t end, struct FlvKeyFrameIndex *flvKeyFrameIndex) {
+	const char *key;
+	uint16_t keyLength;
+	double *times = NULL;
+	double *filePositions = NULL;
+	uint32_t numberOfTimes = 0;
+	uint32_t numberOfFilePositions = 0;
+	int returnCode;
+
+	if ((position >= end) || (mmapedFile[position] != 2))
+		return -1;
+	position++;
+	if ((readAmfString(&position, end, &key, &keyLength) < 0) || (keyLength != 10) || memcmp(key, "onMetaData", 10))
+		return -1;
+	if ((position >= end) || ((mmapedFile[position] != 3) && (mmapedFile[position] != 8)))
+		return -1;
+	position += (mmapedFile[position] == 8) ? 5 : 1;
+	for (;;) {
+		if ((readAmfString(&position, end, &key, &keyLength) < 0) || (! keyLength))
+			return -1;
+		if ((keyLength == 9) && (! memcmp(key, "keyframes", 9)) && (position < end) && (mmapedFile[position] == 3))
 			break;
+		if (skipAmfValue(&position, end, 0) < 0)
+			return -1;
+	}
+	position++;
+
+	returnCode = readKeyFramesObject(&position, end, &times, &numberOfTimes, &filePositions, &numberOfFilePositions);
+	if ((! returnCode) && ((! times) || (! filePositions) || (! numberOfTimes) || (numberOfTimes != numberOfFilePositions)))
+		returnCode = -1;
+	if (! returnCode)
+		returnCode = appendMetaDataKeyFrames(flvKeyFrameIndex, times, filePositions, numberOfTimes);
+	if (returnCode < 0)
+		flvKeyFrameIndex->numberOfKeyFrames = 0;
+	free(times);
+	free(filePositions);
+
+	return returnCode;
+}
+
+// Timestamp of the last tag in milliseconds, found from the previous tag size ending the file
+// The last keyframe is used if the file doesn't end on a tag
+uint32_t FlvParser::getDuration(struct FlvKeyFrameIndex *flvKeyFrameIndex) {
+	const unsigned char *ptrChar;
+	uint32_t lastTagSize;
+	off_t lastTagPosition;
+
+	if (fileSize >= (off_t)(flvKeyFrameIndex->headerSize + FLVSTREAM_PREVIOUSTAGSIZE)) {
+		ptrChar = (const unsigned char *)&mmapedFile[fileSize - FLVSTREAM_PREVIOUSTAGSIZE];
+		lastTagSize = ((uint32_t)ptrChar[0] << 24) | ((uint32_t)ptrChar[1] << 16) | ((uint32_t)ptrChar[2] << 8) | ptrChar[3];
+		lastTagPosition = fileSize - FLVSTREAM_PREVIOUSTAGSIZE - lastTagSize;
+		if ((lastTagSize >= FLVSTREAM_TAGHEADERSIZE) && (lastTagPosition >= flvHeader->offset + FLVSTREAM_PREVIOUSTAGSIZE)) {
+			ptrChar = (const unsigned char *)&mmapedFile[lastTagPosition];
+			if (((ptrChar[0] & 0x1f) == TYPE_VIDEO) || ((ptrChar[0] & 0x1f) == TYPE_AUDIO))
+				return ((uint32_t)ptrChar[7] << 24) | ((uint32_t)ptrChar[4] << 16) | ((uint32_t)ptrChar[5] << 8) | ptrChar[6];
+		}
+	}
+
+	return flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames - 1];
+}
+
+// Return NULL if the file is not a FLV or has no keyframe
+struct FlvKeyFrameIndex *FlvParser::buildKeyFrameIndex(void) {
+	struct FlvKeyFrameIndex *flvKeyFrameIndex;
+	uint32_t keyFramesSize = 0;
+	bool metaDataRead = false;
+	bool metaDataKeyFrames = false;
+	bool mediaFound = false;
+	off_t bodyEnd;
+	uint32_t duration;
+
+	if ((! mmapedFile) || (! flvHeader) || (! flvStream))
+		return NULL;
+	filePosition = 0;
+	if (flvHeader->process() < 0) {
+		systemLog->sysLog(ERROR, "[%d] cannot process the FlvHeader", fileDescriptor);
+		return NULL;
+	}
+	flvKeyFrameIndex = (struct FlvKeyFrameIndex *)calloc(1, sizeof(struct FlvKeyFrameIndex));
+	if (! flvKeyFrameIndex) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a FlvKeyFrameIndex object: %s", strerror(errno));
+		return NULL;
+	}
+	// File header and the first previous tag size
+	filePosition = flvHeader->offset;
+	if ((filePosition + FLVSTREAM_PREVIOUSTAGSIZE > fileSize) || (appendHeader(flvKeyFrameIndex, 0, filePosition + FLVSTREAM_PREVIOUSTAGSIZE) < 0)) {
+		destroyKeyFrameIndex(flvKeyFrameIndex);
+		return NULL;
+	}
+
+	while (flvStream->process() == 0) {
+		bodyEnd = filePosition + flvStream->bodyLength;
+		if ((! mediaFound) && (bodyEnd + FLVSTREAM_PREVIOUSTAGSIZE <= fileSize) && (((flvStream->type == TYPE_META) && (metaDataRead == false)) || flvStream->isSequenceHeader())) {
+			// Tags a player needs before the first frame, with their previous tag size
+			if (appendHeader(flvKeyFrameIndex, flvStream->tagPosition, bodyEnd + FLVSTREAM_PREVIOUSTAGSIZE) < 0)
+				break;
+			if (flvStream->type == TYPE_META) {
+				metaDataRead = true;
+				if (readMetaDataKeyFrames(filePosition, bodyEnd, flvKeyFrameIndex) == 0)
+					metaDataKeyFrames = true;
+			}
+		}
+		else
+		if ((flvStream->type == TYPE_VIDEO) || (flvStream->type == TYPE_AUDIO)) {
+			mediaFound = true;
+			// Sequence headers are all read, the rest of the file is only needed without onMetaData keyframes
+			if (metaDataKeyFrames == true)
+				break;
+			if ((flvStream->type == TYPE_VIDEO) && (flvStream->frameType == FRAME_KEY) && (! flvStream->isSequenceHeader())) {
+				if (appendKeyFrame(flvKeyFrameIndex, &keyFramesSize, flvStream->timestamp, flvStream->tagPosition) < 0)
+					break;
+			}
+		}
+		filePosition = bodyEnd;
+	}
+
+	if (! flvKeyFrameIndex->numberOfKeyFrames) {
+		systemLog->sysLog(ERROR, "[%d] no keyframe found in the FLV file", fileDescriptor);
+		destroyKeyFrameIndex(flvKeyFrameIndex);
+		return NULL;
 	}
+	// Replaces the ffmpeg run of sh=auto shaping, bits per millisecond are kbit/s
+	duration = getDuration(flvKeyFrameIndex);
+	if (duration)
+		flvKeyFrameIndex->bitRate = (uint32_t)((uint64_t)fileSize * 8 / duration);
+	flvKeyFrameIndex->memoryUsage = sizeof(struct FlvKeyFrameIndex) + flvKeyFrameIndex->headerSize + flvKeyFrameIndex->numberOfKeyFrames * (sizeof(uint32_t) + sizeof(uint64_t));
+
+	return flvKeyFrameIndex;
+}
+
+// Last keyframe at or before the timestamp in milliseconds, the first one if the timestamp is before it
+int FlvParser::searchKeyFrameByTime(struct FlvKeyFrameIndex *flvKeyFrameIndex, uint32_t timestamp) {
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t middle;
+
+	if (! flvKeyFrameIndex->numberOfKeyFrames)
+		return -1;
+	high = flvKeyFrameIndex->numberOfKeyFrames;
+	while (high - low > 1) {
+		middle = low + (high - low) / 2;
+		if (flvKeyFrameIndex->timestamps[middle] <= timestamp)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+void FlvParser::destroyKeyFrameIndex(struct FlvKeyFrameIndex *flvKeyFrameIndex) {
+	if (flvKeyFrameIndex->map)
+		munmap(flvKeyFrameIndex->map, flvKeyFrameIndex->mapSize);
+	else {
+		free(flvKeyFrameIndex->timestamps);
+		free(flvKeyFrameIndex->positions);
+		free(flvKeyFrameIndex->header);
+	}
+	free(flvKeyFrameIndex);
+
+	return;
+}
+
+static int writeBlock(FILE *file, const void *data, uint64_t size) {
+	static const char padding[8] = { 0 };
+
+	if (size && (fwrite(data, size, 1, file) != 1))
+		return -1;
+	if ((FLVPARSER_ALIGN(size) != size) && (fwrite(padding, FLVPARSER_ALIGN(size) - size, 1, file) != 1))
+		return -1;
 
 	return 0;
 }
+
+// Sidecar is only valid for this size and modification time of the object
+int FlvParser::writeKeyFrameIndex(struct FlvKeyFrameIndex *flvKeyFrameIndex, const char *fileName, off_t objectSize, time_t objectModificationTime) {
+	struct FlvKeyFrameIndexFile flvKeyFrameIndexFile;
+	FILE *file;
+	int returnCode;
+
+	memset(&flvKeyFrameIndexFile, 0, sizeof(flvKeyFrameIndexFile));
+	flvKeyFrameIndexFile.magic = FLVPARSER_INDEXMAGIC;
+	flvKeyFrameIndexFile.version = FLVPARSER_INDEXVERSION;
+	flvKeyFrameIndexFile.numberOfKeyFrames = flvKeyFrameIndex->numberOfKeyFrames;
+	flvKeyFrameIndexFile.headerSize = flvKeyFrameIndex->headerSize;
+	flvKeyFrameIndexFile.bitRate = flvKeyFrameIndex->bitRate;
+	flvKeyFrameIndexFile.objectSize = objectSize;
+	flvKeyFrameIndexFile.objectModificationTime = objectModificationTime;
+
+	file = fopen(fileName, "wb");
+	if (! file)
+		return -1;
+	returnCode = writeBlock(file, &flvKeyFrameIndexFile, sizeof(flvKeyFrameIndexFile));
+	if (! returnCode)
+		returnCode = writeBlock(file, flvKeyFrameIndex->header, flvKeyFrameIndex->headerSize);
+	if (! returnCode)
+		returnCode = writeBlock(file, flvKeyFrameIndex->timestamps, flvKeyFrameIndex->numberOfKeyFrames * sizeof(uint32_t));
+	if (! returnCode)
+		returnCode = writeBlock(file, flvKeyFrameIndex->positions, flvKeyFrameIndex->numberOfKeyFrames * sizeof(uint64_t));
+	if (fclose(file) != 0)
+		returnCode = -1;
+
+	return returnCode;
+}
+
+// The index points into the mapping, return NULL if the sidecar is missing, stale or truncated
+struct FlvKeyFrameIndex *FlvParser::mapKeyFrameIndex(const char *fileName, off_t objectSize, time_t objectModificationTime) {
+	struct FlvKeyFrameIndex *flvKeyFrameIndex;
+	struct FlvKeyFrameIndexFile *flvKeyFrameIndexFile;
+	struct stat fileStat;
+	char *map;
+	size_t mapSize;
+	uint64_t position;
+	int descriptor;
+
+	descriptor = open(fileName, O_RDONLY);
+	if (descriptor < 0)
+		return NULL;
+	if ((fstat(descriptor, &fileStat) < 0) || (fileStat.st_size < (off_t)sizeof(struct FlvKeyFrameIndexFile))) {
+		close(descriptor);
+		return NULL;
+	}
+	mapSize = fileStat.st_size;
+	map = (char *)mmap(NULL, mapSize, PROT_READ, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	flvKeyFrameIndexFile = (struct FlvKeyFrameIndexFile *)map;
+	position = FLVPARSER_ALIGN(sizeof(struct FlvKeyFrameIndexFile));
+	if ((flvKeyFrameIndexFile->magic != FLVPARSER_INDEXMAGIC) || (flvKeyFrameIndexFile->version != FLVPARSER_INDEXVERSION) ||
+	    (flvKeyFrameIndexFile->objectSize != objectSize) || (flvKeyFrameIndexFile->objectModificationTime != objectModificationTime) ||
+	    (! flvKeyFrameIndexFile->numberOfKeyFrames) ||
+	    (position + FLVPARSER_ALIGN(flvKeyFrameIndexFile->headerSize) + FLVPARSER_ALIGN((uint64_t)flvKeyFrameIndexFile->numberOfKeyFrames * sizeof(uint32_t)) + (uint64_t)flvKeyFrameIndexFile->numberOfKeyFrames * sizeof(uint64_t) > mapSize)) {
+		munmap(map, mapSize);
+		return NULL;
+	}
+	flvKeyFrameIndex = (struct FlvKeyFrameIndex *)calloc(1, sizeof(struct FlvKeyFrameIndex));
+	if (! flvKeyFrameIndex) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a FlvKeyFrameIndex object: %s", strerror(errno));
+		munmap(map, mapSize);
+		return NULL;
+	}
+	flvKeyFrameIndex->map = map;
+	flvKeyFrameIndex->mapSize = mapSize;
+	flvKeyFrameIndex->numberOfKeyFrames = flvKeyFrameIndexFile->numberOfKeyFrames;
+	flvKeyFrameIndex->headerSize = flvKeyFrameIndexFile->headerSize;
+	flvKeyFrameIndex->bitRate = flvKeyFrameIndexFile->bitRate;
+	flvKeyFrameIndex->header = map + position;
+	position += FLVPARSER_ALIGN(flvKeyFrameIndex->headerSize);
+	flvKeyFrameIndex->timestamps = (uint32_t *)(map + position);
+	position += FLVPARSER_ALIGN((uint64_t)flvKeyFrameIndex->numberOfKeyFrames * sizeof(uint32_t));
+	flvKeyFrameIndex->positions = (uint64_t *)(map + position);
+	flvKeyFrameIndex->memoryUsage = sizeof(struct FlvKeyFrameIndex) + mapSize;
+
+	return flvKeyFrameIndex;
+}
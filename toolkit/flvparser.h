@@ -1,7 +1,8 @@
 //
 // C++ Interface: flvparser
 //
-// Description: 
+// Description: keyframe index of a FLV file, built from the onMetaData
+// keyframes when the file has them, or from a scan of its tags
 //
 //
 // Author:  <spe@>, (C) 2007
@@ -12,27 +13,65 @@
 #ifndef FLVPARSER_H
 #define FLVPARSER_H
 
+#include <sys/types.h>
+
 #include "log.h"
 #include "flvstream.h"
 #include "flvheader.h"
 
+// Nesting of AMF values skipped in onMetaData
+#define FLVPARSER_MAXAMFDEPTH 16
+
+struct FlvKeyFrameIndex {
+	uint32_t numberOfKeyFrames;
+	// In milliseconds
+	uint32_t *timestamps;
+	// Start of the video tag, a seek answer is sent from there
+	uint64_t *positions;
+	// FLV header, onMetaData and sequence headers, sent before the first tag of a seek answer
+	char *header;
+	uint32_t headerSize;
+	// Average of the file in kbit/s, 0 if unknown
+	uint32_t bitRate;
+	size_t memoryUsage;
+	// Sidecar file the index points into, NULL if allocated
+	void *map;
+	size_t mapSize;
+};
+
 /**
 	@author  <spe@>
 */
-
 class FlvParser{
 private:
 	int fileDescriptor;
+	off_t fileSize;
 	FlvHeader *flvHeader;
 	FlvStream *flvStream;
 	char *mmapedFile;
-	int filePosition;
-	
+	off_t filePosition;
+
+	int appendHeader(struct FlvKeyFrameIndex *, off_t, off_t);
+	int readAmfString(off_t *, off_t, const char **, uint16_t *);
+	int readAmfNumber(off_t *, off_t, double *);
+	int readAmfNumberArray(off_t *, off_t, double **, uint32_t *);
+	int skipAmfValue(off_t *, off_t, int);
+	int readKeyFramesObject(off_t *, off_t, double **, uint32_t *, double **, uint32_t *);
+	int appendMetaDataKeyFrames(struct FlvKeyFrameIndex *, double *, double *, uint32_t);
+	int readMetaDataKeyFrames(off_t, off_t, struct FlvKeyFrameIndex *);
+	uint32_t getDuration(struct FlvKeyFrameIndex *);
+
 public:
-	FlvParser(int);
+	FlvParser(int, off_t);
 	~FlvParser();
 
-	int searchKeyFrameByTime(time_t);
+	struct FlvKeyFrameIndex *buildKeyFrameIndex(void);
+	static int appendHeaderData(struct FlvKeyFrameIndex *, const char *, uint32_t);
+	static int appendKeyFrame(struct FlvKeyFrameIndex *, uint32_t *, uint32_t, uint64_t);
+	static int searchKeyFrameByTime(struct FlvKeyFrameIndex *, uint32_t);
+	static void destroyKeyFrameIndex(struct FlvKeyFrameIndex *);
+	static int writeKeyFrameIndex(struct FlvKeyFrameIndex *, const char *, off_t, time_t);
+	static struct FlvKeyFrameIndex *mapKeyFrameIndex(const char *, off_t, time_t);
 };
 
 #endif
@@ -0,0 +1,941 @@
+//
+// C++ Implementation: flvremuxer
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "flvremuxer.h"
+
+// Boxes of a fragment header: moof, mfhd, a traf, tfhd and tfdt per track, a trun
+// per sample (its data is not next to the previous one), then the mdat header
+#define FLVREMUXER_MOOFSIZE 8
+#define FLVREMUXER_MFHDSIZE 16
+#define FLVREMUXER_TRAFSIZE (8 + 16 + 20)
+#define FLVREMUXER_VIDEOTRUNSIZE 36
+#define FLVREMUXER_AUDIOTRUNSIZE 28
+#define FLVREMUXER_MDATHEADERSIZE 8
+
+// Sample flags of trun and trex: sync sample, or depending on others and not sync
+#define FLVREMUXER_SYNCSAMPLE 0x02000000
+#define FLVREMUXER_NONSYNCSAMPLE 0x01010000
+
+static const uint32_t aacSampleRates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+// Bit reader of the SPS, reads past the end return zeros
+struct FlvRemuxerBits {
+	unsigned char const *data;
+	uint32_t size;
+	uint32_t position;
+};
+
+static uint32_t readBits(struct FlvRemuxerBits *bits, unsigned int count) {
+	uint32_t value = 0;
+
+	while (count--) {
+		value <<= 1;
+		if (bits->position < bits->size * 8)
+			value |= (bits->data[bits->position >> 3] >> (7 - (bits->position & 7))) & 1;
+		bits->position++;
+	}
+
+	return value;
+}
+
+// Exp-Golomb codes
+static uint32_t readUe(struct FlvRemuxerBits *bits) {
+	unsigned int zeros = 0;
+
+	while ((zeros < 31) && (bits->position < bits->size * 8) && (! readBits(bits, 1)))
+		zeros++;
+
+	return ((1U << zeros) - 1) + readBits(bits, zeros);
+}
+
+static int32_t readSe(struct FlvRemuxerBits *bits) {
+	uint32_t value;
+
+	value = readUe(bits);
+
+	return (value & 1) ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+}
+
+static void skipScalingList(struct FlvRemuxerBits *bits, unsigned int size) {
+	int lastScale = 8;
+	int nextScale = 8;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		if (nextScale)
+			nextScale = (lastScale + readSe(bits) + 256) % 256;
+		if (nextScale)
+			lastScale = nextScale;
+	}
+
+	return;
+}
+
+// Display size from the SPS NAL unit, 0 if it cannot be read
+static void getAvcDimensions(unsigned char const *nal, uint32_t nalSize, uint32_t *width, uint32_t *height) {
+	struct FlvRemuxerBits bits;
+	unsigned char rbsp[256];
+	uint32_t rbspSize = 0;
+	uint32_t zeros = 0;
+	uint32_t i;
+	uint32_t profile;
+	uint32_t chromaFormat = 1;
+	uint32_t count;
+	uint32_t widthInMbs;
+	uint32_t heightInMapUnits;
+	uint32_t frameMbsOnly;
+	uint32_t crop[4] = { 0, 0, 0, 0 };
+	uint32_t cropUnitX;
+	uint32_t cropUnitY;
+
+	*width = 0;
+	*height = 0;
+	// Emulation prevention bytes removed, the sizes are in the first bytes
+	for (i = 1; (i < nalSize) && (rbspSize < sizeof(rbsp)); i++) {
+		if ((zeros >= 2) && (nal[i] == 3)) {
+			zeros = 0;
+			continue;
+		}
+		zeros = nal[i] ? 0 : zeros + 1;
+		rbsp[rbspSize++] = nal[i];
+	}
+	bits.data = rbsp;
+	bits.size = rbspSize;
+	bits.position = 0;
+
+	profile = readBits(&bits, 8);
+	readBits(&bits, 16);
+	readUe(&bits);
+	if ((profile == 100) || (profile == 110) || (profile == 122) || (profile == 244) || (profile == 44) || (profile == 83) || (profile == 86) || (profile == 118) || (profile == 128) || (profile == 138) || (profile == 139) || (profile == 134) || (profile == 135)) {
+		chromaFormat = readUe(&bits);
+		if (chromaFormat == 3)
+			readBits(&bits, 1);
+		readUe(&bits);
+		readUe(&bits);
+		readBits(&bits, 1);
+		if (readBits(&bits, 1)) {
+			for (i = 0; i < ((chromaFormat != 3) ? 8U : 12U); i++) {
+				if (readBits(&bits, 1))
+					skipScalingList(&bits, (i < 6) ? 16 : 64);
+			}
+		}
+	}
+	readUe(&bits);
+	switch (readUe(&bits)) {
+		case 0:
+			readUe(&bits);
+			break;
+		case 1:
+			readBits(&bits, 1);
+			readSe(&bits);
+			readSe(&bits);
+			count = readUe(&bits);
+			for (i = 0; (i < count) && (i < 256); i++)
+				readSe(&bits);
+			break;
+	}
+	readUe(&bits);
+	readBits(&bits, 1);
+	widthInMbs = readUe(&bits) + 1;
+	heightInMapUnits = readUe(&bits) + 1;
+	frameMbsOnly = readBits(&bits, 1);
+	if (! frameMbsOnly)
+		readBits(&bits, 1);
+	readBits(&bits, 1);
+	if (readBits(&bits, 1)) {
+		for (i = 0; i < 4; i++)
+			crop[i] = readUe(&bits);
+	}
+	if (bits.position > bits.size * 8)
+		return;
+	cropUnitX = ((chromaFormat == 1) || (chromaFormat == 2)) ? 2 : 1;
+	cropUnitY = ((chromaFormat == 1) ? 2 : 1) * (2 - frameMbsOnly);
+	*width = widthInMbs * 16 - (crop[0] + crop[1]) * cropUnitX;
+	*height = (2 - frameMbsOnly) * heightInMapUnits * 16 - (crop[2] + crop[3]) * cropUnitY;
+	if ((*width > 16384) || (*height > 16384)) {
+		*width = 0;
+		*height = 0;
+	}
+
+	return;
+}
+
+static unsigned char *writeInt16(unsigned char *buffer, uint32_t value) {
+	buffer[0] = (value >> 8) & 0xff;
+	buffer[1] = value & 0xff;
+
+	return buffer + 2;
+}
+
+static unsigned char *writeInt32(unsigned char *buffer, uint32_t value) {
+	buffer[0] = (value >> 24) & 0xff;
+	buffer[1] = (value >> 16) & 0xff;
+	buffer[2] = (value >> 8) & 0xff;
+	buffer[3] = value & 0xff;
+
+	return buffer + 4;
+}
+
+static unsigned char *writeInt64(unsigned char *buffer, uint64_t value) {
+	buffer = writeInt32(buffer, (uint32_t)(value >> 32));
+
+	return writeInt32(buffer, (uint32_t)value);
+}
+
+static unsigned char *writeBytes(unsigned char *buffer, const void *data, uint32_t size) {
+	memcpy(buffer, data, size);
+
+	return buffer + size;
+}
+
+// The size is written by closeBox once the content is known
+static unsigned char *openBox(unsigned char *buffer, const char *type) {
+	buffer = writeInt32(buffer, 0);
+
+	return writeBytes(buffer, type, 4);
+}
+
+static unsigned char *openFullBox(unsigned char *buffer, const char *type, uint32_t version, uint32_t flags) {
+	buffer = openBox(buffer, type);
+
+	return writeInt32(buffer, (version << 24) | flags);
+}
+
+static void closeBox(unsigned char *box, unsigned char *end) {
+	writeInt32(box, (uint32_t)(end - box));
+
+	return;
+}
+
+static unsigned char *writeMatrix(unsigned char *buffer) {
+	static const uint32_t matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+	unsigned int i;
+
+	for (i = 0; i < 9; i++)
+		buffer = writeInt32(buffer, matrix[i]);
+
+	return buffer;
+}
+
+// Samples of each track in the fragment, return the size of its header
+static uint32_t getFragmentHeaderSize(struct FlvRemuxIndex const *flvRemuxIndex, uint32_t fragment, uint32_t *videoSamples, uint32_t *audioSamples) {
+	uint32_t lastSample;
+	uint32_t sample;
+	uint32_t headerSize;
+
+	*videoSamples = 0;
+	*audioSamples = 0;
+	lastSample = (fragment + 1 < flvRemuxIndex->numberOfFragments) ? flvRemuxIndex->fragments[fragment + 1].firstSample : flvRemuxIndex->numberOfSamples;
+	for (sample = flvRemuxIndex->fragments[fragment].firstSample; sample < lastSample; sample++) {
+		if (flvRemuxIndex->samples[sample].track == FLVREMUXER_VIDEOTRACK)
+			(*videoSamples)++;
+		else
+			(*audioSamples)++;
+	}
+	headerSize = FLVREMUXER_MOOFSIZE + FLVREMUXER_MFHDSIZE + FLVREMUXER_MDATHEADERSIZE;
+	if (*videoSamples)
+		headerSize += FLVREMUXER_TRAFSIZE + *videoSamples * FLVREMUXER_VIDEOTRUNSIZE;
+	if (*audioSamples)
+		headerSize += FLVREMUXER_TRAFSIZE + *audioSamples * FLVREMUXER_AUDIOTRUNSIZE;
+
+	return headerSize;
+}
+
+// Video frames last until the next one, in ms
+static uint32_t getVideoDuration(struct FlvRemuxIndex const *flvRemuxIndex, uint32_t sample) {
+	uint32_t next;
+	uint32_t timestamp;
+
+	timestamp = flvRemuxIndex->samples[sample].timestamp;
+	for (next = sample + 1; next < flvRemuxIndex->numberOfSamples; next++) {
+		if (flvRemuxIndex->samples[next].track == FLVREMUXER_VIDEOTRACK)
+			return (flvRemuxIndex->samples[next].timestamp > timestamp) ? flvRemuxIndex->samples[next].timestamp - timestamp : 1;
+	}
+	// Last frame lasts as long as the one before it
+	for (next = sample; next > 0; next--) {
+		if (flvRemuxIndex->samples[next - 1].track == FLVREMUXER_VIDEOTRACK)
+			return (timestamp > flvRemuxIndex->samples[next - 1].timestamp) ? timestamp - flvRemuxIndex->samples[next - 1].timestamp : 1;
+	}
+
+	return FLVREMUXER_VIDEODURATION;
+}
+
+FlvRemuxer::FlvRemuxer(int _fileDescriptor, off_t _fileSize) {
+	fileDescriptor = _fileDescriptor;
+	fileSize = _fileSize;
+	filePosition = 0;
+	flvHeader = NULL;
+	flvStream = NULL;
+	mmapedFile = NULL;
+	if (fileSize <= 0)
+		return;
+	mmapedFile = (char *)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	if (mmapedFile == MAP_FAILED) {
+		systemLog->sysLog(ERROR, "[%d] cannot mmap file: %s", fileDescriptor, strerror(errno));
+		mmapedFile = NULL;
+		return;
+	}
+	flvHeader = new FlvHeader(mmapedFile, &filePosition, fileSize);
+	if (! flvHeader) {
+		systemLog->sysLog(ERROR, "[%d] cannot initialize a FlvHeader object: %s", fileDescriptor, strerror(errno));
+		return;
+	}
+	flvStream = new FlvStream(mmapedFile, &filePosition, fileSize);
+	if (! flvStream) {
+		systemLog->sysLog(ERROR, "[%d] cannot initialize a FlvStream object: %s", fileDescriptor, strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+FlvRemuxer::~FlvRemuxer() {
+	if (flvHeader)
+		delete flvHeader;
+	if (flvStream)
+		delete flvStream;
+	if (mmapedFile)
+		munmap(mmapedFile, fileSize);
+
+	return;
+}
+
+int FlvRemuxer::appendSample(struct FlvRemuxIndex *flvRemuxIndex, uint32_t *samplesSize, uint64_t position, uint32_t size, uint32_t timestamp, int32_t compositionTime, unsigned char track, bool keyFrame) {
+	struct FlvRemuxSample *samples;
+	struct FlvRemuxSample *flvRemuxSample;
+	uint32_t newSamplesSize;
+
+	if (flvRemuxIndex->numberOfSamples == *samplesSize) {
+		newSamplesSize = *samplesSize ? *samplesSize << 1 : 1024;
+		samples = (struct FlvRemuxSample *)realloc(flvRemuxIndex->samples, newSamplesSize * sizeof(struct FlvRemuxSample));
+		if (! samples) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate the remux samples: %s", strerror(errno));
+			return -1;
+		}
+		flvRemuxIndex->samples = samples;
+		*samplesSize = newSamplesSize;
+	}
+	flvRemuxSample = &flvRemuxIndex->samples[flvRemuxIndex->numberOfSamples];
+	flvRemuxSample->position = position;
+	flvRemuxSample->size = size;
+	flvRemuxSample->timestamp = timestamp;
+	flvRemuxSample->compositionTime = compositionTime;
+	flvRemuxSample->track = track;
+	flvRemuxSample->keyFrame = keyFrame;
+	flvRemuxIndex->numberOfSamples++;
+
+	return 0;
+}
+
+int FlvRemuxer::appendFragment(struct FlvRemuxIndex *flvRemuxIndex, uint32_t *fragmentsSize, uint32_t firstSample, uint64_t position) {
+	struct FlvRemuxFragment *fragments;
+	struct FlvRemuxFragment *flvRemuxFragment;
+	uint32_t newFragmentsSize;
+	uint32_t timestamp;
+
+	if (flvRemuxIndex->numberOfFragments == *fragmentsSize) {
+		newFragmentsSize = *fragmentsSize ? *fragmentsSize << 1 : 256;
+		fragments = (struct FlvRemuxFragment *)realloc(flvRemuxIndex->fragments, newFragmentsSize * sizeof(struct FlvRemuxFragment));
+		if (! fragments) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate the remux fragments: %s", strerror(errno));
+			return -1;
+		}
+		flvRemuxIndex->fragments = fragments;
+		*fragmentsSize = newFragmentsSize;
+	}
+	// Interleaving may put an audio tag a bit late, the times of the fragments must grow
+	timestamp = flvRemuxIndex->samples[firstSample].timestamp;
+	if (flvRemuxIndex->numberOfFragments && (timestamp < flvRemuxIndex->fragments[flvRemuxIndex->numberOfFragments - 1].timestamp))
+		timestamp = flvRemuxIndex->fragments[flvRemuxIndex->numberOfFragments - 1].timestamp;
+	flvRemuxFragment = &flvRemuxIndex->fragments[flvRemuxIndex->numberOfFragments];
+	flvRemuxFragment->position = position;
+	flvRemuxFragment->firstSample = firstSample;
+	flvRemuxFragment->timestamp = timestamp;
+	flvRemuxFragment->audioDecodeTime = 0;
+	flvRemuxIndex->numberOfFragments++;
+
+	return 0;
+}
+
+// AVCDecoderConfigurationRecord of the sequence header, the first SPS gives the size
+int FlvRemuxer::readAvcConfig(struct FlvRemuxIndex *flvRemuxIndex, off_t position, uint32_t size) {
+	const unsigned char *ptrChar;
+	uint32_t spsSize;
+
+	ptrChar = (const unsigned char *)&mmapedFile[position];
+	if ((size < 7) || (ptrChar[0] != 1))
+		return -1;
+	flvRemuxIndex->avcConfig = (unsigned char *)malloc(size);
+	if (! flvRemuxIndex->avcConfig) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %u bytes for the avcC: %s", size, strerror(errno));
+		return -1;
+	}
+	memcpy(flvRemuxIndex->avcConfig, ptrChar, size);
+	flvRemuxIndex->avcConfigSize = size;
+	if ((ptrChar[5] & 0x1f) && (size >= 8)) {
+		spsSize = ((uint32_t)ptrChar[6] << 8) | ptrChar[7];
+		if (8 + spsSize <= size)
+			getAvcDimensions(&ptrChar[8], spsSize, &flvRemuxIndex->width, &flvRemuxIndex->height);
+	}
+
+	return 0;
+}
+
+// AudioSpecificConfig of the sequence header
+int FlvRemuxer::readAacConfig(struct FlvRemuxIndex *flvRemuxIndex, off_t position, uint32_t size) {
+	const unsigned char *ptrChar;
+	unsigned int frequencyIndex;
+
+	ptrChar = (const unsigned char *)&mmapedFile[position];
+	// Sent in a descriptor with a one byte length
+	if ((size < 2) || (size > 64))
+		return -1;
+	frequencyIndex = ((ptrChar[0] & 0x07) << 1) | (ptrChar[1] >> 7);
+	if (frequencyIndex == 15) {
+		if (size < 5)
+			return -1;
+		flvRemuxIndex->sampleRate = ((uint32_t)(ptrChar[1] & 0x7f) << 17) | ((uint32_t)ptrChar[2] << 9) | ((uint32_t)ptrChar[3] << 1) | (ptrChar[4] >> 7);
+		flvRemuxIndex->channels = (ptrChar[4] >> 3) & 0x0f;
+	}
+	else
+	if (frequencyIndex < sizeof(aacSampleRates) / sizeof(aacSampleRates[0])) {
+		flvRemuxIndex->sampleRate = aacSampleRates[frequencyIndex];
+		flvRemuxIndex->channels = (ptrChar[1] >> 3) & 0x0f;
+	}
+	if (! flvRemuxIndex->sampleRate)
+		return -1;
+	if (! flvRemuxIndex->channels)
+		flvRemuxIndex->channels = 2;
+	flvRemuxIndex->aacConfig = (unsigned char *)malloc(size);
+	if (! flvRemuxIndex->aacConfig) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %u bytes for the AAC configuration: %s", size, strerror(errno));
+		return -1;
+	}
+	memcpy(flvRemuxIndex->aacConfig, ptrChar, size);
+	flvRemuxIndex->aacConfigSize = size;
+
+	return 0;
+}
+
+// A fragment per GOP, or per FLVREMUXER_AUDIOFRAGMENT without video
+int FlvRemuxer::buildFragments(struct FlvRemuxIndex *flvRemuxIndex) {
+	struct FlvRemuxSample *flvRemuxSample;
+	uint32_t fragmentsSize = 0;
+	uint32_t sample;
+	uint32_t audioSamples = 0;
+	uint64_t audioStartTime = 0;
+	bool hasVideo = false;
+	bool hasAudio = false;
+	bool fragmentVideo = false;
+	bool fragmentStart;
+
+	for (sample = 0; sample < flvRemuxIndex->numberOfSamples; sample++) {
+		if (flvRemuxIndex->samples[sample].track == FLVREMUXER_VIDEOTRACK)
+			hasVideo = true;
+		else
+		if (hasAudio == false) {
+			hasAudio = true;
+			audioStartTime = (uint64_t)flvRemuxIndex->samples[sample].timestamp * flvRemuxIndex->sampleRate / 1000;
+		}
+	}
+	// Init segment only has the tracks with samples
+	if ((hasVideo == false) && flvRemuxIndex->avcConfig) {
+		free(flvRemuxIndex->avcConfig);
+		flvRemuxIndex->avcConfig = NULL;
+		flvRemuxIndex->avcConfigSize = 0;
+	}
+	if ((hasAudio == false) && flvRemuxIndex->aacConfig) {
+		free(flvRemuxIndex->aacConfig);
+		flvRemuxIndex->aacConfig = NULL;
+		flvRemuxIndex->aacConfigSize = 0;
+	}
+
+	for (sample = 0; sample < flvRemuxIndex->numberOfSamples; sample++) {
+		flvRemuxSample = &flvRemuxIndex->samples[sample];
+		if (! sample)
+			fragmentStart = true;
+		else
+		if (hasVideo == true)
+			// Audio before the first keyframe goes in its fragment
+			fragmentStart = (flvRemuxSample->track == FLVREMUXER_VIDEOTRACK) && (flvRemuxSample->keyFrame == true) && (fragmentVideo == true);
+		else
+			fragmentStart = (flvRemuxSample->timestamp >= flvRemuxIndex->fragments[flvRemuxIndex->numberOfFragments - 1].timestamp + FLVREMUXER_AUDIOFRAGMENT);
+		if (fragmentStart == true) {
+			// Fragment starts on the tag of the sample
+			if (appendFragment(flvRemuxIndex, &fragmentsSize, sample, flvRemuxSample->position - FLVSTREAM_TAGHEADERSIZE - ((flvRemuxSample->track == FLVREMUXER_VIDEOTRACK) ? FLVREMUXER_AVCHEADERSIZE : FLVREMUXER_AACHEADERSIZE)) < 0)
+				return -1;
+			// AAC frames follow each other, their times don't drift with the rounding of the tags
+			flvRemuxIndex->fragments[flvRemuxIndex->numberOfFragments - 1].audioDecodeTime = audioStartTime + (uint64_t)audioSamples * FLVREMUXER_AACFRAMESIZE;
+			fragmentVideo = false;
+		}
+		if (flvRemuxSample->track == FLVREMUXER_VIDEOTRACK)
+			fragmentVideo = true;
+		else
+			audioSamples++;
+	}
+
+	return 0;
+}
+
+// Return NULL if the file is not a FLV, has other codecs than H.264 and AAC or has no sample
+struct FlvRemuxIndex *FlvRemuxer::buildRemuxIndex(void) {
+	struct FlvRemuxIndex *flvRemuxIndex;
+	const unsigned char *ptrChar;
+	uint32_t samplesSize = 0;
+	uint32_t sample;
+	off_t bodyEnd;
+	int32_t compositionTime;
+	bool keyFrameFound = false;
+	bool supported = true;
+
+	if ((! mmapedFile) || (! flvHeader) || (! flvStream))
+		return NULL;
+	filePosition = 0;
+	if (flvHeader->process() < 0) {
+		systemLog->sysLog(ERROR, "[%d] cannot process the FlvHeader", fileDescriptor);
+		return NULL;
+	}
+	flvRemuxIndex = (struct FlvRemuxIndex *)calloc(1, sizeof(struct FlvRemuxIndex));
+	if (! flvRemuxIndex) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a FlvRemuxIndex object: %s", strerror(errno));
+		return NULL;
+	}
+
+	filePosition = flvHeader->offset;
+	while ((supported == true) && (flvStream->process() == 0)) {
+		bodyEnd = filePosition + flvStream->bodyLength;
+		ptrChar = (const unsigned char *)&mmapedFile[filePosition];
+		if (flvStream->type == TYPE_VIDEO) {
+			if (flvStream->codecId != CODEC_AVC)
+				supported = false;
+			else
+			if (flvStream->isSequenceHeader()) {
+				// Only the first configuration is used
+				if ((! flvRemuxIndex->avcConfig) && (flvStream->bodyLength > FLVREMUXER_AVCHEADERSIZE) && (readAvcConfig(flvRemuxIndex, filePosition + FLVREMUXER_AVCHEADERSIZE, flvStream->bodyLength - FLVREMUXER_AVCHEADERSIZE) < 0))
+					supported = false;
+			}
+			else
+			if ((flvStream->packetType == 1) && flvRemuxIndex->avcConfig && (flvStream->bodyLength > FLVREMUXER_AVCHEADERSIZE)) {
+				// Frames before the first keyframe cannot be decoded
+				if (flvStream->frameType == FRAME_KEY)
+					keyFrameFound = true;
+				// Signed 24 bits
+				compositionTime = (int32_t)((((uint32_t)ptrChar[2] << 24) | ((uint32_t)ptrChar[3] << 16) | ((uint32_t)ptrChar[4] << 8))) >> 8;
+				if ((keyFrameFound == true) && (appendSample(flvRemuxIndex, &samplesSize, filePosition + FLVREMUXER_AVCHEADERSIZE, flvStream->bodyLength - FLVREMUXER_AVCHEADERSIZE, flvStream->timestamp, compositionTime, FLVREMUXER_VIDEOTRACK, flvStream->frameType == FRAME_KEY) < 0))
+					break;
+			}
+		}
+		else
+		if (flvStream->type == TYPE_AUDIO) {
+			if (flvStream->soundFormat != SOUND_AAC)
+				supported = false;
+			else
+			if (flvStream->isSequenceHeader()) {
+				if ((! flvRemuxIndex->aacConfig) && (readAacConfig(flvRemuxIndex, filePosition + FLVREMUXER_AACHEADERSIZE, flvStream->bodyLength - FLVREMUXER_AACHEADERSIZE) < 0))
+					supported = false;
+			}
+			else
+			if (flvRemuxIndex->aacConfig && (flvStream->bodyLength > FLVREMUXER_AACHEADERSIZE)) {
+				if (appendSample(flvRemuxIndex, &samplesSize, filePosition + FLVREMUXER_AACHEADERSIZE, flvStream->bodyLength - FLVREMUXER_AACHEADERSIZE, flvStream->timestamp, 0, FLVREMUXER_AUDIOTRACK, true) < 0)
+					break;
+			}
+		}
+		filePosition = bodyEnd;
+	}
+
+	if (supported == false) {
+		systemLog->sysLog(ERROR, "[%d] only H.264 and AAC FLV files can be remuxed", fileDescriptor);
+		destroyRemuxIndex(flvRemuxIndex);
+		return NULL;
+	}
+	if ((! flvRemuxIndex->numberOfSamples) || (buildFragments(flvRemuxIndex) < 0)) {
+		systemLog->sysLog(ERROR, "[%d] no sample to remux in the FLV file", fileDescriptor);
+		destroyRemuxIndex(flvRemuxIndex);
+		return NULL;
+	}
+	sample = flvRemuxIndex->numberOfSamples - 1;
+	flvRemuxIndex->endPosition = flvRemuxIndex->samples[sample].position + flvRemuxIndex->samples[sample].size;
+	for (sample = 0; sample < flvRemuxIndex->numberOfSamples; sample++) {
+		if (flvRemuxIndex->samples[sample].timestamp > flvRemuxIndex->duration)
+			flvRemuxIndex->duration = flvRemuxIndex->samples[sample].timestamp;
+	}
+	flvRemuxIndex->memoryUsage = sizeof(struct FlvRemuxIndex) + flvRemuxIndex->numberOfSamples * sizeof(struct FlvRemuxSample) + flvRemuxIndex->numberOfFragments * sizeof(struct FlvRemuxFragment) + flvRemuxIndex->avcConfigSize + flvRemuxIndex->aacConfigSize;
+
+	return flvRemuxIndex;
+}
+
+// Last fragment starting at or before the timestamp in milliseconds, the first one if the timestamp is before it
+uint32_t FlvRemuxer::searchFragmentByTime(struct FlvRemuxIndex const *flvRemuxIndex, uint32_t timestamp) {
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t middle;
+
+	high = flvRemuxIndex->numberOfFragments;
+	while (high - low > 1) {
+		middle = low + (high - low) / 2;
+		if (flvRemuxIndex->fragments[middle].timestamp <= timestamp)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+// ftyp and moov without samples, the movie lasts from the first fragment sent
+int FlvRemuxer::getInitSegment(struct FlvRemuxIndex const *flvRemuxIndex, uint32_t firstFragment, char **initSegment, uint32_t *initSegmentSize) {
+	unsigned char *buffer;
+	unsigned char *ptr;
+	unsigned char *moov;
+	unsigned char *trak;
+	unsigned char *mdia;
+	unsigned char *minf;
+	unsigned char *dinf;
+	unsigned char *stbl;
+	unsigned char *box;
+	unsigned char *entry;
+	unsigned char *mvex;
+	uint32_t duration;
+	uint32_t track;
+	uint32_t configSize;
+	static const char compressorName[32] = { 0 };
+
+	duration = flvRemuxIndex->duration - flvRemuxIndex->fragments[firstFragment].timestamp;
+	buffer = (unsigned char *)malloc(2048 + flvRemuxIndex->avcConfigSize + flvRemuxIndex->aacConfigSize);
+	if (! buffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate the init segment: %s", strerror(errno));
+		return -1;
+	}
+	ptr = openBox(buffer, "ftyp");
+	ptr = writeBytes(ptr, "isom", 4);
+	ptr = writeInt32(ptr, 0x200);
+	ptr = writeBytes(ptr, "isomiso6avc1mp41", 16);
+	closeBox(buffer, ptr);
+
+	moov = ptr;
+	ptr = openBox(ptr, "moov");
+	box = ptr;
+	ptr = openFullBox(ptr, "mvhd", 0, 0);
+	ptr = writeInt32(ptr, 0);
+	ptr = writeInt32(ptr, 0);
+	ptr = writeInt32(ptr, 1000);
+	ptr = writeInt32(ptr, duration);
+	ptr = writeInt32(ptr, 0x00010000);
+	ptr = writeInt16(ptr, 0x0100);
+	memset(ptr, 0, 10);
+	ptr += 10;
+	ptr = writeMatrix(ptr);
+	memset(ptr, 0, 24);
+	ptr += 24;
+	ptr = writeInt32(ptr, FLVREMUXER_AUDIOTRACK + 1);
+	closeBox(box, ptr);
+
+	for (track = FLVREMUXER_VIDEOTRACK; track <= FLVREMUXER_AUDIOTRACK; track++) {
+		if ((track == FLVREMUXER_VIDEOTRACK) && (! flvRemuxIndex->avcConfig))
+			continue;
+		if ((track == FLVREMUXER_AUDIOTRACK) && (! flvRemuxIndex->aacConfig))
+			continue;
+		trak = ptr;
+		ptr = openBox(ptr, "trak");
+		box = ptr;
+		ptr = openFullBox(ptr, "tkhd", 0, 3);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, track);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, duration);
+		memset(ptr, 0, 12);
+		ptr += 12;
+		ptr = writeInt16(ptr, (track == FLVREMUXER_AUDIOTRACK) ? 0x0100 : 0);
+		ptr = writeInt16(ptr, 0);
+		ptr = writeMatrix(ptr);
+		ptr = writeInt32(ptr, (track == FLVREMUXER_VIDEOTRACK) ? flvRemuxIndex->width << 16 : 0);
+		ptr = writeInt32(ptr, (track == FLVREMUXER_VIDEOTRACK) ? flvRemuxIndex->height << 16 : 0);
+		closeBox(box, ptr);
+
+		mdia = ptr;
+		ptr = openBox(ptr, "mdia");
+		box = ptr;
+		ptr = openFullBox(ptr, "mdhd", 0, 0);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, (track == FLVREMUXER_VIDEOTRACK) ? 1000 : flvRemuxIndex->sampleRate);
+		ptr = writeInt32(ptr, 0);
+		// Undetermined language
+		ptr = writeInt16(ptr, 0x55c4);
+		ptr = writeInt16(ptr, 0);
+		closeBox(box, ptr);
+		box = ptr;
+		ptr = openFullBox(ptr, "hdlr", 0, 0);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeBytes(ptr, (track == FLVREMUXER_VIDEOTRACK) ? "vide" : "soun", 4);
+		memset(ptr, 0, 12);
+		ptr += 12;
+		ptr = writeBytes(ptr, (track == FLVREMUXER_VIDEOTRACK) ? "VideoHandler" : "SoundHandler", 13);
+		closeBox(box, ptr);
+
+		minf = ptr;
+		ptr = openBox(ptr, "minf");
+		box = ptr;
+		if (track == FLVREMUXER_VIDEOTRACK) {
+			ptr = openFullBox(ptr, "vmhd", 0, 1);
+			memset(ptr, 0, 8);
+			ptr += 8;
+		}
+		else {
+			ptr = openFullBox(ptr, "smhd", 0, 0);
+			ptr = writeInt32(ptr, 0);
+		}
+		closeBox(box, ptr);
+		dinf = ptr;
+		ptr = openBox(ptr, "dinf");
+		box = ptr;
+		ptr = openFullBox(ptr, "dref", 0, 0);
+		ptr = writeInt32(ptr, 1);
+		// Media data is in the same file
+		entry = ptr;
+		ptr = openFullBox(ptr, "url ", 0, 1);
+		closeBox(entry, ptr);
+		closeBox(box, ptr);
+		closeBox(dinf, ptr);
+
+		stbl = ptr;
+		ptr = openBox(ptr, "stbl");
+		box = ptr;
+		ptr = openFullBox(ptr, "stsd", 0, 0);
+		ptr = writeInt32(ptr, 1);
+		entry = ptr;
+		if (track == FLVREMUXER_VIDEOTRACK) {
+			ptr = openBox(ptr, "avc1");
+			memset(ptr, 0, 6);
+			ptr += 6;
+			ptr = writeInt16(ptr, 1);
+			memset(ptr, 0, 16);
+			ptr += 16;
+			ptr = writeInt16(ptr, flvRemuxIndex->width);
+			ptr = writeInt16(ptr, flvRemuxIndex->height);
+			ptr = writeInt32(ptr, 0x00480000);
+			ptr = writeInt32(ptr, 0x00480000);
+			ptr = writeInt32(ptr, 0);
+			ptr = writeInt16(ptr, 1);
+			ptr = writeBytes(ptr, compressorName, sizeof(compressorName));
+			ptr = writeInt16(ptr, 0x18);
+			ptr = writeInt16(ptr, 0xffff);
+			ptr = writeInt32(ptr, 8 + flvRemuxIndex->avcConfigSize);
+			ptr = writeBytes(ptr, "avcC", 4);
+			ptr = writeBytes(ptr, flvRemuxIndex->avcConfig, flvRemuxIndex->avcConfigSize);
+		}
+		else {
+			ptr = openBox(ptr, "mp4a");
+			memset(ptr, 0, 6);
+			ptr += 6;
+			ptr = writeInt16(ptr, 1);
+			memset(ptr, 0, 8);
+			ptr += 8;
+			ptr = writeInt16(ptr, flvRemuxIndex->channels);
+			ptr = writeInt16(ptr, 16);
+			ptr = writeInt32(ptr, 0);
+			ptr = writeInt32(ptr, (flvRemuxIndex->sampleRate < 65536) ? flvRemuxIndex->sampleRate << 16 : 0);
+			// ES descriptor holding the decoder configuration and the AudioSpecificConfig
+			configSize = flvRemuxIndex->aacConfigSize;
+			ptr = openFullBox(ptr, "esds", 0, 0);
+			*ptr++ = 0x03;
+			*ptr++ = 3 + 2 + 13 + 2 + configSize + 3;
+			ptr = writeInt16(ptr, track);
+			*ptr++ = 0;
+			*ptr++ = 0x04;
+			*ptr++ = 13 + 2 + configSize;
+			// MPEG-4 audio, audio stream
+			*ptr++ = 0x40;
+			*ptr++ = 0x15;
+			memset(ptr, 0, 11);
+			ptr += 11;
+			*ptr++ = 0x05;
+			*ptr++ = configSize;
+			ptr = writeBytes(ptr, flvRemuxIndex->aacConfig, configSize);
+			*ptr++ = 0x06;
+			*ptr++ = 1;
+			*ptr++ = 0x02;
+			closeBox(entry + 8 + 28, ptr);
+		}
+		closeBox(entry, ptr);
+		closeBox(box, ptr);
+		// Sample tables are empty, the samples are in the fragments
+		box = ptr;
+		ptr = openFullBox(ptr, "stts", 0, 0);
+		ptr = writeInt32(ptr, 0);
+		closeBox(box, ptr);
+		box = ptr;
+		ptr = openFullBox(ptr, "stsc", 0, 0);
+		ptr = writeInt32(ptr, 0);
+		closeBox(box, ptr);
+		box = ptr;
+		ptr = openFullBox(ptr, "stsz", 0, 0);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, 0);
+		closeBox(box, ptr);
+		box = ptr;
+		ptr = openFullBox(ptr, "stco", 0, 0);
+		ptr = writeInt32(ptr, 0);
+		closeBox(box, ptr);
+		closeBox(stbl, ptr);
+		closeBox(minf, ptr);
+		closeBox(mdia, ptr);
+		closeBox(trak, ptr);
+	}
+
+	mvex = ptr;
+	ptr = openBox(ptr, "mvex");
+	box = ptr;
+	ptr = openFullBox(ptr, "mehd", 0, 0);
+	ptr = writeInt32(ptr, duration);
+	closeBox(box, ptr);
+	for (track = FLVREMUXER_VIDEOTRACK; track <= FLVREMUXER_AUDIOTRACK; track++) {
+		if ((track == FLVREMUXER_VIDEOTRACK) && (! flvRemuxIndex->avcConfig))
+			continue;
+		if ((track == FLVREMUXER_AUDIOTRACK) && (! flvRemuxIndex->aacConfig))
+			continue;
+		box = ptr;
+		ptr = openFullBox(ptr, "trex", 0, 0);
+		ptr = writeInt32(ptr, track);
+		ptr = writeInt32(ptr, 1);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, 0);
+		ptr = writeInt32(ptr, (track == FLVREMUXER_AUDIOTRACK) ? FLVREMUXER_SYNCSAMPLE : FLVREMUXER_NONSYNCSAMPLE);
+		closeBox(box, ptr);
+	}
+	closeBox(mvex, ptr);
+	closeBox(moov, ptr);
+
+	*initSegment = (char *)buffer;
+	*initSegmentSize = ptr - buffer;
+
+	return 0;
+}
+
+// Fragment header and the file bytes following it
+uint64_t FlvRemuxer::getFragmentSize(struct FlvRemuxIndex const *flvRemuxIndex, uint32_t fragment) {
+	uint32_t videoSamples;
+	uint32_t audioSamples;
+	uint64_t end;
+
+	end = (fragment + 1 < flvRemuxIndex->numberOfFragments) ? flvRemuxIndex->fragments[fragment + 1].position : flvRemuxIndex->endPosition;
+
+	return getFragmentHeaderSize(flvRemuxIndex, fragment, &videoSamples, &audioSamples) + (end - flvRemuxIndex->fragments[fragment].position);
+}
+
+// moof and mdat header of the fragment, the dataSize bytes of the file from its position follow it
+int FlvRemuxer::getFragment(struct FlvRemuxIndex const *flvRemuxIndex, uint32_t fragment, char **header, uint32_t *headerSize, uint64_t *dataSize) {
+	struct FlvRemuxFragment const *flvRemuxFragment;
+	struct FlvRemuxSample const *flvRemuxSample;
+	unsigned char *buffer;
+	unsigned char *ptr;
+	unsigned char *traf;
+	unsigned char *box;
+	uint32_t videoSamples;
+	uint32_t audioSamples;
+	uint32_t firstSample;
+	uint32_t lastSample;
+	uint32_t sample;
+	uint32_t track;
+	uint32_t moofSize;
+	uint64_t end;
+
+	flvRemuxFragment = &flvRemuxIndex->fragments[fragment];
+	firstSample = flvRemuxFragment->firstSample;
+	lastSample = (fragment + 1 < flvRemuxIndex->numberOfFragments) ? flvRemuxIndex->fragments[fragment + 1].firstSample : flvRemuxIndex->numberOfSamples;
+	end = (fragment + 1 < flvRemuxIndex->numberOfFragments) ? flvRemuxIndex->fragments[fragment + 1].position : flvRemuxIndex->endPosition;
+	*dataSize = end - flvRemuxFragment->position;
+	*headerSize = getFragmentHeaderSize(flvRemuxIndex, fragment, &videoSamples, &audioSamples);
+	// Sample offsets are 32 bits from the moof
+	if (*headerSize + *dataSize > INT_MAX)
+		return -1;
+	moofSize = *headerSize - FLVREMUXER_MDATHEADERSIZE;
+	buffer = (unsigned char *)malloc(*headerSize);
+	if (! buffer) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %u bytes for the fragment header: %s", *headerSize, strerror(errno));
+		return -1;
+	}
+
+	ptr = openBox(buffer, "moof");
+	box = ptr;
+	ptr = openFullBox(ptr, "mfhd", 0, 0);
+	ptr = writeInt32(ptr, fragment + 1);
+	closeBox(box, ptr);
+	for (track = FLVREMUXER_VIDEOTRACK; track <= FLVREMUXER_AUDIOTRACK; track++) {
+		if (! ((track == FLVREMUXER_VIDEOTRACK) ? videoSamples : audioSamples))
+			continue;
+		traf = ptr;
+		ptr = openBox(ptr, "traf");
+		// Default base is the moof
+		box = ptr;
+		ptr = openFullBox(ptr, "tfhd", 0, 0x020000);
+		ptr = writeInt32(ptr, track);
+		closeBox(box, ptr);
+		for (sample = firstSample; (sample < lastSample) && (flvRemuxIndex->samples[sample].track != track); sample++);
+		box = ptr;
+		ptr = openFullBox(ptr, "tfdt", 1, 0);
+		ptr = writeInt64(ptr, (track == FLVREMUXER_VIDEOTRACK) ? flvRemuxIndex->samples[sample].timestamp : flvRemuxFragment->audioDecodeTime);
+		closeBox(box, ptr);
+		for (; sample < lastSample; sample++) {
+			flvRemuxSample = &flvRemuxIndex->samples[sample];
+			if (flvRemuxSample->track != track)
+				continue;
+			box = ptr;
+			if (track == FLVREMUXER_VIDEOTRACK) {
+				// Data offset, duration, size, flags and signed composition offset
+				ptr = openFullBox(ptr, "trun", 1, 0x000f01);
+				ptr = writeInt32(ptr, 1);
+				ptr = writeInt32(ptr, moofSize + FLVREMUXER_MDATHEADERSIZE + (flvRemuxSample->position - flvRemuxFragment->position));
+				ptr = writeInt32(ptr, getVideoDuration(flvRemuxIndex, sample));
+				ptr = writeInt32(ptr, flvRemuxSample->size);
+				ptr = writeInt32(ptr, (flvRemuxSample->keyFrame == true) ? FLVREMUXER_SYNCSAMPLE : FLVREMUXER_NONSYNCSAMPLE);
+				ptr = writeInt32(ptr, (uint32_t)flvRemuxSample->compositionTime);
+			}
+			else {
+				ptr = openFullBox(ptr, "trun", 0, 0x000301);
+				ptr = writeInt32(ptr, 1);
+				ptr = writeInt32(ptr, moofSize + FLVREMUXER_MDATHEADERSIZE + (flvRemuxSample->position - flvRemuxFragment->position));
+				ptr = writeInt32(ptr, FLVREMUXER_AACFRAMESIZE);
+				ptr = writeInt32(ptr, flvRemuxSample->size);
+			}
+			closeBox(box, ptr);
+		}
+		closeBox(traf, ptr);
+	}
+	closeBox(buffer, ptr);
+	// mdat holds the tags of the fragment as they are in the file
+	ptr = writeInt32(ptr, (uint32_t)(FLVREMUXER_MDATHEADERSIZE + *dataSize));
+	ptr = writeBytes(ptr, "mdat", 4);
+
+	*header = (char *)buffer;
+
+	return 0;
+}
+
+void FlvRemuxer::destroyRemuxIndex(struct FlvRemuxIndex *flvRemuxIndex) {
+	free(flvRemuxIndex->samples);
+	free(flvRemuxIndex->fragments);
+	free(flvRemuxIndex->avcConfig);
+	free(flvRemuxIndex->aacConfig);
+	free(flvRemuxIndex);
+
+	return;
+}
@@ -0,0 +1,107 @@
+//
+// C++ Interface: flvremuxer
+//
+// Description: fragmented mp4 output of a H.264/AAC FLV file without
+// transcoding, one moof and mdat per GOP, the mdat wraps the tags of the
+// GOP as they are in the file and the sample offsets skip their headers
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef FLVREMUXER_H
+#define FLVREMUXER_H
+
+#include <sys/types.h>
+
+#include "log.h"
+#include "flvstream.h"
+#include "flvheader.h"
+
+// Body bytes in front of the sample: flags, packet type and composition time for AVC
+#define FLVREMUXER_AVCHEADERSIZE 5
+#define FLVREMUXER_AACHEADERSIZE 2
+// Fragment length of files without video, in ms
+#define FLVREMUXER_AUDIOFRAGMENT 2000
+// Samples of one AAC frame
+#define FLVREMUXER_AACFRAMESIZE 1024
+// Used when a video track has a single sample, in ms
+#define FLVREMUXER_VIDEODURATION 40
+
+#define FLVREMUXER_VIDEOTRACK 1
+#define FLVREMUXER_AUDIOTRACK 2
+
+struct FlvRemuxSample {
+	// Sample data in the file, after the tag and packet headers
+	uint64_t position;
+	uint32_t size;
+	// Decode time in ms
+	uint32_t timestamp;
+	int32_t compositionTime;
+	unsigned char track;
+	bool keyFrame;
+};
+
+struct FlvRemuxFragment {
+	// First tag of the fragment, the fragment ends on the first tag of the next one
+	uint64_t position;
+	uint32_t firstSample;
+	uint32_t timestamp;
+	// Decode time of its first AAC frame, in samples
+	uint64_t audioDecodeTime;
+};
+
+struct FlvRemuxIndex {
+	uint32_t numberOfSamples;
+	struct FlvRemuxSample *samples;
+	uint32_t numberOfFragments;
+	struct FlvRemuxFragment *fragments;
+	// End of the last tag of the last fragment
+	uint64_t endPosition;
+	// avcC body and AudioSpecificConfig from the sequence headers, NULL without the track
+	unsigned char *avcConfig;
+	uint32_t avcConfigSize;
+	unsigned char *aacConfig;
+	uint32_t aacConfigSize;
+	uint32_t width;
+	uint32_t height;
+	uint32_t sampleRate;
+	uint32_t channels;
+	// In milliseconds
+	uint32_t duration;
+	size_t memoryUsage;
+};
+
+/**
+	@author  <spe@>
+*/
+class FlvRemuxer{
+private:
+	int fileDescriptor;
+	off_t fileSize;
+	FlvHeader *flvHeader;
+	FlvStream *flvStream;
+	char *mmapedFile;
+	off_t filePosition;
+
+	int appendSample(struct FlvRemuxIndex *, uint32_t *, uint64_t, uint32_t, uint32_t, int32_t, unsigned char, bool);
+	int appendFragment(struct FlvRemuxIndex *, uint32_t *, uint32_t, uint64_t);
+	int readAvcConfig(struct FlvRemuxIndex *, off_t, uint32_t);
+	int readAacConfig(struct FlvRemuxIndex *, off_t, uint32_t);
+	int buildFragments(struct FlvRemuxIndex *);
+
+public:
+	FlvRemuxer(int, off_t);
+	~FlvRemuxer();
+
+	struct FlvRemuxIndex *buildRemuxIndex(void);
+	static uint32_t searchFragmentByTime(struct FlvRemuxIndex const *, uint32_t);
+	static int getInitSegment(struct FlvRemuxIndex const *, uint32_t, char **, uint32_t *);
+	static uint64_t getFragmentSize(struct FlvRemuxIndex const *, uint32_t);
+	static int getFragment(struct FlvRemuxIndex const *, uint32_t, char **, uint32_t *, uint64_t *);
+	static void destroyRemuxIndex(struct FlvRemuxIndex *);
+};
+
+#endif
@@ -12,14 +12,14 @@
 
 #include <unistd.h>
 #include <errno.h>
-#include <netinet/in.h>
 
 #include "log.h"
 #include "flvstream.h"
 
-FlvStream::FlvStream(char *_mmapedFile, int *_filePosition) {
+FlvStream::FlvStream(char *_mmapedFile, off_t *_filePosition, off_t _fileSize) {
 	mmapedFile = _mmapedFile;
 	filePosition = _filePosition;
+	fileSize = _fileSize;
 
 	return;
 }
@@ -29,51 +29,46 @@ FlvStream::~FlvStream() {
 	return;
 }
 
+// Read the previous tag size and the next tag header, the position is left on the body
+// Return -1 at the end of the file or if the tag goes past it
 int FlvStream::process(void) {
-	uint32_t *ptrInt;
 	u_char *ptrChar;
 
-	ptrInt = (uint32_t *)&mmapedFile[*filePosition];
-	(*filePosition) += sizeof(*ptrInt);
-	previousTagSize = *ptrInt;
-	// Bid Endian to Little Endian conversion
-	previousTagSize = ntohl(previousTagSize);
+	if (*filePosition + FLVSTREAM_PREVIOUSTAGSIZE + FLVSTREAM_TAGHEADERSIZE > fileSize)
+		return -1;
 	ptrChar = (u_char *)&mmapedFile[*filePosition];
-	(*filePosition) += sizeof(*ptrChar);
-	type = *ptrChar;
-	bodyLengthBytes[0] = 0;
-	bodyLengthBytes[1] = mmapedFile[*filePosition];
-	(*filePosition)++;
-	bodyLengthBytes[2] = mmapedFile[*filePosition];
-	(*filePosition)++;
-	bodyLengthBytes[3] = mmapedFile[*filePosition];
-	(*filePosition)++;
-	ptrInt = (uint32_t *)bodyLengthBytes;
-	bodyLength = *ptrInt;
-	// Big Endian to Little Endian conversion
-	bodyLength = ntohl(bodyLength);
-	timestampBytes[0] = 0;
-	timestampBytes[1] = mmapedFile[*filePosition];
-	(*filePosition)++;
-	timestampBytes[2] = mmapedFile[*filePosition];
-	(*filePosition)++;
-	timestampBytes[3] = mmapedFile[*filePosition];
-	(*filePosition)++;
-	ptrInt = (uint32_t *)timestampBytes;
-	timestamp = *ptrInt;
-	// Big Endian to Little Endian conversion
-	timestamp = ntohl(timestamp);
-	ptrInt = (uint32_t *)&mmapedFile[*filePosition];
-	padding = *ptrInt;
-	(*filePosition) += sizeof(padding);
+	// Big Endian, 24 bits fields, the timestamp is extended by its fourth byte
+	previousTagSize = ((uint32_t)ptrChar[0] << 24) | ((uint32_t)ptrChar[1] << 16) | ((uint32_t)ptrChar[2] << 8) | ptrChar[3];
+	tagPosition = *filePosition + FLVSTREAM_PREVIOUSTAGSIZE;
+	ptrChar += FLVSTREAM_PREVIOUSTAGSIZE;
+	// Upper bits are the filter and reserved flags
+	type = ptrChar[0] & 0x1f;
+	bodyLength = ((uint32_t)ptrChar[1] << 16) | ((uint32_t)ptrChar[2] << 8) | ptrChar[3];
+	timestamp = ((uint32_t)ptrChar[7] << 24) | ((uint32_t)ptrChar[4] << 16) | ((uint32_t)ptrChar[5] << 8) | ptrChar[6];
+	streamId = ((uint32_t)ptrChar[8] << 16) | ((uint32_t)ptrChar[9] << 8) | ptrChar[10];
+	(*filePosition) = tagPosition + FLVSTREAM_TAGHEADERSIZE;
+	if (*filePosition + bodyLength > fileSize)
+		return -1;
 
+	codecId = 0;
+	frameType = 0;
+	soundFormat = 0;
+	packetType = 0xff;
+	ptrChar = (u_char *)&mmapedFile[*filePosition];
 	switch (type) {
 		case TYPE_AUDIO:
+			if (bodyLength >= 1)
+				soundFormat = (ptrChar[0] & 0xf0) >> 4;
+			if ((soundFormat == SOUND_AAC) && (bodyLength >= 2))
+				packetType = ptrChar[1];
 			break;
 		case TYPE_VIDEO:
-			codecId = (mmapedFile[*filePosition] & 0x0f) >> 0;
-			frameType = (mmapedFile[*filePosition] & 0xf0) >> 4;
-			printVideo();
+			if (bodyLength >= 1) {
+				codecId = (ptrChar[0] & 0x0f) >> 0;
+				frameType = (ptrChar[0] & 0xf0) >> 4;
+			}
+			if ((codecId == CODEC_AVC) && (bodyLength >= 2))
+				packetType = ptrChar[1];
 			break;
 		case TYPE_META:
 			break;
@@ -82,12 +77,22 @@ int FlvStream::process(void) {
 	return 0;
 }
 
+// Decoder configuration a player needs before any frame of the codec
+bool FlvStream::isSequenceHeader(void) {
+	if ((type == TYPE_VIDEO) && (codecId == CODEC_AVC) && (packetType == PACKET_SEQUENCE_HEADER))
+		return true;
+	if ((type == TYPE_AUDIO) && (soundFormat == SOUND_AAC) && (packetType == PACKET_SEQUENCE_HEADER))
+		return true;
+
+	return false;
+}
+
 void FlvStream::print(void) {
 	systemLog->sysLog(INFO, "previousTagSize	: %u", previousTagSize);
 	systemLog->sysLog(INFO, "type		: 0x%.2X", type);
 	systemLog->sysLog(INFO, "bodyLength	: %u", bodyLength);
 	systemLog->sysLog(INFO, "timestamp	: %u", timestamp);
-	systemLog->sysLog(INFO, "padding		: 0x%.8X", padding);
+	systemLog->sysLog(INFO, "streamId	: %u", streamId);
 
 	return;
 }
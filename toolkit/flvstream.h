@@ -12,6 +12,8 @@
 #ifndef FLVSTREAM_H
 #define FLVSTREAM_H
 
+#include <sys/types.h>
+
 #define TYPE_VIDEO 0x09
 #define TYPE_AUDIO 0x08
 #define TYPE_META 0x12
@@ -19,36 +21,51 @@
 #define CODEC_SORENSEN 2
 #define CODEC_SCREEN_VIDEO 3
 #define CODEC_ON2_VP6 4
+#define CODEC_AVC 7
+
+#define SOUND_AAC 10
 
 #define FRAME_KEY 1
 #define FRAME_INTER 2
 #define FRAME_DISPOSABLE_INTER 3
 
+// AVC and AAC packets: decoder configuration or media data
+#define PACKET_SEQUENCE_HEADER 0
+
+// Previous tag size and tag header
+#define FLVSTREAM_TAGHEADERSIZE 11
+#define FLVSTREAM_PREVIOUSTAGSIZE 4
+
 /**
 	@author  <spe@>
 */
 class FlvStream{
 private:
 	char *mmapedFile;
-	int *filePosition;
+	off_t *filePosition;
+	off_t fileSize;
 
 public:
 	uint32_t previousTagSize;
 	u_char type;
-	char bodyLengthBytes[4];
 	uint32_t bodyLength;
-	char timestampBytes[4];
 	uint32_t timestamp;
-	uint32_t padding;
+	uint32_t streamId;
+	off_t tagPosition;
 
 	// Video packet
 	u_char codecId;
 	u_char frameType;
+	// Audio packet
+	u_char soundFormat;
+	// AVC or AAC packet type
+	u_char packetType;
 
-	FlvStream(char *, int *);
+	FlvStream(char *, off_t *, off_t);
 	~FlvStream();
 
 	int process(void);
+	bool isSequenceHeader(void);
 	void print(void);
 	void printVideo(void);
 };
@@ -9,11 +9,69 @@
 // Copyright: See COPYING file that comes with this distribution
 //
 //
+#include <string.h>
+
 #include "hashalgorithm.h"
 
+static const char *algorithmNames[] = { "", "paulhsieh", "wyhash", "xxhash32", NULL };
+
+// Unaligned little endian loads for wyhash and xxhash32
+static inline uint64_t read64(const char *p) {
+	uint64_t value;
+
+	memcpy(&value, p, sizeof(value));
+
+	return value;
+}
+
+static inline uint32_t read32(const char *p) {
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+
+	return value;
+}
+
+static inline uint32_t rotl32(uint32_t value, int bits) {
+	return (value << bits) | (value >> (32 - bits));
+}
+
+// 64x64 bits multiplication, low half in *a and high half in *b
+static inline void wyMum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t r;
+
+	r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha, hb, la, lb, rh, rm0, rm1, rl, t, c;
+
+	ha = *a >> 32;
+	hb = *b >> 32;
+	la = (uint32_t)*a;
+	lb = (uint32_t)*b;
+	rh = ha * hb;
+	rm0 = ha * lb;
+	rm1 = hb * la;
+	rl = la * lb;
+	t = rl + (rm0 << 32);
+	c = t < rl;
+	*a = t + (rm1 << 32);
+	c += *a < t;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wyMix(uint64_t a, uint64_t b) {
+	wyMum(&a, &b);
+
+	return a ^ b;
+}
+
 HashAlgorithm::HashAlgorithm(unsigned int _algorithmType) {
 	hashAlgorithmInitialized = false;
-	if (_algorithmType > ALGO_END) {
+	if ((! _algorithmType) || (_algorithmType >= ALGO_END)) {
 		systemLog->sysLog(ERROR, "algorithm type (%d) is unknown", _algorithmType);
 		systemLog->sysLog(ERROR, "cannot initialize HashAlgorithm object");
 		return;
@@ -29,13 +87,28 @@ HashAlgorithm::~HashAlgorithm() {
 }
 
 uint32_t HashAlgorithm::run(const char *key) {
+	if (! key) {
+		systemLog->sysLog(ERROR, "data is NULL. Cannot hash a NULL char * pointer");
+		return 0;
+	}
+
+	return run(key, strlen(key));
+}
+
+uint32_t HashAlgorithm::run(const char *key, size_t keyLength) {
 	if (hashAlgorithmInitialized == false) {
 		systemLog->sysLog(ERROR, "HashAlgorithm object is not initialized properly");
 		return 0;
 	}
 	switch (algorithmType) {
 		case ALGO_PAULHSIEH:
-			return SuperFastHash(key);
+			return SuperFastHash(key, keyLength);
+			break;
+		case ALGO_WYHASH:
+			return wyHash(key, keyLength);
+			break;
+		case ALGO_XXHASH32:
+			return xxHash32(key, keyLength);
 			break;
 	}
 
@@ -43,7 +116,19 @@ uint32_t HashAlgorithm::run(const char *key) {
 	return 0;
 }
 
-uint32_t HashAlgorithm::SuperFastHash (const char *data) {
+// Algorithm type from its configuration name, 0 if the name is unknown
+unsigned int HashAlgorithm::getAlgorithmType(const char *algorithmName) {
+	unsigned int i;
+
+	for (i = ALGO_PAULHSIEH; algorithmNames[i]; i++) {
+		if (! strcasecmp(algorithmName, algorithmNames[i]))
+			return i;
+	}
+
+	return 0;
+}
+
+uint32_t HashAlgorithm::SuperFastHash (const char *data, size_t dataLength) {
 	uint32_t hash, tmp, len;
 	int rem;
 
@@ -52,7 +137,7 @@ uint32_t HashAlgorithm::SuperFastHash (const char *data) {
 		return 0;
 	}
 
-	len = strlen(data);
+	len = dataLength;
 	hash = len;
 
 	rem = len & 3;
@@ -97,3 +182,105 @@ uint32_t HashAlgorithm::SuperFastHash (const char *data) {
 	return hash;
 }
 
+
+// wyhash (public domain, Wang Yi), folded to 32 bits
+uint32_t HashAlgorithm::wyHash(const char *data, size_t len) {
+	static const uint64_t secret[4] = { 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t seed = 0;
+	uint64_t see1;
+	uint64_t see2;
+	uint64_t a;
+	uint64_t b;
+	uint64_t hash;
+	size_t i;
+
+	seed ^= wyMix(seed ^ secret[0], secret[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = ((uint64_t)read32(data) << 32) | read32(data + ((len >> 3) << 2));
+			b = ((uint64_t)read32(data + len - 4) << 32) | read32(data + len - 4 - ((len >> 3) << 2));
+		}
+		else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else {
+		i = len;
+		if (i > 48) {
+			see1 = seed;
+			see2 = seed;
+			do {
+				seed = wyMix(read64(data) ^ secret[1], read64(data + 8) ^ seed);
+				see1 = wyMix(read64(data + 16) ^ secret[2], read64(data + 24) ^ see1);
+				see2 = wyMix(read64(data + 32) ^ secret[3], read64(data + 40) ^ see2);
+				data += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wyMix(read64(data) ^ secret[1], read64(data + 8) ^ seed);
+			data += 16;
+			i -= 16;
+		}
+		a = read64(data + i - 16);
+		b = read64(data + i - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	wyMum(&a, &b);
+	hash = wyMix(a ^ secret[0] ^ len, b ^ secret[1]);
+
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// xxHash32 (BSD license, Yann Collet), seed 0
+uint32_t HashAlgorithm::xxHash32(const char *data, size_t len) {
+	static const uint32_t prime1 = 2654435761U;
+	static const uint32_t prime2 = 2246822519U;
+	static const uint32_t prime3 = 3266489917U;
+	static const uint32_t prime4 = 668265263U;
+	static const uint32_t prime5 = 374761393U;
+	const char *end = data + len;
+	uint32_t v1, v2, v3, v4;
+	uint32_t hash;
+
+	if (len >= 16) {
+		v1 = prime1 + prime2;
+		v2 = prime2;
+		v3 = 0;
+		v4 = -prime1;
+		do {
+			v1 = rotl32(v1 + read32(data) * prime2, 13) * prime1;
+			v2 = rotl32(v2 + read32(data + 4) * prime2, 13) * prime1;
+			v3 = rotl32(v3 + read32(data + 8) * prime2, 13) * prime1;
+			v4 = rotl32(v4 + read32(data + 12) * prime2, 13) * prime1;
+			data += 16;
+		} while (data <= end - 16);
+		hash = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+	}
+	else
+		hash = prime5;
+	hash += (uint32_t)len;
+	while (data + 4 <= end) {
+		hash += read32(data) * prime3;
+		hash = rotl32(hash, 17) * prime4;
+		data += 4;
+	}
+	while (data < end) {
+		hash += (unsigned char)*data * prime5;
+		hash = rotl32(hash, 11) * prime1;
+		data++;
+	}
+	hash ^= hash >> 15;
+	hash *= prime2;
+	hash ^= hash >> 13;
+	hash *= prime3;
+	hash ^= hash >> 16;
+
+	return hash;
+}
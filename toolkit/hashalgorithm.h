@@ -18,7 +18,9 @@
 
 #define get16bits(d) (*((const uint16_t *) (d)))
 #define ALGO_PAULHSIEH 1
-#define ALGO_END 2
+#define ALGO_WYHASH 2
+#define ALGO_XXHASH32 3
+#define ALGO_END 4
 
 // Externals
 extern LogError *systemLog;
@@ -29,7 +31,9 @@ extern LogError *systemLog;
 class HashAlgorithm {
 private:
 	bool hashAlgorithmInitialized;
-	uint32_t SuperFastHash (const char *data);
+	uint32_t SuperFastHash (const char *data, size_t len);
+	uint32_t wyHash(const char *, size_t);
+	uint32_t xxHash32(const char *, size_t);
 	unsigned int algorithmType;
 
 public:
@@ -37,6 +41,10 @@ public:
 	~HashAlgorithm();
 
 	uint32_t run(const char *);
+	// For callers that already know the key length
+	uint32_t run(const char *, size_t);
+	unsigned int getAlgorithmType(void) { return algorithmType; };
+	static unsigned int getAlgorithmType(const char *);
 };
 
 #endif
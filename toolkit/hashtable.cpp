@@ -16,6 +16,7 @@
  ***************************************************************************/
 
 #include <errno.h>
+#include <new>
 
 #include "hashtable.h"
 
@@ -34,7 +35,51 @@ HashTable::HashTable(HashAlgorithm *_hashAlgorithm, int _hashTableSize) {
 	hashAlgorithm = _hashAlgorithm;
 	numberOfElements = 0;
 	numberOfCollisions = 0;
+	numberOfResizes = 0;
+	epochManager = NULL;
+	prefixIndex = NULL;
+	slabAllocator = new SlabAllocator();
+	if (! slabAllocator) {
+		systemLog->sysLog(CRITICAL, "cannot create a SlabAllocator object here, can't initialize Hashtable object");
+		return;
+	}
 	hashTableSize = _hashTableSize;
+	initialHashTableSize = _hashTableSize;
+	maxHashTableSize = _hashTableSize;
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object here, can't initialize Hashtable object");
+		return;
+	}
+	hashTableInitialized = true;
+	
+	return;
+}
+
+// Growing hashtable: the bucket array doubles until _maxHashTableSize when chains become too long
+// Sizes are masks (power of two minus one)
+HashTable::HashTable(HashAlgorithm *_hashAlgorithm, int _hashTableSize, int _maxHashTableSize) {
+	hashTableInitialized = false;
+
+	hashTable = (int **)calloc(_hashTableSize+1, sizeof(int *));
+	if (! hashTable) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a hashTable object: %s", strerror(errno));
+		return;
+	}
+	hashAlgorithm = _hashAlgorithm;
+	numberOfElements = 0;
+	numberOfCollisions = 0;
+	numberOfResizes = 0;
+	epochManager = NULL;
+	prefixIndex = NULL;
+	slabAllocator = new SlabAllocator();
+	if (! slabAllocator) {
+		systemLog->sysLog(CRITICAL, "cannot create a SlabAllocator object here, can't initialize Hashtable object");
+		return;
+	}
+	hashTableSize = _hashTableSize;
+	initialHashTableSize = _hashTableSize;
+	maxHashTableSize = (_maxHashTableSize > _hashTableSize) ? _maxHashTableSize : _hashTableSize;
 	mutex = new Mutex();
 	if (! mutex) {
 		systemLog->sysLog(CRITICAL, "cannot create a Mutex object here, can't initialize Hashtable object");
@@ -50,51 +95,160 @@ HashTable::~HashTable() {
 		free(hashTable);
 	if (mutex)
 		delete mutex;
+	if (slabAllocator)
+		delete slabAllocator;
 
 	return;
 }
 
+// Element, key and inline data share one slab block
+static void destroyHashTableElt(void *hashTableElt) {
+	((HashTableElt *)hashTableElt)->~HashTableElt();
+	SlabAllocator::release(hashTableElt);
+}
+
+// Must be called with the hashtable locked, data is copied in the element when dataSize is not 0
+HashTableElt *HashTable::allocateElt(char *key, void *data, size_t dataSize) {
+	HashTableElt *hashTableElt;
+	char *block;
+	size_t dataOffset;
+	size_t keyOffset;
+	size_t keySize;
+
+	keySize = strlen(key) + 1;
+	dataOffset = (sizeof(HashTableElt) + 15) & ~15;
+	keyOffset = dataOffset + dataSize;
+	block = (char *)slabAllocator->allocate(keyOffset + keySize);
+	if (! block)
+		return NULL;
+	hashTableElt = new (block) HashTableElt();
+	if (dataSize) {
+		memcpy(block + dataOffset, data, dataSize);
+		hashTableElt->setData(block + dataOffset);
+		hashTableElt->setDataInline(true);
+	}
+	else
+		hashTableElt->setData(data);
+	memcpy(block + keyOffset, key, keySize);
+	hashTableElt->setKey(block + keyOffset);
+
+	return hashTableElt;
+}
+
+void HashTable::addPrefixIndex(HashTableElt *hashTableElt) {
+	if (prefixIndex && (prefixIndex->insert(hashTableElt->getKey(), hashTableElt) < 0))
+		systemLog->sysLog(ERROR, "cannot add key '%s' to the prefix index", hashTableElt->getKey());
+
+	return;
+}
+
+// Removed elements can still be walked by lockless readers, they are freed later
+void HashTable::destroyElt(HashTableElt *hashTableElt) {
+	if (prefixIndex)
+		prefixIndex->remove(hashTableElt->getKey());
+	if (epochManager)
+		epochManager->retire(hashTableElt, destroyHashTableElt);
+	else
+		destroyHashTableElt(hashTableElt);
+
+	return;
+}
+
+// Free the data of a removed element
+void HashTable::freeData(void *data) {
+	if (epochManager)
+		epochManager->retire(data, free);
+	else
+		free(data);
+
+	return;
+}
+
+
+// Must be called with the hashtable locked, like add()
+int HashTable::resize(unsigned int newHashTableSize) {
+	int **newHashTable;
+	unsigned int i;
+	uint32_t newHashPosition;
+	HashTableElt *hashTableEltPtr;
+	HashTableElt *hashTableEltNext;
+
+	newHashTable = (int **)calloc(newHashTableSize+1, sizeof(int *));
+	if (! newHashTable) {
+		systemLog->sysLog(ERROR, "cannot grow hashtable to %u buckets: %s", newHashTableSize+1, strerror(errno));
+		return -1;
+	}
+	numberOfCollisions = 0;
+	for (i = 0; i <= hashTableSize; i++) {
+		hashTableEltPtr = (HashTableElt *)hashTable[i];
+		while (hashTableEltPtr) {
+			hashTableEltNext = hashTableEltPtr->getNext();
+			newHashPosition = hashTableEltPtr->getHash() & newHashTableSize;
+			if (newHashTable[newHashPosition])
+				numberOfCollisions++;
+			hashTableEltPtr->setNext((HashTableElt *)newHashTable[newHashPosition]);
+			newHashTable[newHashPosition] = (int *)hashTableEltPtr;
+			hashTableEltPtr = hashTableEltNext;
+		}
+	}
+	// Lockless readers load the size before the array, a bigger array with the old size is valid
+	if (epochManager)
+		epochManager->retire(hashTable, free);
+	else
+		free(hashTable);
+	hashTable = newHashTable;
+	__sync_synchronize();
+	hashTableSize = newHashTableSize;
+	numberOfResizes++;
+	systemLog->sysLog(INFO, "hashtable grows to %u buckets for %d elements", hashTableSize+1, numberOfElements);
+
+	return 0;
+}
 
 HashTableElt *HashTable::add(char *keyProut, void *data, uint32_t *hashPosition) {
+	return add(keyProut, data, 0, hashPosition);
+}
+
+// With dataSize, the data is copied in the element and goes away with it
+HashTableElt *HashTable::add(char *keyProut, void *data, size_t dataSize, uint32_t *hashPosition) {
 	HashTableElt *hashTableElt;
 	HashTableElt *hashTableEltPtr;
-	char *keyCopy;
-	unsigned int keySize;
+	uint32_t hash;
+
+	// Average chain longer than 2 elements, double the number of buckets
+	if (((unsigned int)numberOfElements > ((hashTableSize + 1) << 1)) && (hashTableSize < maxHashTableSize))
+		resize((hashTableSize << 1) | 1);
 
-	*hashPosition = hashAlgorithm->run(keyProut) & hashTableSize;
+	hash = hashAlgorithm->run(keyProut);
+	*hashPosition = hash & hashTableSize;
 	hashTableEltPtr = (HashTableElt *)hashTable[*hashPosition];
-	hashTableElt = new HashTableElt();
+	hashTableElt = allocateElt(keyProut, data, dataSize);
 	if (! hashTableElt) {
 		systemLog->sysLog(CRITICAL, "cannot allocate hashTableElt: %s", strerror(errno));
 		return NULL;
 	}
-	hashTableElt->setData(data);
-	keySize = strlen(keyProut) + 1;
-	keyCopy = (char *)malloc(keySize);
-	if (! keyCopy) {
-		systemLog->sysLog(CRITICAL, "cannot allocate keyCopy: %s", strerror(errno));
-		delete hashTableElt;
-		return NULL;
-	}
-	strncpy(keyCopy, keyProut, keySize);
-	keyCopy[keySize] = '\0';
-	hashTableElt->setKey(keyCopy);
+	hashTableElt->setHash(hash);
 	numberOfElements++;
+	// Element must be complete before lockless readers can reach it
+	__sync_synchronize();
 	if (! hashTableEltPtr) {
 		hashTable[*hashPosition] = (int *)hashTableElt;
+		addPrefixIndex(hashTableElt);
 		return hashTableElt;
 	}
 	numberOfCollisions++;
 	do {
-		if (! strcmp(hashTableEltPtr->getKey(), keyProut)) {
+		// Stored hash first, strcmp only on a full 32 bits match
+		if ((hashTableEltPtr->getHash() == hash) && (! strcmp(hashTableEltPtr->getKey(), keyProut))) {
 			systemLog->sysLog(ERROR, "cannot store key '%s', key is already exists on hashtable", keyProut);
-			delete hashTableElt;
+			destroyHashTableElt(hashTableElt);
 			numberOfElements--;
 			numberOfCollisions--;
 			return NULL;
 		}
 		if (! hashTableEltPtr->getNext()) {
 			hashTableEltPtr->setNext(hashTableElt);
+			addPrefixIndex(hashTableElt);
 			return hashTableElt;
 		}
 	} while ((hashTableEltPtr = hashTableEltPtr->getNext()));
@@ -105,10 +259,12 @@ HashTableElt *HashTable::add(char *keyProut, void *data, uint32_t *hashPosition)
 
 int HashTable::remove(char *key) {
 	uint32_t hashPosition;
+	uint32_t hash;
 	HashTableElt *hashTableEltPtr;
 	HashTableElt *hashTableEltPtrPrev;
 
-	hashPosition = hashAlgorithm->run(key) & hashTableSize;
+	hash = hashAlgorithm->run(key);
+	hashPosition = hash & hashTableSize;
 	hashTableEltPtr = (HashTableElt *)hashTable[hashPosition];
 	if (! hashTableEltPtr) {
 		systemLog->sysLog(ERROR, "cannot delete key '%s': key doesn't exist on hashtable", key);
@@ -116,12 +272,12 @@ int HashTable::remove(char *key) {
 	}
 	hashTableEltPtrPrev = hashTableEltPtr;
 	do {
-		if (! strcmp(key, hashTableEltPtr->getKey())) {
+		if ((hashTableEltPtr->getHash() == hash) && (! strcmp(key, hashTableEltPtr->getKey()))) {
 			if (hashTableEltPtr == hashTableEltPtrPrev)
 				hashTable[hashPosition] = (int *)hashTableEltPtr->getNext();
 			else
 				hashTableEltPtrPrev->setNext(hashTableEltPtr->getNext());
-			delete hashTableEltPtr;
+			destroyElt(hashTableEltPtr);
 			numberOfElements--;
 			return 0;
 		}
@@ -134,10 +290,12 @@ int HashTable::remove(char *key) {
 
 int HashTable::remove(char *key, HashTableElt **hashTableElt) {
 	uint32_t hashPosition;
+	uint32_t hash;
 	HashTableElt *hashTableEltPtr;
 	HashTableElt *hashTableEltPtrPrev;
 
-	hashPosition = hashAlgorithm->run(key) & hashTableSize;
+	hash = hashAlgorithm->run(key);
+	hashPosition = hash & hashTableSize;
 	hashTableEltPtr = (HashTableElt *)hashTable[hashPosition];
 	if (! hashTableEltPtr) {
 		systemLog->sysLog(ERROR, "cannot delete key '%s': key doesn't exist on hashtable", key);
@@ -145,13 +303,13 @@ int HashTable::remove(char *key, HashTableElt **hashTableElt) {
 	}
 	hashTableEltPtrPrev = hashTableEltPtr;
 	do {
-		if (! strcmp(key, hashTableEltPtr->getKey())) {
+		if ((hashTableEltPtr->getHash() == hash) && (! strcmp(key, hashTableEltPtr->getKey()))) {
 			*hashTableElt = hashTableEltPtr;
 			if (hashTableEltPtr == hashTableEltPtrPrev)
 				hashTable[hashPosition] = (int *)hashTableEltPtr->getNext();
 			else
 				hashTableEltPtrPrev->setNext(hashTableEltPtr->getNext());
-			delete hashTableEltPtr;
+			destroyElt(hashTableEltPtr);
 			numberOfElements--;
 			return 0;
 		}
@@ -162,83 +320,143 @@ int HashTable::remove(char *key, HashTableElt **hashTableElt) {
 	return -1;
 }
 
-int HashTable::remove(uint64_t hashPosition, HashTableElt *hashtableElt) {
+// Unlink an element known by its pointer, hashPosition may come from a smaller table
+// (timeouts keep it), so the element is only compared and never dereferenced before it is found
+HashTableElt *HashTable::unlink(uint64_t hashPosition, HashTableElt *hashtableElt) {
 	HashTableElt *hashTableEltPtr;
 	HashTableElt *hashTableEltPtrPrev;
+	uint64_t position;
 
-	hashTableEltPtr = (HashTableElt *)hashTable[hashPosition];
+	// After a resize the element is on a bucket with the same low bits
+	for (position = hashPosition & initialHashTableSize; position <= hashTableSize; position += initialHashTableSize + 1) {
+		hashTableEltPtr = (HashTableElt *)hashTable[position];
+		hashTableEltPtrPrev = NULL;
+		while (hashTableEltPtr) {
+			if (hashTableEltPtr == hashtableElt) {
+				if (! hashTableEltPtrPrev)
+					hashTable[position] = (int *)hashTableEltPtr->getNext();
+				else
+					hashTableEltPtrPrev->setNext(hashTableEltPtr->getNext());
+				numberOfElements--;
+				return hashTableEltPtr;
+			}
+			hashTableEltPtrPrev = hashTableEltPtr;
+			hashTableEltPtr = hashTableEltPtr->getNext();
+		}
+	}
+
+	return NULL;
+}
+
+// Is this element still on the hashtable, same rules as unlink()
+HashTableElt *HashTable::search(uint64_t hashPosition, HashTableElt *hashtableElt) {
+	HashTableElt *hashTableEltPtr;
+	uint64_t position;
+
+	for (position = hashPosition & initialHashTableSize; position <= hashTableSize; position += initialHashTableSize + 1) {
+		for (hashTableEltPtr = (HashTableElt *)hashTable[position]; hashTableEltPtr; hashTableEltPtr = hashTableEltPtr->getNext()) {
+			if (hashTableEltPtr == hashtableElt)
+				return hashTableEltPtr;
+		}
+	}
+
+	return NULL;
+}
+
+int HashTable::remove(uint64_t hashPosition, HashTableElt *hashtableElt) {
+	HashTableElt *hashTableEltPtr;
+
+	hashTableEltPtr = unlink(hashPosition, hashtableElt);
 	if (! hashTableEltPtr) {
-		systemLog->sysLog(ERROR, "cannot delete hashPosition %d: key doesn't exist on hashtable", hashPosition);
+		systemLog->sysLog(ERROR, "cannot delete, key doesn't exist on hashtable");
 		return -1;
 	}
-	hashTableEltPtrPrev = hashTableEltPtr;
-	do {
-		if (hashTableEltPtr == hashtableElt) {
-			if (hashTableEltPtr == hashTableEltPtrPrev)
-				hashTable[hashPosition] = (int *)hashTableEltPtr->getNext();
-			else
-				hashTableEltPtrPrev->setNext(hashTableEltPtr->getNext());
-			delete hashTableEltPtr;
-			numberOfElements--;
-			return 0;
-		}
-		hashTableEltPtrPrev = hashTableEltPtr;
-	} while ((hashTableEltPtr = hashTableEltPtr->getNext()));
+	destroyElt(hashTableEltPtr);
 
-	systemLog->sysLog(ERROR, "cannot delete, key doesn't exist on hashtable");
-	return -1;
+	return 0;
 }
 
-HashTableElt *HashTable::search(char *key) {
-	uint32_t hashPosition;
+// Same as above but give back the data, -1 if the element was already removed
+int HashTable::remove(uint64_t hashPosition, HashTableElt *hashtableElt, void **data) {
 	HashTableElt *hashTableEltPtr;
-	bool keyFound = false;
 
-	hashPosition = hashAlgorithm->run(key) & hashTableSize;
-	hashTableEltPtr = (HashTableElt *)hashTable[hashPosition];
+	hashTableEltPtr = unlink(hashPosition, hashtableElt);
 	if (! hashTableEltPtr)
-		return NULL;
-	do {
-		if (! strcmp(key, hashTableEltPtr->getKey())) {
-			keyFound = true;
-			return hashTableEltPtr;
-		}
-	} while ((hashTableEltPtr = hashTableEltPtr->getNext()));
+		return -1;
+	// Inline data is freed with the element
+	*data = (hashTableEltPtr->isDataInline() == true) ? NULL : hashTableEltPtr->getData();
+	destroyElt(hashTableEltPtr);
 
-	return NULL;
+	return 0;
+}
+
+HashTableElt *HashTable::search(char *key) {
+	uint32_t hashPosition;
+
+	return search(key, strlen(key), &hashPosition);
 }
 
 HashTableElt *HashTable::search(char *key, uint32_t *hashPosition) {
+	return search(key, strlen(key), hashPosition);
+}
+
+// Key length known by the caller, the hash doesn't need a strlen
+HashTableElt *HashTable::search(char *key, size_t keyLength, uint32_t *hashPosition) {
 	HashTableElt *hashTableEltPtr;
-	bool keyFound = false;
+	uint32_t hash;
+	unsigned int size;
 
-	*hashPosition = hashAlgorithm->run(key) & hashTableSize;
+	// Size before array, see resize()
+	size = hashTableSize;
+	__sync_synchronize();
+	hash = hashAlgorithm->run(key, keyLength);
+	*hashPosition = hash & size;
 	hashTableEltPtr = (HashTableElt *)hashTable[*hashPosition];
 	if (! hashTableEltPtr)
 		return NULL;
 	do {
-		if (! strcmp(key, hashTableEltPtr->getKey())) {
-			keyFound = true;
+		if ((hashTableEltPtr->getHash() == hash) && (! strcmp(key, hashTableEltPtr->getKey())))
 			return hashTableEltPtr;
-		}
 	} while ((hashTableEltPtr = hashTableEltPtr->getNext()));
 
 	return NULL;
 }
 
+// Number of non empty buckets and length of the longest chain, under lock
+void HashTable::getChainStatistics(unsigned int *usedBuckets, unsigned int *longestChain) {
+	HashTableElt *hashTableEltPtr;
+	uint32_t hashPosition;
+	unsigned int chainLength;
+
+	*usedBuckets = 0;
+	*longestChain = 0;
+	for (hashPosition = 0; hashPosition <= hashTableSize; hashPosition++) {
+		hashTableEltPtr = (HashTableElt *)hashTable[hashPosition];
+		if (! hashTableEltPtr)
+			continue;
+		(*usedBuckets)++;
+		for (chainLength = 0; hashTableEltPtr; hashTableEltPtr = hashTableEltPtr->getNext())
+			chainLength++;
+		if (chainLength > *longestChain)
+			*longestChain = chainLength;
+	}
+
+	return;
+}
+
 void HashTable::purge(void) {
 	uint32_t hashPosition = 0;
 	HashTableElt *hashTableEltPtr;
-	HashTableElt *hashTableEltPtr2;
-
-	while (hashPosition < hashTableSize) {
-		if ((hashTableEltPtr = (HashTableElt *)hashTable[hashPosition])) {
-			do {
-				hashTableEltPtr2 = hashTableEltPtr;
-				delete hashTableEltPtr2;
-			} while ((hashTableEltPtr = hashTableEltPtr->getNext()));
-			hashTable[hashPosition] = NULL;
+	HashTableElt *hashTableEltNext;
+
+	while (hashPosition <= hashTableSize) {
+		hashTableEltPtr = (HashTableElt *)hashTable[hashPosition];
+		while (hashTableEltPtr) {
+			hashTableEltNext = hashTableEltPtr->getNext();
+			destroyElt(hashTableEltPtr);
+			hashTableEltPtr = hashTableEltNext;
 		}
+		hashTable[hashPosition] = NULL;
 		hashPosition++;
 	}
 	numberOfElements = 0;
@@ -28,6 +28,9 @@ extern LogError *systemLog;
 #include "hashtableelt.h"
 #include "hashalgorithm.h"
 #include "../toolkit/mutex.h"
+#include "../toolkit/epochmanager.h"
+#include "../toolkit/slaballocator.h"
+#include "../toolkit/radixtree.h"
 
 /**
   *@author spe
@@ -39,27 +42,57 @@ private:
 	int **hashTable;
 	int numberOfElements;
 	unsigned int hashTableSize;
+	unsigned int initialHashTableSize;
+	unsigned int maxHashTableSize;
 	HashAlgorithm *hashAlgorithm;
 	unsigned int numberOfCollisions;
+	unsigned int numberOfResizes;
 	Mutex *mutex;
+	EpochManager *epochManager;
+	SlabAllocator *slabAllocator;
+	RadixTree *prefixIndex;
+
+	int resize(unsigned int);
+	HashTableElt *allocateElt(char *, void *, size_t);
+	void addPrefixIndex(HashTableElt *);
+	HashTableElt *unlink(uint64_t, HashTableElt *);
+	void destroyElt(HashTableElt *);
 
 public:
 	HashTable(HashAlgorithm *, int);
+	HashTable(HashAlgorithm *, int, int);
 	~HashTable();
 
 	HashTableElt *search(char *);
 	HashTableElt *search(char *, uint32_t *);
+	HashTableElt *search(char *, size_t, uint32_t *);
+	HashTableElt *search(uint64_t, HashTableElt *);
 	HashTableElt *add(char *, void *, uint32_t *);
+	HashTableElt *add(char *, void *, size_t, uint32_t *);
 	int remove(char *);
 	int remove(char *, HashTableElt **);
 	int remove(uint64_t, HashTableElt *);
+	int remove(uint64_t, HashTableElt *, void **);
 	void purge(void);
 	unsigned int getNumberOfCollisions(void) { return numberOfCollisions; };
+	unsigned int getNumberOfResizes(void) { return numberOfResizes; };
+	void getChainStatistics(unsigned int *, unsigned int *);
+	HashAlgorithm *getHashAlgorithm(void) { return hashAlgorithm; };
 	int getNumberOfElements(void) { return numberOfElements; };
 	int **getHashtable(void) { return hashTable; };
+	SlabAllocator *getSlabAllocator(void) { return slabAllocator; };
+	// Optional ordered index of the keys, kept in sync by add() and removals
+	void setPrefixIndex(RadixTree *_prefixIndex) { prefixIndex = _prefixIndex; };
+	RadixTree *getPrefixIndex(void) { return prefixIndex; };
 	unsigned int getSize(void) { return hashTableSize; };
 	int lock(void) { return mutex->lockMutex(); };
 	int unlock(void) { return mutex->unlockMutex(); };
+	// Lookups without lock when an EpochManager is set, writers still use lock()
+	void setEpochManager(EpochManager *_epochManager) { epochManager = _epochManager; };
+	EpochManager *getEpochManager(void) { return epochManager; };
+	void enterRead(void) { if (epochManager) epochManager->enter(); else mutex->lockMutex(); };
+	void exitRead(void) { if (epochManager) epochManager->exit(); else mutex->unlockMutex(); };
+	void freeData(void *);
 };
 
 #endif
@@ -17,16 +17,16 @@
 HashTableElt::HashTableElt() {
 	next = NULL;
 	key = NULL;
+	hash = 0;
 	data = NULL;
+	dataInline = false;
+	timerEntry = NULL;
 	
 	return;
 }
 
 
 HashTableElt::~HashTableElt() {
-	if (key)
-		free(key);
-
 	return;
 }
 
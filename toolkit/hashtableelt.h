@@ -12,15 +12,24 @@
 #ifndef HASHTABLEELT_H
 #define HASHTABLEELT_H
 
+#include <sys/types.h>
+
+struct TimerWheelEntry;
+
 /**
 	@author  <spe@>
 */
 class HashTableElt {
 private:
+	// Key and inline data are stored in the same block as the element
 	char *key;
+	uint32_t hash;
 	void *data;
+	bool dataInline;
 	HashTableElt *next;
 	HashTableElt *previous;
+	// Pending timeout of the element, protected by the lock of its timer wheel
+	struct TimerWheelEntry *timerEntry;
 
 public:
 	HashTableElt();
@@ -28,8 +37,14 @@ public:
 
 	void setData(void *);
 	void *getData(void);
+	void setDataInline(bool _dataInline) { dataInline = _dataInline; };
+	bool isDataInline(void) { return dataInline; };
 	void setKey(char *);
 	char *getKey(void);
+	void setHash(uint32_t _hash) { hash = _hash; };
+	uint32_t getHash(void) { return hash; };
+	void setTimerEntry(struct TimerWheelEntry *_timerEntry) { timerEntry = _timerEntry; };
+	struct TimerWheelEntry *getTimerEntry(void) { return timerEntry; };
 	void setNext(HashTableElt *);
 	HashTableElt *getNext(void);
 };
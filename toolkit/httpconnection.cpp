@@ -13,11 +13,16 @@
 
 #include <fcntl.h>
 
-HttpConnection::HttpConnection(CacheObject *_cacheObject, Configuration *_configuration) {
+#include "../toolkit/moov.h"
+
+HttpConnection::HttpConnection(CacheObject *_cacheObject, NegativeCache *_negativeCache, Configuration *_configuration) {
 	curl = new Curl();
 	cacheObject = _cacheObject;
+	negativeCache = _negativeCache;
 	configuration = _configuration;
 	cantSendMore = false;
+	clientLagging = false;
+	relayMode = false;
 
 	return;
 }
@@ -128,6 +133,310 @@ size_t callbackFunctionCopyCache(void *ptr, size_t size, size_t nmemb, void *obj
 	return size * nmemb;
 }
 
+// Single origin transfer: the body goes to the client and to the cache file
+size_t callbackFunctionRelay(void *ptr, size_t size, size_t nmemb, void *objects) {
+	int **arguments = (int **)objects;
+	HttpConnection *httpConnection;
+	HttpSession *httpSession;
+	ssize_t bytesSent;
+	Curl *curl;
+	CurlSession *curlSession;
+
+	if ((! ptr) || (! objects)) {
+		systemLog->sysLog(ERROR, "ptr or objects is NULL in callbackDatas. Cannot continue");
+		return 0;
+	}
+
+	httpSession = (HttpSession *)arguments[0];
+	httpConnection = (HttpConnection *)arguments[1];
+	curl = (Curl *)arguments[2];
+	curlSession = (CurlSession *)arguments[3];
+
+	if ((! curl) || (! curlSession) || (curl->getHttpCode(curlSession) != 200))
+		return size * nmemb;
+
+	// A slow or gone client must not stop the cache fill, a slow one gets the rest from the cache file
+	if (httpConnection->cantSendMore == false) {
+		bytesSent = httpConnection->sendClient(httpSession, ptr, size * nmemb, MSG_DONTWAIT);
+		httpSession->fileOffset += bytesSent;
+		if (bytesSent < (ssize_t)(size * nmemb)) {
+			httpConnection->cantSendMore = true;
+			httpConnection->clientLagging = (errno == EAGAIN) || (errno == EWOULDBLOCK);
+		}
+	}
+	if (httpConnection->cacheObject->put(httpSession, (char *)ptr, size * nmemb) < 0)
+		return 0;
+
+	return size * nmemb;
+}
+
+// Body of a ranged origin answer: only a 206 is the asked range, anything else stops the transfer
+size_t callbackFunctionOriginRange(void *ptr, size_t size, size_t nmemb, void *objects) {
+	struct OriginRange *originRange = (struct OriginRange *)objects;
+	size_t dataSize = size * nmemb;
+
+	if ((! ptr) || (! objects)) {
+		systemLog->sysLog(ERROR, "ptr or objects is NULL in callbackDatas. Cannot continue");
+		return 0;
+	}
+	if (originRange->curl->getHttpCode(originRange->curlSession) != 206)
+		return 0;
+	if (originRange->received + dataSize > originRange->size)
+		return 0;
+
+	if (originRange->buffer)
+		memcpy(originRange->buffer + originRange->received, ptr, dataSize);
+	else {
+		if (originRange->httpConnection->cantSendMore == true)
+			return 0;
+		if (originRange->httpConnection->sendClient(originRange->httpSession, ptr, dataSize, 0) < (ssize_t)dataSize) {
+			originRange->httpConnection->cantSendMore = true;
+			return 0;
+		}
+		originRange->httpSession->fileOffset += dataSize;
+	}
+	originRange->received += dataSize;
+
+	return dataSize;
+}
+
+// Size of the whole object from "Content-Range: bytes start-end/size"
+size_t callbackFunctionOriginRangeHeader(void *ptr, size_t size, size_t nmemb, void *objects) {
+	struct OriginRange *originRange = (struct OriginRange *)objects;
+	char headerLine[256];
+	size_t headerLineSize = size * nmemb;
+	char *pChar;
+
+	if ((! ptr) || (! objects))
+		return 0;
+	if (headerLineSize >= sizeof(headerLine))
+		return size * nmemb;
+	memcpy(headerLine, ptr, headerLineSize);
+	headerLine[headerLineSize] = '\0';
+	if (! strncasecmp(headerLine, "Content-Range:", 14)) {
+		pChar = strchr(headerLine, '/');
+		if (pChar && (pChar[1] != '*'))
+			originRange->totalSize = strtoll(pChar + 1, NULL, 10);
+	}
+
+	return size * nmemb;
+}
+
+void HttpConnection::logTransfer(HttpSession *httpSession, CurlSession *curlSession) {
+	char vxferLog[64];
+	unsigned int position;
+	bool mustLog = false;
+
+	if (! httpSession->multicastData)
+		return;
+
+	if (httpSession->mp4Position)
+		position = httpSession->mp4Position;
+	else
+		position = httpSession->seekPosition;
+	
+	switch (httpSession->multicastData->commandType) {
+		case 0:
+			char *typeId;
+			if (httpSession->multicastData->tagId >= 1 && httpSession->multicastData->tagId <= 3)
+				typeId = stringType[httpSession->multicastData->tagId];
+			else
+				typeId = stringType[0];
+
+			snprintf(vxferLog, sizeof(vxferLog), "VXFER %u;%s;%u;%s;%d;%u;%u", httpSession->multicastData->itemId, httpSession->multicastData->countryCode, httpSession->multicastData->productId, typeId, (int)httpSession->fileOffset, position, httpSession->multicastData->encodingFormatId);
+			mustLog = true;
+			break;
+		case 1:
+			snprintf(vxferLog, sizeof(vxferLog), "VX %u;%u;%u;%d;%u;%u", httpSession->multicastData->itemId, httpSession->multicastData->productId, httpSession->multicastData->tagId, (int)httpSession->fileOffset, position, httpSession->multicastData->encodingFormatId);
+			mustLog = true;
+			break;
+	}
+	if (mustLog == true)
+		combinedLog(httpSession, vxferLog, curl->getContentLength(curlSession), LOG_NOTICE);
+
+	return;
+}
+
+// Move the temp file to the original name (strip .tmp at the end of the file)
+int HttpConnection::commitCacheFile(HttpSession *httpSession, long fileTime) {
+	char videoNameTmpFilePath[2048];
+	struct timeval tval[2];
+	time_t t;
+	struct tm lt;
+	struct stat fileStat;
+	int returnCode;
+
+	strcpy(videoNameTmpFilePath, httpSession->videoNameFilePath);
+	strcat(videoNameTmpFilePath, ".tmp");
+
+	// Players start without fetching the end of the object, before its mtime is set
+	if ((SeekIndexCache::getIndexType(httpSession->videoName) == SEEKINDEXCACHE_MP4) && (stat(videoNameTmpFilePath, &fileStat) == 0)) {
+		if (mp4_faststart(videoNameTmpFilePath, fileStat.st_size) > 0)
+			systemLog->sysLog(INFO, "[descriptor %d] moov of '%s' moved in front of the media data", httpSession->httpExchange->getInput(), videoNameTmpFilePath);
+	}
+
+	// XXX sanity checks
+	if (fileTime > 0) {
+		t = fileTime;
+		localtime_r(&t, &lt);
+		fileTime = mktime(&lt);
+		tval[0].tv_sec = fileTime;
+		tval[0].tv_usec = 0;
+		tval[1].tv_sec = fileTime;
+		tval[1].tv_usec = 0;
+		utimes(videoNameTmpFilePath, tval);
+	}
+	returnCode = rename(videoNameTmpFilePath, httpSession->videoNameFilePath);
+	if (returnCode < 0) {
+		systemLog->sysLog(ERROR, "[descriptor %d] cannot rename '%s' to '%s': %s", httpSession->httpExchange->getInput(), videoNameTmpFilePath, httpSession->videoNameFilePath, strerror(errno));
+		returnCode = unlink(videoNameTmpFilePath);
+		if (returnCode < 0) {
+			systemLog->sysLog(ERROR, "[descriptor %d] cannot delete the file '%s': %s", httpSession->httpExchange->getInput(), videoNameTmpFilePath, strerror(errno));
+		}
+		return -1;
+	}
+	systemLog->sysLog(INFO, "[descriptor %d] File '%s' copied on cache", httpSession->httpExchange->getInput(), httpSession->videoNameFilePath);
+	cacheObject->invalidate(httpSession->videoName);
+	// Seeks of the object map its index instead of parsing the moov or scanning the tags
+	if (SeekIndexCache::getIndexType(httpSession->videoName) && (stat(httpSession->videoNameFilePath, &fileStat) == 0))
+		SeekIndexCache::writeSidecar(httpSession->videoNameFilePath, &fileStat);
+	if (negativeCache)
+		negativeCache->remove(httpSession->videoName);
+
+	return 0;
+}
+
+// Return the bytes sent, less than dataSize if the client cannot take more (errno is set)
+// The socket has a send timeout, a stalled client ends the answer, MSG_DONTWAIT doesn't wait for it
+ssize_t HttpConnection::sendClient(HttpSession *httpSession, const void *data, size_t dataSize, int flags) {
+	ssize_t bytesSent;
+	size_t offset = 0;
+
+	while (offset < dataSize) {
+		bytesSent = send(httpSession->httpExchange->outputDescriptor, (const char *)data + offset, dataSize - offset, flags);
+		if (bytesSent <= 0)
+			break;
+		offset += bytesSent;
+	}
+
+	return offset;
+}
+
+// Rest of the object from fileOffset in the cache file, for a client too slow to follow the origin
+int HttpConnection::sendClientFile(HttpSession *httpSession, int descriptor) {
+	char buffer[16384];
+	ssize_t bytesRead;
+	ssize_t bytesSent;
+
+	while ((bytesRead = pread(descriptor, buffer, sizeof(buffer), httpSession->fileOffset)) > 0) {
+		bytesSent = sendClient(httpSession, buffer, bytesRead, 0);
+		httpSession->fileOffset += bytesSent;
+		if (bytesSent < bytesRead)
+			return -1;
+	}
+
+	return (bytesRead < 0) ? -1 : 0;
+}
+
+// Return the number of bytes received, -1 if the origin doesn't answer the range
+int64_t HttpConnection::fetchOriginRange(struct OriginRange *originRange, uint64_t offset, uint64_t size, unsigned char *buffer) {
+	CurlSession *curlSession;
+	struct curl_slist *slist;
+	char headerByteRange[64];
+	int returnCode;
+	int httpReturnCode;
+
+	curlSession = curl->createSession();
+	if (! curlSession)
+		return -1;
+	snprintf(headerByteRange, sizeof(headerByteRange), "Range: bytes=%llu-%llu", (unsigned long long)offset, (unsigned long long)(offset + size - 1));
+	slist = curl_slist_append(NULL, headerByteRange);
+	curl->setRequestHeader(curlSession, slist);
+
+	originRange->curl = curl;
+	originRange->curlSession = curlSession;
+	originRange->buffer = buffer;
+	originRange->size = size;
+	originRange->received = 0;
+	returnCode = curl->fetchHttpUrlWithCallback(curlSession, (void *)callbackFunctionOriginRange, (void *)originRange, (void *)callbackFunctionOriginRangeHeader, (void *)originRange, originRange->url);
+	httpReturnCode = curl->getHttpCode(curlSession);
+	curl->deleteSession(curlSession);
+	delete curlSession;
+	curl_slist_free_all(slist);
+	if ((returnCode < 0) || (httpReturnCode != 206))
+		return -1;
+
+	return originRange->received;
+}
+
+static int readOriginRange(void *context, uint64_t offset, uint64_t size, unsigned char *buffer) {
+	struct OriginRange *originRange = (struct OriginRange *)context;
+
+	return (originRange->httpConnection->fetchOriginRange(originRange, offset, size, buffer) == (int64_t)size);
+}
+
+// Seek in an mp4 object of an origin which may not seek itself: its moov is
+// fetched by ranges, the new header is built here and only the kept mdat span
+// is asked to the origin. Return -1 if nothing was sent to the client
+int HttpConnection::proxyizeMp4Seek(HttpSession *httpSession, int originServerUrlNumber) {
+	struct OriginRange originRange;
+	char url[2048];
+	unsigned char *head;
+	int64_t headSize;
+	void *mp4Header = NULL;
+	uint32_t mp4HeaderSize;
+	uint64_t mdatOffset;
+	uint64_t mdatSize;
+	time_t currentTime;
+	char localTimeFormatted[128];
+	int headerSize;
+	int returnCode;
+
+	snprintf(url, sizeof(url), "%s%s", configuration->originServerUrl[originServerUrlNumber], httpSession->videoName);
+	memset(&originRange, 0, sizeof(originRange));
+	originRange.httpSession = httpSession;
+	originRange.httpConnection = this;
+	originRange.url = url;
+	originRange.totalSize = -1;
+
+	head = (unsigned char *)malloc(HTTPCONNECTION_RANGEHEADSIZE);
+	if (! head) {
+		systemLog->sysLog(CRITICAL, "cannot allocate %d bytes for the head of '%s': %s", HTTPCONNECTION_RANGEHEADSIZE, url, strerror(errno));
+		return -1;
+	}
+	// A smaller object comes whole in the first range
+	headSize = fetchOriginRange(&originRange, 0, HTTPCONNECTION_RANGEHEADSIZE, head);
+	if ((headSize <= 0) || (originRange.totalSize <= 0)) {
+		free(head);
+		return -1;
+	}
+	returnCode = mp4_split_ranges(head, headSize, originRange.totalSize, readOriginRange, &originRange, httpSession->seekSeconds, httpSession->endSeconds, &mp4Header, &mp4HeaderSize, &mdatOffset, &mdatSize, 1);
+	free(head);
+	if (! returnCode) {
+		systemLog->sysLog(NOTICE, "cannot seek '%s' from its moov, forwarding the request to the origin", url);
+		if (mp4Header)
+			free(mp4Header);
+		return -1;
+	}
+
+	currentTime = time(NULL);
+	strftime(localTimeFormatted, sizeof(localTimeFormatted), "%a, %d %b %Y %T GMT", gmtime(&currentTime));
+	headerSize = snprintf(httpSession->httpHeader, sizeof(httpSession->httpHeader), "HTTP/1.1 200 OK\r\nContent-Type: video/mp4\r\nContent-Length: %llu\r\nConnection: close\r\nDate: %s\r\nServer: numb/2.0\r\n\r\n", (unsigned long long)(mp4HeaderSize + mdatSize), localTimeFormatted);
+	httpSession->httpCode = 200;
+	httpSession->mp4Position = mdatOffset;
+	if ((sendClient(httpSession, httpSession->httpHeader, headerSize, 0) < (ssize_t)headerSize) || (sendClient(httpSession, mp4Header, mp4HeaderSize, 0) < (ssize_t)mp4HeaderSize)) {
+		free(mp4Header);
+		return 0;
+	}
+	free(mp4Header);
+	if (mdatSize && (fetchOriginRange(&originRange, mdatOffset, mdatSize, NULL) != (int64_t)mdatSize))
+		systemLog->sysLog(ERROR, "[descriptor %d] mdat of '%s' stopped after %llu bytes", httpSession->httpExchange->getInput(), url, (unsigned long long)originRange.received);
+	else
+		systemLog->sysLog(INFO, "[descriptor %d] '%s' seeked at %f seconds from its moov, %llu bytes asked to the origin", httpSession->httpExchange->getInput(), url, httpSession->seekSeconds, (unsigned long long)(headSize + mdatSize));
+
+	return 0;
+}
+
 void HttpConnection::proxyize(HttpSession *httpSession) {
 	CurlSession *curlSession;
 	char fullUrl[2048];
@@ -139,14 +448,20 @@ void HttpConnection::proxyize(HttpSession *httpSession) {
 	socklen_t sendTimeoutSize = sizeof(sendTimeout);
 	int clientSocket;
 	int httpReturnCode;
-	char vxferLog[64];
 	int originServerUrlNumber = 0;
 	char header = 1;
 	char data = 0;
 	struct curl_slist *slist = NULL;
 	char headerByteRange[64];
 	char *pChar;
-
+	int negativeHttpCode = 0;
+	bool mp4RangeSeek;
+	bool plainRequest;
+
+	// Time seeks of mp4 objects don't rely on the origin, it only has to answer ranges
+	mp4RangeSeek = (httpSession->seekSeconds || httpSession->endSeconds) && (httpSession->httpRequestType == 1) && (httpSession->byteRange.start == -1) && (SeekIndexCache::getIndexType(httpSession->videoName) == SEEKINDEXCACHE_MP4) && (! strstr(httpSession->httpRequest, "getSmil"));
+	// The negative cache answers plain requests of the path, only their misses are recorded
+	plainRequest = (httpSession->byteRange.start == -1) && (! strstr(httpSession->httpRequest, "getSmil")) && (! strstr(httpSession->httpRequest, "?"));
 	if (httpSession->byteRange.start != -1) {
 		httpSession->seekPosition = httpSession->byteRange.start;
 		if (httpSession->byteRange.end != -1)
@@ -166,6 +481,12 @@ void HttpConnection::proxyize(HttpSession *httpSession) {
 			close(clientSocket);
 			return;
 		}
+		if (mp4RangeSeek && (proxyizeMp4Seek(httpSession, originServerUrlNumber) == 0)) {
+			clientSocket = httpSession->httpExchange->getOutput();
+			httpSession->destroy(true);
+			close(clientSocket);
+			return;
+		}
 		curlSession = curl->createSession();
 		if (! curlSession) {
 			clientSocket = httpSession->httpExchange->getOutput();
@@ -224,34 +545,7 @@ void HttpConnection::proxyize(HttpSession *httpSession) {
 		httpReturnCode = curl->getHttpCode(curlSession);
 
 		if (httpReturnCode == 200) {
-			if (httpSession->multicastData) {
-				unsigned int position;
-				bool mustLog = false;
-
-				if (httpSession->mp4Position)
-					position = httpSession->mp4Position;
-				else
-					position = httpSession->seekPosition;
-				
-				switch (httpSession->multicastData->commandType) {
-					case 0:
-						char *typeId;
-						if (httpSession->multicastData->tagId >= 1 && httpSession->multicastData->tagId <= 3)
-							typeId = stringType[httpSession->multicastData->tagId];
-						else
-							typeId = stringType[0];
-
-						snprintf(vxferLog, sizeof(vxferLog), "VXFER %u;%s;%u;%s;%d;%u;%u", httpSession->multicastData->itemId, httpSession->multicastData->countryCode, httpSession->multicastData->productId, typeId, (int)httpSession->fileOffset, position, httpSession->multicastData->encodingFormatId);
-						mustLog = true;
-						break;
-					case 1:
-						snprintf(vxferLog, sizeof(vxferLog), "VX %u;%u;%u;%d;%u;%u", httpSession->multicastData->itemId, httpSession->multicastData->productId, httpSession->multicastData->tagId, (int)httpSession->fileOffset, position, httpSession->multicastData->encodingFormatId);
-						mustLog = true;
-						break;
-				}
-				if (mustLog == true)
-					combinedLog(httpSession, vxferLog, curl->getContentLength(curlSession), LOG_NOTICE);
-			}
+			logTransfer(httpSession, curlSession);
 
 			if (slist)
 				curl_slist_free_all(slist);
@@ -267,6 +561,9 @@ void HttpConnection::proxyize(HttpSession *httpSession) {
 			curl->deleteSession(curlSession);
 			delete curlSession;
 
+			// Only remember the miss if every origin answered 404 or 5xx
+			if ((originServerUrlNumber == 0) || negativeHttpCode)
+				negativeHttpCode = (negativeCache && negativeCache->isCacheable(httpReturnCode)) ? httpReturnCode : 0;
 			originServerUrlNumber++;
 		}
 		if (configuration->originServerUrl[originServerUrlNumber][0] == '\0')
@@ -276,6 +573,8 @@ void HttpConnection::proxyize(HttpSession *httpSession) {
 	if (slist)
 		curl_slist_free_all(slist);
 	systemLog->sysLog(ERROR, "cannot found file '%s' on origin server urls", httpSession->videoName);
+	if (negativeHttpCode && plainRequest)
+		negativeCache->add(httpSession->videoName, negativeHttpCode);
 	clientSocket = httpSession->httpExchange->getOutput();
 	httpSession->destroy(true);
 	close(clientSocket);
@@ -294,9 +593,7 @@ void HttpConnection::cache(HttpSession *httpSession) {
 	int httpReturnCode;
 	int originServerUrlNumber = 0;
 	long fileTime;
-	struct timeval tval[2];
-	time_t t;
-	struct tm lt;
+	int negativeHttpCode = 0;
 
 	while (originServerUrlNumber < 16) {
 		sendTimeout.tv_sec = 30;
@@ -322,35 +619,14 @@ void HttpConnection::cache(HttpSession *httpSession) {
 		arguments2[3] = NULL;
 		returnCode = curl->fetchHttpUrlWithCallback(curlSession, (void *)callbackFunctionCopyCache, (void *)arguments, (void *)callbackFunctionCopyCache, (void *)arguments2, fullUrl);
 		httpReturnCode = curl->getHttpCode(curlSession);
+		fileTime = curl->getLastModified(curlSession);
 		curl->deleteSession(curlSession);
 
 		strcpy(videoNameTmpFilePath, httpSession->videoNameFilePath);
 		strcat(videoNameTmpFilePath, ".tmp");
 
 		if ((! returnCode) && (httpReturnCode == 200)) {
-			// Move the temp file to the original name (strip .tmp at the end of the file)
-			// XXX sanity checks
-			fileTime = curl->getLastModified(curlSession);
-			if (fileTime > 0) {
-				t = fileTime;
-				localtime_r(&t, &lt);
-				fileTime = mktime(&lt);
-				tval[0].tv_sec = fileTime;
-				tval[0].tv_usec = 0;
-				tval[1].tv_sec = fileTime;
-				tval[1].tv_usec = 0;
-				utimes(videoNameTmpFilePath, tval);
-			}
-			returnCode = rename(videoNameTmpFilePath, httpSession->videoNameFilePath);
-			if (returnCode < 0) {
-				systemLog->sysLog(ERROR, "[descriptor %d] cannot rename '%s' to '%s': %s", httpSession->httpExchange->getInput(), videoNameTmpFilePath, httpSession->videoNameFilePath, strerror(errno));
-				returnCode = unlink(videoNameTmpFilePath);
-				if (returnCode < 0) {
-					systemLog->sysLog(ERROR, "[descriptor %d] cannot delete the file '%s': %s", httpSession->httpExchange->getInput(), videoNameTmpFilePath, strerror(errno));
-				}
-			}
-			else
-				systemLog->sysLog(INFO, "[descriptor %d] File '%s' copied on cache", httpSession->httpExchange->getInput(), httpSession->videoNameFilePath);
+			commitCacheFile(httpSession, fileTime);
 			delete curlSession;
 			delete httpSession;
 
@@ -359,6 +635,8 @@ void HttpConnection::cache(HttpSession *httpSession) {
 		else {
 			systemLog->sysLog(ERROR, "[descriptor %d] file not found at URL '%s', trying another URL...", httpSession->httpExchange->getInput(), configuration->originServerUrl[originServerUrlNumber]);
 			delete curlSession;
+			if ((originServerUrlNumber == 0) || negativeHttpCode)
+				negativeHttpCode = ((! returnCode) && negativeCache && negativeCache->isCacheable(httpReturnCode)) ? httpReturnCode : 0;
 			originServerUrlNumber++;
 		}
 		if (configuration->originServerUrl[originServerUrlNumber][0] == '\0')
@@ -366,6 +644,8 @@ void HttpConnection::cache(HttpSession *httpSession) {
 	}
 
 	systemLog->sysLog(ERROR, "Cannot found file on origin server urls, can't cache");
+	if (negativeHttpCode)
+		negativeCache->add(httpSession->videoName, negativeHttpCode);
 	returnCode = unlink(videoNameTmpFilePath);
 	if (returnCode < 0) {
 		systemLog->sysLog(ERROR, "[descriptor %d] cannot delete the file '%s', oops... admin guys help !: %s", httpSession->httpExchange->getInput(), videoNameTmpFilePath, strerror(errno));
@@ -374,3 +654,100 @@ void HttpConnection::cache(HttpSession *httpSession) {
 
 	return;
 }
+
+// Cache miss of a plain GET: one origin transfer feeds both the client and the cache file
+void HttpConnection::relay(HttpSession *httpSession) {
+	CurlSession *curlSession;
+	char fullUrl[2048];
+	int *arguments[4];
+	int *arguments2[5];
+	char videoNameTmpFilePath[2048];
+	int returnCode;
+	struct timeval sendTimeout;
+	socklen_t sendTimeoutSize = sizeof(sendTimeout);
+	int clientSocket;
+	int httpReturnCode;
+	int originServerUrlNumber = 0;
+	char header = 1;
+	long fileTime;
+	int negativeHttpCode = 0;
+	int lateDescriptor;
+
+	clientSocket = httpSession->httpExchange->getOutput();
+	strcpy(videoNameTmpFilePath, httpSession->videoNameFilePath);
+	strcat(videoNameTmpFilePath, ".tmp");
+
+	sendTimeout.tv_sec = 30;
+	sendTimeout.tv_usec = 0;
+	returnCode = setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sendTimeoutSize);
+	if (returnCode < 0)
+		systemLog->sysLog(ERROR, "cannot setsockopt with SO_SNDTIMEO on socket %d: %s", clientSocket, strerror(errno));
+
+	while (originServerUrlNumber < 16) {
+		curlSession = curl->createSession();
+		if (! curlSession)
+			break;
+		// XXX Boundary checking
+		strcpy(fullUrl, configuration->originServerUrl[originServerUrlNumber]);
+		if (httpSession->videoName[0] != '/')
+			strcat(fullUrl, "/");
+		strcat(fullUrl, httpSession->videoName);
+
+		arguments[0] = (int *)httpSession;
+		arguments[1] = (int *)this;
+		arguments[2] = (int *)curl;
+		arguments[3] = (int *)curlSession;
+		arguments2[0] = (int *)httpSession;
+		arguments2[1] = (int *)this;
+		arguments2[2] = (int *)curl;
+		arguments2[3] = (int *)curlSession;
+		arguments2[4] = (int *)&header;
+		returnCode = curl->fetchHttpUrlWithCallback(curlSession, (void *)callbackFunctionRelay, (void *)arguments, (void *)callbackFunctionProxy, (void *)arguments2, fullUrl);
+		httpReturnCode = curl->getHttpCode(curlSession);
+		fileTime = curl->getLastModified(curlSession);
+
+		if ((! returnCode) && (httpReturnCode == 200)) {
+			logTransfer(httpSession, curlSession);
+			curl->deleteSession(curlSession);
+			delete curlSession;
+			// Opened before the commit may reorder the file, the client still reads the bytes in origin order
+			lateDescriptor = (clientLagging == true) ? open(videoNameTmpFilePath, O_RDONLY) : -1;
+			commitCacheFile(httpSession, fileTime);
+			if (lateDescriptor >= 0) {
+				if (sendClientFile(httpSession, lateDescriptor) < 0)
+					systemLog->sysLog(ERROR, "[descriptor %d] cannot send the rest of '%s' to the client: %s", httpSession->httpExchange->getInput(), httpSession->videoName, strerror(errno));
+				close(lateDescriptor);
+			}
+			httpSession->destroy(true);
+			close(clientSocket);
+
+			return;
+		}
+		curl->deleteSession(curlSession);
+		delete curlSession;
+		// Part of the body is already sent and written, another origin can't complete it
+		if (httpReturnCode == 200) {
+			systemLog->sysLog(ERROR, "[descriptor %d] transfer of '%s' from '%s' is incomplete", httpSession->httpExchange->getInput(), httpSession->videoName, configuration->originServerUrl[originServerUrlNumber]);
+			negativeHttpCode = 0;
+			break;
+		}
+		systemLog->sysLog(ERROR, "[descriptor %d] file not found at URL '%s', trying another URL...", httpSession->httpExchange->getInput(), configuration->originServerUrl[originServerUrlNumber]);
+		if ((originServerUrlNumber == 0) || negativeHttpCode)
+			negativeHttpCode = ((! returnCode) && negativeCache && negativeCache->isCacheable(httpReturnCode)) ? httpReturnCode : 0;
+		originServerUrlNumber++;
+		if (configuration->originServerUrl[originServerUrlNumber][0] == '\0')
+			break;
+	}
+
+	systemLog->sysLog(ERROR, "cannot found file '%s' on origin server urls", httpSession->videoName);
+	if (negativeHttpCode)
+		negativeCache->add(httpSession->videoName, negativeHttpCode);
+	returnCode = unlink(videoNameTmpFilePath);
+	if (returnCode < 0) {
+		systemLog->sysLog(ERROR, "[descriptor %d] cannot delete the file '%s': %s", httpSession->httpExchange->getInput(), videoNameTmpFilePath, strerror(errno));
+	}
+	httpSession->destroy(true);
+	close(clientSocket);
+
+	return;
+}
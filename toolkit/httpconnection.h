@@ -19,9 +19,28 @@
 #include "../toolkit/httpsession.h"
 #include "../toolkit/cachedisk.h"
 #include "../toolkit/cachememory.h"
+#include "../toolkit/negativecache.h"
 #include "../toolkit/curl.h"
 #include "../src/configuration.h"
 
+// First bytes of the object asked to the origin to find its atoms
+#define HTTPCONNECTION_RANGEHEADSIZE 65536
+
+class HttpConnection;
+
+// Ranged answer of the origin, copied in buffer or, without buffer, sent to the client
+struct OriginRange {
+	HttpSession *httpSession;
+	HttpConnection *httpConnection;
+	Curl *curl;
+	CurlSession *curlSession;
+	char *url;
+	unsigned char *buffer;
+	uint64_t size;
+	uint64_t received;
+	int64_t totalSize;
+};
+
 /**
 	@author  <spe@>
 */
@@ -31,18 +50,31 @@ private:
 	struct sockaddr_in saddr;
 	Curl *curl;
 	Configuration *configuration;
+	NegativeCache *negativeCache;
+	bool relayMode;
+
+	int proxyizeMp4Seek(HttpSession *, int);
 
 public:
 	bool cantSendMore;
+	// Client couldn't take the relayed data in time, it is sent the rest once the object is cached
+	bool clientLagging;
 	CacheObject *cacheObject;
 
-	HttpConnection(CacheObject *, Configuration *);
+	HttpConnection(CacheObject *, NegativeCache *, Configuration *);
 	~HttpConnection();
 
+	void setRelayMode(bool _relayMode) { relayMode = _relayMode; };
 	void proxyize(HttpSession *);
 	void cache(HttpSession *);
+	void relay(HttpSession *);
+	int commitCacheFile(HttpSession *, long);
+	ssize_t sendClient(HttpSession *, const void *, size_t, int);
+	int sendClientFile(HttpSession *, int);
+	int64_t fetchOriginRange(struct OriginRange *, uint64_t, uint64_t, unsigned char *);
+	void logTransfer(HttpSession *, CurlSession *);
 	void combinedLog(HttpSession *, char *, int, int);
-	virtual void start(void *arguments) { if (! cacheObject) proxyize((HttpSession *)arguments); else cache((HttpSession *)arguments); delete(this); return; };
+	virtual void start(void *arguments) { if (! cacheObject) proxyize((HttpSession *)arguments); else if (relayMode == true) relay((HttpSession *)arguments); else cache((HttpSession *)arguments); delete(this); return; };
 };
 
 #endif
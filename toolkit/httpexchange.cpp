@@ -20,14 +20,14 @@ HttpExchange::HttpExchange(int _outputDescriptor) {
 	inputOffset = 0;
 	inputPtrOffset = 0;
 	mediaType = 0;
+	descriptorCache = NULL;
 
 	return;
 }
 
 
 HttpExchange::~HttpExchange() {
-	if (inputDescriptor)
-		close(inputDescriptor);
+	closeInput();
 
 	return;
 }
@@ -45,6 +45,17 @@ void HttpExchange::setInput(int descriptor) {
 	return;
 }
 
+void HttpExchange::closeInput(void) {
+	if (! inputDescriptor)
+		return;
+	if ((! descriptorCache) || (descriptorCache->release(inputDescriptor) < 0))
+		close(inputDescriptor);
+	inputDescriptor = 0;
+	descriptorCache = NULL;
+
+	return;
+}
+
 char *HttpExchange::getInputPtr(void) {
 	return inputPtr;
 }
@@ -58,6 +69,8 @@ int HttpExchange::getInputOffset(void) {
 	return inputOffset;
 }
 
+// Input descriptor may be shared through the descriptor cache, seeks only move
+// the read offset of this exchange
 void HttpExchange::setInputOffset(int offset) {
 	inputOffset = offset;
 
@@ -12,6 +12,8 @@
 #ifndef HTTPEXCHANGE_H
 #define HTTPEXCHANGE_H
 
+#include "../toolkit/descriptorcache.h"
+
 /**
 	@author  <spe@>
 */
@@ -28,12 +30,15 @@ public:
 
 	// Normally a socket
 	int outputDescriptor;
+	// Set when inputDescriptor is shared through the descriptor cache
+	DescriptorCache *descriptorCache;
 
 	HttpExchange(int);
 	~HttpExchange();
 
 	int getInput(void);
 	void setInput(int);
+	void closeInput(void);
 	int getOutput(void);
 	char *getInputPtr(void);
 	void setInputPtr(char *);
@@ -173,6 +173,8 @@ void HttpServer::initHeader(HttpSession *httpSession, const char *additionalHead
 	const char *wmvMimeType = "video/x-ms-wmv";
 	const char *oggMimeType = "video/ogg";
 	const char *webmMimeType = "video/webm";
+	const char *hlsMimeType = "application/vnd.apple.mpegurl";
+	const char *dashMimeType = "application/dash+xml";
 	//const char *htmlMimeType = "text/html";
 	const char *defaultMimeType = "application/octet-stream";
 	const char *connectionClose = "Connection: close";
@@ -198,6 +200,25 @@ void HttpServer::initHeader(HttpSession *httpSession, const char *additionalHead
 		httpSession->noDataToSend = true;
 	}
 
+	if (httpSession->packaging == PACKAGING_HLS) {
+		mimeType = hlsMimeType;
+		httpSession->keepAliveConnection = false;
+		httpSession->mimeType = 8;
+	}
+	else
+	if (httpSession->packaging == PACKAGING_DASH) {
+		mimeType = dashMimeType;
+		httpSession->keepAliveConnection = false;
+		httpSession->mimeType = 9;
+	}
+	else
+	if (httpSession->mp4Streaming) {
+		// Fragmented mp4, also when remuxed from a flv
+		mimeType = mp4MimeType;
+		httpSession->keepAliveConnection = false;
+		httpSession->mimeType = 4;
+	}
+	else
 	if (strstr(httpSession->httpFullRequest, ".jpg")) {
 		mimeType = jpegMimeType;
 		httpSession->mimeType = 0;
@@ -682,10 +703,27 @@ int HttpServer::acceptConnection(void) {
 	return 0;
 }
 
+// First context of the session virtual host or "*", walked by element instead of
+// getElement(i) which restarts from the head of the list each time
+HttpContext *HttpServer::searchContext(HttpSession *httpSession) {
+	ListElt<HttpContext *> *httpContextElt;
+	HttpContext *httpContext;
+
+	// The end sentinel has no data
+	for (httpContextElt = httpContextList.getMaListe()->getNext(); (httpContext = httpContextElt->getData()); httpContextElt = httpContextElt->getNext()) {
+#ifdef DEBUGOUTPUT	
+		fprintf(stderr, "[DEBUG] virtual is %s, context path is %s\n", httpSession->virtualHost, httpContext->getVirtualHost());
+#endif
+		if ((! strcmp(httpContext->getVirtualHost(), httpSession->virtualHost)) || (! strcmp(httpContext->getVirtualHost(), "*")))
+			return httpContext;
+	}
+
+	return NULL;
+}
+
 int HttpServer::endConnection(HttpSession *httpSession) {
 	int returnCode;
  	HttpContext *httpContext;
-	int i;
 	struct kevent kChange;
 
 #ifdef DEBUGOUTPUT
@@ -699,15 +737,7 @@ int HttpServer::endConnection(HttpSession *httpSession) {
 	}
 
 	// Call virtual methods of HttpProtocol object
-	i = 1;
-	httpContext = httpContextList.getFirstElement();
-	while (httpContext && strcmp(httpContext->getVirtualHost(), httpSession->virtualHost) && strcmp(httpContext->getVirtualHost(), "*")) {
-#ifdef DEBUGOUTPUT	
-		fprintf(stderr, "[DEBUG] endConnection virtual is %s, context path is %s\n", httpSession->virtualHost, httpContext->getVirtualHost());
-#endif
-		httpContext = httpContextList.getElement(i);
-		i++;
-	}
+	httpContext = searchContext(httpSession);
 	if (httpContext) {
 		returnCode = httpContext->getHandler()->closeEvent(this, httpSession);
 		// XXX test the return code ?
@@ -725,7 +755,6 @@ int HttpServer::endConnection(HttpSession *httpSession) {
 int HttpServer::writeEvent(HttpSession *httpSession) {
 	struct kevent kChange[4];
 	int returnCode;
-	int i;
 	HttpContext *httpContext;
 
 #ifdef DEBUGOUTPUT
@@ -741,15 +770,7 @@ int HttpServer::writeEvent(HttpSession *httpSession) {
 	}
 
 	// Call virtual methods of HttpProtocol object
-	i = 1;
-	httpContext = httpContextList.getFirstElement();
-	while (httpContext && strcmp(httpContext->getVirtualHost(), httpSession->virtualHost) && strcmp(httpContext->getVirtualHost(), "*")) {
-#ifdef DEBUGOUTPUT	
-		fprintf(stderr, "[DEBUG] i = %d, writeEvent virtual is %s, context path is %s\n", i, httpSession->virtualHost, httpContext->getVirtualHost());
-#endif
-		httpContext = httpContextList.getElement(i);
-		i++;
-	}
+	httpContext = searchContext(httpSession);
 	if (httpContext) {
 		returnCode = httpContext->getHandler()->handle(this, httpSession);
 #ifdef DEBUGOUTPUT
@@ -767,7 +788,13 @@ int HttpServer::writeEvent(HttpSession *httpSession) {
 		}
 		if (returnCode == 3) {
 			//EV_SET(&kChange[1], httpSession->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_CLEAR | EV_ONESHOT, NOTE_LOWAT, sendLoWat, 0);
-			EV_SET(&kChange[0], httpSession->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
+			EV_SET(&httpSession->pendingChanges[0], httpSession->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
+			httpSession->pendingChangesCount = 1;
+			return 0;
+		}
+		if (returnCode == 4) {
+			// Session is parked on the blocking work pool, resumeWriteEvent() rearms it
+			EV_SET(&kChange[0], httpSession->kEvent.ident, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
 			returnCode = kevent(kQueue, kChange, 1, NULL, 0, NULL);
 			return 0;
 		}
@@ -809,18 +836,33 @@ int HttpServer::writeEvent(HttpSession *httpSession) {
 		endConnection(httpSession);
 		return 0;
 	}
-	EV_SET(&kChange[0], httpSession->kEvent.ident, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
-	EV_SET(&kChange[1], httpSession->kEvent.ident, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, writeTimeout, 0);
+	// Body path: the rearm is not sent now but with the next kevent() call of this worker
+	EV_SET(&httpSession->pendingChanges[0], httpSession->kEvent.ident, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
+	httpSession->timerGeneration++;
+	EV_SET(&httpSession->pendingChanges[1], httpSession->kEvent.ident, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, writeTimeout, (void *)httpSession->timerGeneration);
 	if ((httpSession->shappingTimeout > 0) && (! httpSession->burst))
-		EV_SET(&kChange[2], httpSession->kEvent.ident + 100000, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, httpSession->shappingTimeout, 0);
+		EV_SET(&httpSession->pendingChanges[2], httpSession->kEvent.ident + 100000, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, httpSession->shappingTimeout, 0);
 	else {
 		if (httpSession->burst)
 			httpSession->burst--;
-		EV_SET(&kChange[2], httpSession->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
+		EV_SET(&httpSession->pendingChanges[2], httpSession->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
 	}
-	returnCode = kevent(kQueue, kChange, 3, NULL, 0, NULL);
+	httpSession->pendingChangesCount = 3;
+
+	return 0;
+}
+
+// Called by a blocking work pool thread when a parked session can continue its answer
+int HttpServer::resumeWriteEvent(HttpSession *httpSession) {
+	struct kevent kChange[2];
+	int returnCode;
+
+	EV_SET(&kChange[0], httpSession->kEvent.ident, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, writeTimeout, (void *)httpSession->timerGeneration);
+	EV_SET(&kChange[1], httpSession->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
+	returnCode = kevent(kQueue, kChange, 2, NULL, 0, NULL);
 	if (returnCode < 0) {
 		systemLog->sysLog(ERROR, "[%d] (%d) problem while changing events: %s", httpSession->kEvent.ident, httpSession->fileDescriptor, strerror(errno));
+		return -1;
 	}
 
 	return 0;
@@ -885,7 +927,9 @@ int HttpServer::run(void *arguments) {
 	int i;
 	struct timespec kEventTimeout;
 	int numberOfEvents;
-	struct kevent kChange[1];
+	struct kevent kChanges[HTTPSERVER_MAXBATCHCHANGES];
+	int numberOfChanges = 0;
+	HttpSession *httpSession;
 #ifdef DEBUGOUTPUT
 	struct rusage ru;
 #endif
@@ -898,7 +942,10 @@ int HttpServer::run(void *arguments) {
 		getrusage(RUSAGE_SELF, &ru);
 		systemLog->sysLog(DEBUG, "memory usage: ru_maxrss %d ru_ixrss %d ru_idrss %d ru_isrss %d ru_minflt %d ru_majflt %d", ru.ru_maxrss, ru.ru_ixrss, ru.ru_idrss, ru.ru_isrss, ru.ru_minflt, ru.ru_majflt);
 #endif
-		numberOfEvents = kevent(kQueue, NULL, 0, kEvents, 1, NULL);
+		// Changes of the previous events are submitted with the wait, a failing change
+		// is returned as an EV_ERROR event so keep one slot per change
+		numberOfEvents = kevent(kQueue, kChanges, numberOfChanges, kEvents, numberOfChanges + 1, NULL);
+		numberOfChanges = 0;
 		if (numberOfEvents < 0) {
 			systemLog->sysLog(ERROR, "error while receiving an event from kqueue: %s", strerror(errno));
 			continue;
@@ -914,6 +961,13 @@ int HttpServer::run(void *arguments) {
 #ifdef STDOUTDEBUG
 			printf("EventNumber = %d, event Type = %d\n", i, kEvents[i].filter);
 #endif
+			if (kEvents[i].flags & EV_ERROR) {
+				// Timer already expired or deleted by endConnection
+				if (kEvents[i].data != ENOENT)
+					systemLog->sysLog(ERROR, "[%d] problem while changing events: %s", kEvents[i].ident, strerror(kEvents[i].data));
+				i++;
+				continue;
+			}
 			// Server socket event
 			if (kEvents[i].ident == (unsigned int)sd) {
 				returnCode = 0;
@@ -956,13 +1010,13 @@ int HttpServer::run(void *arguments) {
 #endif
 						if (kEvents[i].ident > 100000) {
 							//returnCode = writeEvent(httpSessions[kEvents[i].ident - 100000]);
-							EV_SET(&kChange[0], httpSessionsIndex[kEvents[i].ident - 100000]->kEvent.ident, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
-							returnCode = kevent(kQueue, kChange, 1, NULL, 0, NULL);
-							if (returnCode < 0) {
-								systemLog->sysLog(ERROR, "[%d] (%d) problem while changing events: %s", httpSessionsIndex[kEvents[i].ident - 100000]->kEvent.ident, httpSessionsIndex[kEvents[i].ident - 100000]->fileDescriptor, strerror(errno));
-							}
+							EV_SET(&kChanges[numberOfChanges], kEvents[i].ident - 100000, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
+							numberOfChanges++;
 							break;
 						}
+						// The session was rearmed by a worker which has not submitted its changes yet
+						if ((uintptr_t)kEvents[i].udata != httpSessionsIndex[kEvents[i].ident]->timerGeneration)
+							break;
 						if (httpSessionsIndex[kEvents[i].ident]->endOfRequest == true) {
 							systemLog->sysLog(ERROR, "[%d] transfer timeout (%d bytes) on socket for %s %s...", httpSessionsIndex[kEvents[i].ident]->httpExchange->outputDescriptor, httpSessionsIndex[kEvents[i].ident]->fileOffset, httpSessionsIndex[kEvents[i].ident]->httpRequest, httpSessionsIndex[kEvents[i].ident]->ipSource);
 #ifdef STDOUTDEBUG
@@ -983,6 +1037,14 @@ int HttpServer::run(void *arguments) {
 						break;
 				}
 				if (kEvents[i].ident < 100000) {
+					httpSession = httpSessionsIndex[kEvents[i].ident];
+					if (httpSession->pendingChangesCount) {
+						if (httpSession->mustCloseConnection == false) {
+							memcpy(&kChanges[numberOfChanges], httpSession->pendingChanges, httpSession->pendingChangesCount * sizeof(struct kevent));
+							numberOfChanges += httpSession->pendingChangesCount;
+						}
+						httpSession->pendingChangesCount = 0;
+					}
 					if ((httpSessionsIndex[kEvents[i].ident]->mustCloseConnection == true) && (httpSessionsIndex[kEvents[i].ident]->initialized == true)) {	
 						clientSocket = httpSessionsIndex[kEvents[i].ident]->httpExchange->getOutput();
 						httpSessionsIndex[kEvents[i].ident]->destroy(true);
@@ -996,6 +1058,13 @@ int HttpServer::run(void *arguments) {
 				}
 			}
 			i++;
+			// No more room for the changes of another event, flush them now
+			if (numberOfChanges > HTTPSERVER_MAXBATCHCHANGES - HTTPSESSION_MAXPENDINGCHANGES) {
+				returnCode = kevent(kQueue, kChanges, numberOfChanges, NULL, 0, NULL);
+				if (returnCode < 0)
+					systemLog->sysLog(ERROR, "problem while changing events: %s", strerror(errno));
+				numberOfChanges = 0;
+			}
 		}
 	}
 
@@ -13,6 +13,8 @@
 #define HTTPSERVER_H
 
 #define MAXHTTPREQUESTSIZE 4096
+// Rearm changes collected by a worker before its next kevent() call
+#define HTTPSERVER_MAXBATCHCHANGES 64
 
 #include <sys/types.h>
 #include <sys/event.h>
@@ -41,6 +43,8 @@ private:
 	char *aesVHost;
 	char *noByteRange;
 
+	HttpContext *searchContext(HttpSession *);
+
 protected:
 	int maxConnectionsAuthorized;
 	int kQueue;
@@ -67,6 +71,7 @@ public:
 	int writeHttpAnswer(HttpSession *);
 	int endConnection(HttpSession *);
 	int writeEvent(HttpSession *);
+	int resumeWriteEvent(HttpSession *);
 	int readEvent(HttpSession *);
 	int run(void *);
 	virtual void start(void *arguments) { run(arguments); delete this; return; };
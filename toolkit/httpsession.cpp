@@ -10,6 +10,7 @@
 //
 //
 #include "httpsession.h"
+#include "../src/mp4streaming.h"
 
 HttpSession::HttpSession(void) {
 	videoNameFilePath = (char *)malloc(MAXMSGSIZE + 1);
@@ -32,6 +33,7 @@ HttpSession::HttpSession(void) {
 	chunkBuffer = NULL;
 #endif
 	preBuffer = NULL;
+	mp4Streaming = NULL;
 	multicastData = NULL;
 	redirectUrl = NULL;
 	initialized = false;
@@ -108,7 +110,12 @@ HttpSession::HttpSession(HttpSession *httpSession) {
 	memcpy(&sourceFileStat, &httpSession->sourceFileStat, sizeof(sourceFileStat));
 	seekPosition = httpSession->seekPosition;
 	seekSeconds = httpSession->seekSeconds;
+	endSeconds = httpSession->endSeconds;
 	mp4Position = httpSession->mp4Position;
+	fragmentedSeek = httpSession->fragmentedSeek;
+	mp4Streaming = NULL;
+	packaging = httpSession->packaging;
+	segmentNumber = httpSession->segmentNumber;
 	keepAliveConnection = httpSession->keepAliveConnection;
 	endOfRequest = httpSession->endOfRequest;
 	endOfAnswer = httpSession->endOfAnswer;
@@ -118,6 +125,10 @@ HttpSession::HttpSession(HttpSession *httpSession) {
 	fileDescriptor = httpSession->fileDescriptor;
 	HTTPHeaderInitialized = httpSession->HTTPHeaderInitialized;
 	HTTPHeaderSent = httpSession->HTTPHeaderSent;
+	asyncState = ASYNC_NONE;
+	asyncReturnCode = 0;
+	pendingChangesCount = 0;
+	timerGeneration = 0;
 	strcpy(videoNameFilePath, httpSession->videoNameFilePath);
 	strcpy(videoNameNfsFilePath, httpSession->videoNameNfsFilePath);
 	fileOffset = httpSession->fileOffset;
@@ -149,6 +160,8 @@ HttpSession::~HttpSession() {
 #endif
 	if (preBuffer)
 		free(preBuffer);
+	if (mp4Streaming)
+		delete mp4Streaming;
 
 	if (multicastData)
 		free(multicastData);
@@ -192,7 +205,12 @@ void HttpSession::reinit() {
 	fileSize = -1;
 	seekPosition = 0;
 	seekSeconds = 0;
+	endSeconds = 0;
 	mp4Position = 0;
+	fragmentedSeek = false;
+	mp4Streaming = NULL;
+	packaging = PACKAGING_NONE;
+	segmentNumber = 0;
 	keepAliveConnection = false;
 	endOfRequest = false;
 	endOfAnswer = false;
@@ -204,6 +222,10 @@ void HttpSession::reinit() {
 	fileDescriptor = 0;
 	HTTPHeaderInitialized = false;
 	HTTPHeaderSent = false;
+	asyncState = ASYNC_NONE;
+	asyncReturnCode = 0;
+	pendingChangesCount = 0;
+	timerGeneration = 0;
 	videoNameFilePath[0] = '\0';
 	videoNameNfsFilePath[0] = '\0';
 	fileOffset = 0;
@@ -269,7 +291,12 @@ void HttpSession::init(int _clientSocket, struct sockaddr_in *_sourceAddress) {
 	fileSize = -1;
 	seekPosition = 0;
 	seekSeconds = 0;
+	endSeconds = 0;
 	mp4Position = 0;
+	fragmentedSeek = false;
+	mp4Streaming = NULL;
+	packaging = PACKAGING_NONE;
+	segmentNumber = 0;
 	keepAliveConnection = false;
 	endOfRequest = false;
 	endOfAnswer = false;
@@ -281,6 +308,10 @@ void HttpSession::init(int _clientSocket, struct sockaddr_in *_sourceAddress) {
 	fileDescriptor = 0;
 	HTTPHeaderInitialized = false;
 	HTTPHeaderSent = false;
+	asyncState = ASYNC_NONE;
+	asyncReturnCode = 0;
+	pendingChangesCount = 0;
+	timerGeneration = 0;
 	videoNameFilePath[0] = '\0';
 	videoNameNfsFilePath[0] = '\0';
 	fileOffset = 0;
@@ -328,7 +359,12 @@ void HttpSession::init(void) {
 	fileSize = -1;
 	seekPosition = 0;
 	seekSeconds = 0;
+	endSeconds = 0;
 	mp4Position = 0;
+	fragmentedSeek = false;
+	mp4Streaming = NULL;
+	packaging = PACKAGING_NONE;
+	segmentNumber = 0;
 	keepAliveConnection = false;
 	endOfRequest = false;
 	endOfAnswer = false;
@@ -340,6 +376,10 @@ void HttpSession::init(void) {
 	fileDescriptor = 0;
 	HTTPHeaderInitialized = false;
 	HTTPHeaderSent = false;
+	asyncState = ASYNC_NONE;
+	asyncReturnCode = 0;
+	pendingChangesCount = 0;
+	timerGeneration = 0;
 	videoNameFilePath[0] = '\0';
 	videoNameNfsFilePath[0] = '\0';
 	fileOffset = 0;
@@ -362,7 +402,7 @@ void HttpSession::destroy(bool closeSocket) {
 		httpExchange = NULL;
 	}
 	else
-		close(httpExchange->getInput());
+		httpExchange->closeInput();
 #ifndef SENDFILE
 	if (chunkBuffer) {
 #ifdef DEBUGOUTPUT
@@ -379,6 +419,10 @@ void HttpSession::destroy(bool closeSocket) {
 		preBufferOffset = 0;
 		preBufferSent = false;
 	}
+	if (mp4Streaming) {
+		delete mp4Streaming;
+		mp4Streaming = NULL;
+	}
 	if (multicastData) {
 		free(multicastData);
 		multicastData = NULL;
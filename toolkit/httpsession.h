@@ -28,6 +28,20 @@
 extern int numberOfConnections;
 
 #define MAXHTTPREQUESTSIZE 4096
+#define HTTPSESSION_MAXPENDINGCHANGES 3
+
+// State of the answer preparation delegated to the blocking work pool
+#define ASYNC_NONE	0
+#define ASYNC_PENDING	1
+#define ASYNC_DONE	2
+
+// Packaged answers of a mp4 object: hls=1, dash=1 or segment=<init|N>
+#define PACKAGING_NONE		0
+#define PACKAGING_HLS		1
+#define PACKAGING_DASH		2
+#define PACKAGING_SEGMENT	3
+
+class Mp4Streaming;
 
 typedef struct ByteRange {
 	int32_t start;
@@ -47,6 +61,12 @@ public:
 	// Actual Kqueue Event
 	struct kevent kEvent;
 
+	// Rearm changes given to kqueue with the next kevent() call of the worker
+	struct kevent pendingChanges[HTTPSESSION_MAXPENDINGCHANGES];
+	int pendingChangesCount;
+	// Stored in the udata of the write timer, an older timer is a stale one
+	uintptr_t timerGeneration;
+
 	// Communication Exchange (descriptors etc...)
 	HttpExchange *httpExchange;
 
@@ -75,13 +95,23 @@ public:
 
 	// Request file informations
 	int fileDescriptor;
+	// Size of the answer, generated answers larger than INT_MAX are refused
 	int fileSize;
 	struct stat sourceFileStat;
 
 	// Streaming vars
 	int seekPosition;
 	double seekSeconds;
+	// End of a mp4 clip, 0 for the end of the file
+	double endSeconds;
 	int mp4Position;
+	// fmp4=1, a mp4 seek is answered with fragments, a H.264/AAC flv is remuxed to them
+	bool fragmentedSeek;
+	// Fragments still to be built, NULL for any other answer
+	Mp4Streaming *mp4Streaming;
+	char packaging;
+	// -1 for the init segment
+	int segmentNumber;
 
 	// Some booleans, state of the connection etc...
 	bool keepAliveConnection;
@@ -132,6 +162,10 @@ public:
 	bool mustCloseConnection;
 	char burst;
 
+	// Answer preparation running on the blocking work pool
+	char asyncState;
+	int asyncReturnCode;
+
 	char mimeType;
 
 	HttpSession();
@@ -37,10 +37,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <inttypes.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
 
@@ -59,6 +67,11 @@
 
 #define MAX_TRACKS 8
 
+// Bigger moov atoms are not fetched by range
+#define MP4_RANGES_MAX_MOOV_SIZE (64 * 1024 * 1024)
+// An ftyp is a few brands, a bigger one is not a file to seek
+#define MP4_RANGES_MAX_FTYP_SIZE (64 * 1024)
+
 #define FOURCC(a, b, c, d) ((uint32_t)(a) << 24) + \
                            ((uint32_t)(b) << 16) + \
                            ((uint32_t)(c) << 8) + \
@@ -154,6 +167,119 @@ static unsigned char* write_64(unsigned char* buffer, uint64_t v)
   return buffer + 8;
 }
 
+// Sample tables are big endian arrays of millions of entries on long files,
+// they are converted 4 entries at a time with SSE2
+#ifdef __SSE2__
+static __m128i bswap_32x4(__m128i v)
+{
+  v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+
+  return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+#endif
+
+static void read_32_array(uint32_t* values, unsigned char const* buffer, unsigned int count)
+{
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((__m128i const*)(buffer + i * 4));
+    _mm_storeu_si128((__m128i*)(values + i), bswap_32x4(v));
+  }
+#endif
+  for(; i != count; ++i)
+    values[i] = read_32(buffer + i * 4);
+}
+
+static unsigned char* write_32_array(unsigned char* buffer, uint32_t const* values, unsigned int count)
+{
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((__m128i const*)(values + i));
+    _mm_storeu_si128((__m128i*)(buffer + i * 4), bswap_32x4(v));
+  }
+#endif
+  for(; i != count; ++i)
+    write_32(buffer + i * 4, values[i]);
+
+  return buffer + count * 4;
+}
+
+// 32 bits big endian offsets (stco) to and from the 64 bits offsets in memory
+static void read_32_array_64(uint64_t* values, unsigned char const* buffer, unsigned int count)
+{
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i v = bswap_32x4(_mm_loadu_si128((__m128i const*)(buffer + i * 4)));
+    _mm_storeu_si128((__m128i*)(values + i), _mm_unpacklo_epi32(v, zero));
+    _mm_storeu_si128((__m128i*)(values + i + 2), _mm_unpackhi_epi32(v, zero));
+  }
+#endif
+  for(; i != count; ++i)
+    values[i] = read_32(buffer + i * 4);
+}
+
+static unsigned char* write_64_array_32(unsigned char* buffer, uint64_t const* values, unsigned int count)
+{
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i low = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const*)(values + i)), _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i high = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const*)(values + i + 2)), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i*)(buffer + i * 4), bswap_32x4(_mm_unpacklo_epi64(low, high)));
+  }
+#endif
+  for(; i != count; ++i)
+    write_32(buffer + i * 4, (uint32_t)values[i]);
+
+  return buffer + count * 4;
+}
+
+// Offsets of a written stco moved by the size of what is put in front of them
+static void add_32_array_inplace(unsigned char* buffer, unsigned int count, int32_t offset)
+{
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  __m128i add = _mm_set1_epi32(offset);
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i v = bswap_32x4(_mm_loadu_si128((__m128i const*)(buffer + i * 4)));
+    _mm_storeu_si128((__m128i*)(buffer + i * 4), bswap_32x4(_mm_add_epi32(v, add)));
+  }
+#endif
+  for(; i != count; ++i)
+    write_32(buffer + i * 4, read_32(buffer + i * 4) + offset);
+}
+
+static void add_64_array(uint64_t* values, unsigned int count, int64_t offset)
+{
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  __m128i add = _mm_set1_epi64x(offset);
+  for(; i + 2 <= count; i += 2)
+  {
+    __m128i v = _mm_loadu_si128((__m128i const*)(values + i));
+    _mm_storeu_si128((__m128i*)(values + i), _mm_add_epi64(v, add));
+  }
+#endif
+  for(; i != count; ++i)
+    values[i] += offset;
+}
+
 #define ATOM_PREAMBLE_SIZE 8
 
 struct atom_t
@@ -512,12 +638,12 @@ struct chunks_t
   uint64_t pos_;          // start byte position of chunk
 };
 
+// One column per field, the cut point search only walks the times
 struct samples_t
 {
-  unsigned int pts_;      // decoding/presentation time
-  unsigned int size_;     // size in bytes
-  uint64_t pos_;          // byte offset
-  unsigned int cto_;      // composition time offset
+  unsigned int* pts_;     // decoding/presentation time, one more entry for the end of the track
+  uint64_t* pos_;         // byte offset
+  unsigned int* cto_;     // composition time offset, only with a ctts
 };
 
 struct trak_t
@@ -526,12 +652,14 @@ struct trak_t
   struct tkhd_t* tkhd_;
   struct mdia_t* mdia_;
 
-  /* temporary indices */
+  /* temporary indices, read only once built */
   unsigned int chunks_size_;
   struct chunks_t* chunks_;
 
   unsigned int samples_size_;
-  struct samples_t* samples_;
+  struct samples_t samples_;
+
+  int shared_index_;      // indices belong to a mp4_index_t
 };
 
 struct mvhd_t
@@ -897,8 +1025,6 @@ void stts_exit(struct stts_t* atom)
 
 static void* stts_read(void* UNUSED(parent), unsigned char* buffer, uint64_t size)
 {
-  unsigned int i;
-
   struct stts_t* atom;
 
   if(size < 8)
@@ -916,12 +1042,8 @@ static void* stts_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 
   atom->table_ = (struct stts_table_t*)(malloc(atom->entries_ * sizeof(struct stts_table_t)));
 
-  for(i = 0; i != atom->entries_; ++i)
-  {
-    atom->table_[i].sample_count_ = read_32(buffer + 0);
-    atom->table_[i].sample_duration_ = read_32(buffer + 4);
-    buffer += 8;
-  }
+  // [sample_count, sample_duration] pairs
+  read_32_array((uint32_t*)atom->table_, buffer, atom->entries_ * 2);
 
   return atom;
 }
@@ -929,74 +1051,15 @@ static void* stts_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 static unsigned char* stts_write(void* UNUSED(parent), void* atom, unsigned char* buffer)
 {
   struct stts_t* stts = (stts_t *)atom;
-  unsigned int i;
 
   buffer = write_8(buffer, stts->version_);
   buffer = write_24(buffer, stts->flags_);
   buffer = write_32(buffer, stts->entries_);
-  for(i = 0; i != stts->entries_; ++i)
-  {
-    buffer = write_32(buffer, stts->table_[i].sample_count_);
-    buffer = write_32(buffer, stts->table_[i].sample_duration_);
-  }
+  buffer = write_32_array(buffer, (uint32_t const*)stts->table_, stts->entries_ * 2);
 
   return buffer;
 }
 
-static unsigned int stts_get_sample(struct stts_t const* stts, uint64_t time)
-{
-  unsigned int stts_index = 0;
-  unsigned int stts_count;
-
-  unsigned int ret = 0;
-  uint64_t time_count = 0;
-
-  for(; stts_index != stts->entries_; ++stts_index)
-  {
-    unsigned int sample_count = stts->table_[stts_index].sample_count_;
-    unsigned int sample_duration = stts->table_[stts_index].sample_duration_;
-    if(time_count + (uint64_t)sample_duration * (uint64_t)sample_count >= time)
-    {
-      stts_count = (unsigned int)((time - time_count) / sample_duration);
-      time_count += (uint64_t)stts_count * (uint64_t)sample_duration;
-      ret += stts_count;
-      break;
-    }
-    else
-    {
-      time_count += (uint64_t)sample_duration * (uint64_t)sample_count;
-      ret += sample_count;
-    }
-  }
-  return ret;
-}
-
-static uint64_t stts_get_time(struct stts_t const* stts, unsigned int sample)
-{
-  uint64_t ret = 0;
-  unsigned int stts_index = 0;
-  unsigned int sample_count = 0;
-  
-  for(;;)
-  {
-    unsigned int table_sample_count = stts->table_[stts_index].sample_count_;
-    unsigned int table_sample_duration = stts->table_[stts_index].sample_duration_;
-    if(sample_count + table_sample_count > sample)
-    {
-      unsigned int stts_count = (sample - sample_count);
-      ret += (uint64_t)stts_count * (uint64_t)table_sample_duration;
-      break;
-    }
-    else
-    {
-      sample_count += table_sample_count;
-      ret += (uint64_t)table_sample_count * (uint64_t)table_sample_duration;
-      stts_index++;
-    }
-  }
-  return ret;
-}
-
 static uint64_t stts_get_duration(struct stts_t const* stts)
 {
   uint64_t duration = 0;
@@ -1045,8 +1108,6 @@ void stss_exit(struct stss_t* atom)
 
 static void* stss_read(void* UNUSED(parent), unsigned char* buffer, uint64_t size)
 {
-  unsigned int i;
-
   struct stss_t* atom;
 
   if(size < 8)
@@ -1063,12 +1124,7 @@ static void* stss_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
   buffer += 8;
 
   atom->sample_numbers_ = (uint32_t*)malloc(atom->entries_ * sizeof(uint32_t));
-
-  for(i = 0; i != atom->entries_; ++i)
-  {
-    atom->sample_numbers_[i] = read_32(buffer);
-    buffer += 4;
-  }
+  read_32_array(atom->sample_numbers_, buffer, atom->entries_);
 
   return atom;
 }
@@ -1076,34 +1132,42 @@ static void* stss_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 static unsigned char* stss_write(void* UNUSED(parent), void* atom, unsigned char* buffer)
 {
   struct stss_t const* stss = (const stss_t *)atom;
-  unsigned int i;
 
   buffer = write_8(buffer, stss->version_);
   buffer = write_24(buffer, stss->flags_);
   buffer = write_32(buffer, stss->entries_);
-  for(i = 0; i != stss->entries_; ++i)
-  {
-    buffer = write_32(buffer, stss->sample_numbers_[i]);
-  }
+  buffer = write_32_array(buffer, stss->sample_numbers_, stss->entries_);
 
   return buffer;
 }
 
-static unsigned int stss_get_nearest_keyframe(struct stss_t const* stss, unsigned int sample)
+// First entry of the sorted values at or above value, count if there is none
+static unsigned int uint32_lower_bound(uint32_t const* values, unsigned int count, uint32_t value)
 {
-  // scan the sync samples to find the key frame that precedes the sample number
-  unsigned int i;
-  unsigned int table_sample = 0;
-  for(i = 0; i != stss->entries_; ++i)
+  unsigned int low = 0;
+  unsigned int high = count;
+
+  while(low != high)
   {
-    table_sample = stss->sample_numbers_[i];
-    if(table_sample >= sample)
-      break;
+    unsigned int middle = low + (high - low) / 2;
+    if(values[middle] < value)
+      low = middle + 1;
+    else
+      high = middle;
   }
-  if(table_sample == sample)
-    return table_sample;
+
+  return low;
+}
+
+static unsigned int stss_get_nearest_keyframe(struct stss_t const* stss, unsigned int sample)
+{
+  // search the sync samples for the key frame that precedes the sample number
+  unsigned int i = uint32_lower_bound(stss->sample_numbers_, stss->entries_, sample);
+
+  if(i != stss->entries_ && stss->sample_numbers_[i] == sample)
+    return sample;
   else
-    return stss->sample_numbers_[i - 1];
+    return stss->sample_numbers_[i ? i - 1 : 0];
 }
 
 static struct stsc_t* stsc_init()
@@ -1142,9 +1206,9 @@ static void* stsc_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 
   buffer += 8;
 
-  // reserve space for one extra entry as when splitting the video we may have to
-  // split the first entry
-  atom->table_ = (struct stsc_table_t*)(malloc((atom->entries_ + 1) * sizeof(struct stsc_table_t)));
+  // reserve space for two extra entries as when splitting the video we may have to
+  // split the first and the last entry
+  atom->table_ = (struct stsc_table_t*)(malloc((atom->entries_ + 2) * sizeof(struct stsc_table_t)));
 
   for(i = 0; i != atom->entries_; ++i)
   {
@@ -1194,8 +1258,6 @@ static void stsz_exit(struct stsz_t* atom)
 
 static void* stsz_read(void* UNUSED(parent), unsigned char* buffer, uint64_t size)
 {
-  unsigned int i;
-
   struct stsz_t* atom;
 
   if(size < 12)
@@ -1229,11 +1291,7 @@ static void* stsz_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
   if(!atom->sample_size_)
   {
     atom->sample_sizes_ = (uint32_t*)malloc(atom->entries_ * sizeof(uint32_t));
-    for(i = 0; i != atom->entries_; ++i)
-    {
-      atom->sample_sizes_[i] = read_32(buffer);
-      buffer += 4;
-    }
+    read_32_array(atom->sample_sizes_, buffer, atom->entries_);
   }
 
   return atom;
@@ -1242,17 +1300,13 @@ static void* stsz_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 static unsigned char* stsz_write(void* UNUSED(parent), void* atom, unsigned char* buffer)
 {
   struct stsz_t* stsz = (stsz_t *)atom;
-  unsigned int i;
   unsigned int entries = stsz->sample_size_ ? 0 : stsz->entries_;
 
   buffer = write_8(buffer, stsz->version_);
   buffer = write_24(buffer, stsz->flags_);
   buffer = write_32(buffer, stsz->sample_size_);
   buffer = write_32(buffer, entries);
-  for(i = 0; i != entries; ++i)
-  {
-    buffer = write_32(buffer, stsz->sample_sizes_[i]);
-  }
+  buffer = write_32_array(buffer, stsz->sample_sizes_, entries);
 
   return buffer;
 }
@@ -1276,8 +1330,6 @@ static void stco_exit(struct stco_t* atom)
 
 static void* stco_read(void* UNUSED(parent), unsigned char* buffer, uint64_t size)
 {
-  unsigned int i;
-
   struct stco_t* atom;
 
   if(size < 8)
@@ -1293,11 +1345,7 @@ static void* stco_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
     return 0;
 
   atom->chunk_offsets_ = (uint64_t*)malloc(atom->entries_ * sizeof(uint64_t));
-  for(i = 0; i != atom->entries_; ++i)
-  {
-    atom->chunk_offsets_[i] = read_32(buffer);
-    buffer += 4;
-  }
+  read_32_array_64(atom->chunk_offsets_, buffer, atom->entries_);
 
   return atom;
 }
@@ -1334,35 +1382,25 @@ static unsigned char* stco_write(void* parent, void* atom, unsigned char* buffer
 {
   struct stbl_t* stbl = (stbl_t *)parent;
   struct stco_t* stco = (stco_t *)atom;
-  unsigned int i;
 
   stbl->stco_inplace_ = buffer;      // newly generated stco (patched inplace)
 
   buffer = write_8(buffer, stco->version_);
   buffer = write_24(buffer, stco->flags_);
   buffer = write_32(buffer, stco->entries_);
-  for(i = 0; i != stco->entries_; ++i)
-  {
-    buffer = write_32(buffer, (uint32_t)(stco->chunk_offsets_[i]));
-  }
+  buffer = write_64_array_32(buffer, stco->chunk_offsets_, stco->entries_);
 
   return buffer;
 }
 
 static void stco_shift_offsets(struct stco_t* stco, int offset)
 {
-  unsigned int i;
-  for(i = 0; i != stco->entries_; ++i)
-    stco->chunk_offsets_[i] += offset;
+  add_64_array(stco->chunk_offsets_, stco->entries_, offset);
 }
 
 static void stco_shift_offsets_inplace(unsigned char* stco, int offset)
 {
-  unsigned int entries = read_32(stco + 4);
-  unsigned int* table = (unsigned int*)(stco + 8);
-  unsigned int i;
-  for(i = 0; i != entries; ++i)
-    write_32((unsigned char*)&table[i], (read_32((unsigned char*)&table[i]) + offset));
+  add_32_array_inplace(stco + 8, read_32(stco + 4), offset);
 }
 
 static struct ctts_t* ctts_init()
@@ -1384,8 +1422,6 @@ static void ctts_exit(struct ctts_t* atom)
 
 static void* ctts_read(void* UNUSED(parent), unsigned char* buffer, uint64_t size)
 {
-  unsigned int i;
-
   struct ctts_t* atom;
 
   if(size < 8)
@@ -1403,12 +1439,8 @@ static void* ctts_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 
   atom->table_ = (struct ctts_table_t*)(malloc(atom->entries_ * sizeof(struct ctts_table_t)));
 
-  for(i = 0; i != atom->entries_; ++i)
-  {
-    atom->table_[i].sample_count_ = read_32(buffer + 0);
-    atom->table_[i].sample_offset_ = read_32(buffer + 4);
-    buffer += 8;
-  }
+  // [sample_count, sample_offset] pairs
+  read_32_array((uint32_t*)atom->table_, buffer, atom->entries_ * 2);
 
   return atom;
 }
@@ -1416,16 +1448,11 @@ static void* ctts_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
 static unsigned char* ctts_write(void* UNUSED(parent), void* atom, unsigned char* buffer)
 {
   struct ctts_t const* ctts = (const ctts_t *)atom;
-  unsigned int i;
 
   buffer = write_8(buffer, ctts->version_);
   buffer = write_24(buffer, ctts->flags_);
   buffer = write_32(buffer, ctts->entries_);
-  for(i = 0; i != ctts->entries_; ++i)
-  {
-    buffer = write_32(buffer, (uint32_t)(ctts->table_[i].sample_count_));
-    buffer = write_32(buffer, (uint32_t)(ctts->table_[i].sample_offset_));
-  }
+  buffer = write_32_array(buffer, (uint32_t const*)ctts->table_, ctts->entries_ * 2);
 
   return buffer;
 }
@@ -1886,20 +1913,11 @@ void trak_build_index(struct trak_t* trak)
       trak->samples_size_ = s;
     }
 
-    trak->samples_ = (samples_t *)malloc(trak->samples_size_ * sizeof(struct samples_t));
-
-    if(sample_size == 0)
-    {
-      unsigned int i;
-      for(i = 0; i != trak->samples_size_ ; ++i)
-        trak->samples_[i].size_ = stsz->sample_sizes_[i];
-    }
-    else
-    {
-      unsigned int i;
-      for(i = 0; i != trak->samples_size_ ; ++i)
-        trak->samples_[i].size_ = sample_size;
-    }
+    trak->samples_.pts_ = (unsigned int *)malloc((trak->samples_size_ + 1) * sizeof(unsigned int));
+    trak->samples_.pos_ = (uint64_t *)malloc((trak->samples_size_ + 1) * sizeof(uint64_t));
+    trak->samples_.cto_ = 0;
+    if(trak->mdia_->minf_->stbl_->ctts_)
+      trak->samples_.cto_ = (unsigned int *)calloc(trak->samples_size_ + 1, sizeof(unsigned int));
   }
 
 //  i = 0;
@@ -1923,13 +1941,16 @@ void trak_build_index(struct trak_t* trak)
       unsigned int i;
       unsigned int sample_count = stts->table_[j].sample_count_;
       unsigned int sample_duration = stts->table_[j].sample_duration_;
-      for(i = 0; i < sample_count; i++)
+      for(i = 0; i < sample_count && s < trak->samples_size_; i++)
       {
-        trak->samples_[s].pts_ = pts;
+        trak->samples_.pts_[s] = pts;
         ++s;
         pts += sample_duration;
       }
     }
+    // End of the last sample, its duration is pts_[end] - pts_[end - 1]
+    for(; s <= trak->samples_size_; ++s)
+      trak->samples_.pts_[s] = pts;
   }
 
   // calc composition times:
@@ -1945,31 +1966,55 @@ void trak_build_index(struct trak_t* trak)
         unsigned int i;
         unsigned int sample_count = ctts->table_[j].sample_count_;
         unsigned int sample_offset = ctts->table_[j].sample_offset_;
-        for(i = 0; i < sample_count; i++)
+        for(i = 0; i < sample_count && s < trak->samples_size_; i++)
         {
-          trak->samples_[s].cto_ = sample_offset;
+          trak->samples_.cto_[s] = sample_offset;
           ++s;
         }
       }
     }
   }
 
-  // calc sample offsets
+  // calc sample offsets, sizes are read from stsz
   {
+    struct stsz_t const* stsz = trak->mdia_->minf_->stbl_->stsz_;
     unsigned int s = 0;
     unsigned int j;
+    uint64_t pos = 0;
     for(j = 0; j != trak->chunks_size_; j++)
     {
-      uint64_t pos = trak->chunks_[j].pos_;
       unsigned int i;
-      for(i = 0; i != trak->chunks_[j].size_; i++)
+      pos = trak->chunks_[j].pos_;
+      for(i = 0; i != trak->chunks_[j].size_ && s < trak->samples_size_; i++)
       {
-        trak->samples_[s].pos_ = pos;
-        pos += trak->samples_[s].size_;
+        trak->samples_.pos_[s] = pos;
+        pos += stsz->sample_size_ ? stsz->sample_size_ : stsz->sample_sizes_[s];
         ++s;
       }
     }
+    for(; s <= trak->samples_size_; ++s)
+      trak->samples_.pos_[s] = pos;
+  }
+}
+
+// Last sample starting at or before the time, binary search of the pts built
+// from the stts instead of walking its entries
+static unsigned int samples_get_sample(struct samples_t const* samples, unsigned int samples_size,
+                                       uint64_t time)
+{
+  unsigned int low = 0;
+  unsigned int high = samples_size + 1;
+
+  while(high - low > 1)
+  {
+    unsigned int middle = low + (high - low) / 2;
+    if(samples->pts_[middle] <= time)
+      low = middle;
+    else
+      high = middle;
   }
+
+  return low;
 }
 
 void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end)
@@ -1987,10 +2032,10 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
     {
       unsigned int sample_count = 1;
       unsigned int sample_duration =
-        trak->samples_[s + 1].pts_ - trak->samples_[s].pts_;
+        trak->samples_.pts_[s + 1] - trak->samples_.pts_[s];
       while(s != end - 1)
       {
-        if((trak->samples_[s + 1].pts_ - trak->samples_[s].pts_) != sample_duration)
+        if((trak->samples_.pts_[s + 1] - trak->samples_.pts_[s]) != sample_duration)
           break;
         ++sample_count;
         ++s;
@@ -2019,10 +2064,10 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
       for(s = start; s != end; ++s)
       {
         unsigned int sample_count = 1;
-        unsigned int sample_offset = trak->samples_[s].cto_;
+        unsigned int sample_offset = trak->samples_.cto_[s];
         while(s != end - 1)
         {
-          if(trak->samples_[s + 1].cto_ != sample_offset)
+          if(trak->samples_.cto_[s + 1] != sample_offset)
             break;
           ++sample_count;
           ++s;
@@ -2044,12 +2089,17 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
   // process chunkmap:
   {
     struct stsc_t* stsc = trak->mdia_->minf_->stbl_->stsc_;
-    unsigned int i;
+    unsigned int i = 0;
+    unsigned int high = trak->chunks_size_;
 
-    for(i = 0; i != trak->chunks_size_; ++i)
+    // first chunk ending after the start sample, the chunks are in sample order
+    while(i != high)
     {
-      if(trak->chunks_[i].sample_ + trak->chunks_[i].size_ > start)
-        break;
+      unsigned int middle = i + (high - i) / 2;
+      if(trak->chunks_[middle].sample_ + trak->chunks_[middle].size_ > start)
+        high = middle;
+      else
+        i = middle + 1;
     }
 
     {
@@ -2059,10 +2109,15 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
       // problem.mp4: reported by Jin-seok Lee. Second track contains no samples
       if(trak->chunks_size_ != 0)
       {
-        unsigned int samples =
-          trak->chunks_[i].sample_ + trak->chunks_[i].size_ - start;
+        unsigned int chunk_last = trak->chunks_[i].sample_ + trak->chunks_[i].size_;
+        unsigned int samples;
         unsigned int id = trak->chunks_[i].id_;
 
+        // a clip may end in the middle of a chunk
+        if(chunk_last > end)
+          chunk_last = end;
+        samples = chunk_last - start;
+
         // write entry [chunk,samples,id]
         stsc->table_[stsc_entries].chunk_ = 0;
         stsc->table_[stsc_entries].samples_ = samples;
@@ -2073,12 +2128,16 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
         {
           for(i += 1; i != trak->chunks_size_; ++i)
           {
+            unsigned int chunk_samples = trak->chunks_[i].size_;
+
             if(trak->chunks_[i].sample_ >= end)
               break;
+            if(trak->chunks_[i].sample_ + chunk_samples > end)
+              chunk_samples = end - trak->chunks_[i].sample_;
 
-            if(trak->chunks_[i].size_ != samples)
+            if(chunk_samples != samples)
             {
-              samples = trak->chunks_[i].size_;
+              samples = chunk_samples;
               id = trak->chunks_[i].id_;
 
               stsc->table_[stsc_entries].chunk_ = i - chunk_start;
@@ -2094,16 +2153,12 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
 
       {
         struct stco_t* stco = trak->mdia_->minf_->stbl_->stco_;
-        unsigned int entries = 0;
-        for(i = chunk_start; i != chunk_end; ++i)
-        {
-          stco->chunk_offsets_[entries] = stco->chunk_offsets_[i];
-          ++entries;
-        }
-        stco->entries_ = entries;
+        memmove(stco->chunk_offsets_, stco->chunk_offsets_ + chunk_start,
+                (chunk_end - chunk_start) * sizeof(uint64_t));
+        stco->entries_ = chunk_end - chunk_start;
 
         // patch first chunk with correct sample offset
-        stco->chunk_offsets_[0] = (uint32_t)trak->samples_[start].pos_;
+        stco->chunk_offsets_[0] = (uint32_t)trak->samples_.pos_[start];
       }
     }
   }
@@ -2113,16 +2168,9 @@ void trak_update_index(struct trak_t* trak, unsigned int start, unsigned int end
   {
     struct stss_t* stss = trak->mdia_->minf_->stbl_->stss_;
     unsigned int entries = 0;
-    unsigned int stss_start;
     unsigned int i;
 
-    for(i = 0; i != stss->entries_; ++i)
-    {
-      if(stss->sample_numbers_[i] >= start + 1)
-        break;
-    }
-    stss_start = i;
-    for(; i != stss->entries_; ++i)
+    for(i = uint32_lower_bound(stss->sample_numbers_, stss->entries_, start + 1); i != stss->entries_; ++i)
     {
       unsigned int sync_sample = stss->sample_numbers_[i];
       if(sync_sample >= end + 1)
@@ -2160,7 +2208,10 @@ static struct trak_t* trak_init()
   trak->chunks_size_ = 0;
   trak->chunks_ = 0;
   trak->samples_size_ = 0;
-  trak->samples_ = 0;
+  trak->samples_.pts_ = 0;
+  trak->samples_.pos_ = 0;
+  trak->samples_.cto_ = 0;
+  trak->shared_index_ = 0;
 
   return trak;
 }
@@ -2179,13 +2230,12 @@ static void trak_exit(struct trak_t* trak)
   {
     mdia_exit(trak->mdia_);
   }
-  if(trak->chunks_)
+  if(!trak->shared_index_)
   {
     free(trak->chunks_);
-  }
-  if(trak->samples_)
-  {
-    free(trak->samples_);
+    free(trak->samples_.pts_);
+    free(trak->samples_.pos_);
+    free(trak->samples_.cto_);
   }
   free(trak);
 }
@@ -2239,7 +2289,7 @@ static void* trak_read(void* UNUSED(parent), unsigned char* buffer, uint64_t siz
     return 0;
   }
 
-  trak_build_index(atom);
+  // index is built by moov_seek for the kept traks only
 
   return atom;
 }
@@ -2260,6 +2310,56 @@ static unsigned char* trak_write(void* UNUSED(parent), void* atom, unsigned char
   return buffer;
 }
 
+// Indices of a trak, built once and shared by the seeks on the same file
+struct trak_index_t
+{
+  unsigned int chunks_size_;
+  struct chunks_t* chunks_;
+  unsigned int samples_size_;
+  struct samples_t samples_;
+};
+
+// Give the built indices of the trak to trak_index
+static void trak_detach_index(struct trak_t* trak, struct trak_index_t* trak_index)
+{
+  trak_index->chunks_size_ = trak->chunks_size_;
+  trak_index->chunks_ = trak->chunks_;
+  trak_index->samples_size_ = trak->samples_size_;
+  trak_index->samples_ = trak->samples_;
+  trak->chunks_ = 0;
+  trak->samples_.pts_ = 0;
+  trak->samples_.pos_ = 0;
+  trak->samples_.cto_ = 0;
+}
+
+static void trak_attach_index(struct trak_t* trak, struct trak_index_t const* trak_index)
+{
+  trak->chunks_size_ = trak_index->chunks_size_;
+  trak->chunks_ = trak_index->chunks_;
+  trak->samples_size_ = trak_index->samples_size_;
+  trak->samples_ = trak_index->samples_;
+  trak->shared_index_ = 1;
+}
+
+static void trak_index_exit(struct trak_index_t* trak_index)
+{
+  free(trak_index->chunks_);
+  free(trak_index->samples_.pts_);
+  free(trak_index->samples_.pos_);
+  free(trak_index->samples_.cto_);
+}
+
+static size_t trak_index_size(struct trak_index_t const* trak_index)
+{
+  size_t sample_size = sizeof(unsigned int) + sizeof(uint64_t);
+
+  if(trak_index->samples_.cto_)
+    sample_size += sizeof(unsigned int);
+
+  return trak_index->chunks_size_ * sizeof(struct chunks_t) +
+         (trak_index->samples_size_ + 1) * sample_size;
+}
+
 void trak_shift_offsets(struct trak_t* trak, int64_t offset)
 {
   struct stco_t* stco = trak->mdia_->minf_->stbl_->stco_;
@@ -2534,6 +2634,7 @@ void moov_shift_offsets_inplace(struct moov_t* moov, int64_t offset)
   }
 }
 
+// trak_indices are the indices of a previous parse of the same moov, 0 to build them
 unsigned int moov_seek(unsigned char* moov_data,
                        uint64_t *moov_size,
                        float start_time,
@@ -2541,7 +2642,8 @@ unsigned int moov_seek(unsigned char* moov_data,
                        uint64_t* mdat_start,
                        uint64_t* mdat_size,
                        uint64_t offset,
-                       int client_is_flash)
+                       int client_is_flash,
+                       struct trak_index_t const* trak_indices)
 {
   struct moov_t* moov = (moov_t *)moov_read(NULL, moov_data + ATOM_PREAMBLE_SIZE,
                                   *moov_size - ATOM_PREAMBLE_SIZE);
@@ -2552,6 +2654,17 @@ unsigned int moov_seek(unsigned char* moov_data,
     return 0;
   }
 
+  {
+    unsigned int i;
+    for(i = 0; i != moov->tracks_; ++i)
+    {
+      if(trak_indices)
+        trak_attach_index(moov->traks_[i], &trak_indices[i]);
+      else
+        trak_build_index(moov->traks_[i]);
+    }
+  }
+
   {
     long moov_time_scale = moov->mvhd_->timescale_;
     unsigned int start = (unsigned int)(start_time * moov_time_scale);
@@ -2620,17 +2733,17 @@ unsigned int moov_seek(unsigned char* moov_data,
         }
         else
         {
-          start = stts_get_sample(stbl->stts_, (uint64_t)(start * moov_to_trak_time));
+          start = samples_get_sample(&trak->samples_, trak->samples_size_, (uint64_t)(start * moov_to_trak_time));
 #ifdef DEBUGMOOV
           systemLog->sysLog(DEBUG, "start=%u (trac time)=%.2f (seconds)", start,
-            stts_get_time(stbl->stts_, start) / (float)trak_time_scale);
+            trak->samples_.pts_[start] / (float)trak_time_scale);
 #endif
           start = stbl_get_nearest_keyframe(stbl, start + 1) - 1;
 #ifdef DEBUGMOOV
           systemLog->sysLog(DEBUG, "=%u (zero based keyframe)", start);
 #endif
           trak_sample_start[i] = start;
-          start = (unsigned int)(stts_get_time(stbl->stts_, start) * trak_to_moov_time);
+          start = (unsigned int)(trak->samples_.pts_[start] * trak_to_moov_time);
 #ifdef DEBUGMOOV
           systemLog->sysLog(DEBUG, "=%u (moov time)\n", start);
 #endif
@@ -2643,7 +2756,7 @@ unsigned int moov_seek(unsigned char* moov_data,
         }
         else
         {
-          end = stts_get_sample(stbl->stts_, (uint64_t)(end * moov_to_trak_time));
+          end = samples_get_sample(&trak->samples_, trak->samples_size_, (uint64_t)(end * moov_to_trak_time));
           if(end >= trak->samples_size_)
           {
             end = trak->samples_size_;
@@ -2656,7 +2769,7 @@ unsigned int moov_seek(unsigned char* moov_data,
 #ifdef DEBUGMOOV
           systemLog->sysLog(DEBUG, "endframe=%u, samples_size_=%u\n", end, trak->samples_size_);
 #endif
-          end = (unsigned int)(stts_get_time(stbl->stts_, end) * trak_to_moov_time);
+          end = (unsigned int)(trak->samples_.pts_[end] * trak_to_moov_time);
         }
       }
     }
@@ -2688,16 +2801,17 @@ unsigned int moov_seek(unsigned char* moov_data,
 
       {
         uint64_t skip =
-          trak->samples_[start_sample].pos_ - trak->samples_[0].pos_;
+          trak->samples_.pos_[start_sample] - trak->samples_.pos_[0];
         if(skip < skip_from_start)
           skip_from_start = skip;
 #ifdef DEBUGMOOV
         systemLog->sysLog(DEBUG, "Trak can skip %llu bytes\n", skip);
 #endif
 
-        if(end_sample != trak->samples_size_)
+        // every trak bounds the range, pos_[samples_size_] is the end of its last sample
+        if(end_time > 0)
         {
-          uint64_t end_pos = trak->samples_[end_sample].pos_;
+          uint64_t end_pos = trak->samples_.pos_[end_sample];
           if(end_pos > end_offset)
             end_offset = end_pos;
 #ifdef DEBUGMOOV
@@ -2859,11 +2973,12 @@ unsigned int moov_seek(unsigned char* moov_data,
     }
 #endif
 
-    *mdat_start += skip_from_start;
-    if(end_offset != 0)
+    // end_offset is a file position, the size counts from the start of the mdat atom
+    if(end_offset > *mdat_start && end_offset < *mdat_start + *mdat_size)
     {
-      *mdat_size = end_offset;
+      *mdat_size = end_offset - *mdat_start;
     }
+    *mdat_start += skip_from_start;
     *mdat_size -= skip_from_start;
   }
 
@@ -2883,25 +2998,38 @@ struct mp4_atom_t
   uint64_t end_;
 };
 
-static int mp4_atom_read_header(FILE* infile, struct mp4_atom_t* atom)
+// Header of the atom at offset in the file, buffer holds its first bytes
+// (16 or up to the end of the file), 0 if the atom doesn't fit in the file
+static int mp4_atom_read_header(unsigned char const* buffer, uint64_t offset,
+                                uint64_t filesize, struct mp4_atom_t* atom)
 {
-  unsigned char atom_header[8];
+  unsigned int header_size = 8;
 
-  atom->start_ = ftell(infile);
-  fread(atom_header, 8, 1, infile);
-  atom->short_size_ = read_32(&atom_header[0]);
-  atom->type_ = read_32(&atom_header[4]);
+  if(offset + 8 > filesize)
+    return 0;
+  atom->start_ = offset;
+  atom->short_size_ = read_32(buffer);
+  atom->type_ = read_32(buffer + 4);
 
   if(atom->short_size_ == 1)
   {
-    fread(atom_header, 8, 1, infile);
-    atom->size_ = read_64(&atom_header[0]);
+    if(offset + 16 > filesize)
+      return 0;
+    atom->size_ = read_64(buffer + 8);
+    header_size = 16;
+  }
+  else if(atom->short_size_ == 0)
+  {
+    // last atom, up to the end of the file
+    atom->size_ = filesize - offset;
   }
   else
   {
     atom->size_ = atom->short_size_;
   }
 
+  if(atom->size_ < header_size || atom->size_ > filesize - offset)
+    return 0;
   atom->end_ = atom->start_ + atom->size_;
 
   return 1;
@@ -2929,38 +3057,21 @@ static int mp4_atom_write_header(unsigned char* outbuffer, struct mp4_atom_t* at
   }
 }
 
-int mp4_split(const char* filename, int64_t filesize,
-              float start_time, float end_time,
-              void** mp4_header, uint32_t* mp4_header_size,
-              uint64_t* mdat_offset, uint64_t* mdat_size,
-              int client_is_flash)
+// Walk the top level atoms of the mapped file, nothing is copied
+static int mp4_read_atoms(unsigned char const* data, uint64_t filesize,
+                          struct mp4_atom_t* ftyp_atom,
+                          struct mp4_atom_t* moov_atom,
+                          struct mp4_atom_t* mdat_atom)
 {
-  FILE* infile;
-  struct mp4_atom_t ftyp_atom;
-  struct mp4_atom_t moov_atom;
-  struct mp4_atom_t mdat_atom;
-  unsigned char* moov_data = 0;
-  unsigned char* buffer;
-  uint64_t new_mdat_start;
-
-  *mp4_header = 0;
-  memset(&ftyp_atom, 0, sizeof(ftyp_atom));
-  memset(&moov_atom, 0, sizeof(moov_atom));
-  memset(&mdat_atom, 0, sizeof(mdat_atom));
+  struct mp4_atom_t leaf_atom;
+  uint64_t offset = 0;
 
-  infile = fopen(filename, "rb");
-  if(infile == NULL)
-  {
-    return 0;
-  }
+  memset(ftyp_atom, 0, sizeof(*ftyp_atom));
+  memset(moov_atom, 0, sizeof(*moov_atom));
+  memset(mdat_atom, 0, sizeof(*mdat_atom));
 
-  while(ftello(infile) < filesize)
+  while(mp4_atom_read_header(data + offset, offset, filesize, &leaf_atom))
   {
-    struct mp4_atom_t leaf_atom;
-
-    if(!mp4_atom_read_header(infile, &leaf_atom))
-      break;
-
 #ifdef DEBUGMOOV
     systemLog->sysLog(DEBUG, "Atom(%c%c%c%c,%lld)\n",
            leaf_atom.type_ >> 24, leaf_atom.type_ >> 16,
@@ -2971,80 +3082,136 @@ int mp4_split(const char* filename, int64_t filesize,
     switch(leaf_atom.type_)
     {
     case FOURCC('f', 't', 'y', 'p'):
-      ftyp_atom = leaf_atom;
+      *ftyp_atom = leaf_atom;
       break;
     case FOURCC('m', 'o', 'o', 'v'):
-      moov_atom = leaf_atom;
-      moov_data = (unsigned char*)malloc((size_t)moov_atom.size_);
-      fseeko(infile, moov_atom.start_, SEEK_SET);
-      fread(moov_data, (off_t)moov_atom.size_, 1, infile);
+      // moov_read expects the 8 bytes preamble
+      if(leaf_atom.short_size_ != 1)
+        *moov_atom = leaf_atom;
       break;
     case FOURCC('m', 'd', 'a', 't'):
-      mdat_atom = leaf_atom;
+      *mdat_atom = leaf_atom;
       break;
     }
-    fseeko(infile, leaf_atom.end_, SEEK_SET);
+    offset = leaf_atom.end_;
   }
 
-  if(moov_atom.size_ == 0)
+  if(moov_atom->size_ == 0)
   {
 #ifdef DEBUGMOOV
     systemLog->sysLog(DEBUG, "Error: moov atom not found\n");
 #endif
-    fclose(infile);
     return 0;
   }
 
-  if(mdat_atom.size_ == 0)
+  if(mdat_atom->size_ == 0)
   {
 #ifdef DEBUGMOOV
     systemLog->sysLog(DEBUG, "Error: mdat atom not found\n");
 #endif
-    fclose(infile);
     return 0;
   }
 
-  buffer = (unsigned char*)malloc((uint32_t)moov_atom.size_ + 4 * 1024);
-  *mp4_header = buffer;
+  return 1;
+}
 
-  if(ftyp_atom.size_)
+// The atoms are parsed in the page cache, filesize is cut to the size of the file
+static unsigned char* mp4_map(const char* filename, int64_t* filesize)
+{
+  int descriptor;
+  struct stat file_stat;
+  unsigned char* map;
+
+  descriptor = open(filename, O_RDONLY);
+  if(descriptor < 0)
   {
-    fseeko(infile, ftyp_atom.start_, SEEK_SET);
-    fread(buffer, (off_t)ftyp_atom.size_, 1, infile);
-    buffer += ftyp_atom.size_;
+    return 0;
   }
-
+  if(fstat(descriptor, &file_stat) < 0)
   {
-    static char const free_data[] = {
-      0x0, 0x0, 0x0,  42, 'f', 'r', 'e', 'e',
-      'v', 'i', 'd', 'e', 'o', ' ', 's', 'e',
-      'r', 'v', 'e', 'd', ' ', 'b', 'y', ' ',
-      'm', 'o', 'd', '_', 'h', '2', '6', '4',
-      '_', 's', 't', 'r', 'e', 'a', 'm', 'i',
-      'n', 'g'
-    };
-    memcpy(buffer, free_data, sizeof(free_data));
-    buffer += sizeof(free_data);
+    close(descriptor);
+    return 0;
   }
-
-  new_mdat_start = buffer - (unsigned char*)(*mp4_header) + moov_atom.size_;
-  if(!moov_seek(moov_data,
-                &moov_atom.size_,
-                start_time,
-                end_time,
-                &mdat_atom.start_,
+  if(*filesize > file_stat.st_size)
+    *filesize = file_stat.st_size;
+  if(*filesize <= 0)
+  {
+    close(descriptor);
+    return 0;
+  }
+  map = (unsigned char*)mmap(NULL, (size_t)*filesize, PROT_READ, MAP_SHARED, descriptor, 0);
+  close(descriptor);
+  if(map == MAP_FAILED)
+  {
+    return 0;
+  }
+
+  return map;
+}
+
+// Header of the new file: ftyp, free, then the moov which is cut in place by moov_seek
+static int mp4_write_header(unsigned char const* ftyp_data, uint64_t ftyp_size,
+                            unsigned char const* moov_data, uint64_t moov_size,
+                            struct mp4_atom_t mdat_atom,
+                            float start_time, float end_time,
+                            void** mp4_header, uint32_t* mp4_header_size,
+                            uint64_t* mdat_offset, uint64_t* mdat_size,
+                            int client_is_flash,
+                            struct trak_index_t const* trak_indices)
+{
+  unsigned char* buffer;
+  uint64_t new_mdat_start;
+  uint64_t buffer_size;
+
+  // ftyp, free atom, moov with room to grow and a 64 bits mdat header
+  buffer_size = ftyp_size + 42 + moov_size + 4 * 1024 + 16;
+  *mp4_header = 0;
+  if(ftyp_size > UINT32_MAX || moov_size > UINT32_MAX || buffer_size > UINT32_MAX)
+  {
+    return 0;
+  }
+  buffer = (unsigned char*)malloc((size_t)buffer_size);
+  *mp4_header = buffer;
+  if(buffer == 0)
+  {
+    return 0;
+  }
+
+  if(ftyp_size)
+  {
+    memcpy(buffer, ftyp_data, (size_t)ftyp_size);
+    buffer += ftyp_size;
+  }
+
+  {
+    static char const free_data[] = {
+      0x0, 0x0, 0x0,  42, 'f', 'r', 'e', 'e',
+      'v', 'i', 'd', 'e', 'o', ' ', 's', 'e',
+      'r', 'v', 'e', 'd', ' ', 'b', 'y', ' ',
+      'm', 'o', 'd', '_', 'h', '2', '6', '4',
+      '_', 's', 't', 'r', 'e', 'a', 'm', 'i',
+      'n', 'g'
+    };
+    memcpy(buffer, free_data, sizeof(free_data));
+    buffer += sizeof(free_data);
+  }
+
+  // moov_read copies what it needs, the new moov is written over the old one
+  memcpy(buffer, moov_data, (uint32_t)moov_size);
+  new_mdat_start = buffer - (unsigned char*)(*mp4_header) + moov_size;
+  if(!moov_seek(buffer,
+                &moov_size,
+                start_time,
+                end_time,
+                &mdat_atom.start_,
                 &mdat_atom.size_,
                 new_mdat_start - mdat_atom.start_,
-                client_is_flash))
+                client_is_flash,
+                trak_indices))
   {
-    free(moov_data);
-    fclose(infile);
     return 0;
   }
-
-  memcpy(buffer, moov_data, (uint32_t)moov_atom.size_);
-  buffer += moov_atom.size_;
-  free(moov_data);
+  buffer += moov_size;
 
   {
     int mdat_header_size = mp4_atom_write_header(buffer, &mdat_atom);
@@ -3055,11 +3222,1669 @@ int mp4_split(const char* filename, int64_t filesize,
 
   *mp4_header_size = (uint32_t)(buffer - (unsigned char*)(*mp4_header));
 
-  fclose(infile);
+  return 1;
+}
+
+int mp4_split(const char* filename, int64_t filesize,
+              float start_time, float end_time,
+              void** mp4_header, uint32_t* mp4_header_size,
+              uint64_t* mdat_offset, uint64_t* mdat_size,
+              int client_is_flash)
+{
+  unsigned char* map;
+  struct mp4_atom_t ftyp_atom;
+  struct mp4_atom_t moov_atom;
+  struct mp4_atom_t mdat_atom;
+  int result;
+
+  *mp4_header = 0;
+
+  map = mp4_map(filename, &filesize);
+  if(map == 0)
+  {
+    return 0;
+  }
+
+  if(!mp4_read_atoms(map, filesize, &ftyp_atom, &moov_atom, &mdat_atom))
+  {
+    munmap(map, (size_t)filesize);
+    return 0;
+  }
+
+  // ftyp and moov are copied once, from the map to the new header
+  result = mp4_write_header(map + ftyp_atom.start_, ftyp_atom.size_,
+                            map + moov_atom.start_, moov_atom.size_, mdat_atom,
+                            start_time, end_time,
+                            mp4_header, mp4_header_size,
+                            mdat_offset, mdat_size,
+                            client_is_flash, 0);
+
+  munmap(map, (size_t)filesize);
+
+  return result;
+}
+
+// Bytes [offset, offset + size> of the file, from the head or from read_range
+static unsigned char* mp4_ranges_get(unsigned char const* head, uint64_t head_size,
+                                     mp4_read_range_t read_range, void* context,
+                                     uint64_t offset, uint64_t size)
+{
+  unsigned char* data = (unsigned char*)malloc((size_t)size);
+
+  if(data == 0)
+    return 0;
+  if(offset + size <= head_size)
+  {
+    memcpy(data, head + offset, (size_t)size);
+  }
+  else if(!read_range(context, offset, size, data))
+  {
+    free(data);
+    return 0;
+  }
+
+  return data;
+}
+
+int mp4_split_ranges(unsigned char const* head, uint64_t head_size, int64_t filesize,
+                     mp4_read_range_t read_range, void* context,
+                     float start_time, float end_time,
+                     void** mp4_header, uint32_t* mp4_header_size,
+                     uint64_t* mdat_offset, uint64_t* mdat_size,
+                     int client_is_flash)
+{
+  struct mp4_atom_t ftyp_atom;
+  struct mp4_atom_t moov_atom;
+  struct mp4_atom_t mdat_atom;
+  struct mp4_atom_t leaf_atom;
+  unsigned char atom_header[16];
+  unsigned char* ftyp_data = 0;
+  unsigned char* moov_data;
+  uint64_t offset = 0;
+  int result;
+
+  *mp4_header = 0;
+  memset(&ftyp_atom, 0, sizeof(ftyp_atom));
+  memset(&moov_atom, 0, sizeof(moov_atom));
+  memset(&mdat_atom, 0, sizeof(mdat_atom));
+
+  // Walk the atom headers, one range per header past the head, until both
+  // the moov and the mdat are known
+  while(moov_atom.size_ == 0 || mdat_atom.size_ == 0)
+  {
+    unsigned char const* header = head + offset;
+    uint64_t header_size;
+    if(offset >= (uint64_t)filesize)
+      break;
+    header_size = (uint64_t)filesize - offset < 16 ? (uint64_t)filesize - offset : 16;
+    if(offset + header_size > head_size)
+    {
+      if(!read_range(context, offset, header_size, atom_header))
+        return 0;
+      header = atom_header;
+    }
+    if(!mp4_atom_read_header(header, offset, filesize, &leaf_atom))
+      break;
+
+    switch(leaf_atom.type_)
+    {
+    case FOURCC('f', 't', 'y', 'p'):
+      if(leaf_atom.size_ > MP4_RANGES_MAX_FTYP_SIZE)
+        return 0;
+      ftyp_atom = leaf_atom;
+      break;
+    case FOURCC('m', 'o', 'o', 'v'):
+      if(leaf_atom.short_size_ != 1 && leaf_atom.size_ <= MP4_RANGES_MAX_MOOV_SIZE)
+        moov_atom = leaf_atom;
+      break;
+    case FOURCC('m', 'd', 'a', 't'):
+      mdat_atom = leaf_atom;
+      break;
+    }
+    offset = leaf_atom.end_;
+  }
+  if(moov_atom.size_ == 0 || mdat_atom.size_ == 0)
+    return 0;
+
+  if(ftyp_atom.size_)
+  {
+    ftyp_data = mp4_ranges_get(head, head_size, read_range, context,
+                               ftyp_atom.start_, ftyp_atom.size_);
+    if(ftyp_data == 0)
+      return 0;
+  }
+  moov_data = mp4_ranges_get(head, head_size, read_range, context,
+                             moov_atom.start_, moov_atom.size_);
+  if(moov_data == 0)
+  {
+    free(ftyp_data);
+    return 0;
+  }
+
+  result = mp4_write_header(ftyp_data, ftyp_atom.size_,
+                            moov_data, moov_atom.size_, mdat_atom,
+                            start_time, end_time,
+                            mp4_header, mp4_header_size,
+                            mdat_offset, mdat_size,
+                            client_is_flash, 0);
+
+  free(ftyp_data);
+  free(moov_data);
+
+  return result;
+}
+
+// The new moov goes at insert_offset, the moov at the end is dropped
+static int mp4_faststart_write(unsigned char const* map, const char* filename, int64_t filesize,
+                               uint64_t insert_offset, struct mp4_atom_t moov_atom,
+                               unsigned char const* moov_data, uint64_t moov_size)
+{
+  FILE* outfile;
+  char tmp_filename[PATH_MAX];
+  int result;
+
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.faststart", filename);
+  outfile = fopen(tmp_filename, "wb");
+  if(outfile == NULL)
+  {
+    systemLog->sysLog(ERROR, "cannot create the file '%s': %s", tmp_filename, strerror(errno));
+    return 0;
+  }
+  result = fwrite(map, (size_t)insert_offset, 1, outfile) == 1 &&
+           fwrite(moov_data, (size_t)moov_size, 1, outfile) == 1 &&
+           fwrite(map + insert_offset, (size_t)(moov_atom.start_ - insert_offset), 1, outfile) == 1 &&
+           (moov_atom.end_ == (uint64_t)filesize ||
+            fwrite(map + moov_atom.end_, (size_t)(filesize - moov_atom.end_), 1, outfile) == 1);
+  if(fclose(outfile) != 0)
+    result = 0;
+  if(!result)
+  {
+    systemLog->sysLog(ERROR, "cannot write the file '%s': %s", tmp_filename, strerror(errno));
+    unlink(tmp_filename);
+    return 0;
+  }
+  if(rename(tmp_filename, filename) < 0)
+  {
+    systemLog->sysLog(ERROR, "cannot rename '%s' to '%s': %s", tmp_filename, filename, strerror(errno));
+    unlink(tmp_filename);
+    return 0;
+  }
 
   return 1;
 }
 
+int mp4_faststart(const char* filename, int64_t filesize)
+{
+  unsigned char* map;
+  struct mp4_atom_t ftyp_atom;
+  struct mp4_atom_t moov_atom;
+  struct mp4_atom_t mdat_atom;
+  unsigned char* new_moov_data = 0;
+  struct moov_t* moov;
+  uint64_t new_moov_size = 0;
+  uint64_t insert_offset;
+  uint64_t max_offset = 0;
+  unsigned int i;
+  unsigned int j;
+  int result = -1;
+
+  map = mp4_map(filename, &filesize);
+  if(map == 0)
+    return -1;
+
+  if(!mp4_read_atoms(map, filesize, &ftyp_atom, &moov_atom, &mdat_atom))
+  {
+    munmap(map, (size_t)filesize);
+    return -1;
+  }
+
+  // Already in front, or media data after the moov which wouldn't move by
+  // the same amount as the data before it
+  insert_offset = ftyp_atom.size_ ? ftyp_atom.end_ : 0;
+  if(moov_atom.start_ < mdat_atom.start_ || insert_offset > moov_atom.start_)
+  {
+    munmap(map, (size_t)filesize);
+    return 0;
+  }
+
+  // moov_read doesn't modify the buffer, it is parsed in the map
+  moov = (struct moov_t*)moov_read(NULL, map + moov_atom.start_ + ATOM_PREAMBLE_SIZE,
+                                   moov_atom.size_ - ATOM_PREAMBLE_SIZE);
+  if(moov == 0 || moov->mvhd_ == 0)
+  {
+    systemLog->sysLog(ERROR, "cannot parse the moov of '%s'", filename);
+  }
+  else if((new_moov_data = (unsigned char*)malloc((size_t)moov_atom.size_)) == 0)
+  {
+    systemLog->sysLog(ERROR, "cannot allocate %llu bytes for the moov of '%s': %s",
+                      (unsigned long long)moov_atom.size_, filename, strerror(errno));
+  }
+  else
+  {
+    // co64 tables are written back as stco, the shifted offsets must fit in 32 bits
+    moov_write(moov, new_moov_data);
+    new_moov_size = read_32(new_moov_data);
+    for(i = 0; i != moov->tracks_; ++i)
+    {
+      struct stco_t const* stco = moov->traks_[i]->mdia_->minf_->stbl_->stco_;
+      for(j = 0; j != stco->entries_; ++j)
+      {
+        if(stco->chunk_offsets_[j] > max_offset)
+          max_offset = stco->chunk_offsets_[j];
+      }
+    }
+    if(max_offset + new_moov_size > UINT32_MAX)
+    {
+      systemLog->sysLog(INFO, "mp4 file '%s' is too big to move its moov in front", filename);
+      result = 0;
+    }
+    else
+    {
+      moov_shift_offsets_inplace(moov, new_moov_size);
+      result = mp4_faststart_write(map, filename, filesize, insert_offset,
+                                   moov_atom, new_moov_data, new_moov_size) ? 1 : -1;
+    }
+  }
+
+  if(moov)
+    moov_exit(moov);
+  free(new_moov_data);
+  munmap(map, (size_t)filesize);
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Tables of a trak only needed by the fragmented output
+struct trak_fragment_index_t
+{
+  uint32_t track_id_;
+  uint32_t timescale_;
+  unsigned int* size_;    // size of each sample
+  int has_sync_;          // without a stss every sample is a sync sample
+  unsigned int sync_size_;
+  unsigned int* sync_;    // zero based sync samples
+  unsigned int* segments_;  // first sample of each segment, one more for the end
+};
+
+// Everything mp4_split needs from the file, kept between seeks on the same file
+struct mp4_index_t
+{
+  unsigned char* ftyp_data_;
+  uint64_t ftyp_size_;
+  unsigned char* moov_data_;
+  uint64_t moov_size_;
+  struct mp4_atom_t mdat_atom_;
+  unsigned int tracks_;
+  struct trak_index_t traks_[MAX_TRACKS];
+  uint32_t bitrate_;      // kbit/s of the samples, 0 if unknown
+  uint32_t timescale_;    // of the mvhd
+  unsigned char* init_data_;  // ftyp and moov of the fragmented output, 0 if it cannot be built
+  uint32_t init_size_;
+  uint32_t mehd_offset_;  // fragment duration in the init segment, patched on each seek
+  struct trak_fragment_index_t fragment_traks_[MAX_TRACKS];
+  unsigned int segments_size_;  // segments of the packaged output, 0 if there is none
+  unsigned int segment_trak_;   // trak whose keyframes and times cut the segments
+  size_t size_;
+  void* map_;             // sidecar file the data points into, 0 if allocated
+  size_t map_size_;
+};
+
+// Bytes of the samples of every trak over the longest trak duration
+static uint32_t moov_get_bitrate(struct moov_t const* moov)
+{
+  uint64_t bytes = 0;
+  double duration = 0;
+  unsigned int i;
+  unsigned int j;
+
+  for(i = 0; i != moov->tracks_; ++i)
+  {
+    struct mdhd_t const* mdhd = moov->traks_[i]->mdia_->mdhd_;
+    struct stsz_t const* stsz = moov->traks_[i]->mdia_->minf_->stbl_->stsz_;
+
+    if(mdhd && mdhd->timescale_ &&
+       (double)mdhd->duration_ / mdhd->timescale_ > duration)
+    {
+      duration = (double)mdhd->duration_ / mdhd->timescale_;
+    }
+    if(stsz->sample_size_)
+    {
+      bytes += (uint64_t)stsz->sample_size_ * stsz->entries_;
+    }
+    else
+    {
+      for(j = 0; j != stsz->entries_; ++j)
+        bytes += stsz->sample_sizes_[j];
+    }
+  }
+  if(duration <= 0)
+    return 0;
+
+  return (uint32_t)(bytes * 8 / duration / 1000);
+}
+
+static void trak_build_fragment_index(struct trak_t const* trak, unsigned int samples_size,
+                                      struct trak_fragment_index_t* fragment_index)
+{
+  struct stsz_t const* stsz = trak->mdia_->minf_->stbl_->stsz_;
+  struct stss_t const* stss = trak->mdia_->minf_->stbl_->stss_;
+  unsigned int i;
+
+  fragment_index->track_id_ = trak->tkhd_->track_id_;
+  fragment_index->timescale_ = trak->mdia_->mdhd_->timescale_;
+  fragment_index->size_ = (unsigned int*)malloc((samples_size + 1) * sizeof(unsigned int));
+  for(i = 0; i != samples_size; ++i)
+  {
+    if(stsz->sample_size_)
+      fragment_index->size_[i] = stsz->sample_size_;
+    else
+      fragment_index->size_[i] = i < stsz->entries_ ? stsz->sample_sizes_[i] : 0;
+  }
+  fragment_index->has_sync_ = stss ? 1 : 0;
+  fragment_index->sync_size_ = stss ? stss->entries_ : 0;
+  fragment_index->sync_ = (unsigned int*)malloc((fragment_index->sync_size_ + 1) * sizeof(unsigned int));
+  for(i = 0; i != fragment_index->sync_size_; ++i)
+  {
+    fragment_index->sync_[i] = stss->sample_numbers_[i] - 1;
+  }
+}
+
+static size_t trak_fragment_index_size(struct trak_fragment_index_t const* fragment_index,
+                                       unsigned int samples_size)
+{
+  return (samples_size + fragment_index->sync_size_) * sizeof(unsigned int);
+}
+
+// Shortest segment of the packaged output in seconds, longer if the keyframes are sparse
+#define MP4_SEGMENT_DURATION 6
+
+#define MP4_MEHD_SIZE (ATOM_PREAMBLE_SIZE + 12)
+#define MP4_TREX_SIZE (ATOM_PREAMBLE_SIZE + 24)
+
+// ftyp and a moov without samples announcing the fragments, the sample tables
+// of moov are emptied
+static void mp4_index_build_init(struct mp4_index_t* index, struct moov_t* moov)
+{
+  unsigned char* buffer;
+  unsigned char* moov_start;
+  unsigned int i;
+
+  // Emptied tables only make the moov smaller
+  index->init_data_ = (unsigned char*)malloc((size_t)(index->ftyp_size_ + index->moov_size_ +
+                        ATOM_PREAMBLE_SIZE + MP4_MEHD_SIZE + moov->tracks_ * MP4_TREX_SIZE));
+  if(index->init_data_ == 0)
+    return;
+  buffer = index->init_data_;
+  if(index->ftyp_size_)
+  {
+    memcpy(buffer, index->ftyp_data_, (size_t)index->ftyp_size_);
+    buffer += index->ftyp_size_;
+  }
+
+  for(i = 0; i != moov->tracks_; ++i)
+  {
+    struct trak_t* trak = moov->traks_[i];
+    struct stbl_t* stbl = trak->mdia_->minf_->stbl_;
+
+    if(stbl->stts_)
+      stbl->stts_->entries_ = 0;
+    if(stbl->stss_)
+      stbl->stss_->entries_ = 0;
+    if(stbl->stsc_)
+      stbl->stsc_->entries_ = 0;
+    stbl->stsz_->sample_size_ = 0;
+    stbl->stsz_->entries_ = 0;
+    if(stbl->stco_)
+      stbl->stco_->entries_ = 0;
+    if(stbl->ctts_)
+      stbl->ctts_->entries_ = 0;
+    trak->tkhd_->duration_ = 0;
+    trak->mdia_->mdhd_->duration_ = 0;
+  }
+  moov->mvhd_->duration_ = 0;
+  moov_start = buffer;
+  moov_write(moov, moov_start);
+  buffer += read_32(moov_start);
+
+  buffer = write_32(buffer, ATOM_PREAMBLE_SIZE + MP4_MEHD_SIZE + moov->tracks_ * MP4_TREX_SIZE);
+  buffer = write_32(buffer, FOURCC('m', 'v', 'e', 'x'));
+  buffer = write_32(buffer, MP4_MEHD_SIZE);
+  buffer = write_32(buffer, FOURCC('m', 'e', 'h', 'd'));
+  buffer = write_8(buffer, 1);
+  buffer = write_24(buffer, 0);
+  index->mehd_offset_ = (uint32_t)(buffer - index->init_data_);
+  buffer = write_64(buffer, 0);
+  for(i = 0; i != moov->tracks_; ++i)
+  {
+    buffer = write_32(buffer, MP4_TREX_SIZE);
+    buffer = write_32(buffer, FOURCC('t', 'r', 'e', 'x'));
+    buffer = write_32(buffer, 0);
+    buffer = write_32(buffer, moov->traks_[i]->tkhd_->track_id_);
+    buffer = write_32(buffer, 1);   // sample description
+    buffer = write_32(buffer, 0);   // duration, size and flags are in each trun
+    buffer = write_32(buffer, 0);
+    buffer = write_32(buffer, 0);
+  }
+  write_32(moov_start, (uint32_t)(buffer - moov_start));
+  index->init_size_ = (uint32_t)(buffer - index->init_data_);
+}
+
+// Last sample at or before the time, samples_size_ past the end of the trak
+static unsigned int trak_index_get_sample(struct trak_index_t const* trak_index, uint64_t time)
+{
+  return samples_get_sample(&trak_index->samples_, trak_index->samples_size_, time);
+}
+
+// First sample at or after the time
+static unsigned int trak_index_get_sample_from(struct trak_index_t const* trak_index, uint64_t time)
+{
+  unsigned int sample = trak_index_get_sample(trak_index, time);
+
+  if(sample != trak_index->samples_size_ && trak_index->samples_.pts_[sample] < time)
+    ++sample;
+
+  return sample;
+}
+
+// Next cut of the segments after last_cut, the reference trak is only cut on
+// its keyframes. Return samples_size_ if there is none.
+static unsigned int mp4_index_next_cut(struct mp4_index_t const* index, unsigned int last_cut,
+                                       unsigned int* candidate, unsigned int duration)
+{
+  struct trak_index_t const* trak_index = &index->traks_[index->segment_trak_];
+  struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[index->segment_trak_];
+  unsigned int candidates = fragment_index->has_sync_ ? fragment_index->sync_size_ : trak_index->samples_size_;
+
+  for(; *candidate != candidates; ++*candidate)
+  {
+    unsigned int sample = fragment_index->has_sync_ ? fragment_index->sync_[*candidate] : *candidate;
+
+    if(sample >= trak_index->samples_size_)
+      break;
+    if(sample > last_cut &&
+       (uint64_t)(trak_index->samples_.pts_[sample] - trak_index->samples_.pts_[last_cut]) >=
+       (uint64_t)duration * fragment_index->timescale_)
+      return sample;
+  }
+
+  return trak_index->samples_size_;
+}
+
+// Segments of the packaged output start on a keyframe of the first trak with
+// sync samples (the video) after at least duration seconds, the other traks
+// are cut at the same times
+static void mp4_index_build_segments(struct mp4_index_t* index, unsigned int duration)
+{
+  struct trak_index_t const* trak_index;
+  struct trak_fragment_index_t const* fragment_index;
+  unsigned int segments = 1;
+  unsigned int candidate = 0;
+  unsigned int cut = 0;
+  unsigned int i;
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    if(index->fragment_traks_[i].has_sync_ && index->traks_[i].samples_size_)
+      break;
+  }
+  if(i == index->tracks_)
+  {
+    for(i = 0; i != index->tracks_ && index->traks_[i].samples_size_ == 0; ++i)
+      ;
+  }
+  if(i == index->tracks_ || index->fragment_traks_[i].timescale_ == 0)
+    return;
+  index->segment_trak_ = i;
+  trak_index = &index->traks_[i];
+  fragment_index = &index->fragment_traks_[i];
+
+  while((cut = mp4_index_next_cut(index, cut, &candidate, duration)) != trak_index->samples_size_)
+    ++segments;
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    index->fragment_traks_[i].segments_ = (unsigned int*)malloc((segments + 1) * sizeof(unsigned int));
+    if(index->fragment_traks_[i].segments_ == 0)
+      return;
+    index->fragment_traks_[i].segments_[0] = 0;
+    index->fragment_traks_[i].segments_[segments] = index->traks_[i].samples_size_;
+  }
+
+  segments = 1;
+  candidate = 0;
+  cut = 0;
+  while((cut = mp4_index_next_cut(index, cut, &candidate, duration)) != trak_index->samples_size_)
+  {
+    for(i = 0; i != index->tracks_; ++i)
+    {
+      if(index->fragment_traks_[i].timescale_ == 0)
+        index->fragment_traks_[i].segments_[segments] = index->traks_[i].samples_size_;
+      else
+        index->fragment_traks_[i].segments_[segments] =
+          trak_index_get_sample_from(&index->traks_[i],
+            (uint64_t)trak_index->samples_.pts_[cut] *
+            index->fragment_traks_[i].timescale_ / fragment_index->timescale_);
+    }
+    ++segments;
+  }
+  index->segments_size_ = segments;
+}
+
+struct mp4_index_t* mp4_index_open(const char* filename, int64_t filesize)
+{
+  unsigned char* map;
+  struct mp4_atom_t ftyp_atom;
+  struct mp4_atom_t moov_atom;
+  struct mp4_atom_t mdat_atom;
+  struct mp4_index_t* index;
+  struct moov_t* moov;
+  unsigned int i;
+  int fragments = 1;
+
+  map = mp4_map(filename, &filesize);
+  if(map == 0)
+  {
+    return 0;
+  }
+
+  if(!mp4_read_atoms(map, filesize, &ftyp_atom, &moov_atom, &mdat_atom))
+  {
+    munmap(map, (size_t)filesize);
+    return 0;
+  }
+
+  // The index outlives the map, it keeps its own ftyp and moov
+  index = (struct mp4_index_t*)calloc(1, sizeof(struct mp4_index_t));
+  if(index == 0)
+  {
+    munmap(map, (size_t)filesize);
+    return 0;
+  }
+  index->moov_size_ = moov_atom.size_;
+  index->moov_data_ = (unsigned char*)malloc((size_t)moov_atom.size_);
+  memcpy(index->moov_data_, map + moov_atom.start_, (size_t)moov_atom.size_);
+  index->mdat_atom_ = mdat_atom;
+
+  if(ftyp_atom.size_)
+  {
+    index->ftyp_data_ = (unsigned char*)malloc((size_t)ftyp_atom.size_);
+    memcpy(index->ftyp_data_, map + ftyp_atom.start_, (size_t)ftyp_atom.size_);
+    index->ftyp_size_ = ftyp_atom.size_;
+  }
+  munmap(map, (size_t)filesize);
+
+  // moov_read doesn't modify the buffer, the same bytes give the same traks on each seek
+  moov = (moov_t *)moov_read(NULL, index->moov_data_ + ATOM_PREAMBLE_SIZE,
+                             index->moov_size_ - ATOM_PREAMBLE_SIZE);
+  if(moov == 0)
+  {
+    systemLog->sysLog(ERROR, "Error parsing moov header\n");
+    mp4_index_close(index);
+    return 0;
+  }
+  index->tracks_ = moov->tracks_;
+  index->bitrate_ = moov_get_bitrate(moov);
+  index->timescale_ = moov->mvhd_->timescale_;
+  index->size_ = sizeof(struct mp4_index_t) + index->ftyp_size_ + index->moov_size_;
+  for(i = 0; i != moov->tracks_; ++i)
+  {
+    trak_build_index(moov->traks_[i]);
+    trak_detach_index(moov->traks_[i], &index->traks_[i]);
+    trak_build_fragment_index(moov->traks_[i], index->traks_[i].samples_size_,
+                              &index->fragment_traks_[i]);
+    index->size_ += trak_index_size(&index->traks_[i]) +
+                    trak_fragment_index_size(&index->fragment_traks_[i], index->traks_[i].samples_size_);
+    if(index->fragment_traks_[i].size_ == 0 || index->fragment_traks_[i].sync_ == 0)
+      fragments = 0;
+  }
+  if(fragments)
+  {
+    mp4_index_build_init(index, moov);
+    mp4_index_build_segments(index, MP4_SEGMENT_DURATION);
+  }
+  index->size_ += index->init_size_;
+  if(index->segments_size_)
+    index->size_ += index->tracks_ * (index->segments_size_ + 1) * sizeof(unsigned int);
+  moov_exit(moov);
+
+  return index;
+}
+
+// Same result as mp4_split, without reading the file nor building the indices again
+int mp4_index_split(struct mp4_index_t const* index,
+                    float start_time, float end_time,
+                    void** mp4_header, uint32_t* mp4_header_size,
+                    uint64_t* mdat_offset, uint64_t* mdat_size,
+                    int client_is_flash)
+{
+  *mp4_header = 0;
+
+  return mp4_write_header(index->ftyp_data_, index->ftyp_size_,
+                          index->moov_data_, index->moov_size_, index->mdat_atom_,
+                          start_time, end_time,
+                          mp4_header, mp4_header_size,
+                          mdat_offset, mdat_size,
+                          client_is_flash, index->traks_);
+}
+
+size_t mp4_index_size(struct mp4_index_t const* index)
+{
+  return index->size_;
+}
+
+unsigned int mp4_index_bitrate(struct mp4_index_t const* index)
+{
+  return index->bitrate_;
+}
+
+void mp4_index_close(struct mp4_index_t* index)
+{
+  unsigned int i;
+
+  if(index->map_)
+  {
+    munmap(index->map_, index->map_size_);
+    free(index);
+    return;
+  }
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    trak_index_exit(&index->traks_[i]);
+    free(index->fragment_traks_[i].size_);
+    free(index->fragment_traks_[i].sync_);
+    free(index->fragment_traks_[i].segments_);
+  }
+  free(index->ftyp_data_);
+  free(index->moov_data_);
+  free(index->init_data_);
+  free(index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Fragmented output of a seek: the init segment, then fragments made of whole
+// chunks in file order. The mdat of a fragment is the file range of its chunks
+// as it is, each chunk is described by one trun pointing into it.
+struct mp4_fragmenter_t
+{
+  struct mp4_index_t const* index_;
+  uint32_t fragment_size_;
+  uint32_t sequence_number_;
+  uint64_t data_start_;                 // file offset of the mdat data of the next fragment
+  uint64_t data_end_;                   // end of the last sample of the file
+  unsigned int chunk_[MAX_TRACKS];      // next chunk of each trak
+  unsigned int sample_[MAX_TRACKS];     // next sample of each trak
+  unsigned int sample_end_[MAX_TRACKS]; // first sample of each trak which is not sent
+  unsigned int sync_[MAX_TRACKS];       // next entry of the sync samples
+  unsigned int base_pts_[MAX_TRACKS];   // decode time of the first sample sent, the output starts at 0
+};
+
+#define MP4_MFHD_SIZE (ATOM_PREAMBLE_SIZE + 8)
+#define MP4_TFHD_SIZE (ATOM_PREAMBLE_SIZE + 8)
+#define MP4_TFDT_SIZE (ATOM_PREAMBLE_SIZE + 12)
+#define MP4_TRUN_SIZE (ATOM_PREAMBLE_SIZE + 12)
+#define MP4_TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+#define MP4_TRUN_FLAGS 0x000701      // data offset, sample duration, size and flags
+#define MP4_TRUN_CTO 0x000800
+#define MP4_SAMPLE_SYNC 0x02000000
+#define MP4_SAMPLE_NON_SYNC 0x01010000
+
+static unsigned int trak_fragment_index_get_keyframe(struct trak_fragment_index_t const* fragment_index,
+                                                     unsigned int sample)
+{
+  unsigned int i;
+
+  if(!fragment_index->has_sync_)
+    return sample;
+  i = uint32_lower_bound(fragment_index->sync_, fragment_index->sync_size_, sample + 1);
+
+  return i ? fragment_index->sync_[i - 1] : 0;
+}
+
+// Position of the first sample left in the chunk
+static uint64_t mp4_fragmenter_chunk_pos(struct mp4_fragmenter_t const* fragmenter,
+                                         unsigned int trak, unsigned int chunk)
+{
+  struct trak_index_t const* trak_index = &fragmenter->index_->traks_[trak];
+  unsigned int sample = trak_index->chunks_[chunk].sample_;
+
+  if(sample < fragmenter->sample_[trak])
+    sample = fragmenter->sample_[trak];
+
+  return trak_index->samples_.pos_[sample];
+}
+
+// Samples of a chunk still to be sent, [*first, *last>
+static void mp4_fragmenter_chunk_samples(struct mp4_fragmenter_t const* fragmenter,
+                                         unsigned int trak, unsigned int chunk,
+                                         unsigned int* first, unsigned int* last)
+{
+  struct trak_index_t const* trak_index = &fragmenter->index_->traks_[trak];
+
+  *first = trak_index->chunks_[chunk].sample_;
+  if(*first < fragmenter->sample_[trak])
+    *first = fragmenter->sample_[trak];
+  *last = trak_index->chunks_[chunk].sample_ + trak_index->chunks_[chunk].size_;
+  if(*last > fragmenter->sample_end_[trak])
+    *last = fragmenter->sample_end_[trak];
+  if(*last < *first)
+    *last = *first;
+}
+
+// Chunks of the next fragment, taken in file order until fragment_size_ bytes
+// are reached. Return the number of chunks, 0 when every sample was sent.
+static unsigned int mp4_fragmenter_plan(struct mp4_fragmenter_t const* fragmenter,
+                                        unsigned int* chunk_end, uint64_t* data_end)
+{
+  struct mp4_index_t const* index = fragmenter->index_;
+  unsigned int chunks = 0;
+  unsigned int i;
+
+  for(i = 0; i != index->tracks_; ++i)
+    chunk_end[i] = fragmenter->chunk_[i];
+
+  for(;;)
+  {
+    unsigned int next = MAX_TRACKS;
+    uint64_t next_pos = 0;
+
+    for(i = 0; i != index->tracks_; ++i)
+    {
+      struct trak_index_t const* trak_index = &index->traks_[i];
+      uint64_t pos;
+
+      if(chunk_end[i] == trak_index->chunks_size_ ||
+         trak_index->chunks_[chunk_end[i]].sample_ >= fragmenter->sample_end_[i] ||
+         fragmenter->sample_[i] >= fragmenter->sample_end_[i])
+        continue;
+      pos = mp4_fragmenter_chunk_pos(fragmenter, i, chunk_end[i]);
+      if(next == MAX_TRACKS || pos < next_pos)
+      {
+        next = i;
+        next_pos = pos;
+      }
+    }
+    if(next == MAX_TRACKS)
+    {
+      *data_end = fragmenter->data_end_;
+      return chunks;
+    }
+    if(chunks && next_pos >= fragmenter->data_start_ + fragmenter->fragment_size_)
+    {
+      *data_end = next_pos;
+      return chunks;
+    }
+    ++chunk_end[next];
+    ++chunks;
+  }
+}
+
+// moof and mdat header of the planned fragment, only its size when buffer is 0
+// Return 0 if the chunks don't fit in the file range of the fragment
+static uint32_t mp4_fragmenter_write(struct mp4_fragmenter_t const* fragmenter,
+                                     unsigned int const* chunk_end, uint64_t data_end,
+                                     unsigned char* buffer)
+{
+  struct mp4_index_t const* index = fragmenter->index_;
+  uint64_t moof_size = ATOM_PREAMBLE_SIZE + MP4_MFHD_SIZE;
+  uint64_t data_size = data_end - fragmenter->data_start_;
+  uint32_t mdat_header_size = ATOM_PREAMBLE_SIZE;
+  unsigned char* moof_start = buffer;
+  unsigned int i;
+  unsigned int c;
+  unsigned int s;
+
+  if(data_end < fragmenter->data_start_)
+    return 0;
+  if(data_size + ATOM_PREAMBLE_SIZE > UINT32_MAX)
+    mdat_header_size += 8;
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    uint64_t traf_size = ATOM_PREAMBLE_SIZE + MP4_TFHD_SIZE + MP4_TFDT_SIZE;
+    unsigned int entry_size = index->traks_[i].samples_.cto_ ? 16 : 12;
+    unsigned int truns = 0;
+
+    for(c = fragmenter->chunk_[i]; c != chunk_end[i]; ++c)
+    {
+      unsigned int first;
+      unsigned int last;
+
+      mp4_fragmenter_chunk_samples(fragmenter, i, c, &first, &last);
+      if(first == last)
+        continue;
+      // A chunk out of the file range cannot be pointed to from this mdat
+      if(index->traks_[i].samples_.pos_[first] < fragmenter->data_start_ ||
+         index->traks_[i].samples_.pos_[last - 1] +
+         index->fragment_traks_[i].size_[last - 1] > data_end)
+        return 0;
+      traf_size += MP4_TRUN_SIZE + (uint64_t)(last - first) * entry_size;
+      ++truns;
+    }
+    if(truns)
+      moof_size += traf_size;
+  }
+  if(moof_size + mdat_header_size + data_size > INT32_MAX)
+    return 0;
+  if(buffer == 0)
+    return (uint32_t)(moof_size + mdat_header_size);
+
+  buffer = write_32(buffer, (uint32_t)moof_size);
+  buffer = write_32(buffer, FOURCC('m', 'o', 'o', 'f'));
+  buffer = write_32(buffer, MP4_MFHD_SIZE);
+  buffer = write_32(buffer, FOURCC('m', 'f', 'h', 'd'));
+  buffer = write_32(buffer, 0);
+  buffer = write_32(buffer, fragmenter->sequence_number_);
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    struct trak_index_t const* trak_index = &index->traks_[i];
+    struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[i];
+    unsigned int trun_flags = MP4_TRUN_FLAGS | (trak_index->samples_.cto_ ? MP4_TRUN_CTO : 0);
+    unsigned int sync = fragmenter->sync_[i];
+    unsigned char* traf_start = buffer;
+    int traf_written = 0;
+
+    for(c = fragmenter->chunk_[i]; c != chunk_end[i]; ++c)
+    {
+      unsigned int first;
+      unsigned int last;
+
+      mp4_fragmenter_chunk_samples(fragmenter, i, c, &first, &last);
+      if(first == last)
+        continue;
+      if(!traf_written)
+      {
+        buffer += 4;
+        buffer = write_32(buffer, FOURCC('t', 'r', 'a', 'f'));
+        buffer = write_32(buffer, MP4_TFHD_SIZE);
+        buffer = write_32(buffer, FOURCC('t', 'f', 'h', 'd'));
+        buffer = write_8(buffer, 0);
+        buffer = write_24(buffer, MP4_TFHD_DEFAULT_BASE_IS_MOOF);
+        buffer = write_32(buffer, fragment_index->track_id_);
+        buffer = write_32(buffer, MP4_TFDT_SIZE);
+        buffer = write_32(buffer, FOURCC('t', 'f', 'd', 't'));
+        buffer = write_8(buffer, 1);
+        buffer = write_24(buffer, 0);
+        buffer = write_64(buffer, trak_index->samples_.pts_[first] - fragmenter->base_pts_[i]);
+        traf_written = 1;
+      }
+      buffer = write_32(buffer, MP4_TRUN_SIZE + (last - first) * (trak_index->samples_.cto_ ? 16 : 12));
+      buffer = write_32(buffer, FOURCC('t', 'r', 'u', 'n'));
+      buffer = write_8(buffer, 0);
+      buffer = write_24(buffer, trun_flags);
+      buffer = write_32(buffer, last - first);
+      buffer = write_32(buffer, (uint32_t)(moof_size + mdat_header_size +
+                                trak_index->samples_.pos_[first] - fragmenter->data_start_));
+      for(s = first; s != last; ++s)
+      {
+        uint32_t sample_flags = MP4_SAMPLE_SYNC;
+
+        if(fragment_index->has_sync_)
+        {
+          while(sync != fragment_index->sync_size_ && fragment_index->sync_[sync] < s)
+            ++sync;
+          if(sync == fragment_index->sync_size_ || fragment_index->sync_[sync] != s)
+            sample_flags = MP4_SAMPLE_NON_SYNC;
+        }
+        buffer = write_32(buffer, trak_index->samples_.pts_[s + 1] - trak_index->samples_.pts_[s]);
+        buffer = write_32(buffer, fragment_index->size_[s]);
+        buffer = write_32(buffer, sample_flags);
+        if(trak_index->samples_.cto_)
+          buffer = write_32(buffer, trak_index->samples_.cto_[s]);
+      }
+    }
+    if(traf_written)
+      write_32(traf_start, (uint32_t)(buffer - traf_start));
+  }
+
+  if(mdat_header_size == ATOM_PREAMBLE_SIZE)
+  {
+    buffer = write_32(buffer, (uint32_t)(data_size + ATOM_PREAMBLE_SIZE));
+    buffer = write_32(buffer, FOURCC('m', 'd', 'a', 't'));
+  }
+  else
+  {
+    buffer = write_32(buffer, 1);
+    buffer = write_32(buffer, FOURCC('m', 'd', 'a', 't'));
+    buffer = write_64(buffer, data_size + mdat_header_size);
+  }
+
+  return (uint32_t)(buffer - moof_start);
+}
+
+static void mp4_fragmenter_advance(struct mp4_fragmenter_t* fragmenter,
+                                   unsigned int const* chunk_end, uint64_t data_end)
+{
+  struct mp4_index_t const* index = fragmenter->index_;
+  unsigned int i;
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    struct trak_index_t const* trak_index = &index->traks_[i];
+    struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[i];
+
+    fragmenter->chunk_[i] = chunk_end[i];
+    if(chunk_end[i] == trak_index->chunks_size_ ||
+       trak_index->chunks_[chunk_end[i]].sample_ > fragmenter->sample_end_[i])
+      fragmenter->sample_[i] = fragmenter->sample_end_[i];
+    else if(trak_index->chunks_[chunk_end[i]].sample_ > fragmenter->sample_[i])
+      fragmenter->sample_[i] = trak_index->chunks_[chunk_end[i]].sample_;
+    while(fragmenter->sync_[i] != fragment_index->sync_size_ &&
+          fragment_index->sync_[fragmenter->sync_[i]] < fragmenter->sample_[i])
+      ++fragmenter->sync_[i];
+  }
+  fragmenter->data_start_ = data_end;
+  ++fragmenter->sequence_number_;
+}
+
+// First chunk, sync sample and file range of the samples [sample_, sample_end_>
+// data_start_ is UINT64_MAX if there is nothing to send
+static void mp4_fragmenter_start(struct mp4_fragmenter_t* fragmenter)
+{
+  struct mp4_index_t const* index = fragmenter->index_;
+  unsigned int i;
+
+  fragmenter->data_start_ = UINT64_MAX;
+  fragmenter->data_end_ = 0;
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    struct trak_index_t const* trak_index = &index->traks_[i];
+    struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[i];
+    unsigned int sample = fragmenter->sample_[i];
+    unsigned int sample_end = fragmenter->sample_end_[i];
+    unsigned int low = 0;
+    unsigned int high = trak_index->chunks_size_;
+
+    // Chunk holding the first sample
+    while(high - low > 1)
+    {
+      unsigned int middle = low + (high - low) / 2;
+      if(trak_index->chunks_[middle].sample_ <= sample)
+        low = middle;
+      else
+        high = middle;
+    }
+    fragmenter->chunk_[i] = sample >= sample_end ? trak_index->chunks_size_ : low;
+    fragmenter->sync_[i] = 0;
+    while(fragmenter->sync_[i] != fragment_index->sync_size_ &&
+          fragment_index->sync_[fragmenter->sync_[i]] < sample)
+      ++fragmenter->sync_[i];
+    fragmenter->base_pts_[i] = trak_index->samples_.pts_[sample];
+    if(sample < sample_end)
+    {
+      uint64_t end = trak_index->samples_.pos_[sample_end - 1] + fragment_index->size_[sample_end - 1];
+
+      if(trak_index->samples_.pos_[sample] < fragmenter->data_start_)
+        fragmenter->data_start_ = trak_index->samples_.pos_[sample];
+      if(end > fragmenter->data_end_)
+        fragmenter->data_end_ = end;
+    }
+  }
+}
+
+struct mp4_fragmenter_t* mp4_fragmenter_open(struct mp4_index_t const* index,
+                                             float start_time, float end_time,
+                                             uint32_t fragment_size,
+                                             void** init_segment, uint32_t* init_segment_size,
+                                             uint64_t* data_offset, uint64_t* total_size)
+{
+  struct mp4_fragmenter_t* fragmenter;
+  struct mp4_fragmenter_t dry_run;
+  unsigned int chunk_end[MAX_TRACKS];
+  uint64_t data_end;
+  uint64_t duration = 0;
+  unsigned int start = (unsigned int)(start_time * index->timescale_);
+  unsigned int end = (unsigned int)(end_time * index->timescale_);
+  unsigned int i;
+  unsigned int pass;
+
+  *init_segment = 0;
+  if(index->init_data_ == 0 || index->timescale_ == 0 || fragment_size == 0)
+    return 0;
+
+  fragmenter = (struct mp4_fragmenter_t*)calloc(1, sizeof(struct mp4_fragmenter_t));
+  if(fragmenter == 0)
+    return 0;
+  fragmenter->index_ = index;
+  fragmenter->fragment_size_ = fragment_size;
+  fragmenter->sequence_number_ = 1;
+
+  // Same cut as moov_seek: traks with sync samples start on a keyframe, the
+  // others at the time of the keyframe found
+  for(pass = 0; pass != 2; ++pass)
+  {
+    for(i = 0; i != index->tracks_; ++i)
+    {
+      struct trak_index_t const* trak_index = &index->traks_[i];
+      struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[i];
+      unsigned int sample;
+
+      if(pass == 0 && !fragment_index->has_sync_)
+        continue;
+      if(pass == 1 && fragment_index->has_sync_)
+        continue;
+      if(trak_index->samples_size_ == 0 || fragment_index->timescale_ == 0)
+        continue;
+      if(start)
+      {
+        sample = trak_index_get_sample(trak_index,
+                   (uint64_t)start * fragment_index->timescale_ / index->timescale_);
+        sample = trak_fragment_index_get_keyframe(fragment_index, sample);
+        start = (unsigned int)((uint64_t)trak_index->samples_.pts_[sample] *
+                               index->timescale_ / fragment_index->timescale_);
+        fragmenter->sample_[i] = sample;
+      }
+      // The end is cut the same way, before the keyframe at or before it
+      fragmenter->sample_end_[i] = trak_index->samples_size_;
+      if(end)
+      {
+        sample = trak_index_get_sample(trak_index,
+                   (uint64_t)end * fragment_index->timescale_ / index->timescale_);
+        if(sample != trak_index->samples_size_)
+          sample = trak_fragment_index_get_keyframe(fragment_index, sample);
+        end = (unsigned int)((uint64_t)trak_index->samples_.pts_[sample] *
+                             index->timescale_ / fragment_index->timescale_);
+        fragmenter->sample_end_[i] = sample;
+      }
+    }
+  }
+  if(end && start >= end)
+  {
+    free(fragmenter);
+    return 0;
+  }
+
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    struct trak_index_t const* trak_index = &index->traks_[i];
+    struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[i];
+    unsigned int sample = fragmenter->sample_[i];
+    unsigned int sample_end = fragmenter->sample_end_[i];
+
+    if(sample < sample_end && fragment_index->timescale_ &&
+       (uint64_t)(trak_index->samples_.pts_[sample_end] - trak_index->samples_.pts_[sample]) *
+       index->timescale_ / fragment_index->timescale_ > duration)
+      duration = (uint64_t)(trak_index->samples_.pts_[sample_end] - trak_index->samples_.pts_[sample]) *
+                 index->timescale_ / fragment_index->timescale_;
+  }
+  mp4_fragmenter_start(fragmenter);
+  if(fragmenter->data_start_ == UINT64_MAX)
+  {
+    free(fragmenter);
+    return 0;
+  }
+
+  // Walk the fragments once for the size of the answer, any chunk which
+  // cannot be sent makes the whole output fail
+  dry_run = *fragmenter;
+  *total_size = index->init_size_;
+  while(mp4_fragmenter_plan(&dry_run, chunk_end, &data_end))
+  {
+    uint32_t header_size = mp4_fragmenter_write(&dry_run, chunk_end, data_end, 0);
+
+    if(header_size == 0)
+    {
+      free(fragmenter);
+      return 0;
+    }
+    *total_size += header_size + data_end - dry_run.data_start_;
+    mp4_fragmenter_advance(&dry_run, chunk_end, data_end);
+  }
+
+  *init_segment = malloc(index->init_size_);
+  if(*init_segment == 0)
+  {
+    free(fragmenter);
+    return 0;
+  }
+  memcpy(*init_segment, index->init_data_, index->init_size_);
+  write_64((unsigned char*)*init_segment + index->mehd_offset_, duration);
+  *init_segment_size = index->init_size_;
+  *data_offset = fragmenter->data_start_;
+
+  return fragmenter;
+}
+
+int mp4_fragmenter_next(struct mp4_fragmenter_t* fragmenter,
+                        void** header, uint32_t* header_size, uint64_t* data_size)
+{
+  unsigned int chunk_end[MAX_TRACKS];
+  uint64_t data_end;
+
+  *header = 0;
+  if(!mp4_fragmenter_plan(fragmenter, chunk_end, &data_end))
+    return 0;
+  *header_size = mp4_fragmenter_write(fragmenter, chunk_end, data_end, 0);
+  if(*header_size == 0)
+    return -1;
+  *header = malloc(*header_size);
+  if(*header == 0)
+    return -1;
+  mp4_fragmenter_write(fragmenter, chunk_end, data_end, (unsigned char*)*header);
+  *data_size = data_end - fragmenter->data_start_;
+  mp4_fragmenter_advance(fragmenter, chunk_end, data_end);
+
+  return 1;
+}
+
+void mp4_fragmenter_close(struct mp4_fragmenter_t* fragmenter)
+{
+  free(fragmenter);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Segments of the packaged output (HLS, DASH): the init segment of the
+// fragmented output, then one moof and mdat per segment
+
+unsigned int mp4_index_segments(struct mp4_index_t const* index)
+{
+  return index->init_data_ ? index->segments_size_ : 0;
+}
+
+void mp4_index_segment_time(struct mp4_index_t const* index, unsigned int segment,
+                            double* start, double* duration)
+{
+  struct trak_index_t const* trak_index = &index->traks_[index->segment_trak_];
+  struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[index->segment_trak_];
+  unsigned int first = fragment_index->segments_[segment];
+  unsigned int last = fragment_index->segments_[segment + 1];
+
+  *start = (double)trak_index->samples_.pts_[first] / fragment_index->timescale_;
+  *duration = (double)(trak_index->samples_.pts_[last] - trak_index->samples_.pts_[first]) /
+              fragment_index->timescale_;
+}
+
+int mp4_index_init_segment(struct mp4_index_t const* index,
+                           void** init_segment, uint32_t* init_segment_size)
+{
+  uint64_t duration = 0;
+  unsigned int i;
+
+  *init_segment = 0;
+  if(index->init_data_ == 0)
+    return 0;
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    struct trak_index_t const* trak_index = &index->traks_[i];
+    struct trak_fragment_index_t const* fragment_index = &index->fragment_traks_[i];
+
+    if(fragment_index->timescale_ &&
+       (uint64_t)trak_index->samples_.pts_[trak_index->samples_size_] * index->timescale_ /
+       fragment_index->timescale_ > duration)
+      duration = (uint64_t)trak_index->samples_.pts_[trak_index->samples_size_] * index->timescale_ /
+                 fragment_index->timescale_;
+  }
+  *init_segment = malloc(index->init_size_);
+  if(*init_segment == 0)
+    return 0;
+  memcpy(*init_segment, index->init_data_, index->init_size_);
+  write_64((unsigned char*)*init_segment + index->mehd_offset_, duration);
+  *init_segment_size = index->init_size_;
+
+  return 1;
+}
+
+// moof and mdat header of the segment, the file range [data_offset,
+// data_offset + data_size> follows it. Times are not shifted, tfdt is the
+// decode time of the first sample in the whole file.
+int mp4_index_segment(struct mp4_index_t const* index, unsigned int segment,
+                      void** header, uint32_t* header_size,
+                      uint64_t* data_offset, uint64_t* data_size)
+{
+  struct mp4_fragmenter_t fragmenter;
+  unsigned int chunk_end[MAX_TRACKS];
+  uint64_t data_end;
+  unsigned int i;
+
+  *header = 0;
+  if(segment >= mp4_index_segments(index))
+    return 0;
+  memset(&fragmenter, 0, sizeof(fragmenter));
+  fragmenter.index_ = index;
+  fragmenter.fragment_size_ = UINT32_MAX;
+  fragmenter.sequence_number_ = segment + 1;
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    fragmenter.sample_[i] = index->fragment_traks_[i].segments_[segment];
+    fragmenter.sample_end_[i] = index->fragment_traks_[i].segments_[segment + 1];
+  }
+  mp4_fragmenter_start(&fragmenter);
+  for(i = 0; i != index->tracks_; ++i)
+    fragmenter.base_pts_[i] = 0;
+  if(fragmenter.data_start_ == UINT64_MAX ||
+     !mp4_fragmenter_plan(&fragmenter, chunk_end, &data_end) ||
+     data_end != fragmenter.data_end_)
+    return 0;
+
+  *header_size = mp4_fragmenter_write(&fragmenter, chunk_end, data_end, 0);
+  if(*header_size == 0)
+    return 0;
+  *header = malloc(*header_size);
+  if(*header == 0)
+    return 0;
+  mp4_fragmenter_write(&fragmenter, chunk_end, data_end, (unsigned char*)*header);
+  *data_offset = fragmenter.data_start_;
+  *data_size = data_end - fragmenter.data_start_;
+
+  return 1;
+}
+
+// Payload of the first child atom of this type, 0 if there is none
+static unsigned char const* atom_find_child(unsigned char const* buffer, uint64_t size,
+                                            uint32_t type, uint64_t* child_size)
+{
+  while(size >= ATOM_PREAMBLE_SIZE)
+  {
+    uint64_t atom_size = read_32(buffer);
+
+    if(atom_size < ATOM_PREAMBLE_SIZE || atom_size > size)
+      return 0;
+    if(read_32(buffer + 4) == type)
+    {
+      *child_size = atom_size - ATOM_PREAMBLE_SIZE;
+      return buffer + ATOM_PREAMBLE_SIZE;
+    }
+    buffer += atom_size;
+    size -= atom_size;
+  }
+
+  return 0;
+}
+
+// Length of an MPEG-4 descriptor, 0 if it doesn't fit
+static unsigned int esds_read_length(unsigned char const** buffer, unsigned char const* end)
+{
+  unsigned int length = 0;
+  unsigned int i;
+
+  for(i = 0; i != 4 && *buffer != end; ++i)
+  {
+    unsigned char byte = *(*buffer)++;
+
+    length = (length << 7) | (byte & 0x7f);
+    if(!(byte & 0x80))
+      return length <= (unsigned int)(end - *buffer) ? length : 0;
+  }
+
+  return 0;
+}
+
+// RFC 6381 codec of a sample description: avc1.PPCCLL, mp4a.40.AOT, or its fourcc
+static void stsd_get_codec(unsigned char const* entry, uint64_t entry_size,
+                           uint32_t entry_type, char* codec, size_t codec_size)
+{
+  unsigned char const* child;
+  uint64_t child_size;
+
+  snprintf(codec, codec_size, "%c%c%c%c", (char)(entry_type >> 24), (char)(entry_type >> 16),
+           (char)(entry_type >> 8), (char)entry_type);
+
+  // Visual sample entries have 78 bytes of fields before their atoms, audio ones 28
+  if((entry_type == FOURCC('a', 'v', 'c', '1') || entry_type == FOURCC('a', 'v', 'c', '3')) &&
+     entry_size > 78)
+  {
+    child = atom_find_child(entry + 78, entry_size - 78, FOURCC('a', 'v', 'c', 'C'), &child_size);
+    if(child && child_size >= 4)
+      snprintf(codec + 4, codec_size - 4, ".%02x%02x%02x", child[1], child[2], child[3]);
+  }
+  else
+  if(entry_type == FOURCC('m', 'p', '4', 'a') && entry_size > 28)
+  {
+    unsigned char const* end;
+    unsigned int length;
+
+    child = atom_find_child(entry + 28, entry_size - 28, FOURCC('e', 's', 'd', 's'), &child_size);
+    if(child == 0 || child_size < 5)
+      return;
+    end = child + child_size;
+    child += 4;
+    // ES_Descriptor, its optional fields, then the DecoderConfigDescriptor
+    if(*child++ != 0x03 || (length = esds_read_length(&child, end)) < 3)
+      return;
+    {
+      unsigned char flags = child[2];
+
+      child += 3;
+      if(flags & 0x80)
+        child += 2;
+      if((flags & 0x40) && child < end)
+        child += 1 + *child;
+      if(flags & 0x20)
+        child += 2;
+    }
+    if(child >= end || *child++ != 0x04 || (length = esds_read_length(&child, end)) < 13)
+      return;
+    {
+      unsigned char object_type = child[0];
+
+      child += 13;
+      snprintf(codec + 4, codec_size - 4, ".%02x", object_type);
+      // DecoderSpecificInfo of AAC starts with the audio object type
+      if(object_type == 0x40 && child < end && *child++ == 0x05 &&
+         esds_read_length(&child, end) >= 1)
+        snprintf(codec + 7, codec_size - 7, ".%u", child[0] >> 3);
+    }
+  }
+}
+
+// Codecs of the traks with samples, comma separated, for the manifests
+int mp4_index_codecs(struct mp4_index_t const* index, char* codecs, size_t codecs_size)
+{
+  unsigned char const* moov = index->moov_data_ + ATOM_PREAMBLE_SIZE;
+  uint64_t moov_size = index->moov_size_ - ATOM_PREAMBLE_SIZE;
+  unsigned int i = 0;
+  size_t length = 0;
+
+  codecs[0] = '\0';
+  while(moov_size >= ATOM_PREAMBLE_SIZE && i != index->tracks_)
+  {
+    uint64_t atom_size = read_32(moov);
+    unsigned char const* atom = moov;
+    uint64_t size;
+    char codec[32];
+
+    if(atom_size < ATOM_PREAMBLE_SIZE || atom_size > moov_size)
+      break;
+    moov += atom_size;
+    moov_size -= atom_size;
+    if(read_32(atom + 4) != FOURCC('t', 'r', 'a', 'k'))
+      continue;
+    if(index->traks_[i++].samples_size_ == 0)
+      continue;
+
+    size = atom_size - ATOM_PREAMBLE_SIZE;
+    atom += ATOM_PREAMBLE_SIZE;
+    if((atom = atom_find_child(atom, size, FOURCC('m', 'd', 'i', 'a'), &size)) == 0 ||
+       (atom = atom_find_child(atom, size, FOURCC('m', 'i', 'n', 'f'), &size)) == 0 ||
+       (atom = atom_find_child(atom, size, FOURCC('s', 't', 'b', 'l'), &size)) == 0 ||
+       (atom = atom_find_child(atom, size, FOURCC('s', 't', 's', 'd'), &size)) == 0 ||
+       size < 8 + ATOM_PREAMBLE_SIZE || read_32(atom + 8) < ATOM_PREAMBLE_SIZE ||
+       read_32(atom + 8) > size - 8)
+      return 0;
+    stsd_get_codec(atom + 8 + ATOM_PREAMBLE_SIZE, read_32(atom + 8) - ATOM_PREAMBLE_SIZE,
+                   read_32(atom + 12), codec, sizeof(codec));
+    if(length + strlen(codec) + 2 > codecs_size)
+      return 0;
+    length += sprintf(codecs + length, "%s%s", length ? "," : "", codec);
+  }
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sidecar file of an object: header, then ftyp, moov, the init segment and
+// the columns of each trak, every block 8 bytes aligned. It is only read by
+// the host which wrote it, the structures are stored as they are in memory.
+#define MP4_INDEX_FILE_MAGIC FOURCC('n', 'i', 'd', 'x')
+#define MP4_INDEX_FILE_VERSION 4
+#define MP4_INDEX_FILE_ALIGN(size) (((size) + 7) & ~(uint64_t)7)
+
+struct mp4_index_file_trak_t
+{
+  uint32_t chunks_size_;
+  uint32_t samples_size_;
+  uint32_t has_cto_;
+  uint32_t track_id_;
+  uint32_t timescale_;
+  uint32_t has_sync_;
+  uint32_t sync_size_;
+  uint32_t reserved_;
+};
+
+struct mp4_index_file_t
+{
+  uint32_t magic_;
+  uint32_t version_;
+  uint32_t chunks_size_;  // sizeof(struct chunks_t) of the writer
+  uint32_t tracks_;
+  int64_t object_size_;   // version of the object the index was built on
+  int64_t object_mtime_;
+  uint64_t ftyp_size_;
+  uint64_t moov_size_;
+  struct mp4_atom_t mdat_atom_;
+  uint32_t bitrate_;
+  uint32_t timescale_;
+  uint32_t init_size_;
+  uint32_t mehd_offset_;
+  uint32_t segments_size_;
+  uint32_t segment_trak_;
+  struct mp4_index_file_trak_t traks_[MAX_TRACKS];
+};
+
+static int mp4_index_file_write_block(FILE* outfile, void const* data, uint64_t size)
+{
+  static char const padding[8] = { 0 };
+
+  if(size && fwrite(data, (size_t)size, 1, outfile) != 1)
+    return 0;
+  if(MP4_INDEX_FILE_ALIGN(size) != size &&
+     fwrite(padding, (size_t)(MP4_INDEX_FILE_ALIGN(size) - size), 1, outfile) != 1)
+    return 0;
+
+  return 1;
+}
+
+// Next block of the mapped sidecar, 0 if it goes past the end of the file
+static void* mp4_index_file_map_block(unsigned char* map, size_t map_size,
+                                      uint64_t* offset, uint64_t size)
+{
+  void* block = map + *offset;
+
+  if(size > map_size || *offset > map_size - size)
+    return 0;
+  *offset += MP4_INDEX_FILE_ALIGN(size);
+
+  return block;
+}
+
+int mp4_index_write(struct mp4_index_t const* index, const char* filename,
+                    int64_t filesize, int64_t mtime)
+{
+  FILE* outfile;
+  struct mp4_index_file_t header;
+  unsigned int i;
+  int result = 1;
+
+  memset(&header, 0, sizeof(header));
+  header.magic_ = MP4_INDEX_FILE_MAGIC;
+  header.version_ = MP4_INDEX_FILE_VERSION;
+  header.chunks_size_ = sizeof(struct chunks_t);
+  header.tracks_ = index->tracks_;
+  header.object_size_ = filesize;
+  header.object_mtime_ = mtime;
+  header.ftyp_size_ = index->ftyp_size_;
+  header.moov_size_ = index->moov_size_;
+  header.mdat_atom_ = index->mdat_atom_;
+  header.bitrate_ = index->bitrate_;
+  header.timescale_ = index->timescale_;
+  header.init_size_ = index->init_data_ ? index->init_size_ : 0;
+  header.mehd_offset_ = index->mehd_offset_;
+  header.segments_size_ = header.init_size_ ? index->segments_size_ : 0;
+  header.segment_trak_ = index->segment_trak_;
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    header.traks_[i].chunks_size_ = index->traks_[i].chunks_size_;
+    header.traks_[i].samples_size_ = index->traks_[i].samples_size_;
+    header.traks_[i].has_cto_ = index->traks_[i].samples_.cto_ ? 1 : 0;
+    header.traks_[i].track_id_ = index->fragment_traks_[i].track_id_;
+    header.traks_[i].timescale_ = index->fragment_traks_[i].timescale_;
+    header.traks_[i].has_sync_ = index->fragment_traks_[i].has_sync_;
+    header.traks_[i].sync_size_ = index->fragment_traks_[i].sync_size_;
+  }
+
+  outfile = fopen(filename, "wb");
+  if(outfile == NULL)
+  {
+    return 0;
+  }
+
+  result = mp4_index_file_write_block(outfile, &header, sizeof(header)) &&
+           mp4_index_file_write_block(outfile, index->ftyp_data_, index->ftyp_size_) &&
+           mp4_index_file_write_block(outfile, index->moov_data_, index->moov_size_) &&
+           mp4_index_file_write_block(outfile, index->init_data_, header.init_size_);
+  for(i = 0; result && i != index->tracks_; ++i)
+  {
+    struct trak_index_t const* trak_index = &index->traks_[i];
+    uint64_t samples = trak_index->samples_size_ + 1;
+
+    result = mp4_index_file_write_block(outfile, trak_index->chunks_,
+               trak_index->chunks_size_ * sizeof(struct chunks_t)) &&
+             mp4_index_file_write_block(outfile, trak_index->samples_.pts_,
+               samples * sizeof(unsigned int)) &&
+             mp4_index_file_write_block(outfile, trak_index->samples_.pos_,
+               samples * sizeof(uint64_t));
+    if(result && trak_index->samples_.cto_)
+      result = mp4_index_file_write_block(outfile, trak_index->samples_.cto_,
+                 samples * sizeof(unsigned int));
+    if(result && header.init_size_)
+      result = mp4_index_file_write_block(outfile, index->fragment_traks_[i].size_,
+                 (uint64_t)trak_index->samples_size_ * sizeof(unsigned int)) &&
+               mp4_index_file_write_block(outfile, index->fragment_traks_[i].sync_,
+                 (uint64_t)index->fragment_traks_[i].sync_size_ * sizeof(unsigned int));
+    if(result && header.segments_size_)
+      result = mp4_index_file_write_block(outfile, index->fragment_traks_[i].segments_,
+                 ((uint64_t)header.segments_size_ + 1) * sizeof(unsigned int));
+  }
+
+  if(fclose(outfile) != 0)
+    result = 0;
+
+  return result;
+}
+
+// The index points into the mapping, nothing is parsed nor copied
+struct mp4_index_t* mp4_index_map(const char* filename, int64_t filesize, int64_t mtime)
+{
+  int descriptor;
+  struct stat file_stat;
+  unsigned char* map;
+  size_t map_size;
+  struct mp4_index_file_t const* header;
+  struct mp4_index_t* index;
+  uint64_t offset;
+  unsigned int i;
+
+  descriptor = open(filename, O_RDONLY);
+  if(descriptor < 0)
+  {
+    return 0;
+  }
+  if(fstat(descriptor, &file_stat) < 0 ||
+     file_stat.st_size < (off_t)sizeof(struct mp4_index_file_t))
+  {
+    close(descriptor);
+    return 0;
+  }
+  map_size = (size_t)file_stat.st_size;
+  map = (unsigned char*)mmap(NULL, map_size, PROT_READ, MAP_SHARED, descriptor, 0);
+  close(descriptor);
+  if(map == MAP_FAILED)
+  {
+    return 0;
+  }
+
+  header = (struct mp4_index_file_t const*)map;
+  if(header->magic_ != MP4_INDEX_FILE_MAGIC ||
+     header->version_ != MP4_INDEX_FILE_VERSION ||
+     header->chunks_size_ != sizeof(struct chunks_t) ||
+     header->tracks_ > MAX_TRACKS ||
+     header->object_size_ != filesize ||
+     header->object_mtime_ != mtime ||
+     header->moov_size_ < ATOM_PREAMBLE_SIZE ||
+     (header->segments_size_ && header->segment_trak_ >= header->tracks_))
+  {
+    munmap(map, map_size);
+    return 0;
+  }
+
+  index = (struct mp4_index_t*)calloc(1, sizeof(struct mp4_index_t));
+  if(index == 0)
+  {
+    munmap(map, map_size);
+    return 0;
+  }
+  index->map_ = map;
+  index->map_size_ = map_size;
+  index->ftyp_size_ = header->ftyp_size_;
+  index->moov_size_ = header->moov_size_;
+  index->mdat_atom_ = header->mdat_atom_;
+  index->tracks_ = header->tracks_;
+  index->bitrate_ = header->bitrate_;
+  index->timescale_ = header->timescale_;
+  index->init_size_ = header->init_size_;
+  index->mehd_offset_ = header->mehd_offset_;
+  index->segments_size_ = header->segments_size_;
+  index->segment_trak_ = header->segment_trak_;
+  index->size_ = sizeof(struct mp4_index_t) + map_size;
+
+  offset = MP4_INDEX_FILE_ALIGN(sizeof(struct mp4_index_file_t));
+  index->ftyp_data_ = (unsigned char*)mp4_index_file_map_block(map, map_size, &offset, header->ftyp_size_);
+  index->moov_data_ = (unsigned char*)mp4_index_file_map_block(map, map_size, &offset, header->moov_size_);
+  if(header->init_size_)
+    index->init_data_ = (unsigned char*)mp4_index_file_map_block(map, map_size, &offset, header->init_size_);
+  if(index->moov_data_ == 0 || (header->ftyp_size_ && index->ftyp_data_ == 0) ||
+     (header->init_size_ && (index->init_data_ == 0 ||
+                             (uint64_t)header->mehd_offset_ + 8 > header->init_size_)))
+  {
+    mp4_index_close(index);
+    return 0;
+  }
+  for(i = 0; i != index->tracks_; ++i)
+  {
+    struct trak_index_t* trak_index = &index->traks_[i];
+    uint64_t samples = (uint64_t)header->traks_[i].samples_size_ + 1;
+
+    trak_index->chunks_size_ = header->traks_[i].chunks_size_;
+    trak_index->samples_size_ = header->traks_[i].samples_size_;
+    trak_index->chunks_ = (struct chunks_t*)mp4_index_file_map_block(map, map_size, &offset,
+                            (uint64_t)trak_index->chunks_size_ * sizeof(struct chunks_t));
+    trak_index->samples_.pts_ = (unsigned int*)mp4_index_file_map_block(map, map_size, &offset,
+                                  samples * sizeof(unsigned int));
+    trak_index->samples_.pos_ = (uint64_t*)mp4_index_file_map_block(map, map_size, &offset,
+                                  samples * sizeof(uint64_t));
+    if(header->traks_[i].has_cto_)
+      trak_index->samples_.cto_ = (unsigned int*)mp4_index_file_map_block(map, map_size, &offset,
+                                    samples * sizeof(unsigned int));
+    if(header->init_size_)
+    {
+      struct trak_fragment_index_t* fragment_index = &index->fragment_traks_[i];
+
+      fragment_index->track_id_ = header->traks_[i].track_id_;
+      fragment_index->timescale_ = header->traks_[i].timescale_;
+      fragment_index->has_sync_ = header->traks_[i].has_sync_;
+      fragment_index->sync_size_ = header->traks_[i].sync_size_;
+      fragment_index->size_ = (unsigned int*)mp4_index_file_map_block(map, map_size, &offset,
+                                (uint64_t)trak_index->samples_size_ * sizeof(unsigned int));
+      fragment_index->sync_ = (unsigned int*)mp4_index_file_map_block(map, map_size, &offset,
+                                (uint64_t)fragment_index->sync_size_ * sizeof(unsigned int));
+      if(header->segments_size_)
+        fragment_index->segments_ = (unsigned int*)mp4_index_file_map_block(map, map_size, &offset,
+                                      ((uint64_t)header->segments_size_ + 1) * sizeof(unsigned int));
+      if((trak_index->samples_size_ && fragment_index->size_ == 0) ||
+         (fragment_index->sync_size_ && fragment_index->sync_ == 0) ||
+         (header->segments_size_ && fragment_index->segments_ == 0))
+      {
+        mp4_index_close(index);
+        return 0;
+      }
+    }
+    if(trak_index->samples_.pts_ == 0 || trak_index->samples_.pos_ == 0 ||
+       (trak_index->chunks_size_ && trak_index->chunks_ == 0) ||
+       (header->traks_[i].has_cto_ && trak_index->samples_.cto_ == 0))
+    {
+      mp4_index_close(index);
+      return 0;
+    }
+  }
+
+  return index;
+}
 }
 
 // End Of File
@@ -34,6 +34,82 @@ extern int mp4_split(const char* infile, int64_t filesize,
                      uint64_t* mdat_offset, uint64_t* mdat_size,
                      int client_is_flash);
 
+/* Reads size bytes at offset of the remote file in buffer, returns 0 on error */
+typedef int (*mp4_read_range_t)(void* context, uint64_t offset, uint64_t size, unsigned char* buffer);
+
+/* mp4_split of a remote file: the head holds its first bytes, the atoms
+   past it are fetched with read_range, a few ranges up to the moov */
+extern int mp4_split_ranges(unsigned char const* head, uint64_t head_size, int64_t filesize,
+                            mp4_read_range_t read_range, void* context,
+                            float start_time, float end_time,
+                            void** mp4_header, uint32_t* mp4_header_size,
+                            uint64_t* mdat_offset, uint64_t* mdat_size,
+                            int client_is_flash);
+
+/* Moves the moov in front of the media data of the file, returns 1 when the
+   file was rewritten, 0 when there is nothing to move, -1 on error */
+extern int mp4_faststart(const char* filename, int64_t filesize);
+
+/* Parsed moov and sample indices of a file, shared by the seeks on it */
+struct mp4_index_t;
+
+extern struct mp4_index_t* mp4_index_open(const char* infile, int64_t filesize);
+
+extern int mp4_index_split(struct mp4_index_t const* index,
+                           float start_time, float end_time,
+                           void** mp4_header, uint32_t* mp4_header_size,
+                           uint64_t* mdat_offset, uint64_t* mdat_size,
+                           int client_is_flash);
+
+extern size_t mp4_index_size(struct mp4_index_t const* index);
+
+/* Average bitrate in kbit/s from the sample sizes and the track durations, 0 if unknown */
+extern unsigned int mp4_index_bitrate(struct mp4_index_t const* index);
+
+extern void mp4_index_close(struct mp4_index_t* index);
+
+/* Fragmented output of a seek: the init segment (ftyp, moov without samples
+   and mvex), then one moof and mdat header before each file range, all built
+   from the index which must outlive the fragmenter */
+struct mp4_fragmenter_t;
+
+extern struct mp4_fragmenter_t* mp4_fragmenter_open(struct mp4_index_t const* index,
+                                                    float start_time, float end_time,
+                                                    uint32_t fragment_size,
+                                                    void** init_segment, uint32_t* init_segment_size,
+                                                    uint64_t* data_offset, uint64_t* total_size);
+
+/* Header of the next fragment, the data_size bytes of the file following the
+   previous fragment come after it. Returns 0 after the last fragment, -1 on error */
+extern int mp4_fragmenter_next(struct mp4_fragmenter_t* fragmenter,
+                               void** header, uint32_t* header_size, uint64_t* data_size);
+
+extern void mp4_fragmenter_close(struct mp4_fragmenter_t* fragmenter);
+
+/* Packaged output (HLS, DASH): keyframe aligned segments of a few seconds
+   sharing the init segment of the fragmented output, a segment is its header
+   followed by a range of the file */
+extern unsigned int mp4_index_segments(struct mp4_index_t const* index);
+
+extern void mp4_index_segment_time(struct mp4_index_t const* index, unsigned int segment,
+                                   double* start, double* duration);
+
+extern int mp4_index_init_segment(struct mp4_index_t const* index,
+                                  void** init_segment, uint32_t* init_segment_size);
+
+extern int mp4_index_segment(struct mp4_index_t const* index, unsigned int segment,
+                             void** header, uint32_t* header_size,
+                             uint64_t* data_offset, uint64_t* data_size);
+
+extern int mp4_index_codecs(struct mp4_index_t const* index, char* codecs, size_t codecs_size);
+
+/* Sidecar file of the index, only valid for this size and mtime of the object */
+extern int mp4_index_write(struct mp4_index_t const* index, const char* filename,
+                           int64_t filesize, int64_t mtime);
+
+extern struct mp4_index_t* mp4_index_map(const char* filename,
+                                         int64_t filesize, int64_t mtime);
+
 /* Returns true when the test string is a prefix of the input */
 extern int starts_with(const char* input, const char* test);
 
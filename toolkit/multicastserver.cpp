@@ -136,70 +136,55 @@ int MulticastServer::disableLoopback(void) {
 
 int MulticastServer::decodePacket(char *message) {
 	char key[17];
-	List<String *> *stringList;
-	String *string;
+	struct ParserToken tokens[MULTICASTSERVER_MAXTOKENS];
+	int numberOfTokens;
+	struct MulticastData multicastDataBuffer;
 	struct MulticastData *multicastData;
 	uint32_t hashPosition;
 	HashTableElt *hashTableElt;
 	int returnCode;
 
-	// Parse the messsage and tokenize on '\n'
-	stringList = parser->tokenizeString(message, 128);
-	if (! stringList)
+	// Parse the messsage and tokenize on '\n', tokens stay in the packet buffer
+	numberOfTokens = parser->splitString(message, tokens, MULTICASTSERVER_MAXTOKENS);
+	if (numberOfTokens < 0)
 		return -1;
 
-	stringList->setDestroyData(2);
-
-	if (stringList->listSize < 5) {
-		systemLog->sysLog(ERROR, "invalid packet, must have 6 arguments, but we have %d arguments.\n--- Message ---\n%s", stringList->listSize, message);
-		delete stringList;
+	if (numberOfTokens < 5) {
+		systemLog->sysLog(ERROR, "invalid packet, must have 6 arguments, but we have %d arguments.\n--- Message ---\n%s", numberOfTokens, message);
 		return -1;
 	}
 
-	multicastData = (struct MulticastData *)malloc(sizeof(*multicastData));
-	if (! multicastData) {
-		systemLog->sysLog(CRITICAL, "cannot create a struct MulticastData: %s", strerror(errno));
-		delete stringList;
-		return -1;
-	}
+	// Copied in the key hashtable element, no allocation of its own
+	multicastData = &multicastDataBuffer;
+	memset(multicastData, 0, sizeof(*multicastData));
 	
 	// Now comnplete the multicastPacket fields
-	string = stringList->getElement(1);
-	multicastData->commandType = atoi(string->bloc);
+	multicastData->commandType = atoi(tokens[0].bloc);
 
 	switch (multicastData->commandType) {
 		case 0:
-			string = stringList->getElement(2);
-			strncpy(key, string->bloc, sizeof(key)-1);
-			key[sizeof(key)-1] = '\0';
-			string = stringList->getElement(3);
-			multicastData->itemId = atoi(string->bloc);
-			string = stringList->getElement(4);
-			multicastData->productId = atoi(string->bloc);
-			string = stringList->getElement(5);
-			snprintf(multicastData->countryCode, sizeof(multicastData->countryCode), "%s", string->bloc);
-			string = stringList->getElement(6);
-			multicastData->tagId = atoi(string->bloc);
-			if (stringList->listSize > 6) {
-				string = stringList->getElement(7);
-				multicastData->encodingFormatId = atoi(string->bloc);
+			if (numberOfTokens < 6) {
+				systemLog->sysLog(ERROR, "invalid packet, command 0 must have 6 arguments, but we have %d arguments", numberOfTokens);
+				return -1;
 			}
+			strncpy(key, tokens[1].bloc, sizeof(key)-1);
+			key[sizeof(key)-1] = '\0';
+			multicastData->itemId = atoi(tokens[2].bloc);
+			multicastData->productId = atoi(tokens[3].bloc);
+			snprintf(multicastData->countryCode, sizeof(multicastData->countryCode), "%s", tokens[4].bloc);
+			multicastData->tagId = atoi(tokens[5].bloc);
+			if (numberOfTokens > 6)
+				multicastData->encodingFormatId = atoi(tokens[6].bloc);
 			break;
 
 		case 1:
-			string = stringList->getElement(2);
-			strncpy(key, string->bloc, sizeof(key)-1);
+			strncpy(key, tokens[1].bloc, sizeof(key)-1);
 			key[sizeof(key)-1] = '\0';
-			string = stringList->getElement(3);
-			multicastData->itemId = atoi(string->bloc);
-			string = stringList->getElement(4);
-			multicastData->productId = atoi(string->bloc);
-			string = stringList->getElement(5);
-			multicastData->tagId = atoi(string->bloc);
-			if (stringList->listSize > 5) {
-				string = stringList->getElement(6);
-				multicastData->encodingFormatId = atoi(string->bloc);
-			}
+			multicastData->itemId = atoi(tokens[2].bloc);
+			multicastData->productId = atoi(tokens[3].bloc);
+			multicastData->tagId = atoi(tokens[4].bloc);
+			if (numberOfTokens > 5)
+				multicastData->encodingFormatId = atoi(tokens[5].bloc);
 			break;
 
 		default:
@@ -207,9 +192,6 @@ int MulticastServer::decodePacket(char *message) {
 			break;
 	}
 
-	// And destruct the arguments List
-	delete stringList;
-
 #ifdef DEBUGOUTPUT
 	systemLog->sysLog(DEBUG, "[=== message decoded ===]");
 	systemLog->sysLog(DEBUG, "	key is #%s#", key);
@@ -221,16 +203,14 @@ int MulticastServer::decodePacket(char *message) {
 #endif
 
 	keyHashtable->lock();
-	hashTableElt = keyHashtable->add(key, multicastData, &hashPosition);
+	hashTableElt = keyHashtable->add(key, multicastData, sizeof(*multicastData), &hashPosition);
 	if (! hashTableElt) {
-		free(multicastData);
 		keyHashtable->unlock();
 		return -1;
 	}
 	returnCode = keyHashtableTimeout->add(hashPosition, hashTableElt);
 	if (returnCode < 0) {
 		keyHashtable->remove(key);
-		free(multicastData);
 		keyHashtable->unlock();
 		return -1;
 	}
@@ -18,6 +18,9 @@
 #include "../src/multicastdata.h"
 #include "../src/keyhashtabletimeout.h"
 
+// Packets carry up to 7 fields, anything after lands in the last token
+#define MULTICASTSERVER_MAXTOKENS 8
+
 /**
 	@author  <spe@>
 */
@@ -119,49 +119,47 @@ int MulticastServerCatalog::disableLoopback(void) {
 }
 
 int MulticastServerCatalog::decodePacket(char *message) {
-	List<String *> *stringList;
-	String *string;
+	struct ParserToken tokens[MULTICASTSERVERCATALOG_MAXTOKENS];
+	int numberOfTokens;
 	struct CatalogData *catalogData;
 	uint32_t hashPosition;
 	HashTableElt *hashTableElt;
 	int returnCode;
 	int i;
 	MonitoredHost *monitoredHost;
-	size_t len;
 	char messageType;
 	char *relativePath;
 	char *buffer;
 
-	// Parse the messsage and tokenize on '\n'
-	stringList = parser->tokenizeString(message, 128);
-	if (! stringList)
+	// Parse the messsage and tokenize on '\n', tokens stay in the packet buffer
+	numberOfTokens = parser->splitString(message, tokens, MULTICASTSERVERCATALOG_MAXTOKENS);
+	if (numberOfTokens < 0)
 		return -1;
 
-	stringList->setDestroyData(2);
-
-	if ((stringList->listSize <= 0) || (stringList->listSize > 3)) {
-		systemLog->sysLog(ERROR, "invalid packet, must have arguments > 0 and arguments <= 3, but we have %d arguments.\n--- Message ---\n%s", stringList->listSize, message);
-		delete stringList;
+	if ((numberOfTokens <= 0) || (numberOfTokens > 3)) {
+		systemLog->sysLog(ERROR, "invalid packet, must have arguments > 0 and arguments <= 3, but we have %d arguments.\n--- Message ---\n%s", numberOfTokens, message);
 		return -1;
 	}
 
 	catalogData = (struct CatalogData *)malloc(sizeof(struct CatalogData));
 	if (! catalogData) {
 		systemLog->sysLog(CRITICAL, "cannot create a MPCatalog object: %s", strerror(errno));
-		delete stringList;
 		return -1;
 	}
 	
 	// Now comnplete the multicastPacket fields
-	string = stringList->getElement(1);
-	messageType = atoi(string->bloc);
+	messageType = atoi(tokens[0].bloc);
 
 	switch (messageType) {
 		case CATALOGPING:
-			string = stringList->getElement(2);
-			catalogData->host = inet_addr(string->bloc);
+			if (numberOfTokens < 2) {
+				systemLog->sysLog(ERROR, "CATALOGPING command must have exactly 1 parameter");
+				free(catalogData);
+				return -1;
+			}
+			catalogData->host = inet_addr(tokens[1].bloc);
 #ifdef DEBUGCATALOG
-			systemLog->sysLog(DEBUG, "ping from #%s#", string->bloc);
+			systemLog->sysLog(DEBUG, "ping from #%s#", tokens[1].bloc);
 #endif
 			for (i = 1; i <= serverList->getListSize(); i++) {
 				if (serverList->getElement(i)->ipAddress == catalogData->host) {
@@ -170,7 +168,6 @@ int MulticastServerCatalog::decodePacket(char *message) {
 					systemLog->sysLog(DEBUG, "found server %s on the list, setting timeout to %d", inet_ntoa(*((struct in_addr *)&catalogData->host)), serverList->getElement(i)->timeout);
 #endif
 					free(catalogData);
-					delete stringList;
 					return 0;
 				}
 			}
@@ -178,7 +175,6 @@ int MulticastServerCatalog::decodePacket(char *message) {
 			if (! monitoredHost) {
 				systemLog->sysLog(CRITICAL, "cannot allocate ipAddressPtr object: %s", strerror(errno));
 				free(catalogData);
-				delete stringList;
 				return -1;
 			}
 			monitoredHost->ipAddress = catalogData->host;
@@ -189,7 +185,6 @@ int MulticastServerCatalog::decodePacket(char *message) {
 			if (! buffer) {
 				systemLog->sysLog(CRITICAL, "cannot allocate a buffer object: %s", strerror(errno));
 				free(catalogData);
-				delete stringList;
 				return -1;
 			}
 			buffer[0] = '\0';
@@ -202,7 +197,6 @@ int MulticastServerCatalog::decodePacket(char *message) {
 			delete buffer;
 
 			free(catalogData);
-			delete stringList;
 
 			return 0;
 			
@@ -210,26 +204,15 @@ int MulticastServerCatalog::decodePacket(char *message) {
 		case CATALOGADD:
 			char *key;
 
-			if (stringList->getListSize() != 3) {
+			if (numberOfTokens != 3) {
 				systemLog->sysLog(ERROR, "CATALOGADD command must have exactly 2 parameters");
 				free(catalogData);
-				delete stringList;
 				return -1;
 			}
-			string = stringList->getElement(2);
-			catalogData->host = inet_addr(string->bloc);
+			catalogData->host = inet_addr(tokens[1].bloc);
 			catalogData->counter = 0;
-			string = stringList->getElement(3);
-			len = strlen(string->bloc);
-			key = new char[len + 1];
-			if (! key) {
-				systemLog->sysLog(CRITICAL, "cannot allocate relativePath object: %s", strerror(errno));
-				free(catalogData);
-				delete stringList;
-				return -1;
-			}
-			strncpy(key, string->bloc, len);
-			key[len] = '\0';
+			// Key is copied in the hashtable element
+			key = tokens[2].bloc;
 
 #ifdef DEBUGCATALOG
 			systemLog->sysLog(DEBUG, "new entry in catalog:");
@@ -242,8 +225,6 @@ int MulticastServerCatalog::decodePacket(char *message) {
 			if (! hashTableElt) {
 				systemLog->sysLog(CRITICAL, "cannot add key to catalog hashtable: %s", strerror(errno));
 				free(catalogData);
-				delete stringList;
-				free(key);
 				catalogHashtable->unlock();
 				return -1;
 			}
@@ -255,45 +236,31 @@ int MulticastServerCatalog::decodePacket(char *message) {
 				systemLog->sysLog(DEBUG, "numberOfElements   is %d", catalogHashtable->getNumberOfElements());
 			}
 #endif
-			delete stringList;
 			return 0;
 			
 			break;
 		case CATALOGDEL:
-			if (stringList->getListSize() != 2) {
+			if (numberOfTokens != 2) {
 				systemLog->sysLog(ERROR, "CATALOGDEL command must have exactly 1 parameters");
 				free(catalogData);
-				delete stringList;
 				return -1;
 			}
-			string = stringList->getElement(2);
-			len = strlen(string->bloc);
-			relativePath = new char[len + 1];
-			if (! relativePath) {
-				systemLog->sysLog(CRITICAL, "cannot allocate relativePath object: %s", strerror(errno));
-				free(catalogData);
-				delete stringList;
-				return -1;
-			}
-			strncpy(relativePath, string->bloc, len);
-			relativePath[len] = '\0';
+			relativePath = tokens[1].bloc;
 
 			catalogHashtable->lock();
-			returnCode = catalogHashtable->remove(relativePath, &hashTableElt);
-			if (returnCode) {
-				systemLog->sysLog(CRITICAL, "cannot delete key to catalog hashtable: %s", strerror(errno));
-				delete catalogData;
-				delete stringList;
+			hashTableElt = catalogHashtable->search(relativePath, tokens[1].length, &hashPosition);
+			if (! hashTableElt) {
+				catalogHashtable->unlock();
+				systemLog->sysLog(ERROR, "cannot delete key '%s' from catalog hashtable, key doesn't exist", relativePath);
+				free(catalogData);
 				return -1;
 			}
-
-			//catalogData = (CatalogData *)hashTableElt->getData();
+			// Lockless readers may still use the removed data
+			catalogHashtable->freeData(hashTableElt->getData());
+			catalogHashtable->remove(hashPosition, hashTableElt);
 			catalogHashtable->unlock();
 
 			free(catalogData);
-			free(relativePath);
-			delete hashTableElt;
-			delete stringList;
 
 			return 0;
 			
@@ -301,7 +268,6 @@ int MulticastServerCatalog::decodePacket(char *message) {
 		default:
 			systemLog->sysLog(ERROR, "unrecognized catalog message type %d", messageType);
 			free(catalogData);
-			delete stringList;
 			return -1;
 			break;
 	} 
@@ -355,6 +321,7 @@ int MulticastServerCatalog::purgeCatalogFromHost(uint32_t ipAddress) {
 	int **hashtablePtr;
 	int hashtableSize;
 	HashTableElt *hashtableElt;
+	HashTableElt *hashtableEltNext;
 	struct CatalogData *catalogData;
 
 	catalogHashtable->lock();
@@ -370,15 +337,16 @@ int MulticastServerCatalog::purgeCatalogFromHost(uint32_t ipAddress) {
 #endif
 			hashtableElt = (HashTableElt *)hashtablePtr[i];
 			while (hashtableElt) {
+				hashtableEltNext = hashtableElt->getNext();
 				catalogData = (struct CatalogData *)hashtableElt->getData();
 #ifdef DEBUGCATALOG
 				systemLog->sysLog(DEBUG, "catalogData->host is %s and ipAddress is %s", inet_ntoa(*((struct in_addr *)&catalogData->host)), inet_ntoa(*((struct in_addr *)&ipAddress)));
 #endif
 				if (catalogData->host == ipAddress) {
 					catalogHashtable->remove(i, hashtableElt);
-					free(catalogData);
+					catalogHashtable->freeData(catalogData);
 				}
-				hashtableElt = hashtableElt->getNext();
+				hashtableElt = hashtableEltNext;
 			}
 		}
 		i++;
@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <netinet/in.h>
 
+// Catalog packets carry up to 3 fields
+#define MULTICASTSERVERCATALOG_MAXTOKENS 4
+
 /**
 	@author  <spe@>
 */
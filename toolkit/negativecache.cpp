@@ -0,0 +1,166 @@
+//
+// C++ Implementation: negativecache
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+
+#include "negativecache.h"
+
+NegativeCache::NegativeCache(unsigned int _timeout, int _maxElements) {
+	timeout = _timeout;
+	maxElements = _maxElements;
+	hits = 0;
+	inserts = 0;
+	hashAlgorithm = new HashAlgorithm(ALGO_PAULHSIEH);
+	if (! hashAlgorithm) {
+		systemLog->sysLog(CRITICAL, "cannot create an HashAlgorithm object: %s", strerror(errno));
+		return;
+	}
+	hashTable = new HashTable(hashAlgorithm, 0xFFFF);
+	if (! hashTable) {
+		systemLog->sysLog(CRITICAL, "cannot create a HashTable object: %s", strerror(errno));
+		return;
+	}
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object: %s", strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+NegativeCache::~NegativeCache() {
+	if (hashTable)
+		delete hashTable;
+	if (hashAlgorithm)
+		delete hashAlgorithm;
+	if (mutex)
+		delete mutex;
+
+	return;
+}
+
+// Must be called with the mutex locked
+void NegativeCache::purgeExpired(time_t currentTime) {
+	int **hashtablePtr;
+	unsigned int hashtableSize;
+	unsigned int i;
+	HashTableElt *hashtableElt;
+	HashTableElt *hashtableEltNext;
+	struct NegativeCacheData *negativeCacheData;
+
+	hashtablePtr = hashTable->getHashtable();
+	hashtableSize = hashTable->getSize();
+	for (i = 0; i <= hashtableSize; i++) {
+		hashtableElt = (HashTableElt *)hashtablePtr[i];
+		while (hashtableElt) {
+			hashtableEltNext = hashtableElt->getNext();
+			negativeCacheData = (struct NegativeCacheData *)hashtableElt->getData();
+			if (negativeCacheData->expireTime <= currentTime) {
+				hashTable->remove(i, hashtableElt);
+				free(negativeCacheData);
+			}
+			hashtableElt = hashtableEltNext;
+		}
+	}
+
+	return;
+}
+
+// Return the HTTP code stored for this object, or 0 if the object is not negatively cached
+int NegativeCache::search(char *key) {
+	HashTableElt *hashtableElt;
+	struct NegativeCacheData *negativeCacheData;
+	int httpCode = 0;
+	uint32_t hashPosition;
+
+	mutex->lockMutex();
+	hashtableElt = hashTable->search(key, &hashPosition);
+	if (hashtableElt) {
+		negativeCacheData = (struct NegativeCacheData *)hashtableElt->getData();
+		if (negativeCacheData->expireTime > time(NULL)) {
+			httpCode = negativeCacheData->httpCode;
+			hits++;
+		}
+		else {
+			hashTable->remove(hashPosition, hashtableElt);
+			free(negativeCacheData);
+		}
+	}
+	mutex->unlockMutex();
+
+	return httpCode;
+}
+
+int NegativeCache::add(char *key, int httpCode) {
+	HashTableElt *hashtableElt;
+	struct NegativeCacheData *negativeCacheData;
+	uint32_t hashPosition;
+	time_t currentTime;
+
+	if ((! timeout) || (isCacheable(httpCode) == false))
+		return 0;
+
+	currentTime = time(NULL);
+	mutex->lockMutex();
+	// Proxy and cache threads of the same miss can both report it, just refresh the entry
+	hashtableElt = hashTable->search(key, &hashPosition);
+	if (hashtableElt) {
+		negativeCacheData = (struct NegativeCacheData *)hashtableElt->getData();
+		negativeCacheData->expireTime = currentTime + timeout;
+		negativeCacheData->httpCode = httpCode;
+		mutex->unlockMutex();
+		return 0;
+	}
+	if (hashTable->getNumberOfElements() >= maxElements) {
+		purgeExpired(currentTime);
+		if (hashTable->getNumberOfElements() >= maxElements) {
+			mutex->unlockMutex();
+			systemLog->sysLog(WARNING, "negative cache is full (%d entries), cannot add '%s'", maxElements, key);
+			return -1;
+		}
+	}
+	negativeCacheData = (struct NegativeCacheData *)malloc(sizeof(struct NegativeCacheData));
+	if (! negativeCacheData) {
+		mutex->unlockMutex();
+		systemLog->sysLog(CRITICAL, "cannot allocate a NegativeCacheData object: %s", strerror(errno));
+		return -1;
+	}
+	negativeCacheData->expireTime = currentTime + timeout;
+	negativeCacheData->httpCode = httpCode;
+	hashtableElt = hashTable->add(key, negativeCacheData, &hashPosition);
+	if (! hashtableElt) {
+		mutex->unlockMutex();
+		free(negativeCacheData);
+		return -1;
+	}
+	inserts++;
+	mutex->unlockMutex();
+
+	return 0;
+}
+
+int NegativeCache::remove(char *key) {
+	HashTableElt *hashtableElt;
+	uint32_t hashPosition;
+	int returnCode = -1;
+
+	mutex->lockMutex();
+	hashtableElt = hashTable->search(key, &hashPosition);
+	if (hashtableElt) {
+		free(hashtableElt->getData());
+		returnCode = hashTable->remove(hashPosition, hashtableElt);
+	}
+	mutex->unlockMutex();
+
+	return returnCode;
+}
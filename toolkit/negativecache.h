@@ -0,0 +1,56 @@
+//
+// C++ Interface: negativecache
+//
+// Description: remember objects that the origin servers don't have (404/5xx)
+// so that following requests are answered locally for a short time
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef NEGATIVECACHE_H
+#define NEGATIVECACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "../toolkit/hashtable.h"
+#include "../toolkit/hashalgorithm.h"
+#include "../toolkit/mutex.h"
+
+struct NegativeCacheData {
+	time_t expireTime;
+	int httpCode;
+};
+
+/**
+	@author  <spe@>
+*/
+class NegativeCache {
+private:
+	HashAlgorithm *hashAlgorithm;
+	HashTable *hashTable;
+	Mutex *mutex;
+	unsigned int timeout;
+	int maxElements;
+	uint64_t hits;
+	uint64_t inserts;
+
+	void purgeExpired(time_t);
+
+public:
+	NegativeCache(unsigned int, int);
+	~NegativeCache();
+
+	int search(char *);
+	int add(char *, int);
+	int remove(char *);
+	bool isCacheable(int httpCode) { return ((httpCode == 404) || (httpCode >= 500)); };
+	int getNumberOfElements(void) { return hashTable->getNumberOfElements(); };
+	uint64_t getHits(void) { return hits; };
+	uint64_t getInserts(void) { return inserts; };
+};
+
+#endif
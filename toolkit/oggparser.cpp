@@ -0,0 +1,255 @@
+//
+// C++ Implementation: oggparser
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "oggparser.h"
+
+OggParser::OggParser(int _fileDescriptor, off_t _fileSize) {
+	fileDescriptor = _fileDescriptor;
+	fileSize = _fileSize;
+	mmapedFile = NULL;
+	numberOfStreams = 0;
+	if (fileSize <= 0)
+		return;
+	mmapedFile = (char *)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	if (mmapedFile == MAP_FAILED) {
+		systemLog->sysLog(ERROR, "[%d] cannot mmap file: %s", fileDescriptor, strerror(errno));
+		mmapedFile = NULL;
+		return;
+	}
+
+	return;
+}
+
+OggParser::~OggParser() {
+	if (mmapedFile)
+		munmap(mmapedFile, fileSize);
+
+	return;
+}
+
+// Return -1 if there is no complete page at position
+int OggParser::readPage(off_t position, struct OggPage *oggPage) {
+	const unsigned char *ptrChar;
+	unsigned int numberOfSegments;
+	unsigned int i;
+	off_t bodySize = 0;
+
+	if (position + OGGPARSER_PAGEHEADERSIZE > fileSize)
+		return -1;
+	ptrChar = (const unsigned char *)&mmapedFile[position];
+	if (memcmp(ptrChar, "OggS", 4) || ptrChar[4])
+		return -1;
+	numberOfSegments = ptrChar[26];
+	if (position + OGGPARSER_PAGEHEADERSIZE + numberOfSegments > fileSize)
+		return -1;
+	oggPage->numberOfPackets = 0;
+	for (i = 0; i < numberOfSegments; i++) {
+		bodySize += ptrChar[OGGPARSER_PAGEHEADERSIZE + i];
+		if (ptrChar[OGGPARSER_PAGEHEADERSIZE + i] < 255)
+			oggPage->numberOfPackets++;
+	}
+	oggPage->position = position;
+	oggPage->bodyPosition = position + OGGPARSER_PAGEHEADERSIZE + numberOfSegments;
+	oggPage->end = oggPage->bodyPosition + bodySize;
+	if (oggPage->end > fileSize)
+		return -1;
+	oggPage->flags = ptrChar[5];
+	oggPage->granule = 0;
+	for (i = 0; i < 8; i++)
+		oggPage->granule |= (int64_t)ptrChar[6 + i] << (i * 8);
+	oggPage->serial = (uint32_t)ptrChar[14] | ((uint32_t)ptrChar[15] << 8) | ((uint32_t)ptrChar[16] << 16) | ((uint32_t)ptrChar[17] << 24);
+
+	return 0;
+}
+
+// Identify the codec from the first header packet, on the BOS page
+int OggParser::addStream(struct OggPage *oggPage) {
+	struct OggStream *oggStream;
+	const unsigned char *ptrChar;
+	off_t bodySize;
+
+	if (numberOfStreams == OGGPARSER_MAXSTREAMS)
+		return -1;
+	oggStream = &streams[numberOfStreams];
+	memset(oggStream, 0, sizeof(struct OggStream));
+	oggStream->serial = oggPage->serial;
+	ptrChar = (const unsigned char *)&mmapedFile[oggPage->bodyPosition];
+	bodySize = oggPage->end - oggPage->bodyPosition;
+	if ((bodySize >= 16) && (! memcmp(ptrChar, "\x01vorbis", 7))) {
+		oggStream->codec = OGGPARSER_VORBIS;
+		oggStream->rateNumerator = (uint32_t)ptrChar[12] | ((uint32_t)ptrChar[13] << 8) | ((uint32_t)ptrChar[14] << 16) | ((uint32_t)ptrChar[15] << 24);
+		oggStream->rateDenominator = 1;
+		oggStream->headerPackets = 3;
+	}
+	else
+	if ((bodySize >= 12) && (! memcmp(ptrChar, "OpusHead", 8))) {
+		// Granule positions are always at 48 kHz
+		oggStream->codec = OGGPARSER_OPUS;
+		oggStream->rateNumerator = 48000;
+		oggStream->rateDenominator = 1;
+		oggStream->preSkip = (uint32_t)ptrChar[10] | ((uint32_t)ptrChar[11] << 8);
+		oggStream->headerPackets = 2;
+	}
+	else
+	if ((bodySize >= 42) && (! memcmp(ptrChar, "\x80theora", 7))) {
+		oggStream->codec = OGGPARSER_THEORA;
+		oggStream->rateNumerator = ((uint32_t)ptrChar[22] << 24) | ((uint32_t)ptrChar[23] << 16) | ((uint32_t)ptrChar[24] << 8) | ptrChar[25];
+		oggStream->rateDenominator = ((uint32_t)ptrChar[26] << 24) | ((uint32_t)ptrChar[27] << 16) | ((uint32_t)ptrChar[28] << 8) | ptrChar[29];
+		oggStream->keyFrameShift = ((((uint32_t)ptrChar[40] << 8) | ptrChar[41]) >> 5) & 0x1F;
+		// Since 3.2.1 the frames are counted from 1
+		if ((ptrChar[7] > 3) || ((ptrChar[7] == 3) && ((ptrChar[8] > 2) || ((ptrChar[8] == 2) && ptrChar[9]))))
+			oggStream->preSkip = 1;
+		oggStream->headerPackets = 3;
+	}
+	else
+		return -1;
+	if ((! oggStream->rateNumerator) || (! oggStream->rateDenominator))
+		return -1;
+	numberOfStreams++;
+
+	return 0;
+}
+
+struct OggStream *OggParser::searchStream(uint32_t serial) {
+	unsigned int i;
+
+	for (i = 0; i < numberOfStreams; i++) {
+		if (streams[i].serial == serial)
+			return &streams[i];
+	}
+
+	return NULL;
+}
+
+// Time at the end of the granule position, in ms
+uint32_t OggParser::getTimestamp(struct OggStream *oggStream, int64_t granule) {
+	uint64_t units;
+
+	if (granule < 0)
+		return 0;
+	units = granule;
+	if (oggStream->codec == OGGPARSER_THEORA)
+		units = (units >> oggStream->keyFrameShift) + (units & ((1ULL << oggStream->keyFrameShift) - 1));
+	units = (units > oggStream->preSkip) ? units - oggStream->preSkip : 0;
+
+	return (uint32_t)(units * 1000 * oggStream->rateDenominator / oggStream->rateNumerator);
+}
+
+// Return NULL if the file is not an Ogg of known codecs or has no data page
+// The header is every page up to the end of the codec header packets
+struct FlvKeyFrameIndex *OggParser::buildKeyFrameIndex(void) {
+	struct FlvKeyFrameIndex *flvKeyFrameIndex;
+	struct OggPage oggPage;
+	struct OggStream *oggStream;
+	struct OggStream *referenceStream = NULL;
+	uint32_t keyFramesSize = 0;
+	off_t position = 0;
+	off_t keyFramePosition = -1;
+	uint32_t timestamp;
+	uint32_t duration = 0;
+	bool headersRead = false;
+	unsigned int i;
+
+	if (! mmapedFile)
+		return NULL;
+	numberOfStreams = 0;
+	flvKeyFrameIndex = (struct FlvKeyFrameIndex *)calloc(1, sizeof(struct FlvKeyFrameIndex));
+	if (! flvKeyFrameIndex) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a FlvKeyFrameIndex object: %s", strerror(errno));
+		return NULL;
+	}
+
+	while (readPage(position, &oggPage) == 0) {
+		position = oggPage.end;
+		if (oggPage.flags & OGGPARSER_BOS) {
+			// Another BOS after the headers chains a new file, its times start again
+			if (headersRead == true)
+				break;
+			if (addStream(&oggPage) < 0) {
+				systemLog->sysLog(ERROR, "[%d] unsupported stream in the Ogg file", fileDescriptor);
+				FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+				return NULL;
+			}
+		}
+		oggStream = searchStream(oggPage.serial);
+		if (! oggStream)
+			continue;
+		if (headersRead == false) {
+			oggStream->headerPackets -= (oggPage.numberOfPackets < oggStream->headerPackets) ? oggPage.numberOfPackets : oggStream->headerPackets;
+			for (i = 0; (i < numberOfStreams) && (! streams[i].headerPackets); i++);
+			if (i < numberOfStreams)
+				continue;
+			// Header packets end their page, the data pages come next
+			headersRead = true;
+			if (FlvParser::appendHeaderData(flvKeyFrameIndex, mmapedFile, position) < 0) {
+				FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+				return NULL;
+			}
+			// Video pages are only seek points on keyframes, audio pages always are
+			referenceStream = &streams[0];
+			for (i = 0; i < numberOfStreams; i++) {
+				if (streams[i].codec == OGGPARSER_THEORA) {
+					referenceStream = &streams[i];
+					break;
+				}
+			}
+			continue;
+		}
+		if (oggStream == referenceStream) {
+			if (oggStream->codec == OGGPARSER_THEORA) {
+				// Intra frame packet starting the page, its time is known on the page where it ends
+				if ((! (oggPage.flags & OGGPARSER_CONTINUED)) && (oggPage.end > oggPage.bodyPosition) && mmapedFile[oggPage.position + OGGPARSER_PAGEHEADERSIZE] && (! (mmapedFile[oggPage.bodyPosition] & 0xC0)))
+					keyFramePosition = oggPage.position;
+				if ((keyFramePosition >= 0) && (oggPage.granule >= 0)) {
+					timestamp = getTimestamp(oggStream, (oggPage.granule >> oggStream->keyFrameShift) << oggStream->keyFrameShift);
+					if ((! flvKeyFrameIndex->numberOfKeyFrames) || (timestamp > flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames - 1])) {
+						if (FlvParser::appendKeyFrame(flvKeyFrameIndex, &keyFramesSize, timestamp, keyFramePosition) < 0)
+							break;
+					}
+					keyFramePosition = -1;
+				}
+			}
+			else
+			if ((! (oggPage.flags & OGGPARSER_CONTINUED)) && (oggPage.granule >= 0)) {
+				// Page starts where the previous one of the stream ended
+				timestamp = oggStream->lastTimestamp;
+				if ((! flvKeyFrameIndex->numberOfKeyFrames) || (timestamp >= flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames - 1] + OGGPARSER_AUDIOINTERVAL)) {
+					if (FlvParser::appendKeyFrame(flvKeyFrameIndex, &keyFramesSize, timestamp, oggPage.position) < 0)
+						break;
+				}
+			}
+		}
+		if (oggPage.granule >= 0) {
+			oggStream->lastTimestamp = getTimestamp(oggStream, oggPage.granule);
+			if (oggStream->lastTimestamp > duration)
+				duration = oggStream->lastTimestamp;
+		}
+	}
+
+	if (! flvKeyFrameIndex->numberOfKeyFrames) {
+		systemLog->sysLog(ERROR, "[%d] no seek point found in the Ogg file", fileDescriptor);
+		FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+		return NULL;
+	}
+	if (duration)
+		flvKeyFrameIndex->bitRate = (uint32_t)((uint64_t)fileSize * 8 / duration);
+	flvKeyFrameIndex->memoryUsage = sizeof(struct FlvKeyFrameIndex) + flvKeyFrameIndex->headerSize + flvKeyFrameIndex->numberOfKeyFrames * (sizeof(uint32_t) + sizeof(uint64_t));
+
+	return flvKeyFrameIndex;
+}
@@ -0,0 +1,81 @@
+//
+// C++ Interface: oggparser
+//
+// Description: keyframe index of an Ogg file (Vorbis, Opus, Theora), built
+// from the granule positions of its pages
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef OGGPARSER_H
+#define OGGPARSER_H
+
+#include <sys/types.h>
+
+#include "log.h"
+#include "flvparser.h"
+
+// Capture pattern to the segment table
+#define OGGPARSER_PAGEHEADERSIZE 27
+#define OGGPARSER_CONTINUED 0x01
+#define OGGPARSER_BOS 0x02
+#define OGGPARSER_MAXSTREAMS 8
+// Audio pages are a few KB apart, keep one seek point per interval in ms
+#define OGGPARSER_AUDIOINTERVAL 1000
+
+#define OGGPARSER_VORBIS 1
+#define OGGPARSER_OPUS 2
+#define OGGPARSER_THEORA 3
+
+struct OggPage {
+	off_t position;
+	off_t bodyPosition;
+	off_t end;
+	unsigned char flags;
+	// -1 when no packet ends on the page
+	int64_t granule;
+	uint32_t serial;
+	// Packets ending on the page
+	unsigned int numberOfPackets;
+};
+
+struct OggStream {
+	uint32_t serial;
+	int codec;
+	// Vorbis and Opus sample rate, Theora frame rate is rateNumerator / rateDenominator
+	uint32_t rateNumerator;
+	uint32_t rateDenominator;
+	uint32_t preSkip;
+	unsigned int keyFrameShift;
+	unsigned int headerPackets;
+	// End of the last page with a granule position, in ms
+	uint32_t lastTimestamp;
+};
+
+/**
+	@author  <spe@>
+*/
+class OggParser{
+private:
+	int fileDescriptor;
+	off_t fileSize;
+	char *mmapedFile;
+	struct OggStream streams[OGGPARSER_MAXSTREAMS];
+	unsigned int numberOfStreams;
+
+	int readPage(off_t, struct OggPage *);
+	int addStream(struct OggPage *);
+	struct OggStream *searchStream(uint32_t);
+	uint32_t getTimestamp(struct OggStream *, int64_t);
+
+public:
+	OggParser(int, off_t);
+	~OggParser();
+
+	struct FlvKeyFrameIndex *buildKeyFrameIndex(void);
+};
+
+#endif
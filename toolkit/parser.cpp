@@ -141,6 +141,45 @@ List<String *> *Parser::tokenizeString(char *chaine, int tokenizeLimit) {
 	return tokenList;
 }
 
+bool Parser::isDelimiter(const char *string) {
+	if (parserInitialized == 1)
+		return (! strncmp(string, delimiter, delimiterLenght));
+
+	return ((*string >= minAsciiDelimiter) && (*string <= maxAsciiDelimiter));
+}
+
+// Split in place: delimiters are overwritten by '\0' and the tokens point in the string.
+// The last token gets the rest of the string when maxTokens is reached. Return the number
+// of tokens, a trailing delimiter doesn't make an empty token (like tokenizeString)
+int Parser::splitString(char *string, struct ParserToken *tokens, int maxTokens) {
+	char *stringPtr = string;
+	int numberOfTokens = 0;
+
+	if (! parserInitialized) {
+		systemLog->sysLog(ERROR, "parser parameters are not initialized correctly. cannot tokenize string");
+		return -1;
+	}
+	if ((! string) || (maxTokens <= 0))
+		return -1;
+	while (*stringPtr) {
+		tokens[numberOfTokens].bloc = stringPtr;
+		if (numberOfTokens == maxTokens - 1) {
+			tokens[numberOfTokens].length = strlen(stringPtr);
+			return maxTokens;
+		}
+		while (*stringPtr && (! isDelimiter(stringPtr)))
+			stringPtr++;
+		tokens[numberOfTokens].length = stringPtr - tokens[numberOfTokens].bloc;
+		numberOfTokens++;
+		if (*stringPtr) {
+			*stringPtr = '\0';
+			stringPtr += delimiterLenght;
+		}
+	}
+
+	return numberOfTokens;
+}
+
 List<Memory<char> *> *Parser::tokenizeData(char *chaine, int tokenizeLimit, ssize_t size) {
 	ssize_t cpt = 0;  
 	int cpt2;
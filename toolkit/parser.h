@@ -13,6 +13,12 @@ extern LogError *systemLog;
 #include "../toolkit/mystring.h"
 #include "../toolkit/memory.h"
 
+// Token in the tokenized string itself, nothing is allocated
+struct ParserToken {
+	char *bloc;
+	size_t length;
+};
+
 class Parser {
 private:
 	int parserInitialized;
@@ -20,6 +26,8 @@ private:
 	int delimiterLenght;
 	int minAsciiDelimiter;
 	int maxAsciiDelimiter;
+
+	bool isDelimiter(const char *);
 public:
 	Parser(const char *);
 	Parser(int, int);
@@ -29,6 +37,7 @@ public:
 	void upperCase(char *chaine);
 	void deleteWhiteSpaces(String *string);
 	List<String *> *tokenizeString(char *, int);
+	int splitString(char *, struct ParserToken *, int);
 	List<Memory<char> *> *tokenizeData(char *, int, ssize_t);
 };
 
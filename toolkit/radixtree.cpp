@@ -0,0 +1,321 @@
+//
+// C++ Implementation: radixtree
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radixtree.h"
+
+RadixTree::RadixTree() {
+	numberOfNodes = 0;
+	numberOfKeys = 0;
+	keyBuffer = NULL;
+	keyBufferSize = 0;
+	root = NULL;
+	slabAllocator = new SlabAllocator();
+	if (! slabAllocator) {
+		systemLog->sysLog(CRITICAL, "cannot create a SlabAllocator object: %s", strerror(errno));
+		return;
+	}
+	root = createNode("", 0, NULL);
+
+	return;
+}
+
+RadixTree::~RadixTree() {
+	if (root)
+		destroyTree(root);
+	if (keyBuffer)
+		free(keyBuffer);
+	if (slabAllocator)
+		delete slabAllocator;
+
+	return;
+}
+
+struct RadixTreeNode *RadixTree::createNode(const char *label, unsigned int labelLength, void *value) {
+	struct RadixTreeNode *radixTreeNode;
+
+	radixTreeNode = (struct RadixTreeNode *)slabAllocator->allocate(sizeof(struct RadixTreeNode) + labelLength);
+	if (! radixTreeNode)
+		return NULL;
+	radixTreeNode->children = NULL;
+	radixTreeNode->sibling = NULL;
+	radixTreeNode->value = value;
+	radixTreeNode->labelLength = labelLength;
+	memcpy(RADIXTREE_LABEL(radixTreeNode), label, labelLength);
+	numberOfNodes++;
+
+	return radixTreeNode;
+}
+
+void RadixTree::destroyNode(struct RadixTreeNode *radixTreeNode) {
+	SlabAllocator::release(radixTreeNode);
+	numberOfNodes--;
+
+	return;
+}
+
+void RadixTree::destroyTree(struct RadixTreeNode *radixTreeNode) {
+	struct RadixTreeNode *child;
+	struct RadixTreeNode *childNext;
+
+	for (child = radixTreeNode->children; child; child = childNext) {
+		childNext = child->sibling;
+		destroyTree(child);
+	}
+	destroyNode(radixTreeNode);
+
+	return;
+}
+
+// Link to the child starting with this byte, or to the place where it must be inserted
+struct RadixTreeNode **RadixTree::searchChild(struct RadixTreeNode *radixTreeNode, char firstByte) {
+	struct RadixTreeNode **link;
+
+	link = &radixTreeNode->children;
+	while (*link && ((unsigned char)RADIXTREE_LABEL(*link)[0] < (unsigned char)firstByte))
+		link = &(*link)->sibling;
+
+	return link;
+}
+
+// Return -1 if the key already exists or on allocation failure
+int RadixTree::insert(char *key, void *value) {
+	struct RadixTreeNode *radixTreeNode;
+	struct RadixTreeNode *child;
+	struct RadixTreeNode *parent;
+	struct RadixTreeNode *leaf;
+	struct RadixTreeNode **link;
+	const char *keyPtr = key;
+	char *label;
+	unsigned int common;
+
+	if ((! root) || (! value))
+		return -1;
+	radixTreeNode = root;
+	for (;;) {
+		if (! *keyPtr) {
+			if (radixTreeNode->value)
+				return -1;
+			radixTreeNode->value = value;
+			numberOfKeys++;
+			return 0;
+		}
+		link = searchChild(radixTreeNode, *keyPtr);
+		child = *link;
+		if ((! child) || (RADIXTREE_LABEL(child)[0] != *keyPtr)) {
+			leaf = createNode(keyPtr, strlen(keyPtr), value);
+			if (! leaf)
+				return -1;
+			leaf->sibling = child;
+			*link = leaf;
+			numberOfKeys++;
+			return 0;
+		}
+		label = RADIXTREE_LABEL(child);
+		for (common = 1; (common < child->labelLength) && (keyPtr[common] == label[common]); common++);
+		if (common < child->labelLength) {
+			// Key leaves the label in its middle, split the child on the common part
+			parent = createNode(keyPtr, common, NULL);
+			if (! parent)
+				return -1;
+			parent->sibling = child->sibling;
+			parent->children = child;
+			child->sibling = NULL;
+			memmove(label, label + common, child->labelLength - common);
+			child->labelLength -= common;
+			*link = parent;
+			child = parent;
+		}
+		radixTreeNode = child;
+		keyPtr += common;
+	}
+}
+
+void *RadixTree::search(char *key) {
+	struct RadixTreeNode *radixTreeNode;
+	struct RadixTreeNode *child;
+	const char *keyPtr = key;
+	char *label;
+	unsigned int i;
+
+	radixTreeNode = root;
+	while (radixTreeNode) {
+		if (! *keyPtr)
+			return radixTreeNode->value;
+		child = *searchChild(radixTreeNode, *keyPtr);
+		if ((! child) || (RADIXTREE_LABEL(child)[0] != *keyPtr))
+			return NULL;
+		label = RADIXTREE_LABEL(child);
+		for (i = 1; i < child->labelLength; i++) {
+			if (keyPtr[i] != label[i])
+				return NULL;
+		}
+		keyPtr += child->labelLength;
+		radixTreeNode = child;
+	}
+
+	return NULL;
+}
+
+// The node behind link has already consumed its label, compact it on the way back
+int RadixTree::removeKey(struct RadixTreeNode **link, const char *keyPtr, void **value) {
+	struct RadixTreeNode *radixTreeNode;
+	struct RadixTreeNode *child;
+	struct RadixTreeNode *merged;
+	struct RadixTreeNode **childLink;
+	unsigned int i;
+	int returnCode;
+
+	radixTreeNode = *link;
+	if (! *keyPtr) {
+		if (! radixTreeNode->value)
+			return -1;
+		*value = radixTreeNode->value;
+		radixTreeNode->value = NULL;
+		numberOfKeys--;
+	}
+	else {
+		childLink = searchChild(radixTreeNode, *keyPtr);
+		child = *childLink;
+		if ((! child) || (RADIXTREE_LABEL(child)[0] != *keyPtr))
+			return -1;
+		for (i = 1; i < child->labelLength; i++) {
+			if (keyPtr[i] != RADIXTREE_LABEL(child)[i])
+				return -1;
+		}
+		returnCode = removeKey(childLink, keyPtr + child->labelLength, value);
+		if (returnCode < 0)
+			return returnCode;
+	}
+	if ((radixTreeNode == root) || radixTreeNode->value)
+		return 0;
+	if (! radixTreeNode->children) {
+		*link = radixTreeNode->sibling;
+		destroyNode(radixTreeNode);
+		return 0;
+	}
+	// Only one child left, it takes the place of its parent
+	child = radixTreeNode->children;
+	if (child->sibling)
+		return 0;
+	merged = (struct RadixTreeNode *)slabAllocator->allocate(sizeof(struct RadixTreeNode) + radixTreeNode->labelLength + child->labelLength);
+	if (! merged)
+		return 0;
+	merged->children = child->children;
+	merged->sibling = radixTreeNode->sibling;
+	merged->value = child->value;
+	merged->labelLength = radixTreeNode->labelLength + child->labelLength;
+	memcpy(RADIXTREE_LABEL(merged), RADIXTREE_LABEL(radixTreeNode), radixTreeNode->labelLength);
+	memcpy(RADIXTREE_LABEL(merged) + radixTreeNode->labelLength, RADIXTREE_LABEL(child), child->labelLength);
+	*link = merged;
+	destroyNode(radixTreeNode);
+	destroyNode(child);
+	numberOfNodes++;
+
+	return 0;
+}
+
+// Return the value of the removed key, NULL if the key doesn't exist
+void *RadixTree::remove(char *key) {
+	void *value = NULL;
+
+	if (! root)
+		return NULL;
+	if (removeKey(&root, key, &value) < 0)
+		return NULL;
+
+	return value;
+}
+
+// Append the label of the node at offset in the key buffer, growing it if needed
+int RadixTree::appendKeyBuffer(size_t offset, struct RadixTreeNode *radixTreeNode) {
+	char *newKeyBuffer;
+	size_t newKeyBufferSize;
+
+	if (offset + radixTreeNode->labelLength + 1 > keyBufferSize) {
+		newKeyBufferSize = (offset + radixTreeNode->labelLength + 1) << 1;
+		newKeyBuffer = (char *)realloc(keyBuffer, newKeyBufferSize);
+		if (! newKeyBuffer) {
+			systemLog->sysLog(CRITICAL, "cannot reallocate keyBuffer: %s", strerror(errno));
+			return -1;
+		}
+		keyBuffer = newKeyBuffer;
+		keyBufferSize = newKeyBufferSize;
+	}
+	memcpy(keyBuffer + offset, RADIXTREE_LABEL(radixTreeNode), radixTreeNode->labelLength);
+	keyBuffer[offset + radixTreeNode->labelLength] = '\0';
+
+	return 0;
+}
+
+// keyBuffer holds the key of the node on keyLength bytes
+int RadixTree::walkNode(struct RadixTreeNode *radixTreeNode, size_t keyLength, RadixTreeWalker radixTreeWalker, void *arguments) {
+	struct RadixTreeNode *child;
+	int numberOfKeysWalked = 0;
+	int returnCode;
+
+	if (radixTreeNode->value) {
+		if (radixTreeWalker(keyBuffer, radixTreeNode->value, arguments) < 0)
+			return -1;
+		numberOfKeysWalked++;
+	}
+	for (child = radixTreeNode->children; child; child = child->sibling) {
+		if (appendKeyBuffer(keyLength, child) < 0)
+			return -1;
+		returnCode = walkNode(child, keyLength + child->labelLength, radixTreeWalker, arguments);
+		if (returnCode < 0)
+			return -1;
+		numberOfKeysWalked += returnCode;
+	}
+
+	return numberOfKeysWalked;
+}
+
+// Call radixTreeWalker on every key starting with prefix, in byte order
+// Return the number of keys walked, -1 if the walk was stopped
+// The tree must not be modified by radixTreeWalker
+int RadixTree::walk(char *prefix, RadixTreeWalker radixTreeWalker, void *arguments) {
+	struct RadixTreeNode *radixTreeNode;
+	struct RadixTreeNode *child;
+	const char *prefixPtr = prefix;
+	size_t keyLength = 0;
+	size_t prefixLength;
+	unsigned int i;
+
+	if (! root)
+		return 0;
+	radixTreeNode = root;
+	if (appendKeyBuffer(0, root) < 0)
+		return -1;
+	while (*prefixPtr) {
+		child = *searchChild(radixTreeNode, *prefixPtr);
+		if ((! child) || (RADIXTREE_LABEL(child)[0] != *prefixPtr))
+			return 0;
+		// Prefix may end in the middle of the label
+		prefixLength = strlen(prefixPtr);
+		for (i = 1; (i < child->labelLength) && (i < prefixLength); i++) {
+			if (prefixPtr[i] != RADIXTREE_LABEL(child)[i])
+				return 0;
+		}
+		if (appendKeyBuffer(keyLength, child) < 0)
+			return -1;
+		keyLength += child->labelLength;
+		radixTreeNode = child;
+		if (prefixLength <= child->labelLength)
+			break;
+		prefixPtr += child->labelLength;
+	}
+
+	return walkNode(radixTreeNode, keyLength, radixTreeWalker, arguments);
+}
@@ -0,0 +1,69 @@
+//
+// C++ Interface: radixtree
+//
+// Description: compressed radix tree over C strings, keys sharing a prefix
+// (object paths) store it once, children are kept sorted so walks are ordered
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef RADIXTREE_H
+#define RADIXTREE_H
+
+#include <sys/types.h>
+
+#include "../toolkit/slaballocator.h"
+
+// Label bytes follow the node in the same block
+#define RADIXTREE_LABEL(node) ((char *)((node) + 1))
+
+struct RadixTreeNode {
+	struct RadixTreeNode *children;
+	struct RadixTreeNode *sibling;
+	// NULL when no key ends on this node
+	void *value;
+	unsigned int labelLength;
+};
+
+// Return a negative value to stop the walk
+typedef int (*RadixTreeWalker)(char *, void *, void *);
+
+/**
+	@author  <spe@>
+*/
+class RadixTree {
+private:
+	struct RadixTreeNode *root;
+	SlabAllocator *slabAllocator;
+	unsigned int numberOfNodes;
+	unsigned int numberOfKeys;
+	char *keyBuffer;
+	size_t keyBufferSize;
+
+	struct RadixTreeNode *createNode(const char *, unsigned int, void *);
+	void destroyNode(struct RadixTreeNode *);
+	void destroyTree(struct RadixTreeNode *);
+	struct RadixTreeNode **searchChild(struct RadixTreeNode *, char);
+	int removeKey(struct RadixTreeNode **, const char *, void **);
+	int appendKeyBuffer(size_t, struct RadixTreeNode *);
+	int walkNode(struct RadixTreeNode *, size_t, RadixTreeWalker, void *);
+
+public:
+	RadixTree();
+	~RadixTree();
+
+	// Not thread safe, the owner serializes the calls, values must not be NULL
+	int insert(char *, void *);
+	void *search(char *);
+	void *remove(char *);
+	int walk(char *, RadixTreeWalker, void *);
+
+	unsigned int getNumberOfNodes(void) { return numberOfNodes; };
+	unsigned int getNumberOfKeys(void) { return numberOfKeys; };
+	size_t getMemoryUsage(void) { return slabAllocator->getBytesInUse(); };
+};
+
+#endif
@@ -0,0 +1,490 @@
+//
+// C++ Implementation: seekindexcache
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "seekindexcache.h"
+
+// Memory usage is in bytes
+SeekIndexCache::SeekIndexCache(size_t _maxMemoryUsage) {
+	maxMemoryUsage = _maxMemoryUsage;
+	memoryUsage = 0;
+	numberOfEntries = 0;
+	hits = 0;
+	misses = 0;
+	sidecarLoads = 0;
+	idleHead = NULL;
+	idleTail = NULL;
+	hashAlgorithm = new HashAlgorithm(ALGO_PAULHSIEH);
+	if (! hashAlgorithm) {
+		systemLog->sysLog(CRITICAL, "cannot create an HashAlgorithm object: %s", strerror(errno));
+		return;
+	}
+	hashTable = new HashTable(hashAlgorithm, 0xFFFF);
+	if (! hashTable) {
+		systemLog->sysLog(CRITICAL, "cannot create a HashTable object: %s", strerror(errno));
+		return;
+	}
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object: %s", strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+// Sessions still holding an index must be gone
+SeekIndexCache::~SeekIndexCache() {
+	while (idleHead) {
+		struct SeekIndexCacheData *seekIndexCacheData = idleHead;
+
+		idleUnlink(seekIndexCacheData);
+		destroyData(seekIndexCacheData);
+	}
+	if (hashTable)
+		delete hashTable;
+	if (hashAlgorithm)
+		delete hashAlgorithm;
+	if (mutex)
+		delete mutex;
+
+	return;
+}
+
+// All private methods must be called with the mutex locked
+void SeekIndexCache::idleUnlink(struct SeekIndexCacheData *seekIndexCacheData) {
+	if (seekIndexCacheData->idlePrevious)
+		seekIndexCacheData->idlePrevious->idleNext = seekIndexCacheData->idleNext;
+	else
+		idleHead = seekIndexCacheData->idleNext;
+	if (seekIndexCacheData->idleNext)
+		seekIndexCacheData->idleNext->idlePrevious = seekIndexCacheData->idlePrevious;
+	else
+		idleTail = seekIndexCacheData->idlePrevious;
+	seekIndexCacheData->idlePrevious = NULL;
+	seekIndexCacheData->idleNext = NULL;
+
+	return;
+}
+
+void SeekIndexCache::idlePush(struct SeekIndexCacheData *seekIndexCacheData) {
+	seekIndexCacheData->idlePrevious = NULL;
+	seekIndexCacheData->idleNext = idleHead;
+	if (idleHead)
+		idleHead->idlePrevious = seekIndexCacheData;
+	else
+		idleTail = seekIndexCacheData;
+	idleHead = seekIndexCacheData;
+
+	return;
+}
+
+void SeekIndexCache::destroyData(struct SeekIndexCacheData *seekIndexCacheData) {
+	if (seekIndexCacheData->hashtableElt) {
+		hashTable->remove(seekIndexCacheData->hashPosition, seekIndexCacheData->hashtableElt);
+		memoryUsage -= seekIndexCacheData->memoryUsage;
+		numberOfEntries--;
+	}
+	closeIndex(seekIndexCacheData);
+	free(seekIndexCacheData);
+
+	return;
+}
+
+// Entry leaves the table, it is destroyed when the last session releases it
+void SeekIndexCache::invalidateData(struct SeekIndexCacheData *seekIndexCacheData) {
+	if (! seekIndexCacheData->referenceCounter) {
+		idleUnlink(seekIndexCacheData);
+		destroyData(seekIndexCacheData);
+		return;
+	}
+	hashTable->remove(seekIndexCacheData->hashPosition, seekIndexCacheData->hashtableElt);
+	seekIndexCacheData->hashtableElt = NULL;
+	seekIndexCacheData->invalidated = true;
+	memoryUsage -= seekIndexCacheData->memoryUsage;
+	numberOfEntries--;
+
+	return;
+}
+
+// Make room by dropping unused indices from the tail of the LRU, return -1 if the entry is not kept
+int SeekIndexCache::insert(char *key, struct SeekIndexCacheData *seekIndexCacheData) {
+	HashTableElt *hashtableElt;
+	uint32_t hashPosition;
+
+	// Another session may have parsed the same object meanwhile
+	if (hashTable->search(key))
+		return -1;
+	if (seekIndexCacheData->memoryUsage > maxMemoryUsage)
+		return -1;
+	while ((memoryUsage + seekIndexCacheData->memoryUsage > maxMemoryUsage) && idleTail) {
+		struct SeekIndexCacheData *evictedData = idleTail;
+
+		idleUnlink(evictedData);
+		destroyData(evictedData);
+	}
+	if (memoryUsage + seekIndexCacheData->memoryUsage > maxMemoryUsage)
+		return -1;
+	hashtableElt = hashTable->add(key, seekIndexCacheData, &hashPosition);
+	if (! hashtableElt)
+		return -1;
+	seekIndexCacheData->hashtableElt = hashtableElt;
+	seekIndexCacheData->hashPosition = hashPosition;
+	seekIndexCacheData->invalidated = false;
+	memoryUsage += seekIndexCacheData->memoryUsage;
+	numberOfEntries++;
+
+	return 0;
+}
+
+// Index type of an object, 0 if it cannot be seeked by time
+int SeekIndexCache::getIndexType(char *name) {
+	if (strstr(name, ".mp4"))
+		return SEEKINDEXCACHE_MP4;
+	if (strstr(name, ".flv"))
+		return SEEKINDEXCACHE_FLV;
+	if (strstr(name, ".webm"))
+		return SEEKINDEXCACHE_WEBM;
+	if (strstr(name, ".ogg"))
+		return SEEKINDEXCACHE_OGG;
+
+	return 0;
+}
+
+// Keyframe index of a flv, webm or ogg file, NULL if the file is not valid for the index type
+struct FlvKeyFrameIndex *SeekIndexCache::buildKeyFrameIndex(int indexType, int descriptor, off_t fileSize) {
+	struct FlvKeyFrameIndex *flvKeyFrameIndex = NULL;
+	FlvParser *flvParser;
+	WebmParser *webmParser;
+	OggParser *oggParser;
+
+	switch (indexType) {
+		case SEEKINDEXCACHE_FLV:
+			flvParser = new FlvParser(descriptor, fileSize);
+			if (! flvParser) {
+				systemLog->sysLog(CRITICAL, "cannot create a FlvParser object: %s", strerror(errno));
+				return NULL;
+			}
+			flvKeyFrameIndex = flvParser->buildKeyFrameIndex();
+			delete flvParser;
+			break;
+		case SEEKINDEXCACHE_WEBM:
+			webmParser = new WebmParser(descriptor, fileSize);
+			if (! webmParser) {
+				systemLog->sysLog(CRITICAL, "cannot create a WebmParser object: %s", strerror(errno));
+				return NULL;
+			}
+			flvKeyFrameIndex = webmParser->buildKeyFrameIndex();
+			delete webmParser;
+			break;
+		case SEEKINDEXCACHE_OGG:
+			oggParser = new OggParser(descriptor, fileSize);
+			if (! oggParser) {
+				systemLog->sysLog(CRITICAL, "cannot create an OggParser object: %s", strerror(errno));
+				return NULL;
+			}
+			flvKeyFrameIndex = oggParser->buildKeyFrameIndex();
+			delete oggParser;
+			break;
+	}
+
+	return flvKeyFrameIndex;
+}
+
+// Remux index of a flv file, NULL if it is not a H.264/AAC flv
+struct FlvRemuxIndex *SeekIndexCache::buildRemuxIndex(int descriptor, off_t fileSize) {
+	struct FlvRemuxIndex *flvRemuxIndex;
+	FlvRemuxer *flvRemuxer;
+
+	flvRemuxer = new FlvRemuxer(descriptor, fileSize);
+	if (! flvRemuxer) {
+		systemLog->sysLog(CRITICAL, "cannot create a FlvRemuxer object: %s", strerror(errno));
+		return NULL;
+	}
+	flvRemuxIndex = flvRemuxer->buildRemuxIndex();
+	delete flvRemuxer;
+
+	return flvRemuxIndex;
+}
+
+// Parse the object, return -1 if it is not a valid file of the index type
+int SeekIndexCache::buildIndex(struct SeekIndexCacheData *seekIndexCacheData, char *filePath, struct stat *fileStat) {
+	int descriptor;
+
+	switch (seekIndexCacheData->indexType) {
+		case SEEKINDEXCACHE_MP4:
+			seekIndexCacheData->mp4Index = mp4_index_open(filePath, fileStat->st_size);
+			if (! seekIndexCacheData->mp4Index)
+				return -1;
+			seekIndexCacheData->memoryUsage = mp4_index_size(seekIndexCacheData->mp4Index);
+			break;
+		case SEEKINDEXCACHE_FLV:
+		case SEEKINDEXCACHE_WEBM:
+		case SEEKINDEXCACHE_OGG:
+			descriptor = open(filePath, O_RDONLY);
+			if (descriptor < 0)
+				return -1;
+			seekIndexCacheData->flvKeyFrameIndex = buildKeyFrameIndex(seekIndexCacheData->indexType, descriptor, fileStat->st_size);
+			close(descriptor);
+			if (! seekIndexCacheData->flvKeyFrameIndex)
+				return -1;
+			seekIndexCacheData->memoryUsage = seekIndexCacheData->flvKeyFrameIndex->memoryUsage;
+			break;
+		case SEEKINDEXCACHE_FLVREMUX:
+			descriptor = open(filePath, O_RDONLY);
+			if (descriptor < 0)
+				return -1;
+			seekIndexCacheData->flvRemuxIndex = buildRemuxIndex(descriptor, fileStat->st_size);
+			close(descriptor);
+			if (! seekIndexCacheData->flvRemuxIndex)
+				return -1;
+			seekIndexCacheData->memoryUsage = seekIndexCacheData->flvRemuxIndex->memoryUsage;
+			break;
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+// Use the sidecar of the object, return -1 if it is missing or stale
+int SeekIndexCache::mapIndex(struct SeekIndexCacheData *seekIndexCacheData, char *sidecarPath, struct stat *fileStat) {
+	switch (seekIndexCacheData->indexType) {
+		case SEEKINDEXCACHE_MP4:
+			seekIndexCacheData->mp4Index = mp4_index_map(sidecarPath, fileStat->st_size, fileStat->st_mtime);
+			if (! seekIndexCacheData->mp4Index)
+				return -1;
+			seekIndexCacheData->memoryUsage = mp4_index_size(seekIndexCacheData->mp4Index);
+			break;
+		case SEEKINDEXCACHE_FLV:
+		case SEEKINDEXCACHE_WEBM:
+		case SEEKINDEXCACHE_OGG:
+			seekIndexCacheData->flvKeyFrameIndex = FlvParser::mapKeyFrameIndex(sidecarPath, fileStat->st_size, fileStat->st_mtime);
+			if (! seekIndexCacheData->flvKeyFrameIndex)
+				return -1;
+			seekIndexCacheData->memoryUsage = seekIndexCacheData->flvKeyFrameIndex->memoryUsage;
+			break;
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+void SeekIndexCache::closeIndex(struct SeekIndexCacheData *seekIndexCacheData) {
+	if (seekIndexCacheData->mp4Index)
+		mp4_index_close(seekIndexCacheData->mp4Index);
+	if (seekIndexCacheData->flvKeyFrameIndex)
+		FlvParser::destroyKeyFrameIndex(seekIndexCacheData->flvKeyFrameIndex);
+	if (seekIndexCacheData->flvRemuxIndex)
+		FlvRemuxer::destroyRemuxIndex(seekIndexCacheData->flvRemuxIndex);
+	seekIndexCacheData->mp4Index = NULL;
+	seekIndexCacheData->flvKeyFrameIndex = NULL;
+	seekIndexCacheData->flvRemuxIndex = NULL;
+
+	return;
+}
+
+// Return the index of this version of the object, parsing the file on a miss
+// The caller keeps one reference on it, NULL if the file is not valid for the index type
+// The stat informations identify the version the index was built on. Streaming
+// objects may be given no cache, they parse the file on each request then
+struct SeekIndexCacheData *SeekIndexCache::acquire(char *key, char *filePath, struct stat *fileStat, int indexType) {
+	HashTableElt *hashtableElt;
+	struct SeekIndexCacheData *seekIndexCacheData;
+	char sidecarPath[2048];
+	bool sidecarLoaded = false;
+
+	mutex->lockMutex();
+	hashtableElt = hashTable->search(key);
+	if (hashtableElt) {
+		seekIndexCacheData = (struct SeekIndexCacheData *)hashtableElt->getData();
+		if ((seekIndexCacheData->indexType == indexType) && (seekIndexCacheData->modificationTime == fileStat->st_mtime) && (seekIndexCacheData->fileSize == fileStat->st_size)) {
+			if (! seekIndexCacheData->referenceCounter)
+				idleUnlink(seekIndexCacheData);
+			seekIndexCacheData->referenceCounter++;
+			hits++;
+			mutex->unlockMutex();
+			return seekIndexCacheData;
+		}
+		invalidateData(seekIndexCacheData);
+	}
+	misses++;
+	mutex->unlockMutex();
+
+	seekIndexCacheData = (struct SeekIndexCacheData *)calloc(1, sizeof(struct SeekIndexCacheData));
+	if (! seekIndexCacheData) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a SeekIndexCacheData object: %s", strerror(errno));
+		return NULL;
+	}
+	seekIndexCacheData->indexType = indexType;
+	// Parsing reads the whole moov or scans the tags, other seeks must not wait for it
+	if ((getSidecarPath(filePath, sidecarPath, sizeof(sidecarPath)) == 0) && (mapIndex(seekIndexCacheData, sidecarPath, fileStat) == 0))
+		sidecarLoaded = true;
+	else
+	if (buildIndex(seekIndexCacheData, filePath, fileStat) < 0) {
+		free(seekIndexCacheData);
+		return NULL;
+	}
+	seekIndexCacheData->hashtableElt = NULL;
+	seekIndexCacheData->hashPosition = 0;
+	seekIndexCacheData->modificationTime = fileStat->st_mtime;
+	seekIndexCacheData->fileSize = fileStat->st_size;
+	seekIndexCacheData->referenceCounter = 1;
+	// Not cached entries are destroyed by release
+	seekIndexCacheData->invalidated = true;
+	seekIndexCacheData->idlePrevious = NULL;
+	seekIndexCacheData->idleNext = NULL;
+
+	mutex->lockMutex();
+	if (sidecarLoaded == true)
+		sidecarLoads++;
+	insert(key, seekIndexCacheData);
+	mutex->unlockMutex();
+
+	return seekIndexCacheData;
+}
+
+void SeekIndexCache::release(struct SeekIndexCacheData *seekIndexCacheData) {
+	mutex->lockMutex();
+	seekIndexCacheData->referenceCounter--;
+	if (! seekIndexCacheData->referenceCounter) {
+		if (seekIndexCacheData->invalidated == true)
+			destroyData(seekIndexCacheData);
+		else
+			idlePush(seekIndexCacheData);
+	}
+	mutex->unlockMutex();
+
+	return;
+}
+
+// Object is removed or replaced on disk, its remux index goes with it
+int SeekIndexCache::invalidate(char *key) {
+	HashTableElt *hashtableElt;
+	char remuxKey[2048];
+	int returnCode = -1;
+
+	mutex->lockMutex();
+	hashtableElt = hashTable->search(key);
+	if (hashtableElt) {
+		invalidateData((struct SeekIndexCacheData *)hashtableElt->getData());
+		returnCode = 0;
+	}
+	if (getRemuxKey(key, remuxKey, sizeof(remuxKey)) == 0) {
+		hashtableElt = hashTable->search(remuxKey);
+		if (hashtableElt) {
+			invalidateData((struct SeekIndexCacheData *)hashtableElt->getData());
+			returnCode = 0;
+		}
+	}
+	mutex->unlockMutex();
+
+	return returnCode;
+}
+
+// Average bitrate of the object in kbit/s, 0 if unknown
+unsigned int SeekIndexCache::getBitRate(struct SeekIndexCacheData *seekIndexCacheData) {
+	if (seekIndexCacheData->mp4Index)
+		return mp4_index_bitrate(seekIndexCacheData->mp4Index);
+	if (seekIndexCacheData->flvKeyFrameIndex)
+		return seekIndexCacheData->flvKeyFrameIndex->bitRate;
+
+	return 0;
+}
+
+// Same without a cache, the index is built and thrown away
+unsigned int SeekIndexCache::readBitRate(char *filePath, struct stat *fileStat, int indexType) {
+	struct SeekIndexCacheData seekIndexCacheData;
+	unsigned int bitRate;
+
+	memset(&seekIndexCacheData, 0, sizeof(seekIndexCacheData));
+	seekIndexCacheData.indexType = indexType;
+	if (buildIndex(&seekIndexCacheData, filePath, fileStat) < 0)
+		return 0;
+	bitRate = getBitRate(&seekIndexCacheData);
+	closeIndex(&seekIndexCacheData);
+
+	return bitRate;
+}
+
+// Return -1 if the path is too long
+int SeekIndexCache::getSidecarPath(char *filePath, char *sidecarPath, size_t sidecarPathSize) {
+	int length;
+
+	length = snprintf(sidecarPath, sidecarPathSize, "%s%s", filePath, SEEKINDEXCACHE_SIDECARSUFFIX);
+	if ((length < 0) || ((size_t)length >= sidecarPathSize))
+		return -1;
+
+	return 0;
+}
+
+// Return -1 if the key is too long
+int SeekIndexCache::getRemuxKey(char *key, char *remuxKey, size_t remuxKeySize) {
+	int length;
+
+	length = snprintf(remuxKey, remuxKeySize, "%s%s", key, SEEKINDEXCACHE_REMUXSUFFIX);
+	if ((length < 0) || ((size_t)length >= remuxKeySize))
+		return -1;
+
+	return 0;
+}
+
+// Build the index of a complete object and store it next to it, -1 if the object cannot be seeked by time
+int SeekIndexCache::writeSidecar(char *filePath, struct stat *fileStat) {
+	struct SeekIndexCacheData seekIndexCacheData;
+	char sidecarPath[2048];
+	char sidecarTmpPath[2048];
+	int returnCode = -1;
+
+	if (getSidecarPath(filePath, sidecarPath, sizeof(sidecarPath)) < 0)
+		return -1;
+	snprintf(sidecarTmpPath, sizeof(sidecarTmpPath), "%s.tmp", sidecarPath);
+	memset(&seekIndexCacheData, 0, sizeof(seekIndexCacheData));
+	seekIndexCacheData.indexType = getIndexType(filePath);
+	if (buildIndex(&seekIndexCacheData, filePath, fileStat) < 0) {
+		// An older version of the object may have left one
+		unlink(sidecarPath);
+		return -1;
+	}
+	if (seekIndexCacheData.mp4Index)
+		returnCode = mp4_index_write(seekIndexCacheData.mp4Index, sidecarTmpPath, fileStat->st_size, fileStat->st_mtime) ? 0 : -1;
+	if (seekIndexCacheData.flvKeyFrameIndex)
+		returnCode = FlvParser::writeKeyFrameIndex(seekIndexCacheData.flvKeyFrameIndex, sidecarTmpPath, fileStat->st_size, fileStat->st_mtime);
+	closeIndex(&seekIndexCacheData);
+	if (returnCode < 0) {
+		systemLog->sysLog(ERROR, "cannot write the seek index '%s': %s", sidecarTmpPath, strerror(errno));
+		unlink(sidecarTmpPath);
+		return -1;
+	}
+	if (rename(sidecarTmpPath, sidecarPath) < 0) {
+		systemLog->sysLog(ERROR, "cannot rename '%s' to '%s': %s", sidecarTmpPath, sidecarPath, strerror(errno));
+		unlink(sidecarTmpPath);
+		return -1;
+	}
+
+	return 0;
+}
+
+int SeekIndexCache::removeSidecar(char *filePath) {
+	char sidecarPath[2048];
+
+	if (getSidecarPath(filePath, sidecarPath, sizeof(sidecarPath)) < 0)
+		return -1;
+
+	return unlink(sidecarPath);
+}
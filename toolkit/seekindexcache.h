@@ -0,0 +1,111 @@
+//
+// C++ Interface: seekindexcache
+//
+// Description: keep the seek indices of hot objects (parsed moov and sample
+// indices of mp4, keyframes of flv, webm and ogg, samples of remuxed flv), time
+// seeks on them skip the file read and the index build
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef SEEKINDEXCACHE_H
+#define SEEKINDEXCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../toolkit/hashtable.h"
+#include "../toolkit/hashalgorithm.h"
+#include "../toolkit/mutex.h"
+#include "../toolkit/moov.h"
+#include "../toolkit/flvparser.h"
+#include "../toolkit/webmparser.h"
+#include "../toolkit/oggparser.h"
+#include "../toolkit/flvremuxer.h"
+
+// Index written next to the cached object when its copy completes
+#define SEEKINDEXCACHE_SIDECARSUFFIX ".nidx"
+// Key of the remux index of a flv, next to its keyframe index
+#define SEEKINDEXCACHE_REMUXSUFFIX "#fmp4"
+
+#define SEEKINDEXCACHE_MP4 1
+#define SEEKINDEXCACHE_FLV 2
+#define SEEKINDEXCACHE_WEBM 3
+#define SEEKINDEXCACHE_OGG 4
+// Samples of a flv remuxed to fragmented mp4, never written to a sidecar
+#define SEEKINDEXCACHE_FLVREMUX 5
+
+struct SeekIndexCacheData {
+	HashTableElt *hashtableElt;
+	uint32_t hashPosition;
+	int indexType;
+	// Only the index of the type is set
+	struct mp4_index_t *mp4Index;
+	// Also the index of webm and ogg, they share its layout
+	struct FlvKeyFrameIndex *flvKeyFrameIndex;
+	struct FlvRemuxIndex *flvRemuxIndex;
+	// Index is only valid for this version of the object
+	time_t modificationTime;
+	off_t fileSize;
+	size_t memoryUsage;
+	int referenceCounter;
+	bool invalidated;
+	// LRU list of unused indices
+	struct SeekIndexCacheData *idlePrevious;
+	struct SeekIndexCacheData *idleNext;
+};
+
+/**
+	@author  <spe@>
+*/
+class SeekIndexCache {
+private:
+	HashAlgorithm *hashAlgorithm;
+	HashTable *hashTable;
+	Mutex *mutex;
+	struct SeekIndexCacheData *idleHead;
+	struct SeekIndexCacheData *idleTail;
+	size_t maxMemoryUsage;
+	size_t memoryUsage;
+	int numberOfEntries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t sidecarLoads;
+
+	void idleUnlink(struct SeekIndexCacheData *);
+	void idlePush(struct SeekIndexCacheData *);
+	void destroyData(struct SeekIndexCacheData *);
+	void invalidateData(struct SeekIndexCacheData *);
+	int insert(char *, struct SeekIndexCacheData *);
+	static int buildIndex(struct SeekIndexCacheData *, char *, struct stat *);
+	static int mapIndex(struct SeekIndexCacheData *, char *, struct stat *);
+	static void closeIndex(struct SeekIndexCacheData *);
+
+public:
+	SeekIndexCache(size_t);
+	~SeekIndexCache();
+
+	struct SeekIndexCacheData *acquire(char *, char *, struct stat *, int);
+	void release(struct SeekIndexCacheData *);
+	int invalidate(char *);
+	static int getIndexType(char *);
+	static struct FlvKeyFrameIndex *buildKeyFrameIndex(int, int, off_t);
+	static struct FlvRemuxIndex *buildRemuxIndex(int, off_t);
+	static int getRemuxKey(char *, char *, size_t);
+	static unsigned int getBitRate(struct SeekIndexCacheData *);
+	static unsigned int readBitRate(char *, struct stat *, int);
+	static int getSidecarPath(char *, char *, size_t);
+	static int writeSidecar(char *, struct stat *);
+	static int removeSidecar(char *);
+	uint64_t getHits(void) { return hits; };
+	uint64_t getMisses(void) { return misses; };
+	uint64_t getSidecarLoads(void) { return sidecarLoads; };
+	int getNumberOfEntries(void) { return numberOfEntries; };
+	size_t getMemoryUsage(void) { return memoryUsage; };
+	size_t getMaxMemoryUsage(void) { return maxMemoryUsage; };
+};
+
+#endif
@@ -0,0 +1,142 @@
+//
+// C++ Implementation: slaballocator
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slaballocator.h"
+
+SlabAllocator::SlabAllocator() {
+	int i;
+
+	for (i = 0; i < SLABALLOCATOR_NUMBEROFCLASSES; i++)
+		freeLists[i] = NULL;
+	slabList = NULL;
+	numberOfSlabs = 0;
+	numberOfAllocations = 0;
+	numberOfLargeAllocations = 0;
+	numberOfReleases = 0;
+	bytesInUse = 0;
+
+	return;
+}
+
+// Every block of the slabs goes away with them, large blocks must have been released before
+SlabAllocator::~SlabAllocator() {
+	struct Slab *slab;
+
+	while (slabList) {
+		slab = slabList;
+		slabList = slabList->next;
+		free(slab);
+	}
+
+	return;
+}
+
+// Size class fitting the header and the object, SLABALLOCATOR_LARGE if no class is big enough
+int SlabAllocator::getSizeClass(size_t size) {
+	size_t classSize = SLABALLOCATOR_MINCLASSSIZE;
+	int sizeClass;
+
+	size += sizeof(struct SlabBlock);
+	for (sizeClass = 0; sizeClass < SLABALLOCATOR_NUMBEROFCLASSES; sizeClass++) {
+		if (size <= classSize)
+			return sizeClass;
+		classSize <<= 1;
+	}
+
+	return SLABALLOCATOR_LARGE;
+}
+
+// Cut a new slab into free blocks of the given class
+int SlabAllocator::grow(int sizeClass) {
+	struct Slab *slab;
+	struct SlabFree *slabFree;
+	size_t classSize;
+	size_t offset;
+
+	slab = (struct Slab *)malloc(SLABALLOCATOR_SLABSIZE);
+	if (! slab) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a slab of %d bytes: %s", SLABALLOCATOR_SLABSIZE, strerror(errno));
+		return -1;
+	}
+	slab->next = slabList;
+	slabList = slab;
+	numberOfSlabs++;
+	classSize = SLABALLOCATOR_MINCLASSSIZE << sizeClass;
+	// First block starts after the slab header, on a 16 bytes boundary
+	for (offset = (sizeof(struct Slab) + 15) & ~15; offset + classSize <= SLABALLOCATOR_SLABSIZE; offset += classSize) {
+		slabFree = (struct SlabFree *)((char *)slab + offset);
+		slabFree->next = freeLists[sizeClass];
+		freeLists[sizeClass] = slabFree;
+	}
+
+	return 0;
+}
+
+void *SlabAllocator::allocate(size_t size) {
+	struct SlabBlock *slabBlock;
+	int sizeClass;
+
+	sizeClass = getSizeClass(size);
+	if (sizeClass == SLABALLOCATOR_LARGE) {
+		slabBlock = (struct SlabBlock *)malloc(sizeof(struct SlabBlock) + size);
+		if (! slabBlock) {
+			systemLog->sysLog(CRITICAL, "cannot allocate a block of %d bytes: %s", size, strerror(errno));
+			return NULL;
+		}
+		numberOfLargeAllocations++;
+	}
+	else {
+		if ((! freeLists[sizeClass]) && (grow(sizeClass) < 0))
+			return NULL;
+		slabBlock = (struct SlabBlock *)freeLists[sizeClass];
+		freeLists[sizeClass] = freeLists[sizeClass]->next;
+		bytesInUse += SLABALLOCATOR_MINCLASSSIZE << sizeClass;
+	}
+	slabBlock->slabAllocator = this;
+	slabBlock->sizeClass = sizeClass;
+	numberOfAllocations++;
+
+	return slabBlock + 1;
+}
+
+void SlabAllocator::releaseBlock(struct SlabBlock *slabBlock) {
+	struct SlabFree *slabFree;
+	int sizeClass;
+
+	numberOfReleases++;
+	sizeClass = slabBlock->sizeClass;
+	if (sizeClass == SLABALLOCATOR_LARGE) {
+		free(slabBlock);
+		return;
+	}
+	slabFree = (struct SlabFree *)slabBlock;
+	slabFree->next = freeLists[sizeClass];
+	freeLists[sizeClass] = slabFree;
+	bytesInUse -= SLABALLOCATOR_MINCLASSSIZE << sizeClass;
+
+	return;
+}
+
+// The block knows its allocator, so it can be given to free callbacks (EpochManager::retire)
+void SlabAllocator::release(void *pointer) {
+	struct SlabBlock *slabBlock;
+
+	if (! pointer)
+		return;
+	slabBlock = (struct SlabBlock *)pointer - 1;
+	slabBlock->slabAllocator->releaseBlock(slabBlock);
+
+	return;
+}
@@ -0,0 +1,75 @@
+//
+// C++ Interface: slaballocator
+//
+// Description: small objects carved from big slabs, sorted by size class,
+// freed blocks go back to the free list of their class for reuse
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <sys/types.h>
+
+#include "log.h"
+
+#define SLABALLOCATOR_SLABSIZE 65536
+#define SLABALLOCATOR_NUMBEROFCLASSES 6
+// Smallest class, each following class is twice bigger
+#define SLABALLOCATOR_MINCLASSSIZE 64
+#define SLABALLOCATOR_LARGE -1
+
+extern LogError *systemLog;
+
+// Stored in front of each block, padded to keep the object 16 bytes aligned
+struct SlabBlock {
+	class SlabAllocator *slabAllocator;
+	int sizeClass;
+} __attribute__((aligned(16)));
+
+struct SlabFree {
+	struct SlabFree *next;
+};
+
+struct Slab {
+	struct Slab *next;
+};
+
+/**
+	@author  <spe@>
+*/
+class SlabAllocator {
+private:
+	struct SlabFree *freeLists[SLABALLOCATOR_NUMBEROFCLASSES];
+	struct Slab *slabList;
+	unsigned int numberOfSlabs;
+	uint64_t numberOfAllocations;
+	uint64_t numberOfLargeAllocations;
+	uint64_t numberOfReleases;
+	size_t bytesInUse;
+
+	int getSizeClass(size_t);
+	int grow(int);
+	void releaseBlock(struct SlabBlock *);
+
+public:
+	SlabAllocator();
+	~SlabAllocator();
+
+	// Not thread safe, the owner serializes the calls (hashtable lock)
+	void *allocate(size_t);
+	static void release(void *);
+
+	unsigned int getNumberOfSlabs(void) { return numberOfSlabs; };
+	uint64_t getNumberOfAllocations(void) { return numberOfAllocations; };
+	uint64_t getNumberOfLargeAllocations(void) { return numberOfLargeAllocations; };
+	uint64_t getNumberOfReleases(void) { return numberOfReleases; };
+	size_t getBytesInUse(void) { return bytesInUse; };
+	size_t getBytesReserved(void) { return (size_t)numberOfSlabs * SLABALLOCATOR_SLABSIZE; };
+};
+
+#endif
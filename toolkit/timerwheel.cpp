@@ -0,0 +1,212 @@
+//
+// C++ Implementation: timerwheel
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timerwheel.h"
+
+// Resolution is in milliseconds, like the timeouts
+TimerWheel::TimerWheel(unsigned int _resolution) {
+	int level;
+	int i;
+
+	resolution = _resolution ? _resolution : 1;
+	numberOfEntries = 0;
+	for (level = 0; level < TIMERWHEEL_LEVELS; level++) {
+		for (i = 0; i < TIMERWHEEL_SLOTS; i++) {
+			slots[level][i].previous = &slots[level][i];
+			slots[level][i].next = &slots[level][i];
+		}
+	}
+	nextTick = getCurrentTick();
+	mutex = new Mutex();
+	if (! mutex) {
+		systemLog->sysLog(CRITICAL, "cannot create a Mutex object: %s", strerror(errno));
+		return;
+	}
+
+	return;
+}
+
+TimerWheel::~TimerWheel() {
+	struct TimerWheelEntry *timerWheelEntry;
+	int level;
+	int i;
+
+	for (level = 0; level < TIMERWHEEL_LEVELS; level++) {
+		for (i = 0; i < TIMERWHEEL_SLOTS; i++) {
+			while (slots[level][i].next != &slots[level][i]) {
+				timerWheelEntry = slots[level][i].next;
+				unlink(timerWheelEntry);
+				free(timerWheelEntry);
+			}
+		}
+	}
+	if (mutex)
+		delete mutex;
+
+	return;
+}
+
+uint64_t TimerWheel::getCurrentTick(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000) / resolution;
+}
+
+uint64_t TimerWheel::getTicks(unsigned int timeout) {
+	uint64_t ticks;
+
+	ticks = (timeout + resolution - 1) / resolution;
+
+	return ticks ? ticks : 1;
+}
+
+// Near timeouts go to the first level, farther ones to coarser levels and are cascaded down later
+void TimerWheel::link(struct TimerWheelEntry *timerWheelEntry) {
+	struct TimerWheelEntry *slot;
+	int64_t delta;
+	int level;
+
+	delta = (int64_t)(timerWheelEntry->expireTick - nextTick);
+	if (delta < 0)
+		slot = &slots[0][nextTick & TIMERWHEEL_SLOTMASK];
+	else {
+		if (delta >= ((int64_t)1 << (TIMERWHEEL_LEVELS * TIMERWHEEL_SLOTBITS))) {
+			delta = ((int64_t)1 << (TIMERWHEEL_LEVELS * TIMERWHEEL_SLOTBITS)) - 1;
+			timerWheelEntry->expireTick = nextTick + delta;
+		}
+		for (level = 0; level < TIMERWHEEL_LEVELS - 1; level++) {
+			if (delta < ((int64_t)1 << ((level + 1) * TIMERWHEEL_SLOTBITS)))
+				break;
+		}
+		slot = &slots[level][(timerWheelEntry->expireTick >> (level * TIMERWHEEL_SLOTBITS)) & TIMERWHEEL_SLOTMASK];
+	}
+	timerWheelEntry->previous = slot->previous;
+	timerWheelEntry->next = slot;
+	slot->previous->next = timerWheelEntry;
+	slot->previous = timerWheelEntry;
+
+	return;
+}
+
+void TimerWheel::unlink(struct TimerWheelEntry *timerWheelEntry) {
+	timerWheelEntry->previous->next = timerWheelEntry->next;
+	timerWheelEntry->next->previous = timerWheelEntry->previous;
+	timerWheelEntry->previous = NULL;
+	timerWheelEntry->next = NULL;
+
+	return;
+}
+
+// Spread one slot of a coarse level on the finer levels
+void TimerWheel::cascade(int level, int index) {
+	struct TimerWheelEntry *slot;
+	struct TimerWheelEntry *timerWheelEntry;
+
+	slot = &slots[level][index];
+	while (slot->next != slot) {
+		timerWheelEntry = slot->next;
+		unlink(timerWheelEntry);
+		link(timerWheelEntry);
+	}
+
+	return;
+}
+
+// Timeout is in milliseconds, return NULL if the entry cannot be allocated
+struct TimerWheelEntry *TimerWheel::add(void *object, uint64_t cookie, unsigned int timeout) {
+	struct TimerWheelEntry *timerWheelEntry;
+
+	timerWheelEntry = (struct TimerWheelEntry *)malloc(sizeof(struct TimerWheelEntry));
+	if (! timerWheelEntry) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a TimerWheelEntry object: %s", strerror(errno));
+		return NULL;
+	}
+	timerWheelEntry->object = object;
+	timerWheelEntry->cookie = cookie;
+	timerWheelEntry->state = TIMERWHEEL_PENDING;
+	timerWheelEntry->expireTick = getCurrentTick() + getTicks(timeout);
+	link(timerWheelEntry);
+	numberOfEntries++;
+
+	return timerWheelEntry;
+}
+
+// Return -1 if the entry has already expired, a new one must be added then
+int TimerWheel::refresh(struct TimerWheelEntry *timerWheelEntry, unsigned int timeout) {
+	if (timerWheelEntry->state != TIMERWHEEL_PENDING)
+		return -1;
+	unlink(timerWheelEntry);
+	timerWheelEntry->expireTick = getCurrentTick() + getTicks(timeout);
+	link(timerWheelEntry);
+
+	return 0;
+}
+
+// An expired entry belongs to the caller of expire() which will release it
+void TimerWheel::cancel(struct TimerWheelEntry *timerWheelEntry) {
+	if (timerWheelEntry->state != TIMERWHEEL_PENDING)
+		return;
+	unlink(timerWheelEntry);
+	free(timerWheelEntry);
+	numberOfEntries--;
+
+	return;
+}
+
+// Run every tick elapsed since the last call and return the expired entries chained by next
+struct TimerWheelEntry *TimerWheel::expire(void) {
+	struct TimerWheelEntry *expiredList = NULL;
+	struct TimerWheelEntry *timerWheelEntry;
+	struct TimerWheelEntry *slot;
+	uint64_t currentTick;
+	int index;
+	int level;
+
+	currentTick = getCurrentTick();
+	while (nextTick <= currentTick) {
+		index = nextTick & TIMERWHEEL_SLOTMASK;
+		for (level = 1; (! index) && (level < TIMERWHEEL_LEVELS); level++) {
+			index = (nextTick >> (level * TIMERWHEEL_SLOTBITS)) & TIMERWHEEL_SLOTMASK;
+			cascade(level, index);
+		}
+		slot = &slots[0][nextTick & TIMERWHEEL_SLOTMASK];
+		nextTick++;
+		while (slot->next != slot) {
+			timerWheelEntry = slot->next;
+			unlink(timerWheelEntry);
+			timerWheelEntry->state = TIMERWHEEL_EXPIRED;
+			timerWheelEntry->next = expiredList;
+			expiredList = timerWheelEntry;
+			numberOfEntries--;
+		}
+	}
+
+	return expiredList;
+}
+
+void TimerWheel::release(struct TimerWheelEntry *timerWheelEntry) {
+	free(timerWheelEntry);
+
+	return;
+}
+
+void TimerWheel::waitNextTick(void) {
+	usleep(resolution * 1000);
+
+	return;
+}
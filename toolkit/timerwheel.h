@@ -0,0 +1,76 @@
+//
+// C++ Interface: timerwheel
+//
+// Description: hierarchical timing wheel, thousands of timeouts share one
+// thread and one lock, add/refresh/cancel are O(1)
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "../toolkit/mutex.h"
+
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_SLOTBITS 8
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOTBITS)
+#define TIMERWHEEL_SLOTMASK (TIMERWHEEL_SLOTS - 1)
+
+#define TIMERWHEEL_PENDING 0
+#define TIMERWHEEL_EXPIRED 1
+
+struct TimerWheelEntry {
+	uint64_t expireTick;
+	void *object;
+	uint64_t cookie;
+	char state;
+	struct TimerWheelEntry *previous;
+	struct TimerWheelEntry *next;
+};
+
+/**
+	@author  <spe@>
+*/
+class TimerWheel {
+private:
+	// Circular lists, each slot is its own sentinel so unlinking never needs the slot
+	struct TimerWheelEntry slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+	// Next tick to process
+	uint64_t nextTick;
+	unsigned int resolution;
+	int numberOfEntries;
+	Mutex *mutex;
+
+	uint64_t getCurrentTick(void);
+	uint64_t getTicks(unsigned int);
+	void link(struct TimerWheelEntry *);
+	void unlink(struct TimerWheelEntry *);
+	void cascade(int, int);
+
+public:
+	TimerWheel(unsigned int);
+	~TimerWheel();
+
+	// All the following methods must be called with the wheel locked
+	struct TimerWheelEntry *add(void *, uint64_t, unsigned int);
+	int refresh(struct TimerWheelEntry *, unsigned int);
+	void cancel(struct TimerWheelEntry *);
+	struct TimerWheelEntry *expire(void);
+
+	// Expired entries are released by the caller of expire() once handled
+	void release(struct TimerWheelEntry *);
+	void waitNextTick(void);
+	unsigned int getResolution(void) { return resolution; };
+	int getNumberOfEntries(void) { return numberOfEntries; };
+	int lock(void) { return mutex->lockMutex(); };
+	int unlock(void) { return mutex->unlockMutex(); };
+};
+
+#endif
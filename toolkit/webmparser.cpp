@@ -0,0 +1,414 @@
+//
+// C++ Implementation: webmparser
+//
+// Description:
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "webmparser.h"
+
+WebmParser::WebmParser(int _fileDescriptor, off_t _fileSize) {
+	fileDescriptor = _fileDescriptor;
+	fileSize = _fileSize;
+	mmapedFile = NULL;
+	timecodeScale = WEBMPARSER_TIMECODESCALE;
+	segmentPosition = 0;
+	if (fileSize <= 0)
+		return;
+	mmapedFile = (char *)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	if (mmapedFile == MAP_FAILED) {
+		systemLog->sysLog(ERROR, "[%d] cannot mmap file: %s", fileDescriptor, strerror(errno));
+		mmapedFile = NULL;
+		return;
+	}
+
+	return;
+}
+
+WebmParser::~WebmParser() {
+	if (mmapedFile)
+		munmap(mmapedFile, fileSize);
+
+	return;
+}
+
+// EBML variable length integer, IDs keep their length marker, sizes don't
+int WebmParser::readVint(off_t *position, off_t end, uint64_t *value, bool isId) {
+	const unsigned char *ptrChar;
+	unsigned int length;
+	unsigned int i;
+
+	if (*position >= end)
+		return -1;
+	ptrChar = (const unsigned char *)&mmapedFile[*position];
+	for (length = 1; (length <= 8) && (! (ptrChar[0] & (0x80 >> (length - 1)))); length++);
+	if ((length > (isId ? 4U : 8U)) || (*position + length > end))
+		return -1;
+	*value = isId ? ptrChar[0] : (ptrChar[0] & ((0x80 >> (length - 1)) - 1));
+	for (i = 1; i < length; i++)
+		*value = (*value << 8) | ptrChar[i];
+	if ((! isId) && (*value == (1ULL << (7 * length)) - 1))
+		*value = WEBMPARSER_UNKNOWNSIZE;
+	*position += length;
+
+	return 0;
+}
+
+// Leave position on the data of the element, return -1 if it doesn't fit before end
+int WebmParser::readElement(off_t *position, off_t end, uint32_t *id, uint64_t *size) {
+	uint64_t value;
+
+	if (readVint(position, end, &value, true) < 0)
+		return -1;
+	*id = (uint32_t)value;
+	if (readVint(position, end, size, false) < 0)
+		return -1;
+	if ((*size != WEBMPARSER_UNKNOWNSIZE) && (*size > (uint64_t)(end - *position)))
+		return -1;
+
+	return 0;
+}
+
+uint64_t WebmParser::readUnsigned(off_t position, uint64_t size) {
+	const unsigned char *ptrChar;
+	uint64_t value = 0;
+	uint64_t i;
+
+	ptrChar = (const unsigned char *)&mmapedFile[position];
+	for (i = 0; (i < size) && (i < 8); i++)
+		value = (value << 8) | ptrChar[i];
+
+	return value;
+}
+
+double WebmParser::readFloat(off_t position, uint64_t size) {
+	uint64_t bits;
+	uint32_t bits32;
+	double value;
+	float value32;
+
+	if (size == 4) {
+		bits32 = (uint32_t)readUnsigned(position, 4);
+		memcpy(&value32, &bits32, sizeof(value32));
+		return value32;
+	}
+	if (size == 8) {
+		bits = readUnsigned(position, 8);
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	return 0;
+}
+
+// Absolute position of the Cues from the SeekHead, 0 if it is not listed
+off_t WebmParser::readSeekHead(off_t position, off_t end) {
+	off_t seekPosition;
+	off_t seekEnd;
+	uint32_t id;
+	uint64_t size;
+	uint64_t seekId;
+	uint64_t seekOffset;
+
+	while (position < end) {
+		if ((readElement(&position, end, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE))
+			return 0;
+		if (id == WEBMPARSER_ID_SEEK) {
+			seekId = 0;
+			seekOffset = 0;
+			seekEnd = position + size;
+			for (seekPosition = position; seekPosition < seekEnd; seekPosition += size) {
+				if ((readElement(&seekPosition, seekEnd, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE))
+					return 0;
+				if (id == WEBMPARSER_ID_SEEKID)
+					seekId = readUnsigned(seekPosition, size);
+				else
+				if (id == WEBMPARSER_ID_SEEKPOSITION)
+					seekOffset = readUnsigned(seekPosition, size);
+			}
+			if ((seekId == WEBMPARSER_ID_CUES) && (seekOffset < (uint64_t)(fileSize - segmentPosition)))
+				return segmentPosition + seekOffset;
+			size = seekEnd - position;
+		}
+		position += size;
+	}
+
+	return 0;
+}
+
+// TimecodeScale and Duration, in TimecodeScale units
+int WebmParser::readInfo(off_t position, off_t end, double *duration) {
+	uint32_t id;
+	uint64_t size;
+
+	while (position < end) {
+		if ((readElement(&position, end, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE))
+			return -1;
+		if (id == WEBMPARSER_ID_TIMECODESCALE) {
+			timecodeScale = readUnsigned(position, size);
+			if (! timecodeScale)
+				timecodeScale = WEBMPARSER_TIMECODESCALE;
+		}
+		else
+		if (id == WEBMPARSER_ID_DURATION)
+			*duration = readFloat(position, size);
+		position += size;
+	}
+
+	return 0;
+}
+
+// One keyframe per cluster listed by a CuePoint, the Cues element starts at position
+int WebmParser::readCues(off_t position, off_t end, struct FlvKeyFrameIndex *flvKeyFrameIndex) {
+	uint32_t keyFramesSize = 0;
+	off_t cuesEnd;
+	off_t pointPosition;
+	off_t pointEnd;
+	off_t trackPosition;
+	off_t trackEnd;
+	off_t clusterPosition;
+	uint32_t id;
+	uint64_t size;
+	uint64_t cueTime;
+	uint64_t cueClusterPosition;
+	uint32_t timestamp;
+	bool cueClusterPositionFound;
+
+	if ((readElement(&position, end, &id, &size) < 0) || (id != WEBMPARSER_ID_CUES) || (size == WEBMPARSER_UNKNOWNSIZE))
+		return -1;
+	cuesEnd = position + size;
+	while (position < cuesEnd) {
+		if ((readElement(&position, cuesEnd, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE))
+			return -1;
+		if (id == WEBMPARSER_ID_CUEPOINT) {
+			cueTime = 0;
+			cueClusterPosition = 0;
+			cueClusterPositionFound = false;
+			pointEnd = position + size;
+			for (pointPosition = position; pointPosition < pointEnd; pointPosition += size) {
+				if ((readElement(&pointPosition, pointEnd, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE))
+					return -1;
+				if (id == WEBMPARSER_ID_CUETIME)
+					cueTime = readUnsigned(pointPosition, size);
+				else
+				if ((id == WEBMPARSER_ID_CUETRACKPOSITIONS) && (cueClusterPositionFound == false)) {
+					trackEnd = pointPosition + size;
+					for (trackPosition = pointPosition; trackPosition < trackEnd; trackPosition += size) {
+						if ((readElement(&trackPosition, trackEnd, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE))
+							return -1;
+						if (id == WEBMPARSER_ID_CUECLUSTERPOSITION) {
+							cueClusterPosition = readUnsigned(trackPosition, size);
+							cueClusterPositionFound = true;
+						}
+					}
+					size = trackEnd - pointPosition;
+				}
+			}
+			size = pointEnd - position;
+			clusterPosition = segmentPosition + cueClusterPosition;
+			timestamp = (uint32_t)(cueTime * timecodeScale / 1000000);
+			// Several CuePoints may point to the same cluster, the first one gives its time
+			if ((cueClusterPositionFound == true) && (cueClusterPosition < (uint64_t)(fileSize - segmentPosition - 4)) && (readUnsigned(clusterPosition, 4) == WEBMPARSER_ID_CLUSTER) &&
+			    ((! flvKeyFrameIndex->numberOfKeyFrames) || ((timestamp >= flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames - 1]) && ((uint64_t)clusterPosition > flvKeyFrameIndex->positions[flvKeyFrameIndex->numberOfKeyFrames - 1])))) {
+				if (FlvParser::appendKeyFrame(flvKeyFrameIndex, &keyFramesSize, timestamp, clusterPosition) < 0)
+					return -1;
+			}
+		}
+		position += size;
+	}
+
+	return 0;
+}
+
+// Timecode of the cluster and whether its first block is a keyframe, return the end of the cluster
+// A cluster of unknown size ends on the next level 1 element, only those have 4 bytes IDs
+off_t WebmParser::getClusterEnd(off_t position, off_t end, uint64_t *timecode, bool *keyFrame) {
+	off_t childPosition;
+	off_t blockPosition;
+	off_t blockEnd;
+	uint32_t id;
+	uint64_t size;
+	uint64_t trackNumber;
+	bool blockFound = false;
+
+	*timecode = 0;
+	*keyFrame = false;
+	while (position < end) {
+		childPosition = position;
+		if (readElement(&position, end, &id, &size) < 0)
+			return end;
+		if (id > 0xFFFFFF)
+			return childPosition;
+		if (size == WEBMPARSER_UNKNOWNSIZE)
+			return end;
+		if (id == WEBMPARSER_ID_TIMECODE)
+			*timecode = readUnsigned(position, size);
+		else
+		if ((id == WEBMPARSER_ID_SIMPLEBLOCK) && (blockFound == false)) {
+			blockFound = true;
+			// Track number, relative timecode then the flags
+			blockPosition = position;
+			if ((readVint(&blockPosition, position + size, &trackNumber, false) == 0) && (blockPosition + 2 < (off_t)(position + size)))
+				*keyFrame = (mmapedFile[blockPosition + 2] & 0x80) ? true : false;
+		}
+		else
+		if ((id == WEBMPARSER_ID_BLOCKGROUP) && (blockFound == false)) {
+			blockFound = true;
+			// Blocks without a ReferenceBlock are keyframes
+			*keyFrame = true;
+			blockEnd = position + size;
+			for (blockPosition = position; blockPosition < blockEnd; blockPosition += size) {
+				if ((readElement(&blockPosition, blockEnd, &id, &size) < 0) || (size == WEBMPARSER_UNKNOWNSIZE) || (id == 0xFB)) {
+					*keyFrame = false;
+					break;
+				}
+			}
+			size = blockEnd - position;
+		}
+		position += size;
+	}
+
+	return end;
+}
+
+// Without Cues, each cluster starting with a keyframe is a seek point
+int WebmParser::scanClusters(off_t position, off_t end, struct FlvKeyFrameIndex *flvKeyFrameIndex) {
+	uint32_t keyFramesSize = 0;
+	off_t elementPosition;
+	uint32_t id;
+	uint64_t size;
+	uint64_t timecode;
+	uint32_t timestamp;
+	bool keyFrame;
+
+	while (position < end) {
+		elementPosition = position;
+		if (readElement(&position, end, &id, &size) < 0)
+			break;
+		if (id == WEBMPARSER_ID_CLUSTER) {
+			position = getClusterEnd(position, (size == WEBMPARSER_UNKNOWNSIZE) ? end : (off_t)(position + size), &timecode, &keyFrame);
+			timestamp = (uint32_t)(timecode * timecodeScale / 1000000);
+			if ((keyFrame == true) && ((! flvKeyFrameIndex->numberOfKeyFrames) || (timestamp >= flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames - 1]))) {
+				if (FlvParser::appendKeyFrame(flvKeyFrameIndex, &keyFramesSize, timestamp, elementPosition) < 0)
+					return -1;
+			}
+			continue;
+		}
+		if (size == WEBMPARSER_UNKNOWNSIZE)
+			break;
+		position += size;
+	}
+
+	return 0;
+}
+
+// Return NULL if the file is not a WebM or has no cluster
+// The header is the EBML header, a Segment of unknown size, its Info and Tracks
+struct FlvKeyFrameIndex *WebmParser::buildKeyFrameIndex(void) {
+	static const char unknownSize[8] = { 0x01, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF };
+	struct FlvKeyFrameIndex *flvKeyFrameIndex;
+	off_t position = 0;
+	off_t elementPosition;
+	off_t segmentEnd;
+	off_t cuesPosition = 0;
+	off_t clusterPosition = 0;
+	uint32_t id;
+	uint64_t size;
+	double duration = 0;
+	bool infoFound = false;
+	bool tracksFound = false;
+	uint32_t durationMs;
+
+	if (! mmapedFile)
+		return NULL;
+	timecodeScale = WEBMPARSER_TIMECODESCALE;
+	if ((readElement(&position, fileSize, &id, &size) < 0) || (id != WEBMPARSER_ID_EBML) || (size == WEBMPARSER_UNKNOWNSIZE)) {
+		systemLog->sysLog(ERROR, "[%d] no EBML header found in the WebM file", fileDescriptor);
+		return NULL;
+	}
+	position += size;
+	elementPosition = position;
+	if ((readElement(&position, fileSize, &id, &size) < 0) || (id != WEBMPARSER_ID_SEGMENT)) {
+		systemLog->sysLog(ERROR, "[%d] no Segment found in the WebM file", fileDescriptor);
+		return NULL;
+	}
+	segmentPosition = position;
+	segmentEnd = (size == WEBMPARSER_UNKNOWNSIZE) ? fileSize : (off_t)(position + size);
+	flvKeyFrameIndex = (struct FlvKeyFrameIndex *)calloc(1, sizeof(struct FlvKeyFrameIndex));
+	if (! flvKeyFrameIndex) {
+		systemLog->sysLog(CRITICAL, "cannot allocate a FlvKeyFrameIndex object: %s", strerror(errno));
+		return NULL;
+	}
+	// Segment ID is 4 bytes, the answer doesn't end where the file does
+	if ((FlvParser::appendHeaderData(flvKeyFrameIndex, mmapedFile, elementPosition + 4) < 0) || (FlvParser::appendHeaderData(flvKeyFrameIndex, unknownSize, sizeof(unknownSize)) < 0)) {
+		FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+		return NULL;
+	}
+
+	// SeekHead is left out, its positions are those of the file
+	while (position < segmentEnd) {
+		elementPosition = position;
+		if (readElement(&position, segmentEnd, &id, &size) < 0)
+			break;
+		if (id == WEBMPARSER_ID_CLUSTER) {
+			clusterPosition = elementPosition;
+			break;
+		}
+		if (size == WEBMPARSER_UNKNOWNSIZE)
+			break;
+		if ((id == WEBMPARSER_ID_INFO) && (infoFound == false)) {
+			if ((readInfo(position, position + size, &duration) < 0) || (FlvParser::appendHeaderData(flvKeyFrameIndex, &mmapedFile[elementPosition], position + size - elementPosition) < 0))
+				break;
+			infoFound = true;
+		}
+		else
+		if ((id == WEBMPARSER_ID_TRACKS) && (tracksFound == false)) {
+			if (FlvParser::appendHeaderData(flvKeyFrameIndex, &mmapedFile[elementPosition], position + size - elementPosition) < 0)
+				break;
+			tracksFound = true;
+		}
+		else
+		if ((id == WEBMPARSER_ID_SEEKHEAD) && (! cuesPosition))
+			cuesPosition = readSeekHead(position, position + size);
+		else
+		if (id == WEBMPARSER_ID_CUES)
+			cuesPosition = elementPosition;
+		position += size;
+	}
+	if ((infoFound == false) || (tracksFound == false) || (! clusterPosition)) {
+		systemLog->sysLog(ERROR, "[%d] no Info, Tracks or Cluster found in the WebM file", fileDescriptor);
+		FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+		return NULL;
+	}
+
+	// Cues at the end of the file are only found through the SeekHead
+	if (cuesPosition && (readCues(cuesPosition, segmentEnd, flvKeyFrameIndex) < 0))
+		flvKeyFrameIndex->numberOfKeyFrames = 0;
+	if (! flvKeyFrameIndex->numberOfKeyFrames)
+		scanClusters(clusterPosition, segmentEnd, flvKeyFrameIndex);
+	if (! flvKeyFrameIndex->numberOfKeyFrames) {
+		systemLog->sysLog(ERROR, "[%d] no keyframe found in the WebM file", fileDescriptor);
+		FlvParser::destroyKeyFrameIndex(flvKeyFrameIndex);
+		return NULL;
+	}
+	durationMs = (uint32_t)(duration * timecodeScale / 1000000);
+	if (! durationMs)
+		durationMs = flvKeyFrameIndex->timestamps[flvKeyFrameIndex->numberOfKeyFrames - 1];
+	if (durationMs)
+		flvKeyFrameIndex->bitRate = (uint32_t)((uint64_t)fileSize * 8 / durationMs);
+	flvKeyFrameIndex->memoryUsage = sizeof(struct FlvKeyFrameIndex) + flvKeyFrameIndex->headerSize + flvKeyFrameIndex->numberOfKeyFrames * (sizeof(uint32_t) + sizeof(uint64_t));
+
+	return flvKeyFrameIndex;
+}
@@ -0,0 +1,75 @@
+//
+// C++ Interface: webmparser
+//
+// Description: keyframe index of a WebM file, built from its Cues when the
+// file has them, or from a scan of its clusters
+//
+//
+// Author:  <spe@>, (C) 2007
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+#ifndef WEBMPARSER_H
+#define WEBMPARSER_H
+
+#include <sys/types.h>
+
+#include "log.h"
+#include "flvparser.h"
+
+#define WEBMPARSER_ID_EBML 0x1A45DFA3
+#define WEBMPARSER_ID_SEGMENT 0x18538067
+#define WEBMPARSER_ID_SEEKHEAD 0x114D9B74
+#define WEBMPARSER_ID_SEEK 0x4DBB
+#define WEBMPARSER_ID_SEEKID 0x53AB
+#define WEBMPARSER_ID_SEEKPOSITION 0x53AC
+#define WEBMPARSER_ID_INFO 0x1549A966
+#define WEBMPARSER_ID_TIMECODESCALE 0x2AD7B1
+#define WEBMPARSER_ID_DURATION 0x4489
+#define WEBMPARSER_ID_TRACKS 0x1654AE6B
+#define WEBMPARSER_ID_CUES 0x1C53BB6B
+#define WEBMPARSER_ID_CUEPOINT 0xBB
+#define WEBMPARSER_ID_CUETIME 0xB3
+#define WEBMPARSER_ID_CUETRACKPOSITIONS 0xB7
+#define WEBMPARSER_ID_CUECLUSTERPOSITION 0xF1
+#define WEBMPARSER_ID_CLUSTER 0x1F43B675
+#define WEBMPARSER_ID_TIMECODE 0xE7
+#define WEBMPARSER_ID_SIMPLEBLOCK 0xA3
+#define WEBMPARSER_ID_BLOCKGROUP 0xA0
+
+// Size with all its value bits set, the element runs to the end of its parent
+#define WEBMPARSER_UNKNOWNSIZE 0xFFFFFFFFFFFFFFFFULL
+// Default TimecodeScale, in nanoseconds
+#define WEBMPARSER_TIMECODESCALE 1000000
+
+/**
+	@author  <spe@>
+*/
+class WebmParser{
+private:
+	int fileDescriptor;
+	off_t fileSize;
+	char *mmapedFile;
+	uint64_t timecodeScale;
+	// Start of the data of the Segment, Cues and SeekHead positions are relative to it
+	off_t segmentPosition;
+
+	int readVint(off_t *, off_t, uint64_t *, bool);
+	int readElement(off_t *, off_t, uint32_t *, uint64_t *);
+	uint64_t readUnsigned(off_t, uint64_t);
+	double readFloat(off_t, uint64_t);
+	off_t readSeekHead(off_t, off_t);
+	int readInfo(off_t, off_t, double *);
+	int readCues(off_t, off_t, struct FlvKeyFrameIndex *);
+	int scanClusters(off_t, off_t, struct FlvKeyFrameIndex *);
+	off_t getClusterEnd(off_t, off_t, uint64_t *, bool *);
+
+public:
+	WebmParser(int, off_t);
+	~WebmParser();
+
+	struct FlvKeyFrameIndex *buildKeyFrameIndex(void);
+};
+
+#endif